@@ -744,6 +744,15 @@ pgpDig dig = _dig;
 	}
 	strcpy(buf, rpmio_flags);
 	buf[s - rpmio_flags] = '\0';
+	/* XXX the no. of compression threads is not a payload property. */
+	{   char * t = strchr(buf, 'T');
+	    if (t != NULL) {
+		char * te = t + 1;
+		while (*te >= '0' && *te <= '9')
+		    te++;
+		(void) memmove(t, te, strlen(te) + 1);
+	    }
+	}
 
 	he->tag = RPMTAG_PAYLOADFLAGS;
 	he->t = RPM_STRING_TYPE;
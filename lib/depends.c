@@ -36,6 +36,17 @@
 #if defined(CACHE_DEPENDENCY_RESULT)
 /*@unchecked@*/
 int _cacheDependsRC = CACHE_DEPENDENCY_RESULT;
+
+/*@unchecked@*/
+static int _cacheDependsDisk = 1;
+
+/**
+ * Dependency result memo entry, keyed by DNEVR.
+ */
+typedef struct depcacheEntry_s {
+    int rc;			/*!< unsatisfiedDepend() result. */
+    char DNEVR[1];		/*!< Dependency (the hash key). */
+} * depcacheEntry;
 #endif
 
 /*@observer@*/ /*@unchecked@*/
@@ -857,6 +868,156 @@ void rpmnsClean(void)
     sysinfo_path = _free(sysinfo_path);
 }
 
+#if defined(CACHE_DEPENDENCY_RESULT)
+/**
+ * Return the dependency result memo, flushed when the rpmdb generation or
+ * the set of removed packages has changed since the results were cached.
+ * @param ts		transaction set
+ * @return		dependency result memo
+ */
+static hashTable depcacheMemo(rpmts ts)
+	/*@globals fileSystem @*/
+	/*@modifies ts, fileSystem @*/
+{
+    rpmuint32_t stamp = rpmdbGeneration(rpmtsGetRdb(ts));
+
+    if (ts->depcache != NULL && (ts->depcacheStamp != stamp
+     || ts->depcacheNRemoved != ts->numRemovedPackages))
+	ts->depcache = htFree(ts->depcache);
+    if (ts->depcache == NULL) {
+	ts->depcache = htCreate(1024, 0, 1, NULL, NULL);
+	ts->depcacheStamp = stamp;
+	ts->depcacheNRemoved = ts->numRemovedPackages;
+    }
+    return ts->depcache;
+}
+
+/**
+ * Memoize a dependency result.
+ * @param memo		dependency result memo
+ * @param DNEVR		dependency
+ * @param rc		dependency result
+ */
+static void depcacheMemoAdd(hashTable memo, const char * DNEVR, int rc)
+	/*@modifies memo @*/
+{
+    size_t nb = strlen(DNEVR);
+    depcacheEntry e;
+
+    if (htHasEntry(memo, DNEVR))
+	return;
+    e = xmalloc(sizeof(*e) + nb);
+    e->rc = rc;
+    memcpy(e->DNEVR, DNEVR, nb + 1);
+    htAddEntry(memo, e->DNEVR, e);
+}
+
+/**
+ * Look up a cached dependency result, in memory, then in Depcache.
+ * Depcache values are { rpmdb generation, result } pairs, and only
+ * match while the rpmdb generation is unchanged.
+ * @param ts		transaction set
+ * @param DNEVR		dependency
+ * @return		cached result, -1 if not cached
+ */
+static int depcacheGet(rpmts ts, const char * DNEVR)
+	/*@globals _cacheDependsDisk, fileSystem, internalState @*/
+	/*@modifies ts, _cacheDependsDisk, fileSystem, internalState @*/
+{
+    hashTable memo = depcacheMemo(ts);
+    const void ** data = NULL;
+    int rc = -1;
+
+    if (!htGetEntry(memo, DNEVR, &data, NULL, NULL) && data != NULL)
+	return ((depcacheEntry)data[0])->rc;
+
+    /* Persistent results only hold without transaction set context. */
+    if (_cacheDependsDisk && ts->numRemovedPackages == 0
+     && rpmtsGetRdb(ts) != NULL)
+    {
+	dbiIndex dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPCACHE, 0);
+	if (dbi == NULL)
+	    _cacheDependsDisk = 0;
+	else {
+	    DBC * dbcursor = NULL;
+	    rpmuint32_t stamp[2];
+	    DBT k;
+	    DBT v;
+	    int xx;
+
+	    memset(&k, 0, sizeof(k));
+	    memset(&v, 0, sizeof(v));
+/*@-observertrans@*/
+	    k.data = (void *) DNEVR;
+/*@=observertrans@*/
+	    k.size = strlen(DNEVR);
+
+	    xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, 0);
+	    xx = dbiGet(dbi, dbcursor, &k, &v, DB_SET);
+	    if (xx == 0 && v.data != NULL && v.size == sizeof(stamp)) {
+		memcpy(stamp, v.data, sizeof(stamp));
+		if (stamp[0] == ts->depcacheStamp)
+		    rc = (int) stamp[1];
+	    }
+	    xx = dbiCclose(dbi, dbcursor, 0);
+
+	    if (rc >= 0)
+		depcacheMemoAdd(memo, DNEVR, rc);
+	}
+    }
+    return rc;
+}
+
+/**
+ * Cache a dependency result, in memory, and in Depcache if configured.
+ * @param ts		transaction set
+ * @param DNEVR		dependency
+ * @param rc		dependency result
+ */
+static void depcachePut(rpmts ts, const char * DNEVR, int rc)
+	/*@globals _cacheDependsDisk, fileSystem, internalState @*/
+	/*@modifies ts, _cacheDependsDisk, fileSystem, internalState @*/
+{
+    hashTable memo = depcacheMemo(ts);
+
+    depcacheMemoAdd(memo, DNEVR, rc);
+
+    /* Persistent results only hold without transaction set context. */
+    if (_cacheDependsDisk && ts->numRemovedPackages == 0
+     && rpmtsGetRdb(ts) != NULL)
+    {
+	dbiIndex dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPCACHE, 0);
+	if (dbi == NULL)
+	    _cacheDependsDisk = 0;
+	else {
+	    DBC * dbcursor = NULL;
+	    rpmuint32_t stamp[2];
+	    DBT k;
+	    DBT v;
+	    int xx;
+
+	    stamp[0] = ts->depcacheStamp;
+	    stamp[1] = (rpmuint32_t) rc;
+	    memset(&k, 0, sizeof(k));
+	    memset(&v, 0, sizeof(v));
+/*@-observertrans@*/
+	    k.data = (void *) DNEVR;
+/*@=observertrans@*/
+	    k.size = strlen(DNEVR);
+	    v.data = stamp;
+	    v.size = sizeof(stamp);
+
+	    xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, DB_WRITECURSOR);
+	    /*@-compmempass@*/
+	    if (dbiPut(dbi, dbcursor, &k, &v, 0))
+		_cacheDependsDisk = 0;
+	    /*@=compmempass@*/
+	    xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
+	}
+    }
+}
+#endif
+
 /**
  * Check dep for an unsatisfied dependency.
  * @param ts		transaction set
@@ -865,20 +1026,20 @@ void rpmnsClean(void)
  * @return		0 if satisfied, 1 if not satisfied, 2 if error
  */
 static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
-	/*@globals _cacheDependsRC, rpmGlobalMacroContext, h_errno,
-		sysinfo_path, fileSystem, internalState @*/
-	/*@modifies ts, dep, _cacheDependsRC, rpmGlobalMacroContext,
+	/*@globals _cacheDependsRC, _cacheDependsDisk, rpmGlobalMacroContext,
+		h_errno, sysinfo_path, fileSystem, internalState @*/
+	/*@modifies ts, dep, _cacheDependsDisk, rpmGlobalMacroContext,
 		sysinfo_path, fileSystem, internalState @*/
 {
-    DBT * key = alloca(sizeof(*key));
-    DBT * data = alloca(sizeof(*data));
     rpmmi mi;
     nsType NSType;
     const char * Name;
     rpmuint32_t Flags;
     Header h;
 #if defined(CACHE_DEPENDENCY_RESULT)
-    int _cacheThisRC = 1;
+    const char * DNEVR = NULL;
+    rpmop missop = NULL;
+    int _cacheThisRC = 0;
 #endif
     int rc;
     int xx;
@@ -891,49 +1052,21 @@ static int unsatisfiedDepend(rpmts ts, rpmds dep, int adding)
 
 #if defined(CACHE_DEPENDENCY_RESULT)
     /*
-     * Check if dbiOpen/dbiPut failed (e.g. permissions), we can't cache.
+     * Only results resolved against the installed packages are cached, as
+     * those don't depend on the added packages (nor change with them).
      */
-    if (_cacheDependsRC) {
-	dbiIndex dbi;
-	dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPCACHE, 0);
-	if (dbi == NULL)
-	    _cacheDependsRC = 0;
-	else {
-	    const char * DNEVR;
-
-	    rc = -1;
-	    if ((DNEVR = rpmdsDNEVR(dep)) != NULL) {
-		DBC * dbcursor = NULL;
-		void * datap = NULL;
-		size_t datalen = 0;
-		size_t DNEVRlen = strlen(DNEVR);
-
-		xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, 0);
-
-		memset(key, 0, sizeof(*key));
-/*@i@*/		key->data = (void *) DNEVR;
-		key->size = DNEVRlen;
-		memset(data, 0, sizeof(*data));
-		data->data = datap;
-		data->size = datalen;
-/*@-nullstate@*/ /* FIX: data->data may be NULL */
-		xx = dbiGet(dbi, dbcursor, key, data, DB_SET);
-/*@=nullstate@*/
-		DNEVR = key->data;
-		DNEVRlen = key->size;
-		datap = data->data;
-		datalen = data->size;
-
-		if (xx == 0 && datap && datalen == 4)
-		    memcpy(&rc, datap, datalen);
-		xx = dbiCclose(dbi, dbcursor, 0);
-	    }
-
-	    if (rc >= 0) {
-		rpmdsNotify(dep, _("(cached)"), rc);
-		return rpmdsNegateRC(dep, rc);
-	    }
+    if (_cacheDependsRC && (DNEVR = rpmdsDNEVR(dep)) != NULL) {
+	rc = depcacheGet(ts, DNEVR);
+	if (rc >= 0) {
+	    rpmop hitop = rpmtsOp(ts, RPMTS_OP_DEPCACHEHIT);
+	    (void) rpmswEnter(hitop, 0);
+	    (void) rpmswExit(hitop, 0);
+	    rpmdsNotify(dep, _("(cached)"), rc);
+	    return rpmdsNegateRC(dep, rc);
 	}
+	/* Misses are timed until resolved. */
+	missop = rpmtsOp(ts, RPMTS_OP_DEPCACHEMISS);
+	(void) rpmswEnter(missop, 0);
     }
 #endif
 
@@ -1425,14 +1558,6 @@ retry:
 
     /* Search added packages for the dependency. */
     if (rpmalSatisfiesDepend(ts->addedPackages, dep, NULL) != NULL) {
-#if defined(CACHE_DEPENDENCY_RESULT)
-	/*
-	 * XXX Ick, context sensitive answers from dependency cache.
-	 * XXX Always resolve added dependencies within context to disambiguate.
-	 */
-	if (_rpmds_nopromote)
-	    _cacheThisRC = 0;
-#endif
 	goto exit;
     }
 
@@ -1450,6 +1575,9 @@ retry:
 	    while ((h = rpmmiNext(mi)) != NULL) {
 		rpmdsNotify(dep, _("(db files)"), rc);
 		mi = rpmmiFree(mi);
+#if defined(CACHE_DEPENDENCY_RESULT)
+		_cacheThisRC = 1;
+#endif
 		goto exit;
 	    }
 	    mi = rpmmiFree(mi);
@@ -1462,6 +1590,9 @@ retry:
 	    if (rpmdsAnyMatchesDep(h, dep, _rpmds_nopromote)) {
 		rpmdsNotify(dep, _("(db provides)"), rc);
 		mi = rpmmiFree(mi);
+#if defined(CACHE_DEPENDENCY_RESULT)
+		_cacheThisRC = 1;
+#endif
 		goto exit;
 	    }
 	}
@@ -1487,9 +1618,6 @@ retry:
 unsatisfied:
     if (Flags & RPMSENSE_MISSINGOK) {
 	rc = 0;	/* dependency is unsatisfied, but just a hint. */
-#if defined(CACHE_DEPENDENCY_RESULT)
-	_cacheThisRC = 0;
-#endif
 	rpmdsNotify(dep, _("(hint skipped)"), rc);
     } else {
 	rc = 1;	/* dependency is unsatisfied */
@@ -1497,40 +1625,10 @@ unsatisfied:
     }
 
 exit:
-    /*
-     * If dbiOpen/dbiPut fails (e.g. permissions), we can't cache.
-     */
 #if defined(CACHE_DEPENDENCY_RESULT)
-    if (_cacheDependsRC && _cacheThisRC) {
-	dbiIndex dbi;
-	dbi = dbiOpen(rpmtsGetRdb(ts), RPMDBI_DEPCACHE, 0);
-	if (dbi == NULL) {
-	    _cacheDependsRC = 0;
-	} else {
-	    const char * DNEVR;
-	    xx = 0;
-	    if ((DNEVR = rpmdsDNEVR(dep)) != NULL) {
-		DBC * dbcursor = NULL;
-		size_t DNEVRlen = strlen(DNEVR);
-
-		xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, DB_WRITECURSOR);
-
-		memset(key, 0, sizeof(*key));
-/*@i@*/		key->data = (void *) DNEVR;
-		key->size = DNEVRlen;
-		memset(data, 0, sizeof(*data));
-		data->data = &rc;
-		data->size = sizeof(rc);
-
-		/*@-compmempass@*/
-		xx = dbiPut(dbi, dbcursor, key, data, 0);
-		/*@=compmempass@*/
-		xx = dbiCclose(dbi, dbcursor, DB_WRITECURSOR);
-	    }
-	    if (xx)
-		_cacheDependsRC = 0;
-	}
-    }
+    if (DNEVR != NULL && _cacheThisRC && (DNEVR = rpmdsDNEVR(dep)) != NULL)
+	depcachePut(ts, DNEVR, rc);
+    (void) rpmswExit(missop, 0);
 #endif
 
     return rpmdsNegateRC(dep, rc);
@@ -55,12 +55,49 @@ static char * get_filter_name(/*@returned@*/ const char * fn)
     return p;
 }
 
+/**
+ * Files awaiting filetriggers, kept in memory during a transaction.
+ * Lines are "+path\n" (installed) or "-path\n" (erased).
+ */
+/*@unchecked@*/
+static struct awaiting_s {
+/*@only@*/ /*@null@*/
+    const char * fn;		/*!< list path (including rootDir) */
+/*@only@*/ /*@null@*/
+    char * b;			/*!< list lines */
+    size_t nb;			/*!< no. of bytes used */
+    size_t nalloced;		/*!< no. of bytes allocated */
+} _awaiting;
+
+int saveFilesAwaitingFiletriggers(void)
+{
+    FILE * fp;
+    int rc = RPMRC_OK;
+    int xx;
+
+    if (_awaiting.fn != NULL && _awaiting.nb > 0) {
+	fp = fopen(_awaiting.fn, "a");
+	if (fp == NULL) {
+	    rpmlog(RPMLOG_ERR, _("%s: open failed: %s\n"), _awaiting.fn,
+			strerror(errno));
+	    rc = RPMRC_FAIL;
+	} else {
+	    if (fwrite(_awaiting.b, 1, _awaiting.nb, fp) != _awaiting.nb)
+		rc = RPMRC_FAIL;
+	    xx = fclose(fp);
+	}
+    }
+    _awaiting.fn = _free(_awaiting.fn);
+    _awaiting.b = _free(_awaiting.b);
+    _awaiting.nb = 0;
+    _awaiting.nalloced = 0;
+    return rc;
+}
+
 int mayAddToFilesAwaitingFiletriggers(const char * rootDir, rpmfi fi,
 		int install_or_erase)
 {
     const char * fn;
-    FILE * fp;
-    int rc = RPMRC_FAIL;
     int xx;
 
     if (filetriggers_dir() == NULL)
@@ -68,25 +105,30 @@ int mayAddToFilesAwaitingFiletriggers(const char * rootDir, rpmfi fi,
 
     fn = rpmGetPath(rootDir ? rootDir : "/", files_awaiting_filetriggers, NULL);
 
-    fp = fopen(fn, "a");
-    if (fp == NULL) {
-	rpmlog(RPMLOG_ERR, _("%s: open failed: %s\n"), fn, strerror(errno));
-	goto exit;
-    }
+    /* Save the list for a different rootDir (can't happen). */
+    if (_awaiting.fn != NULL && strcmp(_awaiting.fn, fn))
+	xx = saveFilesAwaitingFiletriggers();
+    if (_awaiting.fn == NULL)
+	_awaiting.fn = xstrdup(fn);
 
     fi = rpmfiInit(fi, 0);
     if (fi != NULL)
     while (rpmfiNext(fi) >= 0) {
-	xx = fputc(install_or_erase ? '+' : '-', fp);
-	xx = fputs(rpmfiFN(fi), fp);
-	xx = fputc('\n', fp);
+	const char * FN = rpmfiFN(fi);
+	size_t nFN = strlen(FN);
+
+	if (_awaiting.nb + nFN + 2 > _awaiting.nalloced) {
+	    _awaiting.nalloced = 2 * _awaiting.nalloced + nFN + BUFSIZ;
+	    _awaiting.b = xrealloc(_awaiting.b, _awaiting.nalloced);
+	}
+	_awaiting.b[_awaiting.nb++] = (install_or_erase ? '+' : '-');
+	memcpy(_awaiting.b + _awaiting.nb, FN, nFN);
+	_awaiting.nb += nFN;
+	_awaiting.b[_awaiting.nb++] = '\n';
     }
-    xx = fclose(fp);
-    rc = RPMRC_OK;
 
-exit:
     fn = _free(fn);
-    return rc;
+    return RPMRC_OK;
 }
 
 struct filetrigger_raw {
@@ -100,6 +142,47 @@ struct filetrigger {
     char * name;
     int command_pipe;
     pid_t command_pid;
+    int skip;		/*!< no. of leading "." before the literal prefix */
+/*@only@*/ /*@null@*/
+    char * prefix;	/*!< literal prefix of a "^..." regexp (or NULL) */
+    size_t nprefix;
+    int literal;	/*!< 1: prefix matches, 2: whole line must match */
+};
+
+/**
+ * Literal prefix trie node.
+ */
+struct filetrigger_node {
+/*@only@*/ /*@null@*/
+    struct filetrigger_node * child;	/*!< 1st child */
+/*@only@*/ /*@null@*/
+    struct filetrigger_node * next;	/*!< next sibling */
+/*@only@*/ /*@null@*/
+    int * ids;		/*!< triggers whose prefix ends here */
+    int nids;
+    unsigned char c;
+};
+
+#define	FILETRIGGER_MAXSKIP	4
+
+/**
+ * Combined matcher for all filetriggers.
+ * Anchored regexps are indexed by their literal prefix (after up to
+ * FILETRIGGER_MAXSKIP leading "." wildcards, e.g. the +/- mark), so a
+ * single walk finds the candidate triggers for a file name. Only
+ * candidates that aren't literal, and unanchored regexps, run regexec.
+ */
+struct filetriggers_s {
+    int nft;
+/*@only@*/ /*@null@*/
+    struct filetrigger * list;
+/*@only@*/ /*@null@*/
+    struct filetrigger_node * tries[FILETRIGGER_MAXSKIP+1];
+/*@only@*/ /*@null@*/
+    int * any;		/*!< unanchored triggers */
+    int nany;
+/*@only@*/ /*@null@*/
+    int * hits;		/*!< matching trigger ids */
 };
 
 static int getFiletriggers_raw(const char * rootDir, int * nftp,
@@ -165,34 +248,18 @@ exit:
     return RPMRC_OK;
 }
 
-static char * computeMatchesAnyFilter(size_t nb,
-		struct filetrigger_raw * list_raw)
-	/*@*/
-{
-    char * matches_any;
-    char * p;
-    size_t regexp_str_size = 0;
-    int i;
-
-    for (i = 0; i < (int)nb; i++)
-	regexp_str_size += strlen(list_raw[i].regexp) + 1;
-
-    matches_any = xmalloc(regexp_str_size);
-    p = stpcpy(matches_any, list_raw[0].regexp);
-
-    for (i = 1; i < (int)nb; i++) {
-	*p++ = '|';
-	p = stpcpy(p, list_raw[i].regexp);
-    }
-    rpmlog(RPMLOG_DEBUG, D_("[filetriggers] matches-any regexp is %s\n"),
-		matches_any);
-    return matches_any;
-}
-
-static void compileFiletriggersRegexp(/*@only@*/ char * raw, miRE mire)
+/**
+ * Compile a filetrigger regexp.
+ * @param raw		filetrigger regexp (freed)
+ * @param mire		pattern container (freed on failure)
+ * @return		0 on success, -1 on failure
+ */
+static int compileFiletriggersRegexp(/*@only@*/ char * raw,
+		/*@only@*/ miRE mire)
 	/*@modifies raw, mire @*/
 {
     static int options = REG_NOSUB | REG_EXTENDED | REG_NEWLINE;
+    int rc = 0;
     int xx;
 
     xx = mireSetCOptions(mire, RPMMIRE_REGEX, 0, options, NULL);
@@ -200,45 +267,177 @@ static void compileFiletriggersRegexp(/*@only@*/ char * raw, miRE mire)
     if (mireRegcomp(mire, raw) != 0) {
 	rpmlog(RPMLOG_ERR, "failed to compile filetrigger filter: %s\n", raw);
 	mire = mireFree(mire);
+	rc = -1;
     }
     raw = _free(raw);
+    return rc;
 }
 
-static void getFiletriggers(const char * rootDir, miRE matches_any,
-		int * nftp, struct filetrigger ** list)
+/**
+ * Extract the literal prefix of an anchored filetrigger regexp.
+ * @param trigger	filetrigger
+ * @param re		filetrigger regexp
+ */
+static void parseFiletriggerPrefix(struct filetrigger * trigger,
+		const char * re)
+	/*@modifies trigger @*/
+{
+    static const char meta[] = ".[]()*+?{}|^$\\";
+    static const char quantifiers[] = "*+?{";
+    const char * s = re;
+    char * t;
+
+    trigger->skip = 0;
+    trigger->prefix = NULL;
+    trigger->nprefix = 0;
+    trigger->literal = 0;
+
+    /* Alternation makes the anchor apply to 1st branch only. */
+    if (*s++ != '^' || strchr(re, '|') != NULL)
+	return;
+
+    while (s[0] == '.' && !(s[1] && strchr(quantifiers, s[1]))
+	 && trigger->skip < FILETRIGGER_MAXSKIP)
+    {
+	trigger->skip++;
+	s++;
+    }
+
+    trigger->prefix = t = xmalloc(strlen(s) + 1);
+    while (*s != '\0') {
+	const char * se;
+	int c;
+
+	if (s[0] == '\\' && s[1] != '\0' && !xisalnum((int)s[1])) {
+	    c = (int) s[1];
+	    se = s + 2;
+	} else if (strchr(meta, *s) != NULL)
+	    break;
+	else {
+	    c = (int) s[0];
+	    se = s + 1;
+	}
+	/* A quantified character isn't part of the literal prefix. */
+	if (*se != '\0' && strchr(quantifiers, *se) != NULL)
+	    break;
+	*t++ = (char) c;
+	s = se;
+    }
+    *t = '\0';
+    trigger->nprefix = (size_t)(t - trigger->prefix);
+
+    if (*s == '\0' || !strcmp(s, ".*") || !strcmp(s, ".*$"))
+	trigger->literal = 1;
+    else if (!strcmp(s, "$"))
+	trigger->literal = 2;
+}
+
+/**
+ * Add a filetrigger to the literal prefix trie.
+ * @param nodep		trie root
+ * @param prefix	literal prefix
+ * @param id		filetrigger index
+ */
+static void addFiletriggerPrefix(struct filetrigger_node ** nodep,
+		const char * prefix, int id)
+	/*@modifies *nodep @*/
+{
+    struct filetrigger_node * node;
+
+    if (*nodep == NULL)
+	*nodep = xcalloc(1, sizeof(**nodep));
+    node = *nodep;
+
+    for (; *prefix != '\0'; prefix++) {
+	struct filetrigger_node ** np = &node->child;
+	while (*np != NULL && (*np)->c != (unsigned char) *prefix)
+	    np = &(*np)->next;
+	if (*np == NULL) {
+	    *np = xcalloc(1, sizeof(**np));
+	    (*np)->c = (unsigned char) *prefix;
+	}
+	node = *np;
+    }
+    node->ids = xrealloc(node->ids, (node->nids + 1) * sizeof(*node->ids));
+    node->ids[node->nids++] = id;
+}
+
+/*@null@*/
+static struct filetrigger_node * freeFiletriggerNode(
+		/*@only@*/ /*@null@*/ struct filetrigger_node * node)
+	/*@modifies node @*/
+{
+    while (node != NULL) {
+	struct filetrigger_node * next = node->next;
+	node->child = freeFiletriggerNode(node->child);
+	node->ids = _free(node->ids);
+	node = _free(node);
+	node = next;
+    }
+    return NULL;
+}
+
+static void getFiletriggers(const char * rootDir, struct filetriggers_s * ft)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
-	/*@modifies matches_any, *nftp, *list, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies *ft, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
     struct filetrigger_raw * list_raw = NULL;
     int xx;
     int i;
 
-    xx = getFiletriggers_raw(rootDir, nftp, &list_raw);
-    if (*nftp == 0) return;
+    xx = getFiletriggers_raw(rootDir, &ft->nft, &list_raw);
+    if (ft->nft == 0) return;
+
+    ft->list = xcalloc(ft->nft, sizeof(*ft->list));
+    ft->hits = xcalloc(ft->nft, sizeof(*ft->hits));
+    for (i = 0; i < ft->nft; i++) {
+	struct filetrigger * trigger = ft->list + i;
+
+	trigger->name = list_raw[i].name;
+	if (list_raw[i].regexp == NULL)	/* XXX unreadable filter */
+	    continue;
 
-    compileFiletriggersRegexp(computeMatchesAnyFilter(*nftp, list_raw), matches_any);
+	parseFiletriggerPrefix(trigger, list_raw[i].regexp);
+	rpmlog(RPMLOG_DEBUG,
+		D_("[filetriggers] %s: %s prefix '%s' skip %d literal %d\n"),
+		trigger->name, list_raw[i].regexp,
+		(trigger->prefix ? trigger->prefix : "(unanchored)"),
+		trigger->skip, trigger->literal);
+
+	/* A trigger whose regexp doesn't compile is never a candidate. */
+	trigger->mire = mireNew(0, 0);
+	if (compileFiletriggersRegexp(list_raw[i].regexp, trigger->mire)) {
+	    trigger->mire = NULL;
+	    continue;
+	}
 
-    *list = xcalloc(*nftp, sizeof(**list));
-    for (i = 0; i < *nftp; i++) {
-	(*list)[i].name = list_raw[i].name;
-	(*list)[i].mire = mireNew(0, 0);
-	compileFiletriggersRegexp(list_raw[i].regexp, (*list)[i].mire);
+	if (trigger->prefix != NULL)
+	    addFiletriggerPrefix(&ft->tries[trigger->skip], trigger->prefix, i);
+	else {
+	    ft->any = xrealloc(ft->any, (ft->nany + 1) * sizeof(*ft->any));
+	    ft->any[ft->nany++] = i;
+	}
     }
     list_raw = _free(list_raw);
 }
 
-static void freeFiletriggers(/*@only@*/ miRE matches_any,
-		int nft, /*@only@*/ struct filetrigger * list)
-	/*@modifies matches_any, list @*/
+static void freeFiletriggers(struct filetriggers_s * ft)
+	/*@modifies *ft @*/
 {
     int i;
 
-    matches_any = mireFree(matches_any);
-    for (i = 0; i < nft; i++) {
-	list[i].mire = mireFree(list[i].mire);
-	list[i].name = _free(list[i].name);
+    for (i = 0; i < ft->nft; i++) {
+	ft->list[i].mire = mireFree(ft->list[i].mire);
+	ft->list[i].name = _free(ft->list[i].name);
+	ft->list[i].prefix = _free(ft->list[i].prefix);
     }
-    list = _free(list);
+    ft->list = _free(ft->list);
+    for (i = 0; i <= FILETRIGGER_MAXSKIP; i++)
+	ft->tries[i] = freeFiletriggerNode(ft->tries[i]);
+    ft->any = _free(ft->any);
+    ft->hits = _free(ft->hits);
+    ft->nft = 0;
+    ft->nany = 0;
 }
 
 static int is_regexp_matching(miRE mire, const char * s)
@@ -247,6 +446,71 @@ static int is_regexp_matching(miRE mire, const char * s)
     return mireRegexec(mire, s, (size_t) 0) == 0;
 }
 
+/**
+ * Find all filetriggers matching a file name.
+ * @param ft		filetriggers
+ * @param s		file name line (with +/- mark)
+ * @param ns		file name line length
+ * @return		no. of matching triggers (in ft->hits, ascending)
+ */
+static int matchFiletriggers(struct filetriggers_s * ft,
+		const char * s, size_t ns)
+	/*@modifies ft @*/
+{
+    int nhits = 0;
+    int i, j;
+
+    /* Collect candidates: unanchored triggers, and prefix trie walks. */
+    for (i = 0; i < ft->nany; i++)
+	ft->hits[nhits++] = ft->any[i];
+    for (i = 0; i <= FILETRIGGER_MAXSKIP; i++) {
+	struct filetrigger_node * node = ft->tries[i];
+	const char * se = s + i;
+
+	if (node == NULL || ns < (size_t)i)
+	    continue;
+	while (1) {
+	    for (j = 0; j < node->nids; j++)
+		ft->hits[nhits++] = node->ids[j];
+	    if (*se == '\0')
+		/*@innerbreak@*/ break;
+	    for (node = node->child; node != NULL; node = node->next) {
+		if (node->c == (unsigned char) *se)
+		    /*@innerbreak@*/ break;
+	    }
+	    if (node == NULL)
+		/*@innerbreak@*/ break;
+	    se++;
+	}
+    }
+
+    /* Verify candidates, keeping trigger order. */
+    for (i = 0, j = 0; i < nhits; i++) {
+	int id = ft->hits[i];
+	struct filetrigger * trigger = ft->list + id;
+	int k;
+
+	switch (trigger->literal) {
+	case 1:
+	    break;
+	case 2:
+	    if (ns != trigger->skip + trigger->nprefix)
+		continue;
+	    break;
+	default:
+	    if (!is_regexp_matching(trigger->mire, s))
+		continue;
+	    break;
+	}
+
+	for (k = j; k > 0 && ft->hits[k-1] > id; k--)
+	    ft->hits[k] = ft->hits[k-1];
+	ft->hits[k] = id;
+	j++;
+    }
+    return j;
+}
+
 static int popen_with_root(const char * rootDir, const char * cmd,
 		pid_t * pidp)
 	/*@globals fileSystem, internalState @*/
@@ -307,37 +571,68 @@ static void mayStartFiletrigger(const char * rootDir,
     }
 }
 
+/**
+ * Pipe a file name to all matching filetriggers.
+ * @param rootDir	chroot directory
+ * @param ft		filetriggers
+ * @param s		file name line (with +/- mark)
+ * @param ns		file name line length
+ */
+static void runFiletriggers(const char * rootDir, struct filetriggers_s * ft,
+		const char * s, size_t ns)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ft, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    int nhits = matchFiletriggers(ft, s, ns);
+    int i;
+
+    for (i = 0; i < nhits; i++) {
+	struct filetrigger * trigger = ft->list + ft->hits[i];
+	ssize_t nw;
+
+	rpmlog(RPMLOG_DEBUG,
+		D_("[filetriggers] file name '%s' matches pattern '%s'\n"),
+		s, trigger->mire->pattern);
+
+	mayStartFiletrigger(rootDir, trigger);
+	nw = write(trigger->command_pipe, s, ns);
+	nw = write(trigger->command_pipe, "\n", 1);
+    }
+}
+
 void rpmRunFileTriggers(const char * rootDir)
 {
-    miRE matches_any = mireNew(RPMMIRE_DEFAULT, 0);
-    int nft = 0;
-    struct filetrigger *list = NULL;
+    struct filetriggers_s ft;
     const char * fn = NULL;
     FD_t fd = NULL;
     FILE * fp = NULL;
+    void (*oldhandler)(int) = NULL;
     int xx;
+    int i;
 
+    memset(&ft, 0, sizeof(ft));
     rpmlog(RPMLOG_DEBUG, D_("[filetriggers] starting\n"));
 
     fn = rpmGenPath(rootDir, files_awaiting_filetriggers, NULL);
 
-    if (!filetriggers_dir())
-	goto exit;
+    /* Save the in-memory list for a different rootDir (can't happen). */
+    if (_awaiting.fn != NULL && strcmp(_awaiting.fn, fn))
+	xx = saveFilesAwaitingFiletriggers();
 
-    getFiletriggers(rootDir, matches_any, &nft, &list);
-    if (nft <= 0)
+    if (!filetriggers_dir())
 	goto exit;
 
-    fd = Fopen(fn, "r.fpio");
-    if (fd == NULL)
+    getFiletriggers(rootDir, &ft);
+    if (ft.nft <= 0)
 	goto exit;
 
-    fp = fdGetFILE(fd);
+    oldhandler = signal(SIGPIPE, SIG_IGN);
 
+    /* Files left over from previous transactions are run first. */
+    fd = Fopen(fn, "r.fpio");
+    fp = (fd != NULL ? fdGetFILE(fd) : NULL);
     if (fp != NULL) {
-	void (*oldhandler)(int) = signal(SIGPIPE, SIG_IGN);
 	char tmp[BUFSIZ];
-	int i;
 
 	rpmlog(RPMLOG_DEBUG,
 		D_("[filetriggers] testing files from list: %s\n"), fn);
@@ -347,51 +642,57 @@ void rpmRunFileTriggers(const char * rootDir)
 
 	    if (tmplen > 0 && tmp[tmplen-1] == '\n')
 		tmp[--tmplen] = '\0';
+	    runFiletriggers(rootDir, &ft, tmp, tmplen);
+	}
+    }
+    if (fd != NULL)
+	xx = Fclose(fd);
+    fd = NULL;
+    fp = NULL;
 
-	    if (!is_regexp_matching(matches_any, tmp))
-		continue;
-
-	    rpmlog(RPMLOG_DEBUG,
-			D_("[filetriggers] matches-any regexp found %s\n"),
-			tmp);
-
-	    for (i = 0; i < nft; i++) {
-		ssize_t nw;
-		if (!is_regexp_matching(list[i].mire, tmp))
-		    /*@innercontinue@*/ continue;
-
-		rpmlog(RPMLOG_DEBUG,
-			D_("[filetriggers] file name '%s' matches pattern '%s'\n"),
-			tmp, list[i].mire->pattern);
+    /* Files from this transaction. */
+    if (_awaiting.b != NULL) {
+	char * b = _awaiting.b;
+	char * be = b + _awaiting.nb;
 
-		mayStartFiletrigger(rootDir, &list[i]);
-		nw = write(list[i].command_pipe, tmp, tmplen);
-		nw = write(list[i].command_pipe, "\n", 1);
-	    }
+	rpmlog(RPMLOG_DEBUG,
+		D_("[filetriggers] testing %u bytes of files in memory\n"),
+		(unsigned)_awaiting.nb);
+
+	while (b < be) {
+	    char * t = memchr(b, '\n', (size_t)(be - b));
+	    if (t == NULL)
+		t = be;		/* XXX can't happen */
+	    else
+		*t = '\0';
+	    runFiletriggers(rootDir, &ft, b, (size_t)(t - b));
+	    b = t + 1;
 	}
+    }
 
-	xx = Fclose(fd);
-	fd = NULL;
-	fp = NULL;
-
-	for (i = 0; i < nft; i++) {
-	    int status;
-	    if (list[i].command_pipe) {
-		pid_t pid;
-		xx = close(list[i].command_pipe);
-		rpmlog(RPMLOG_DEBUG,
+    for (i = 0; i < ft.nft; i++) {
+	int status;
+	if (ft.list[i].command_pipe) {
+	    pid_t pid;
+	    xx = close(ft.list[i].command_pipe);
+	    rpmlog(RPMLOG_DEBUG,
 			D_("[filetriggers] waiting for %s to end\n"),
-			list[i].name);
-		pid = waitpid(list[i].command_pid, &status, 0);
-		list[i].command_pipe = 0;
-	    }
+			ft.list[i].name);
+	    pid = waitpid(ft.list[i].command_pid, &status, 0);
+	    ft.list[i].command_pipe = 0;
 	}
-
-	oldhandler = signal(SIGPIPE, oldhandler);
     }
 
+    oldhandler = signal(SIGPIPE, oldhandler);
+
 exit:
-    freeFiletriggers(matches_any, nft, list);
+    freeFiletriggers(&ft);
+
+    /* The in-memory list has been run (or is not needed). */
+    _awaiting.fn = _free(_awaiting.fn);
+    _awaiting.b = _free(_awaiting.b);
+    _awaiting.nb = 0;
+    _awaiting.nalloced = 0;
 
     if (fn != NULL)
 	xx = unlink(fn);
@@ -17,6 +17,17 @@ int mayAddToFilesAwaitingFiletriggers(const char *rootDir, rpmfi fi,
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies fi, rpmGlobalMacroContext, fileSystem, internalState @*/;
 
+/**
+ * Append the in-memory list of files awaiting filetriggers to
+ * /var/lib/rpm/files-awaiting-filetriggers, for filetriggers that aren't
+ * run at the end of this transaction.
+ * @return		RPMRC_OK on success
+ */
+__attribute__ ((visibility("hidden")))
+int saveFilesAwaitingFiletriggers(void)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/;
+
 /**
  */
 void rpmRunFileTriggers(const char *rootDir)
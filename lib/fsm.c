@@ -8,6 +8,7 @@
 #include <rpmio_internal.h>	/* XXX urlPath, fdGetCpioPos */
 #include <rpmcb.h>		/* XXX fnpyKey */
 #include "rpmsq.h"
+#include <yarn.h>
 #include <rpmsx.h>
 #if defined(SUPPORT_AR_PAYLOADS)
 #include "ar.h"
@@ -20,6 +21,7 @@
 #include <rpmtypes.h>
 #define	_RPMDB_INTERNAL
 #include <rpmdb.h>
+#include <rpmlio.h>
 
 #define	_RPMFI_INTERNAL
 #include "rpmfi.h"
@@ -415,27 +417,11 @@ const char * dnlNextIterator(/*@null@*/ DNLI_t dnli)
     return dn;
 }
 
-#if defined(WITH_PTHREADS)
-static void * fsmThread(void * arg)
-	/*@globals h_errno, fileSystem, internalState @*/
-	/*@modifies arg, fileSystem, internalState @*/
-{
-    IOSM_t fsm = arg;
-/*@-unqualifiedtrans@*/
-    return ((void *) ((long)fsmStage(fsm, fsm->nstage)));
-/*@=unqualifiedtrans@*/
-}
-#endif
-
 int fsmNext(IOSM_t fsm, iosmFileStage nstage)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies fsm, fileSystem, internalState @*/
 {
     fsm->nstage = nstage;
-#if defined(WITH_PTHREADS)
-    if (fsm->multithreaded)
-	return rpmsqJoin( rpmsqThread(fsmThread, fsm) );
-#endif
     return fsmStage(fsm, fsm->nstage);
 }
 
@@ -753,6 +739,11 @@ fprintf(stderr, "--> fsmTeardown(%p)\n", fsm);
 	(void) rpmswAdd(rpmtsOp(fsmGetTs(fsm), RPMTS_OP_DIGEST),
 			&fsm->op_digest);
 
+    /* Make this package's batched file operation log records durable. */
+    {	int xx = rpmlioFlush(rpmtsGetRdb(fsmGetTs(fsm)));
+	if (xx && !rc) rc = xx;
+    }
+
     fsm->lmtab = _free(fsm->lmtab);
     (void)rpmtsFree(fsm->iter->ts); 
     fsm->iter->ts = NULL;
@@ -965,6 +956,729 @@ int fsmMapAttrs(IOSM_t fsm)
     return 0;
 }
 
+#if defined(WITH_PTHREADS)
+/*
+ * Payload extraction pipeline (enabled with --fsmthreads):
+ *
+ *	reader:	   one thread decompressing the payload into a bounded ring,
+ *		   consumed by the fsm through IOSM_DREAD/IOSM_EAT/IOSM_POS.
+ *	writers:   a pool of threads that fill and digest distinct files.
+ *	commit:	   renames/setmeta are deferred into a FIFO and done by the
+ *		   fsm thread in archive order once each file is written.
+ *
+ * At most FSM_PIPE_NOPEN queued files are held open for writing, so that
+ * a payload of many small files can't exhaust RLIMIT_NOFILE. A deferred
+ * failure is reported (failedFile) against the path saved in its job.
+ *
+ * All pipeline state is protected by a single yarn lock, whose value is
+ * bumped on every change so that waiters can sleep until something moves.
+ */
+#define	FSM_PIPE_NRING		8		/* no. of decompressed blocks */
+#define	FSM_PIPE_BLKSIZE	(128 * 1024)	/* decompressed block size */
+#define	FSM_PIPE_INFLIGHT	(32 * 1024 * 1024) /* max. unwritten bytes */
+#define	FSM_PIPE_NJOBS		1024		/* max. uncommitted files */
+#define	FSM_PIPE_NOPEN		64		/* max. files open for writing */
+#define	FSM_PIPE_NWRITERS	8		/* max. default writers */
+
+typedef struct fsmBlock_s * fsmBlock;
+typedef struct fsmJob_s * fsmJob;
+typedef struct fsmPipe_s * fsmPipe;
+
+/**
+ * File data waiting to be written.
+ */
+struct fsmBlock_s {
+/*@null@*/
+    fsmBlock next;
+    size_t nb;			/*!< No. of bytes in block. */
+    unsigned char * b;		/*!< Block data. */
+};
+
+/**
+ * Deferred file commit, with the data to be written (if any).
+ */
+struct fsmJob_s {
+/*@null@*/
+    fsmJob next;		/*!< Next job in archive order. */
+/*@null@*/
+    fsmJob qnext;		/*!< Next job for the writers. */
+/*@null@*/
+    FD_t wfd;			/*!< Output file handle (NULL if no data). */
+/*@null@*/
+    fsmBlock blocks;		/*!< Data blocks to be written. */
+    fsmBlock * btail;
+    int eof;			/*!< All blocks have been queued? */
+    int done;			/*!< Has the writer finished? */
+    int rc;			/*!< Writer return code. */
+    int commit;			/*!< Commit the file? */
+    rpmuint32_t fdigestalgo;
+    rpmuint32_t digestlen;
+/*@dependent@*/ /*@null@*/
+    const char * fdigest;
+/*@dependent@*/ /*@null@*/
+    const unsigned char * digest;
+    struct rpmop_s op_digest;	/*!< RPMSW_OP_DIGEST accumulator. */
+
+    /* Saved fsm state needed by IOSM_COMMIT. */
+/*@only@*/ /*@null@*/
+    const char * path;
+/*@shared@*/ /*@null@*/
+    const char * subdir;
+/*@shared@*/ /*@null@*/
+    const char * suffix;
+/*@shared@*/ /*@null@*/
+    const char * osuffix;
+/*@shared@*/ /*@null@*/
+    const char * nsuffix;
+/*@shared@*/ /*@null@*/
+    const char * dirName;
+/*@shared@*/ /*@null@*/
+    const char * baseName;
+    int ix;
+    int postpone;
+    int diskchecked;
+    int exists;
+    rpmuint32_t fflags;
+    iosmFileAction action;
+    struct stat sb;
+    struct stat osb;
+};
+
+/**
+ * Payload extraction pipeline.
+ */
+struct fsmPipe_s {
+    yarnLock lock;		/*!< Pipeline state (bumped on change). */
+/*@dependent@*/
+    FD_t cfd;			/*!< Payload file handle. */
+    yarnThread reader;		/*!< Decompressor thread. */
+    unsigned char * ring[FSM_PIPE_NRING];
+    size_t ringnb[FSM_PIPE_NRING];
+    size_t ringoff;		/*!< Consumer offset in head block. */
+    unsigned head;		/*!< Next block to consume. */
+    unsigned tail;		/*!< Next block to fill. */
+    int eof;			/*!< Has the reader stopped? */
+    int rerr;			/*!< Did the reader fail? */
+    int nwriters;
+    yarnThread * writers;	/*!< Writer threads. */
+/*@null@*/
+    fsmJob jobs;		/*!< Uncommitted jobs in archive order. */
+    fsmJob * jtail;
+    unsigned njobs;
+/*@null@*/
+    fsmJob todo;		/*!< Jobs waiting for a writer. */
+    fsmJob * qtail;
+/*@null@*/ /*@dependent@*/
+    fsmJob cur;			/*!< Job for the file being extracted. */
+    size_t inflight;		/*!< No. of queued but unwritten bytes. */
+    unsigned nopen;		/*!< No. of files open for writing. */
+    int stop;			/*!< Are the threads to exit? */
+    int rc;			/*!< First deferred commit failure. */
+};
+
+/**
+ * Wait for a change to the pipeline state (lock must be possessed).
+ * @param pipe		payload extraction pipeline
+ */
+static void fsmPipeWait(fsmPipe pipe)
+	/*@modifies pipe @*/
+{
+    yarnWaitFor(pipe->lock, NOT_TO_BE, yarnPeekLock(pipe->lock));
+}
+
+/**
+ * Signal a change to the pipeline state, releasing the lock.
+ * @param pipe		payload extraction pipeline
+ */
+static void fsmPipeSignal(fsmPipe pipe)
+	/*@modifies pipe @*/
+{
+    yarnTwist(pipe->lock, BY, 1);
+}
+
+/**
+ * Decompressor thread: fill the ring with payload blocks until EOF.
+ * @param _pipe		payload extraction pipeline
+ */
+static void fsmPipeReader(void * _pipe)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _pipe, fileSystem, internalState @*/
+{
+    fsmPipe pipe = _pipe;
+    int done = 0;
+
+    while (!done) {
+	unsigned char * b;
+	size_t nb = 0;
+	int rerr;
+
+	yarnPossess(pipe->lock);
+	while (!pipe->stop && pipe->tail - pipe->head >= FSM_PIPE_NRING)
+	    fsmPipeWait(pipe);
+	if (pipe->stop) {
+	    yarnRelease(pipe->lock);
+	    break;
+	}
+	b = pipe->ring[pipe->tail % FSM_PIPE_NRING];
+	yarnRelease(pipe->lock);
+
+	/* The slot at tail is not visible to the consumer until published. */
+	while (nb < FSM_PIPE_BLKSIZE) {
+	    ssize_t n = (ssize_t) Fread(b + nb, sizeof(*b),
+				FSM_PIPE_BLKSIZE - nb, pipe->cfd);
+	    if (n <= 0)
+		/*@innerbreak@*/ break;
+	    nb += n;
+	}
+	rerr = Ferror(pipe->cfd);
+
+	yarnPossess(pipe->lock);
+	pipe->ringnb[pipe->tail % FSM_PIPE_NRING] = nb;
+	if (nb > 0)
+	    pipe->tail++;
+	if (nb < FSM_PIPE_BLKSIZE || rerr) {
+	    pipe->eof = 1;
+	    pipe->rerr = rerr;
+	    done = 1;
+	}
+	fsmPipeSignal(pipe);
+    }
+}
+
+/**
+ * Read decompressed payload from the ring.
+ * @param pipe		payload extraction pipeline
+ * @retval buf		data buffer
+ * @param len		no. of bytes requested
+ * @return		no. of bytes read (short on EOF or error)
+ */
+static size_t fsmPipeRead(fsmPipe pipe, char * buf, size_t len)
+	/*@modifies pipe, *buf @*/
+{
+    size_t total = 0;
+
+    yarnPossess(pipe->lock);
+    while (total < len) {
+	unsigned ix;
+	size_t n;
+
+	while (pipe->head == pipe->tail && !pipe->eof)
+	    fsmPipeWait(pipe);
+	if (pipe->head == pipe->tail)
+	    break;
+	ix = pipe->head % FSM_PIPE_NRING;
+	n = pipe->ringnb[ix] - pipe->ringoff;
+	if (n > len - total)
+	    n = len - total;
+	yarnRelease(pipe->lock);
+
+	/* The reader never touches published slots. */
+	memcpy(buf + total, pipe->ring[ix] + pipe->ringoff, n);
+	total += n;
+
+	yarnPossess(pipe->lock);
+	pipe->ringoff += n;
+	if (pipe->ringoff == pipe->ringnb[ix]) {
+	    pipe->ringoff = 0;
+	    pipe->head++;
+	    fsmPipeSignal(pipe);
+	    yarnPossess(pipe->lock);
+	}
+    }
+    yarnRelease(pipe->lock);
+    return total;
+}
+
+/**
+ * Write (and digest) the blocks of a job as they are queued.
+ * @param pipe		payload extraction pipeline
+ * @param job		file job
+ */
+static void fsmJobWrite(fsmPipe pipe, fsmJob job)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies pipe, job, fileSystem, internalState @*/
+{
+    fsmBlock b;
+    int rc = 0;
+
+    while (1) {
+	yarnPossess(pipe->lock);
+	while ((b = job->blocks) == NULL && !job->eof)
+	    fsmPipeWait(pipe);
+	if (b == NULL) {
+	    yarnRelease(pipe->lock);
+	    break;
+	}
+	if ((job->blocks = b->next) == NULL)
+	    job->btail = &job->blocks;
+	pipe->inflight -= b->nb;
+	fsmPipeSignal(pipe);
+
+	if (!rc) {
+	    size_t nw = Fwrite(b->b, sizeof(*b->b), b->nb, job->wfd);
+	    if (nw != b->nb || Ferror(job->wfd))
+		rc = IOSMERR_WRITE_FAILED;
+	}
+	b = _free(b);
+    }
+
+    if (!rc && (job->fdigest != NULL || job->digest != NULL)) {
+	void * digest = NULL;
+	int asAscii = (job->digest == NULL ? 1 : 0);
+
+	(void) Fflush(job->wfd);
+	fdFiniDigest(job->wfd, job->fdigestalgo, &digest, NULL, asAscii);
+
+	if (digest == NULL)
+	    rc = IOSMERR_DIGEST_MISMATCH;
+	else if (job->digest != NULL) {
+	    if (memcmp(digest, job->digest, job->digestlen))
+		rc = IOSMERR_DIGEST_MISMATCH;
+	} else {
+	    if (strcmp(digest, job->fdigest))
+		rc = IOSMERR_DIGEST_MISMATCH;
+	}
+	digest = _free(digest);
+    }
+
+    (void) rpmswAdd(&job->op_digest, fdstat_op(job->wfd, FDSTAT_DIGEST));
+    (void) Fclose(job->wfd);
+    job->wfd = NULL;
+
+    yarnPossess(pipe->lock);
+    job->rc = rc;
+    job->done = 1;
+    pipe->nopen--;
+    fsmPipeSignal(pipe);
+}
+
+/**
+ * Writer thread: write files until told to stop.
+ * @param _pipe		payload extraction pipeline
+ */
+static void fsmPipeWriter(void * _pipe)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _pipe, fileSystem, internalState @*/
+{
+    fsmPipe pipe = _pipe;
+    fsmJob job;
+
+    while (1) {
+	yarnPossess(pipe->lock);
+	while (!pipe->stop && pipe->todo == NULL)
+	    fsmPipeWait(pipe);
+	if ((job = pipe->todo) == NULL) {
+	    yarnRelease(pipe->lock);
+	    break;
+	}
+	if ((pipe->todo = job->qnext) == NULL)
+	    pipe->qtail = &pipe->todo;
+	job->qnext = NULL;
+	yarnRelease(pipe->lock);
+
+	fsmJobWrite(pipe, job);
+    }
+}
+
+/**
+ * Create a file job.
+ * @param wfd		output file handle (NULL for commit only)
+ * @return		new file job
+ */
+static fsmJob fsmJobNew(/*@null@*/ FD_t wfd)
+	/*@*/
+{
+    fsmJob job = xcalloc(1, sizeof(*job));
+    job->wfd = wfd;
+    job->btail = &job->blocks;
+    job->done = (wfd == NULL);
+    return job;
+}
+
+/**
+ * Destroy a (finished) file job.
+ * @param job		file job
+ * @return		NULL always
+ */
+static /*@null@*/ fsmJob fsmJobFree(/*@only@*/ fsmJob job)
+	/*@modifies job @*/
+{
+    fsmBlock b;
+
+    while ((b = job->blocks) != NULL) {
+	job->blocks = b->next;
+	b = _free(b);
+    }
+    job->path = _free(job->path);
+    return _free(job);
+}
+
+/**
+ * Exchange the per-file fsm state with a job.
+ * @param fsm		file state machine data
+ * @param job		file job
+ */
+static void fsmJobSwap(IOSM_t fsm, fsmJob job)
+	/*@modifies fsm, job @*/
+{
+#define	SWAP(_t, _a, _b)	{ _t _tmp = (_a); (_a) = (_b); (_b) = _tmp; }
+    SWAP(const char *, fsm->path, job->path);
+    SWAP(const char *, fsm->subdir, job->subdir);
+    SWAP(const char *, fsm->suffix, job->suffix);
+    SWAP(const char *, fsm->osuffix, job->osuffix);
+    SWAP(const char *, fsm->nsuffix, job->nsuffix);
+    SWAP(const char *, fsm->dirName, job->dirName);
+    SWAP(const char *, fsm->baseName, job->baseName);
+    SWAP(int, fsm->ix, job->ix);
+    SWAP(int, fsm->postpone, job->postpone);
+    SWAP(int, fsm->diskchecked, job->diskchecked);
+    SWAP(int, fsm->exists, job->exists);
+    SWAP(rpmuint32_t, fsm->fflags, job->fflags);
+    SWAP(iosmFileAction, fsm->action, job->action);
+    SWAP(struct stat, fsm->sb, job->sb);
+    SWAP(struct stat, fsm->osb, job->osb);
+#undef	SWAP
+}
+
+/**
+ * Save the per-file fsm state needed to commit later.
+ * @param fsm		file state machine data
+ * @param job		file job
+ */
+static void fsmJobSave(IOSM_t fsm, fsmJob job)
+	/*@modifies fsm, job @*/
+{
+    job->path = fsm->path;
+    fsm->path = NULL;
+    job->subdir = fsm->subdir;
+    job->suffix = fsm->suffix;
+    job->osuffix = fsm->osuffix;
+    job->nsuffix = fsm->nsuffix;
+    job->dirName = fsm->dirName;
+    job->baseName = fsm->baseName;
+    job->ix = fsm->ix;
+    job->postpone = fsm->postpone;
+    job->diskchecked = fsm->diskchecked;
+    job->exists = fsm->exists;
+    job->fflags = fsm->fflags;
+    job->action = fsm->action;
+    job->sb = fsm->sb;			/* structure assignment */
+    job->osb = fsm->osb;		/* structure assignment */
+}
+
+/**
+ * Wait until another output file may be opened for a writer.
+ * Files already queued have all their data, so the writers always drain.
+ * @param pipe		payload extraction pipeline
+ */
+static void fsmPipeOpen(fsmPipe pipe)
+	/*@modifies pipe @*/
+{
+    yarnPossess(pipe->lock);
+    while (pipe->nopen >= FSM_PIPE_NOPEN)
+	fsmPipeWait(pipe);
+    pipe->nopen++;
+    fsmPipeSignal(pipe);
+}
+
+/**
+ * Give back an output file slot (the open failed).
+ * @param pipe		payload extraction pipeline
+ */
+static void fsmPipeClose(fsmPipe pipe)
+	/*@modifies pipe @*/
+{
+    yarnPossess(pipe->lock);
+    pipe->nopen--;
+    fsmPipeSignal(pipe);
+}
+
+/**
+ * Append a job to the pipeline, queueing it for a writer if needed.
+ * @param pipe		payload extraction pipeline
+ * @param job		file job
+ */
+static void fsmPipeAddJob(fsmPipe pipe, fsmJob job)
+	/*@modifies pipe, job @*/
+{
+    yarnPossess(pipe->lock);
+    *pipe->jtail = job;
+    pipe->jtail = &job->next;
+    pipe->njobs++;
+    if (job->wfd != NULL) {
+	*pipe->qtail = job;
+	pipe->qtail = &job->qnext;
+    }
+    fsmPipeSignal(pipe);
+}
+
+/**
+ * Queue file data for a writer, waiting if too much is in flight.
+ * @param pipe		payload extraction pipeline
+ * @param job		file job
+ * @param buf		data
+ * @param nb		no. of bytes
+ */
+static void fsmJobAppend(fsmPipe pipe, fsmJob job, const char * buf, size_t nb)
+	/*@modifies pipe, job @*/
+{
+    fsmBlock b = xmalloc(sizeof(*b) + nb);
+
+    b->next = NULL;
+    b->nb = nb;
+    b->b = (unsigned char *) (b + 1);
+    memcpy(b->b, buf, nb);
+
+    yarnPossess(pipe->lock);
+    while (pipe->inflight >= FSM_PIPE_INFLIGHT)
+	fsmPipeWait(pipe);
+    *job->btail = b;
+    job->btail = &b->next;
+    pipe->inflight += nb;
+    fsmPipeSignal(pipe);
+}
+
+/**
+ * Commit (or discard) deferred files in archive order.
+ * @param fsm		file state machine data
+ * @param all		wait for all jobs (otherwise only finished ones)?
+ * @return		0 on success, first failure otherwise
+ */
+static int fsmPipeCommit(IOSM_t fsm, int all)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = fsm->pipe;
+    fsmJob job;
+
+    while (1) {
+	int rc = 0;
+
+	yarnPossess(pipe->lock);
+	if ((job = pipe->jobs) == NULL
+	 || (!all && !job->done && pipe->njobs <= FSM_PIPE_NJOBS))
+	{
+	    yarnRelease(pipe->lock);
+	    break;
+	}
+	while (!job->done)
+	    fsmPipeWait(pipe);
+	if ((pipe->jobs = job->next) == NULL)
+	    pipe->jtail = &pipe->jobs;
+	pipe->njobs--;
+	yarnRelease(pipe->lock);
+
+	(void) rpmswAdd(&fsm->op_digest, &job->op_digest);
+
+	/* XXX the job for an aborted extraction has no saved state. */
+	if (job->path != NULL) {
+	    fsmJobSwap(fsm, job);
+	    if (pipe->rc) {
+		/* Discard files following a failure. */
+		if (S_ISREG(fsm->sb.st_mode) && fsm->sufbuf[0] != '\0')
+		    (void) fsmNext(fsm, IOSM_UNLINK);
+	    } else if (job->rc) {
+		rc = job->rc;
+		(void) fsmNext(fsm, IOSM_UNDO);
+	    } else if (job->commit)
+		rc = fsmNext(fsm, IOSM_COMMIT);
+	    /* Report the job's file, not the one being extracted. */
+	    if (rc && fsm->failedFile && *fsm->failedFile == NULL)
+		*fsm->failedFile = xstrdup(fsm->path);
+	    fsmJobSwap(fsm, job);
+	}
+	job = fsmJobFree(job);
+
+	if (rc && !pipe->rc)
+	    pipe->rc = rc;
+    }
+    return pipe->rc;
+}
+
+/**
+ * Extract file data through the pipeline writers.
+ * @param fsm		file state machine data
+ * @return		0 on success
+ */
+static int fsmPipeExtract(IOSM_t fsm)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = fsm->pipe;
+    fsmJob job = fsmJobNew(fsm->wfd);
+    size_t left = (size_t) fsm->sb.st_size;
+    int rc = 0;
+
+    fsm->wfd = NULL;
+    if (fsm->sb.st_size > 0) {
+	job->fdigestalgo = fsm->fdigestalgo;
+	job->digestlen = fsm->digestlen;
+	job->fdigest = fsm->fdigest;
+	job->digest = fsm->digest;
+    }
+    fsmPipeAddJob(pipe, job);
+    pipe->cur = job;
+
+    while (left) {
+	fsm->wrlen = (left > fsm->wrsize ? fsm->wrsize : left);
+	rc = fsmNext(fsm, IOSM_DREAD);
+	if (rc)
+	    break;
+
+	fsmJobAppend(pipe, job, fsm->wrbuf, fsm->rdnb);
+	fsm->wrnb = fsm->rdnb;
+	left -= fsm->wrnb;
+
+	/* Notify iff progress, completion is done elsewhere */
+	if (left)
+	    (void) fsmNext(fsm, IOSM_NOTIFY);
+    }
+
+    yarnPossess(pipe->lock);
+    job->eof = 1;
+    fsmPipeSignal(pipe);
+
+    return rc;
+}
+
+/**
+ * Payload read stages, consuming the decompressed ring.
+ * @param fsm		file state machine data
+ * @param stage		payload read stage
+ * @return		0 on success
+ */
+static int fsmPipeStage(IOSM_t fsm, iosmFileStage stage)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = fsm->pipe;
+    struct stat * st = &fsm->sb;
+    size_t left;
+    int rc = 0;
+
+    switch (stage) {
+    case IOSM_NEXT:
+	rc = fsmUNSAFE(fsm, IOSM_HREAD);
+	if (rc) break;
+	if (!strcmp(fsm->path, CPIO_TRAILER)) { /* Detect end-of-payload. */
+	    fsm->path = _free(fsm->path);
+	    rc = IOSMERR_HDR_TRAILER;
+	}
+	if (!rc)
+	    rc = fsmNext(fsm, IOSM_POS);
+	break;
+    case IOSM_EAT:
+	for (left = st->st_size; left > 0; left -= fsm->rdnb) {
+	    fsm->wrlen = (left > fsm->wrsize ? fsm->wrsize : left);
+	    rc = fsmNext(fsm, IOSM_DREAD);
+	    if (rc)
+		/*@loopbreak@*/ break;
+	}
+	break;
+    case IOSM_POS:
+	left = (fsm->blksize - (fdGetCpioPos(fsm->cfd) % fsm->blksize)) % fsm->blksize;
+	if (left) {
+	    fsm->wrlen = left;
+	    (void) fsmNext(fsm, IOSM_DREAD);
+	}
+	break;
+    case IOSM_HREAD:
+	rc = fsmNext(fsm, IOSM_POS);
+	if (!rc)
+	    rc = (*fsm->headerRead) (fsm, st);	/* Read next payload header. */
+	break;
+    case IOSM_DREAD:
+	fsm->rdnb = fsmPipeRead(pipe, fsm->wrbuf, fsm->wrlen);
+	if (fsm->debug && (stage & IOSM_SYSCALL))
+	    rpmlog(RPMLOG_DEBUG, " %8s (%s, %d, ring)\trdnb %d\n",
+		iosmFileStageString(stage), "wrbuf",
+		(int)fsm->wrlen, (int)fsm->rdnb);
+	if (fsm->rdnb != fsm->wrlen || pipe->rerr)
+	    rc = IOSMERR_READ_FAILED;
+	if (fsm->rdnb > 0)
+	    fdSetCpioPos(fsm->cfd, fdGetCpioPos(fsm->cfd) + fsm->rdnb);
+	break;
+    default:
+	rc = iosmStage(fsm, stage);
+	break;
+    }
+    return rc;
+}
+
+/**
+ * Create a payload extraction pipeline, starting its threads.
+ * @param fsm		file state machine data
+ * @return		payload extraction pipeline
+ */
+static fsmPipe fsmPipeNew(IOSM_t fsm)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = xcalloc(1, sizeof(*pipe));
+    int i;
+
+    pipe->nwriters = fsm->multithreaded;
+    if (pipe->nwriters < 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+	pipe->nwriters = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (pipe->nwriters > FSM_PIPE_NWRITERS)
+	    pipe->nwriters = FSM_PIPE_NWRITERS;
+    }
+    if (pipe->nwriters < 1)
+	pipe->nwriters = 1;
+
+    pipe->lock = yarnNewLock(0);
+    pipe->cfd = fsm->cfd;
+    for (i = 0; i < FSM_PIPE_NRING; i++)
+	pipe->ring[i] = xmalloc(FSM_PIPE_BLKSIZE);
+    pipe->jtail = &pipe->jobs;
+    pipe->qtail = &pipe->todo;
+
+    pipe->reader = yarnLaunch(fsmPipeReader, pipe);
+    pipe->writers = xcalloc(pipe->nwriters, sizeof(*pipe->writers));
+    for (i = 0; i < pipe->nwriters; i++)
+	pipe->writers[i] = yarnLaunch(fsmPipeWriter, pipe);
+
+    return pipe;
+}
+
+/**
+ * Stop the pipeline threads and destroy the pipeline.
+ * @param fsm		file state machine data
+ * @return		NULL always
+ */
+static /*@null@*/ fsmPipe fsmPipeFree(IOSM_t fsm)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = fsm->pipe;
+    fsmJob job;
+    int i;
+
+    /* Writers drain their queue before exiting. */
+    yarnPossess(pipe->lock);
+    pipe->stop = 1;
+    fsmPipeSignal(pipe);
+
+    pipe->reader = yarnJoin(pipe->reader);
+    for (i = 0; i < pipe->nwriters; i++)
+	pipe->writers[i] = yarnJoin(pipe->writers[i]);
+    pipe->writers = _free(pipe->writers);
+
+    while ((job = pipe->jobs) != NULL) {
+	pipe->jobs = job->next;
+	(void) rpmswAdd(&fsm->op_digest, &job->op_digest);
+	job = fsmJobFree(job);
+    }
+    for (i = 0; i < FSM_PIPE_NRING; i++)
+	pipe->ring[i] = _free(pipe->ring[i]);
+    pipe->lock = yarnFreeLock(pipe->lock);
+    pipe = _free(pipe);
+    return NULL;
+}
+#endif	/* WITH_PTHREADS */
+
 /** \ingroup payload
  * Create file from payload stream.
  * @param fsm		file state machine data
@@ -992,13 +1706,31 @@ static int extractRegular(/*@special@*/ IOSM_t fsm)
 	xx = rpmlioCreat(rpmtsGetRdb(fsmGetTs(fsm)), fn, mode, b, blen, d, dlen, dalgo);
     }
 
+#if defined(WITH_PTHREADS)
+    if (fsm->pipe != NULL && st->st_nlink <= 1)
+	fsmPipeOpen(fsm->pipe);
+#endif
+
     rc = fsmNext(fsm, IOSM_WOPEN);
-    if (rc)
+    if (rc) {
+#if defined(WITH_PTHREADS)
+	if (fsm->pipe != NULL && st->st_nlink <= 1)
+	    fsmPipeClose(fsm->pipe);
+#endif
 	goto exit;
+    }
 
     if (st->st_size > 0 && (fsm->fdigest != NULL || fsm->digest != NULL))
 	fdInitDigest(fsm->wfd, fsm->fdigestalgo, 0);
 
+#if defined(WITH_PTHREADS)
+    /* XXX hard links are created from the file in IOSM_PROCESS. */
+    if (fsm->pipe != NULL && st->st_nlink <= 1) {
+	rc = fsmPipeExtract(fsm);
+	goto exit;
+    }
+#endif
+
     while (left) {
 
 	fsm->wrlen = (left > fsm->wrsize ? fsm->wrsize : left);
@@ -1592,6 +2324,44 @@ static int fsmStat(/*@special@*/ /*@partial@*/ IOSM_t fsm)
 	((_x)[sizeof("/dev/log")-1] == '\0' || \
 	 (_x)[sizeof("/dev/log")-1] == ';'))
 
+#if defined(WITH_PTHREADS)
+/**
+ * Defer the commit of the current file until its data has been written.
+ * @param fsm		file state machine data
+ * @return		0 on success, first deferred failure otherwise
+ */
+static int fsmPipeFini(IOSM_t fsm)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fsm, fileSystem, internalState @*/
+{
+    fsmPipe pipe = fsm->pipe;
+    fsmJob job = pipe->cur;
+    int commit = (!fsm->postpone && fsm->commit);
+    int rc;
+
+    pipe->cur = NULL;
+
+    /* Hard links are committed as a set: drain the pipeline first. */
+    if (S_ISREG(fsm->sb.st_mode) && fsm->sb.st_nlink > 1) {
+	rc = fsmPipeCommit(fsm, 1);
+	if (!rc && commit)
+	    rc = fsmCommitLinks(fsm);
+	return rc;
+    }
+
+    if (job == NULL) {
+	if (!commit)
+	    return fsmPipeCommit(fsm, 0);
+	job = fsmJobNew(NULL);
+	fsmPipeAddJob(pipe, job);
+    }
+    job->commit = commit;
+    fsmJobSave(fsm, job);
+
+    return fsmPipeCommit(fsm, 0);
+}
+#endif
+
 /*@-compmempass@*/
 int fsmStage(IOSM_t fsm, iosmFileStage stage)
 {
@@ -1639,6 +2409,10 @@ int fsmStage(IOSM_t fsm, iosmFileStage stage)
     case IOSM_UNKNOWN:
 	break;
     case IOSM_PKGINSTALL:
+#if defined(WITH_PTHREADS)
+	if (fsm->multithreaded)
+	    fsm->pipe = fsmPipeNew(fsm);
+#endif
 	while (1) {
 	    /* Clean fsm, free'ing memory. Read next archive header. */
 	    rc = fsmUNSAFE(fsm, IOSM_INIT);
@@ -1671,6 +2445,14 @@ int fsmStage(IOSM_t fsm, iosmFileStage stage)
 		/*@loopbreak@*/ break;
 	    }
 	}
+#if defined(WITH_PTHREADS)
+	if (fsm->pipe != NULL) {
+	    int xx = fsmPipeCommit(fsm, 1);
+	    if (!rc)
+		rc = xx;
+	    fsm->pipe = fsmPipeFree(fsm);
+	}
+#endif
 	break;
     case IOSM_PKGERASE:
     case IOSM_PKGCOMMIT:
@@ -2054,6 +2836,11 @@ assert(fsm->lpath != NULL);
 	    *fsm->failedFile = xstrdup(fsm->path);
 	break;
     case IOSM_FINI:
+#if defined(WITH_PTHREADS)
+	if (fsm->pipe != NULL)
+	    rc = fsmPipeFini(fsm);
+	else
+#endif
 	if (!fsm->postpone && fsm->commit) {
 	    if (fsm->goal == IOSM_PKGINSTALL)
 		rc = ((S_ISREG(st->st_mode) && st->st_nlink > 1)
@@ -2394,6 +3181,12 @@ iosmcall:
     case IOSM_HWRITE:
     case IOSM_DREAD:
     case IOSM_DWRITE:
+#if defined(WITH_PTHREADS)
+	if (fsm->pipe != NULL) {
+	    rc = fsmPipeStage(fsm, stage);
+	    break;
+	}
+#endif
 	rc = iosmStage(fsm, stage);
 	break;
 
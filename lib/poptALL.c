@@ -44,6 +44,9 @@ extern unsigned int * keyids;
 #define POPT_QUERYTAGS		-997
 #define POPT_PREDEFINE		-996
 #define POPT_UNDEFINE		-994
+#define POPT_BUILDMACROCACHE	-990
+#define POPT_VERIFYMACROCACHE	-989
+#define POPT_DUMPMACROCACHE	-988
 
 /*@access headerTagIndices @*/		/* XXX rpmcliFini */
 /*@access headerTagTableEntry @*/	/* XXX rpmcliFini */
@@ -307,6 +310,29 @@ assert(arg != NULL);
 /*@i@*/	con = rpmcliFini(con);
 	exit(EXIT_SUCCESS);
 	/*@notreached@*/ break;
+    case POPT_BUILDMACROCACHE:
+    case POPT_VERIFYMACROCACHE:
+    case POPT_DUMPMACROCACHE:
+    {	const char * mfpath;
+	int rc;
+	if (rpmMacrocache == NULL) {
+	    fprintf(stderr, _("%s: --macrocache <FILE> must be specified\n"),
+		__progname);
+/*@i@*/	    con = rpmcliFini(con);
+	    exit(EXIT_FAILURE);
+	}
+	rpmcliConfigured();
+	mfpath = rpmExpand(rpmMacrofiles, NULL);
+	if (opt->val == POPT_BUILDMACROCACHE)
+	    rc = rpmMacroCacheBuild(rpmMacrocache, mfpath);
+	else if (opt->val == POPT_VERIFYMACROCACHE)
+	    rc = rpmMacroCacheVerify(rpmMacrocache, mfpath);
+	else
+	    rc = rpmMacroCacheDump(rpmMacrocache, mfpath, stdout);
+	mfpath = _free(mfpath);
+/*@i@*/	con = rpmcliFini(con);
+	exit((rc ? EXIT_FAILURE : EXIT_SUCCESS));
+    }	/*@notreached@*/ break;
     case RPMCLI_POPT_NODIGEST:
 	rpmcliQueryFlags |= VERIFY_DIGEST;
 	pgpDigVSFlags |= _RPMVSF_NODIGESTS;
@@ -402,6 +428,15 @@ struct poptOption rpmcliAllPoptTable[] = {
  { "macros", '\0', POPT_ARG_STRING, &rpmMacrofiles, 0,
 	N_("Read <FILE:...> instead of default file(s)"),
 	N_("<FILE:...>") },
+ { "macrocache", '\0', POPT_ARG_STRING, &rpmMacrocache, 0,
+	N_("Use <FILE> as precompiled macro cache"),
+	N_("<FILE>") },
+ { "buildmacrocache", '\0', 0, NULL, POPT_BUILDMACROCACHE,
+	N_("Rebuild the precompiled macro cache"), NULL },
+ { "verifymacrocache", '\0', 0, NULL, POPT_VERIFYMACROCACHE,
+	N_("Verify that the precompiled macro cache is current"), NULL },
+ { "dumpmacrocache", '\0', POPT_ARGFLAG_DOC_HIDDEN, NULL, POPT_DUMPMACROCACHE,
+	N_("Display the precompiled macro cache"), NULL },
 #ifdef WITH_LUA
  { "rpmlua", '\0', POPT_ARG_STRING, &rpmluaFiles, 0,
 	N_("Read <FILE:...> instead of default RPM Lua file(s)"),
@@ -436,6 +436,8 @@ struct poptOption rpmVerifyPoptTable[] = {
 	N_("don't verify file security contexts"), NULL },
  { "nofiles", '\0', POPT_BIT_SET, &rpmQVKArgs.qva_flags, VERIFY_FILES,
 	N_("don't verify files in package"), NULL},
+ { "jobs", '\0', POPT_ARG_INT, &rpmQVKArgs.qva_jobs, 0,
+	N_("verify files using N threads"), N_("N") },
 #ifdef	DYING
  { "nodeps", '\0', POPT_BIT_SET, &rpmQVKArgs.qva_flags, VERIFY_DEPS,
 	N_("don't verify package dependencies"), NULL },
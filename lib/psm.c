@@ -509,7 +509,9 @@ static rpmRC runLuaScript(rpmpsm psm, const char * sln, HE_t Phe,
 
     {	char buf[BUFSIZ];
 	xx = snprintf(buf, BUFSIZ, "%s(%s)", sln, psm->NVRA);
-	xx = rpmluaRunScript(lua, script, buf);
+	xx = rpmluaRunChunk(lua, script, buf,
+		rpmtsOp(psm->ts, RPMTS_OP_LUACOMPILE),
+		rpmtsOp(psm->ts, RPMTS_OP_LUAEXEC));
 	if (xx == -1) {
 	    void * ptr = rpmtsNotify(psm->ts, psm->te, RPMCALLBACK_SCRIPT_ERROR,
 				 psm->scriptTag, 1);
@@ -747,6 +749,110 @@ static int ldconfig_done = 0;
 /*@unchecked@*/ /*@observer@*/ /*@null@*/
 static const char * ldconfig_path = "/sbin/ldconfig";
 
+/**
+ * Scriptlet invocations deferred to the end of the transaction.
+ */
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static ARGV_t psmDeferred = NULL;
+
+/**
+ * Return a scriptlet as a command line to defer if it is a single
+ * invocation of one of the idempotent commands in %{_rpmpsm_coalesce}.
+ *
+ * The body (or the "-p" interpreter when there is no body) may contain
+ * only plain words, optionally followed by redirections to /dev/null and
+ * a trailing "|| :".
+ *
+ * @param Phe		scriptlet args, Phe->p.argv[0] is interpreter to use
+ * @param body		expanded scriptlet body (or NULL)
+ * @return		command line to defer, NULL if not coalescable
+ */
+/*@null@*/
+static char * psmCoalesce(HE_t Phe, /*@null@*/ const char * body)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    static const char * _redirs[] =
+	{ ">/dev/null", "2>/dev/null", "&>/dev/null", "2>&1", NULL };
+    static const char _metachars[] = "\"'\\`$;&|<>()[]{}*?~#=%";
+    ARGV_t cmds = NULL;
+    ARGV_t av = NULL;
+    const char * a;
+    char * cmd = NULL;
+    int ac;
+    int i;
+    int j;
+
+    a = rpmExpand("%{?_rpmpsm_coalesce}", NULL);
+    if (a && *a)
+	(void) argvSplit(&cmds, a, NULL);
+    a = _free(a);
+    if (cmds == NULL || cmds[0] == NULL)
+	goto exit;
+
+    if (body != NULL) {
+	const char * se;
+	char * t;
+
+	/* Only /bin/sh bodies are coalesced. */
+	if (Phe->p.argv != NULL
+	 && !(Phe->c == 1 && !strcmp(Phe->p.argv[0], "/bin/sh")))
+	    goto exit;
+	while (*body && xisspace((int)*body))
+	    body++;
+	se = body + strlen(body);
+	while (se > body && xisspace((int)se[-1]))
+	    se--;
+	if (se == body || memchr(body, '\n', (se - body)) != NULL)
+	    goto exit;
+	t = memcpy(xmalloc((se - body) + 1), body, (se - body));
+	t[se - body] = '\0';
+	(void) argvSplit(&av, t, NULL);
+	t = _free(t);
+    } else if (Phe->p.argv != NULL) {
+	for (i = 0; i < (int)Phe->c && Phe->p.argv[i] != NULL; i++)
+	    (void) argvAdd(&av, Phe->p.argv[i]);
+    }
+
+    ac = argvCount(av);
+    if (ac < 1 || strpbrk(av[0], _metachars) != NULL)
+	goto exit;
+
+    /* Permit a trailing "|| :" (or "|| true"). */
+    if (ac >= 3 && !strcmp(av[ac-2], "||")
+     && (!strcmp(av[ac-1], ":") || !strcmp(av[ac-1], "true")))
+	ac -= 2;
+    for (i = 1; i < ac; i++) {
+	if (strpbrk(av[i], _metachars) == NULL)
+	    continue;
+	for (j = 0; _redirs[j] != NULL; j++) {
+	    if (!strcmp(av[i], _redirs[j]))
+		/*@innerbreak@*/ break;
+	}
+	if (_redirs[j] == NULL)
+	    goto exit;
+    }
+
+    /* Match the command by path, or by basename if either has no path. */
+    a = strrchr(av[0], '/');
+    a = (a != NULL ? a + 1 : av[0]);
+    for (i = 0; cmds[i] != NULL; i++) {
+	const char * c = strrchr(cmds[i], '/');
+	c = (c != NULL ? c + 1 : cmds[i]);
+	if (!strcmp(av[0], cmds[i])
+	 || ((a == av[0] || c == cmds[i]) && !strcmp(a, c)))
+	{
+	    cmd = argvJoin(av, ' ');
+	    break;
+	}
+    }
+
+exit:
+    av = argvFree(av);
+    cmds = argvFree(cmds);
+    return cmd;
+}
+
 /**
  * Run scriptlet with args.
  *
@@ -836,6 +942,30 @@ assert(he->p.str != NULL);
 	goto exit;
     }
 
+    /*
+     * Defer %post/%postun invocations of idempotent commands, run once each
+     * at the end of the transaction by rpmpsmRunDeferred().
+     */
+    if (psm->te != NULL
+     && (psm->scriptTag == RPMTAG_POSTIN || psm->scriptTag == RPMTAG_POSTUN))
+    {
+	char * cmd = psmCoalesce(Phe, (script ? body : NULL));
+	if (cmd != NULL) {
+	    rpmlog(RPMLOG_DEBUG,
+		D_("%s: %s(%s) deferring \"%s\".\n"),
+		psm->stepName, tag2sln(psm->scriptTag), NVRA, cmd);
+	    for (i = 0; psmDeferred != NULL && psmDeferred[i] != NULL; i++) {
+		if (!strcmp(psmDeferred[i], cmd))
+		    /*@innerbreak@*/ break;
+	    }
+	    if (psmDeferred == NULL || psmDeferred[i] == NULL)
+		(void) argvAdd(&psmDeferred, cmd);
+	    cmd = _free(cmd);
+	    rc = RPMRC_OK;
+	    goto exit;
+	}
+    }
+
     psm->sq.reaper = 1;
 
     /*
@@ -1146,6 +1276,36 @@ exit:
     return rc;
 }
 
+rpmRC rpmpsmRunDeferred(rpmts ts)
+{
+    HE_t Phe = memset(alloca(sizeof(*Phe)), 0, sizeof(*Phe));
+    ARGV_t av = psmDeferred;
+    rpmRC rc = RPMRC_OK;
+    rpmpsm psm;
+    int i;
+
+    psmDeferred = NULL;
+    if (av == NULL)
+	return rc;
+
+    psm = rpmpsmNew(ts, NULL, NULL);
+    psm->scriptTag = RPMTAG_POSTTRANS;
+    psm->progTag = RPMTAG_POSTTRANSPROG;
+    psm->stepName = "deferred";
+    psm->NVRA = xstrdup("deferred");
+    /* Deferred invocations have no install prefixes. */
+    psm->IPhe->tag = RPMTAG_INSTPREFIXES;
+
+    for (i = 0; av[i] != NULL; i++) {
+	if (runScript(psm, NULL, "%post", Phe, av[i], -1, -1) != RPMRC_OK)
+	    rc = RPMRC_FAIL;
+    }
+
+    psm = rpmpsmFree(psm, __FUNCTION__);
+    av = argvFree(av);
+    return rc;
+}
+
 /**
  * Retrieve and run scriptlet from header.
  * @param psm		package state machine data
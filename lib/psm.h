@@ -220,6 +220,15 @@ rpmRC rpmpsmScriptStage(rpmpsm psm, rpmTag scriptTag, rpmTag progTag)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
 	/*@modifies psm, rpmGlobalMacroContext, fileSystem, internalState @*/;
 
+/**
+ * Run the scriptlet invocations deferred by %{_rpmpsm_coalesce}, once each.
+ * @param ts		transaction set
+ * @return		RPMRC_OK on success
+ */
+rpmRC rpmpsmRunDeferred(rpmts ts)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ts, rpmGlobalMacroContext, fileSystem, internalState @*/;
+
 void rpmpsmSetAsync(rpmpsm psm, int async)
 	/*@modifies psm @*/;
 
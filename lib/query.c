@@ -137,17 +137,36 @@ static void printFileInfo(char * te, const char * name,
 }
 
 /**
+ * Compiled --queryformat, reused across headers.
  */
-static inline /*@null@*/ const char * queryHeader(Header h, const char * qfmt)
-	/*@globals internalState @*/
-	/*@modifies h, internalState @*/
+/*@only@*/ /*@null@*/
+static headerSprintfProg _queryProg;
+/*@only@*/ /*@null@*/
+static const char * _queryProgFmt;
+
+/**
+ */
+static /*@observer@*/ /*@null@*/ const char * queryHeader(Header h, const char * qfmt)
+	/*@globals _queryProg, _queryProgFmt, internalState @*/
+	/*@modifies h, _queryProg, _queryProgFmt, internalState @*/
 {
     const char * errstr = "(unkown error)";
-    const char * str;
-
+    const char * str = NULL;
+
+    /* Parse the query format once, not once per header. */
+    if (_queryProg == NULL || _queryProgFmt == NULL
+     || strcmp(_queryProgFmt, qfmt))
+    {
+	_queryProg = headerSprintfFree(_queryProg);
+	_queryProgFmt = _free(_queryProgFmt);
 /*@-modobserver@*/
-    str = headerSprintf(h, qfmt, NULL, rpmHeaderFormats, &errstr);
+	_queryProg = headerSprintfCompile(qfmt, NULL, rpmHeaderFormats, &errstr);
 /*@=modobserver@*/
+	if (_queryProg != NULL)
+	    _queryProgFmt = xstrdup(qfmt);
+    }
+    if (_queryProg != NULL)
+	str = headerSprintfExec(_queryProg, h, &errstr);
     if (str == NULL)
 	rpmlog(RPMLOG_ERR, _("incorrect format: %s\n"), errstr);
     return str;
@@ -209,7 +228,6 @@ JBJDEBUG((stderr, "--> %s(%p,%p,%p)\n", __FUNCTION__, qva, ts, h));
 	    /*@-usereleased@*/
 	    te = stpcpy(te, str);
 	    /*@=usereleased@*/
-	    str = _free(str);
 	    flushBuffer(&t, &te, 1);
 	}
     }
@@ -918,6 +936,9 @@ JBJDEBUG((stderr, "--> %s(%p,%p,%p)\n", __FUNCTION__, ts, qva, argv));
     if (qva->qva_showPackage == showQueryPackage)
 	qva->qva_showPackage = NULL;
 
+    _queryProg = headerSprintfFree(_queryProg);
+    _queryProgFmt = _free(_queryProgFmt);
+
 JBJDEBUG((stderr, "<-- %s(%p,%p,%p) rc %d\n", __FUNCTION__, ts, qva, argv, ec));
     return ec;
 }
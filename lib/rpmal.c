@@ -6,13 +6,16 @@
 
 #include <rpmio.h>
 #include <rpmiotypes.h>		/* XXX fnpyKey */
-#include <rpmbf.h>
+#include <rpmurl.h>
+#include <rpmhash.h>
 
 #include <rpmtag.h>
 #include <rpmtypes.h>
 
 #define	_RPMDS_INTERNAL
 #include <rpmds.h>
+#define	_RPMFI_INTERNAL
+#include <rpmfi.h>
 #include <rpmal.h>
 
 #include "debug.h"
@@ -37,7 +40,7 @@ struct availablePackage_s {
 /*@refcounted@*/ /*@null@*/
     rpmds provides;		/*!< Provides: dependencies. */
 /*@refcounted@*/ /*@null@*/
-    rpmbf bf;			/*!< File name Bloom filter. */
+    rpmfi fi;			/*!< Files. */
 
     rpmuint32_t tscolor;	/*!< Transaction color bits. */
 
@@ -77,6 +80,19 @@ struct availableIndex_s {
     int k;			/*!< Current index. */
 };
 
+typedef /*@abstract@*/ struct availableFile_s *	availableFile;
+/*@access availableFile@*/
+
+/** \ingroup rpmdep
+ * A single available file, split as in the header (dirname/basename).
+ */
+struct availableFile_s {
+/*@observer@*/
+    const char * dn;		/*!< Directory name (with trailing '/'). */
+/*@observer@*/
+    const char * bn;		/*!< Base name. */
+};
+
 /** \ingroup rpmdep
  * Set of available packages, items, and directories.
  */
@@ -85,6 +101,10 @@ struct rpmal_s {
 /*@owned@*/ /*@null@*/
     availablePackage list;	/*!< Set of packages. */
     struct availableIndex_s index;	/*!< Set of available items. */
+/*@only@*/ /*@null@*/
+    availableFile files;	/*!< Array of available files. */
+/*@refcounted@*/ /*@null@*/
+    hashTable fileHash;		/*!< Available file -> alKey(s) index. */
     int delta;			/*!< Delta for pkg list reallocation. */
     int size;			/*!< No. of pkgs in list. */
     int alloced;		/*!< No. of pkgs allocated for list. */
@@ -115,6 +135,17 @@ static inline alKey alNum2Key(/*@unused@*/ /*@null@*/ const rpmal al,
     /*@=nullret =temptrans =retalias @*/
 }
 
+/**
+ * Destroy available file index.
+ * @param al		available list
+ */
+static void rpmalFreeFileIndex(rpmal al)
+	/*@modifies al @*/
+{
+    al->fileHash = htFree(al->fileHash);
+    al->files = _free(al->files);
+}
+
 /**
  * Destroy available item index.
  * @param al		available list
@@ -127,6 +158,7 @@ static void rpmalFreeIndex(rpmal al)
 	ai->index = _free(ai->index);
 	ai->size = 0;
     }
+    rpmalFreeFileIndex(al);
 }
 
 static void rpmalFini(void * _al)
@@ -139,8 +171,8 @@ static void rpmalFini(void * _al)
     for (i = 0; i < al->size; i++, alp++) {
 	(void)rpmdsFree(alp->provides);
 	alp->provides = NULL;
-	(void)rpmbfFree(alp->bf);
-	alp->bf = NULL;
+	(void)rpmfiFree(alp->fi);
+	alp->fi = NULL;
     }
 
     al->list = _free(al->list);
@@ -195,8 +227,11 @@ void rpmalDel(rpmal al, alKey pkgKey)
 
     (void)rpmdsFree(alp->provides);
     alp->provides = NULL;
-    (void)rpmbfFree(alp->bf);
-    alp->bf = NULL;
+    (void)rpmfiFree(alp->fi);
+    alp->fi = NULL;
+
+    /* The file index points into the package's file names. */
+    rpmalFreeFileIndex(al);
 
     memset(alp, 0, sizeof(*alp));	/* XXX trash and burn */
     return;
@@ -235,7 +270,7 @@ alKey rpmalAdd(rpmal * alistp, alKey pkgKey, fnpyKey key,
 
 /*@-assignexpose -castexpose @*/
     alp->provides = rpmdsLink(provides, "Provides (rpmalAdd)");
-    alp->bf = rpmbfLink(rpmfiFNBF(fi));
+    alp->fi = rpmfiLink(fi, "Files (rpmalAdd)");
 /*@=assignexpose =castexpose @*/
 
     rpmalFreeIndex(al);
@@ -309,6 +344,77 @@ assert(ix < 0x10000);
     }
 }
 
+/**
+ * Return hash value of an available file (hash of dn followed by bn).
+ * @param h		hash initial value
+ * @param data		available file
+ * @param size		(unused)
+ * @return		hash value
+ */
+static rpmuint32_t afHashFunction(rpmuint32_t h, const void * data,
+		/*@unused@*/ size_t size)
+	/*@*/
+{
+    const availableFile af = (const availableFile) data;
+    return hashFunctionString(hashFunctionString(h, af->dn, 0), af->bn, 0);
+}
+
+/**
+ * Compare two available files for equality.
+ * @param one		1st available file
+ * @param two		2nd available file
+ * @return		0 if files are equal
+ */
+static int afEqual(const void * one, const void * two)
+	/*@*/
+{
+    const availableFile a = (const availableFile) one;
+    const availableFile b = (const availableFile) two;
+    int rc = strcmp(a->bn, b->bn);
+    if (!rc)
+	rc = strcmp(a->dn, b->dn);
+    return rc;
+}
+
+/**
+ * Create the index of files contained in available packages.
+ * @param al		available list
+ */
+static void rpmalMakeFileIndex(rpmal al)
+	/*@modifies al @*/
+{
+    availablePackage alp;
+    availableFile af;
+    size_t nfiles = 0;
+    int i;
+
+    if (al->fileHash != NULL || al->list == NULL)
+	return;
+
+    for (i = 0; i < al->size; i++) {
+	alp = al->list + i;
+	if (alp->fi != NULL)
+	    nfiles += alp->fi->fc;
+    }
+
+    al->files = af = xmalloc((nfiles ? nfiles : 1) * sizeof(*al->files));
+    al->fileHash = htCreate(nfiles/2 + 1, 0, 0, afHashFunction, afEqual);
+
+    for (i = 0; i < al->size; i++) {
+	rpmfi fi;
+	int j;
+
+	alp = al->list + i;
+	if ((fi = alp->fi) == NULL || fi->dnl == NULL || fi->bnl == NULL)
+	    continue;
+	for (j = 0; j < (int)fi->fc; j++, af++) {
+	    (void) urlPath(fi->dnl[fi->dil[j]], &af->dn);
+	    af->bn = fi->bnl[j];
+	    htAddEntry(al->fileHash, af, alNum2Key(al, (alNum)i));
+	}
+    }
+}
+
 void rpmalMakeIndex(rpmal al)
 {
     availableIndex ai;
@@ -336,29 +442,52 @@ void rpmalMakeIndex(rpmal al)
     /* Reset size to the no. of provides added. */
     ai->size = ai->k;
     qsort(ai->index, ai->size, sizeof(*ai->index), indexcmp);
+
+    rpmalMakeFileIndex(al);
 }
 
 fnpyKey *
 rpmalAllFileSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
 {
+    struct availableFile_s needle;
+    const void ** keys = NULL;
+    int nkeys = 0;
     fnpyKey * ret = NULL;
     int found = 0;
     const char * fn;
-    size_t nfn;
+    char * dn;
+    char * bn;
     int i;
 
     if (keyp) *keyp = RPMAL_NOMATCH;
 
     if (al == NULL || (fn = rpmdsN(ds)) == NULL || *fn != '/')
 	goto exit;
-    nfn = strlen(fn);
 
-    if (al->list != NULL)	/* XXX always true */
-    for (i = 0; i < al->size; i++) {
-	availablePackage alp = al->list + i;
+    /* XXX rpmalDel() discards the index, rebuild it on demand. */
+    if (al->fileHash == NULL)
+	rpmalMakeFileIndex(al);
+    if (al->fileHash == NULL || al->list == NULL)
+	goto exit;
+
+    /* Split the path as in the header (the dirname keeps its '/'). */
+    dn = strcpy(alloca(strlen(fn) + 1), fn);
+    bn = strrchr(dn, '/') + 1;
+    needle.bn = fn + (bn - dn);
+    *bn = '\0';
+    needle.dn = dn;
+
+    if (htGetEntry(al->fileHash, &needle, &keys, &nkeys, NULL))
+	goto exit;
+
+    for (i = 0; i < nkeys; i++) {
+	alKey pkgKey = (alKey) keys[i];
+	availablePackage alp;
 
-	if (!rpmbfChk(alp->bf, fn, nfn))
+	/* Skip paths listed more than once in the same package. */
+	if (i > 0 && pkgKey == (alKey) keys[i-1])
 	    continue;
+	alp = al->list + alKey2Num(al, pkgKey);
 
 	rpmdsNotify(ds, _("(added files)"), 0);
 
@@ -366,7 +495,7 @@ rpmalAllFileSatisfiesDepend(const rpmal al, const rpmds ds, alKey * keyp)
 	if (ret)	/* can't happen */
 	    ret[found] = alp->key;
 	if (keyp)
-	    *keyp = alNum2Key(al, i);
+	    *keyp = pkgKey;
 	found++;
     }
 
@@ -665,6 +665,7 @@ struct rpmQVKArguments_s {
 		- 'R'	from --resign
 		*/
     char qva_char;		/*!< (unused) always ' ' */
+    int qva_jobs;		/*!< No. of file verify threads (--jobs). */
 
     /* install/erase mode arguments */
     rpmdepFlags depFlags;
@@ -175,6 +175,7 @@ static void rpmdsFini(void * _ds)
     ds->Color = _free(ds->Color);
     ds->Refs = _free(ds->Refs);
     ds->Result = _free(ds->Result);
+    ds->EVRid = _free(ds->EVRid);
     ds->exclude = mireFreeAll(ds->exclude, ds->nexclude);
     ds->include = mireFreeAll(ds->include, ds->ninclude);
 }
@@ -1090,6 +1091,8 @@ assert(ods->Flags != NULL);
 	ds->i = -1;
 	ds->Count++;
 
+	/* Interned EVR ids are re-gathered lazily. */
+	ds->EVRid = _free(ds->EVRid);
     }
 /*@-nullderef@*/
 ods->i = save;
@@ -4004,19 +4007,46 @@ assert(evr_tuple_order != NULL && evr_tuple_order[0] != '\0');
 /*@=freshtrans@*/
 }
 
+/**
+ * Return the parsed EVR of the current dependency, interning on first use.
+ * @param ds		dependency set
+ * @param evr		EVR container to parse into if not interned
+ * @return		parsed EVR (shared if interned)
+ */
+static EVR_t rpmdsEVRparsed(rpmds ds, EVR_t evr)
+	/*@globals internalState @*/
+	/*@modifies ds, evr, internalState @*/
+{
+    const char * EVR = ds->EVR[ds->i];
+
+    /* Only the default parser is interned. */
+    if (ds->EVRparse == NULL) {
+	rpmuint32_t id;
+	if (ds->EVRid == NULL)		/* XXX lazy malloc */
+	    ds->EVRid = xcalloc(ds->Count, sizeof(*ds->EVRid));
+	if ((id = ds->EVRid[ds->i]) == 0)
+	    id = ds->EVRid[ds->i] = rpmEVRintern(EVR);
+	if (id != 0)
+	    return rpmEVRlookup(id);
+    }
+    (void) (ds->EVRparse ? ds->EVRparse : rpmEVRparse) (EVR, evr);
+    return evr;
+}
+
 int rpmdsCompare(const rpmds A, const rpmds B)
 {
-    const char *aDepend = (A->DNEVR != NULL ? xstrdup(A->DNEVR+2) : "");
-    const char *bDepend = (B->DNEVR != NULL ? xstrdup(B->DNEVR+2) : "");
-    EVR_t a = memset(alloca(sizeof(*a)), 0, sizeof(*a));
-    EVR_t b = memset(alloca(sizeof(*a)), 0, sizeof(*a));
+    const char *aDepend = (A->DNEVR != NULL ? A->DNEVR+2 : "");
+    const char *bDepend = (B->DNEVR != NULL ? B->DNEVR+2 : "");
+    EVR_t aevr = memset(alloca(sizeof(*aevr)), 0, sizeof(*aevr));
+    EVR_t bevr = memset(alloca(sizeof(*bevr)), 0, sizeof(*bevr));
+    EVR_t a;
+    EVR_t b;
     evrFlags aFlags = A->ns.Flags;
     evrFlags bFlags = B->ns.Flags;
     int (*EVRcmp) (const char *a, const char *b);
     int result = 1;
     const char * s;
     int sense;
-    int xx;
 
 assert((rpmdsFlags(A) & RPMSENSE_SENSEMASK) == A->ns.Flags);
 assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
@@ -4040,8 +4070,8 @@ assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
 	goto exit;
 
     /* Both AEVR and BEVR exist. */
-    xx = (A->EVRparse ? A->EVRparse : rpmEVRparse) (A->EVR[A->i], a);
-    xx = (B->EVRparse ? B->EVRparse : rpmEVRparse) (B->EVR[B->i], b);
+    a = rpmdsEVRparsed(A, aevr);
+    b = rpmdsEVRparsed(B, bevr);
 
     /* If EVRcmp is identical, use that, otherwise use default. */
     EVRcmp = (A->EVRcmp && B->EVRcmp && A->EVRcmp == B->EVRcmp)
@@ -4089,8 +4119,8 @@ assert((rpmdsFlags(B) & RPMSENSE_SENSEMASK) == B->ns.Flags);
 	    break;
     }
 
-    a->str = _free(a->str);
-    b->str = _free(b->str);
+    aevr->str = _free(aevr->str);
+    bevr->str = _free(bevr->str);
 
     /* Detect overlap of {A,B} range. */
     if (aFlags == RPMSENSE_NOTEQUAL || bFlags == RPMSENSE_NOTEQUAL) {
@@ -4112,8 +4142,6 @@ exit:
     if (_noisy_range_comparison_debug_message)
     rpmlog(RPMLOG_DEBUG, D_("  %s    A %s\tB %s\n"),
 	(result ? _("YES") : _("NO ")), aDepend, bDepend);
-    aDepend = _free(aDepend);
-    bDepend = _free(bDepend);
     return result;
 }
 
@@ -56,6 +56,8 @@ struct rpmds_s {
     rpmuint32_t * Refs;		/*!< No. of file refs. */
 /*@only@*/ /*@null@*/
     rpmint32_t * Result;	/*!< Dependency check result. */
+/*@only@*/ /*@null@*/
+    rpmuint32_t * EVRid;	/*!< Interned EVR ids (0 if not yet interned). */
 /*@null@*/
     int (*EVRparse) (const char *evrstr, EVR_t evr);	 /* EVR parsing. */
     int (*EVRcmp) (const char *a, const char *b);	 /* EVR comparison. */
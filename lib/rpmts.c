@@ -99,8 +99,13 @@ int rpmtsCloseDB(rpmts ts)
 	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBGET), &ts->rdb->db_getops);
 	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBPUT), &ts->rdb->db_putops);
 	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBDEL), &ts->rdb->db_delops);
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBHDRHIT), &ts->rdb->db_hdrhits);
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBHDRMISS), &ts->rdb->db_hdrmisses);
+	(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_LIOFLUSH), &ts->rdb->db_lioflushes);
 	rc = rpmdbClose(ts->rdb);
 	ts->rdb = NULL;
+	/* Memoized results are stamped with this rpmdb's generation. */
+	ts->depcache = htFree(ts->depcache);
     }
     return rc;
 }
@@ -231,6 +236,9 @@ int rpmtsCloseSDB(rpmts ts)
 		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBGET), &sdb->db_getops);
 		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBPUT), &sdb->db_putops);
 		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBDEL), &sdb->db_delops);
+		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBHDRHIT), &sdb->db_hdrhits);
+		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_DBHDRMISS), &sdb->db_hdrmisses);
+		(void) rpmswAdd(rpmtsOp(ts, RPMTS_OP_LIOFLUSH), &sdb->db_lioflushes);
 		xx = rpmdbClose(sdb);
 		if (xx && rc == 0)
 		    rc = xx;
@@ -639,6 +647,7 @@ void rpmtsEmpty(rpmts ts)
     ts->maxDepth = 0;
 
     ts->numRemovedPackages = 0;
+    ts->depcache = htFree(ts->depcache);
 /*@-nullstate@*/	/* FIX: partial annotations */
     return;
 /*@=nullstate@*/
@@ -692,6 +701,13 @@ static void rpmtsPrintStats(rpmts ts)
     rpmtsPrintStat("readhdr:     ", rpmtsOp(ts, RPMTS_OP_READHDR));
     rpmtsPrintStat("hdrload:     ", rpmtsOp(ts, RPMTS_OP_HDRLOAD));
     rpmtsPrintStat("hdrget:      ", rpmtsOp(ts, RPMTS_OP_HDRGET));
+    rpmtsPrintStat("dbhdrhit:    ", rpmtsOp(ts, RPMTS_OP_DBHDRHIT));
+    rpmtsPrintStat("dbhdrmiss:   ", rpmtsOp(ts, RPMTS_OP_DBHDRMISS));
+    rpmtsPrintStat("lioflush:    ", rpmtsOp(ts, RPMTS_OP_LIOFLUSH));
+    rpmtsPrintStat("luacompile:  ", rpmtsOp(ts, RPMTS_OP_LUACOMPILE));
+    rpmtsPrintStat("luaexec:     ", rpmtsOp(ts, RPMTS_OP_LUAEXEC));
+    rpmtsPrintStat("depcachehit: ", rpmtsOp(ts, RPMTS_OP_DEPCACHEHIT));
+    rpmtsPrintStat("depcachemiss:", rpmtsOp(ts, RPMTS_OP_DEPCACHEMISS));
 /*@-globstate@*/
     return;
 /*@=globstate@*/
@@ -730,6 +746,8 @@ assert(ts->txn == NULL);	/* XXX FIXME */
 
     ts->dsi = _free(ts->dsi);
 
+    ts->arena = rpmioFreeArena(ts->arena);
+
     if (ts->scriptFd != NULL) {
 /*@-refcounttrans@*/	/* FIX: XfdFree annotation */
 	ts->scriptFd = fdFree(ts->scriptFd, __FUNCTION__);
@@ -1481,6 +1499,7 @@ rpmts rpmtsCreate(void)
     ts->rdb = NULL;
     ts->dbmode = O_RDONLY;
     ts->txn = NULL;
+    ts->arena = rpmioNewArena("ts", 0);
 
     ts->scriptFd = NULL;
     {	struct timeval tv;
@@ -1500,6 +1519,10 @@ rpmts rpmtsCreate(void)
     ts->removedPackages = xcalloc(ts->allocedRemovedPackages,
 			sizeof(*ts->removedPackages));
 
+    ts->depcache = NULL;
+    ts->depcacheStamp = 0;
+    ts->depcacheNRemoved = 0;
+
     ts->rootDir = NULL;
     ts->currDir = NULL;
     ts->chrootDone = 0;
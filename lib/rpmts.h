@@ -135,8 +135,15 @@ typedef	enum rpmtsOpX_e {
     RPMTS_OP_READHDR		= 17,
     RPMTS_OP_HDRLOAD		= 18,
     RPMTS_OP_HDRGET		= 19,
-    RPMTS_OP_DEBUG		= 20,
-    RPMTS_OP_MAX		= 20
+    RPMTS_OP_DBHDRHIT		= 20,
+    RPMTS_OP_DBHDRMISS		= 21,
+    RPMTS_OP_LIOFLUSH		= 22,
+    RPMTS_OP_LUACOMPILE		= 23,
+    RPMTS_OP_LUAEXEC		= 24,
+    RPMTS_OP_DEPCACHEHIT	= 25,
+    RPMTS_OP_DEPCACHEMISS	= 26,
+    RPMTS_OP_DEBUG		= 27,
+    RPMTS_OP_MAX		= 27
 } rpmtsOpX;
 
 /** \ingroup rpmts
@@ -248,6 +255,12 @@ struct rpmts_s {
     int dbmode;			/*!< Install database open mode. */
 /*@only@*/
     hashTable ht;		/*!< Fingerprint hash table. */
+/*@only@*/ /*@null@*/
+    hashTable depcache;		/*!< Dependency result memo. */
+    rpmuint32_t depcacheStamp;	/*!< rpmdb generation of memo results. */
+    int depcacheNRemoved;	/*!< No. removed packages of memo results. */
+/*@only@*/ /*@null@*/
+    rpmioArena arena;		/*!< Transaction lifetime allocations. */
 /*@null@*/
     rpmtxn txn;			/*!< Transaction set transaction pointer. */
 
@@ -37,11 +37,12 @@
 #include "rpmds.h"
 
 #include "rpmlock.h"
+#include <rpmlua.h>
 
 #include "misc.h" /* XXX currentDirectory */
 
 #if defined(RPM_VENDOR_MANDRIVA)
-#include "filetriggers.h" /* XXX mayAddToFilesAwaitingFiletriggers, rpmRunFileTriggers */
+#include "filetriggers.h" /* XXX mayAddToFilesAwaitingFiletriggers, rpmRunFileTriggers, saveFilesAwaitingFiletriggers */
 #endif
 
 #include <rpmcli.h>	/* XXX QVA_t INSTALL_FOO flags */
@@ -1299,7 +1300,7 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%u,%p,%p)\n", __FUNCTION__, ts, (unsigned)fileCo
 		htAddEntry(symlinks, rpmfiFpsIndex(fi, i), ffi);
 	    }
 #else
-	    {	struct rpmffi_s *ffip = alloca(sizeof(*ffip));
+	    {	struct rpmffi_s *ffip = rpmioArenaAlloc(ts->arena, sizeof(*ffip));
 /*@-dependenttrans@*/
 		ffip->p = p;
 /*@=dependenttrans@*/
@@ -1430,6 +1431,7 @@ FPSDEBUG(0, (stderr, "--> %s(%p,%p)\n", __FUNCTION__, ts, sx));
 #else	/* REFERENCE */
     if (sx != NULL) sx = rpmsxFree(sx);
 #endif	/* REFERENCE */
+    rpmioResetArena(ts->arena);
     return 0;
 }
 
@@ -1515,7 +1517,8 @@ rpmlog(RPMLOG_DEBUG, D_("computing %u file fingerprints\n"), (unsigned)fileCount
 	    /*@switchbreak@*/ break;
 	}
 
-	fi->fps = (fc > 0 ? xmalloc(fc * sizeof(*fi->fps)) : NULL);
+	fi->fps = (fc > 0
+		? rpmioArenaAlloc(ts->arena, fc * sizeof(*fi->fps)) : NULL);
     }
     pi = rpmtsiFree(pi);
 
@@ -1540,8 +1543,10 @@ rpmlog(RPMLOG_DEBUG, D_("computing %u file fingerprints\n"), (unsigned)fileCount
 	(void) rpmtsSetChrootDone(ts, 1);
     }
 
-    ts->ht = htCreate(fileCount/2 + 1, 0, 1, fpHashFunction, fpEqual);
+    /* File info and fingerprint sub-directories live in ts->arena. */
+    ts->ht = htCreate(fileCount/2 + 1, 0, 0, fpHashFunction, fpEqual);
     fpc = fpCacheCreate(fileCount/2 + 10001);
+    fpc->arena = ts->arena;
 
 #endif	/* REFERENCE */
 
@@ -1627,23 +1632,21 @@ rpmlog(RPMLOG_DEBUG, D_("computing %u file fingerprints\n"), (unsigned)fileCount
 	rpmteSetFI(p, NULL);
     }
     pi = rpmtsiFree(pi);
+#endif	/* REFERENCE */
+
+exit:
+#ifdef	REFERENCE
+    ht = rpmFpHashFree(ht);
 #else	/* REFERENCE */
+    /* Fingerprints are released with ts->arena in rpmtsFinish(). */
     pi = rpmtsiInit(ts);
     while ((p = rpmtsiNext(pi, 0)) != NULL) {
 	if (p->isSource) continue;
 	if ((fi = rpmtsiFi(pi)) == NULL)
 	    continue;	/* XXX can't happen */
-	if (rpmfiFC(fi) == 0)
-	    continue;
-	fi->fps = _free(fi->fps);
+	fi->fps = NULL;
     }
     pi = rpmtsiFree(pi);
-#endif	/* REFERENCE */
-
-exit:
-#ifdef	REFERENCE
-    ht = rpmFpHashFree(ht);
-#else	/* REFERENCE */
     ts->ht = htFree(ts->ht);
 #endif	/* REFERENCE */
     fpc = fpCacheFree(fpc);
@@ -2106,6 +2109,12 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
     ps = rpmtsSanityCheck(ts, &totalFileCount);
     ps = rpmpsFree(ps);
 
+#if defined(WITH_LUA)
+    /* Optionally start the transaction with a fresh Lua interpreter. */
+    if (rpmExpandNumeric("%{?_rpmlua_transaction_state}"))
+	(void) rpmluaFree(NULL);
+#endif
+
     /* ===============================================
      * Run pre-transaction scripts, but only if no known problems exist.
      */
@@ -2134,7 +2143,7 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
        )
     {
 	lock = rpmtsFreeLock(lock);
-	if (sx != NULL) sx = rpmsxFree(sx);
+	xx = rpmtsFinish(ts, sx);
 	return ts->orderCount;
     }
 
@@ -2154,6 +2163,12 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
      */
     ourrc = rpmtsProcess(ts, ignoreSet, rollbackFailures);
 
+    /* ===============================================
+     * Run coalesced %post/%postun invocations, once each.
+     */
+    if (rpmpsmRunDeferred(ts) != RPMRC_OK)
+	ourrc++;
+
     /* ===============================================
      * Run post-transaction scripts unless disabled.
      */
@@ -2170,6 +2185,11 @@ fprintf(stderr, "--> %s(%p,%p,0x%x) tsFlags 0x%x\n", __FUNCTION__, ts, okProbs,
 	xx = rpmtsRunScript(ts, RPMTAG_POSTTRANS);
     }
 
+#if defined(RPM_VENDOR_MANDRIVA)
+    /* Keep files awaiting filetriggers that weren't run for next time. */
+    xx = saveFilesAwaitingFiletriggers();
+#endif
+
 exit:
     xx = rpmtsFinish(ts, sx);
 
@@ -9,6 +9,9 @@
 #include <rpmio.h>
 #include <rpmcb.h>
 #include "ugid.h"
+#if defined(WITH_PTHREADS)
+#include <yarn.h>
+#endif
 
 #include <rpmtypes.h>
 #include <rpmtag.h>
@@ -50,6 +53,13 @@ struct rpmvf_s {
     const unsigned char * digest;
     const char * fuser;
     const char * fgroup;
+    struct stat  dsb;		/*!< On-disk file stat(2) data. */
+    rpmVerifyAttrs res;		/*!< Verify failures. */
+    int ec;			/*!< Did Lstat(2) fail? */
+    int err;			/*!< Lstat(2) errno. */
+    int done;			/*!< Has the file been checked? */
+/*@null@*/ /*@dependent@*/
+    rpmvf next;			/*!< Next file in the verify queue. */
 #if defined(__LCLINT__NOTYET)
 /*@refs@*/
     int nrefs;			/*!< (unused) keep splint happy */
@@ -138,12 +148,12 @@ static rpmvf rpmvfNew(rpmts ts, rpmfi fi, int i, rpmVerifyAttrs omitMask)
 }
 
 /** \ingroup rpmcli
- * Verify file attributes (including file digest).
+ * Check on-disk file attributes (including file digest).
+ * Owner and group are checked by rpmvfReport(), the name caches used to
+ * compare them are not thread safe.
  * @param vf		file data to verify
- * #param spew		should verify results be printed?
- * @return		0 on success (or not installed), 1 on error
  */
-static int rpmvfVerify(rpmvf vf, int spew)
+static void rpmvfCheck(rpmvf vf)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies vf, fileSystem, internalState @*/
 {
@@ -151,6 +161,9 @@ static int rpmvfVerify(rpmvf vf, int spew)
     struct stat sb;
     int ec = 0;
 
+    memset(&sb, 0, sizeof(sb));
+    vf->err = 0;
+
     /* Check to see if the file was installed - if not pretend all is OK. */
     switch (vf->fstate) {
     default:
@@ -166,6 +179,7 @@ static int rpmvfVerify(rpmvf vf, int spew)
 
 assert(vf->fn != NULL);
     if (vf->fn == NULL || Lstat(vf->fn, &sb) != 0) {
+	vf->err = errno;
 	res |= RPMVERIFY_LSTATFAIL;
 	ec = 1;
 	goto exit;
@@ -264,19 +278,38 @@ assert(vf->fn != NULL);
 	    res |= RPMVERIFY_MTIME;
     }
 
-    if (vf->vflags & RPMVERIFY_USER) {
-	const char * fuser = uidToUname(sb.st_uid);
-	if (fuser == NULL || vf->fuser == NULL || strcmp(fuser, vf->fuser))
-	    res |= RPMVERIFY_USER;
-    }
+exit:
+    memcpy(&vf->dsb, &sb, sizeof(vf->dsb));
+    vf->res = res;
+    vf->ec = ec;
+}
 
-    if (vf->vflags & RPMVERIFY_GROUP) {
-	const char * fgroup = gidToGname(sb.st_gid);
-	if (fgroup == NULL || vf->fgroup == NULL || strcmp(fgroup, vf->fgroup))
-	    res |= RPMVERIFY_GROUP;
-    }
+/** \ingroup rpmcli
+ * Finish verifying file attributes checked by rpmvfCheck().
+ * @param vf		file data to verify
+ * #param spew		should verify results be printed?
+ * @return		0 on success (or not installed), 1 on error
+ */
+static int rpmvfReport(rpmvf vf, int spew)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies vf, fileSystem, internalState @*/
+{
+    rpmVerifyAttrs res = vf->res;
+    int ec = vf->ec;
+
+    if (vf->fstate == RPMFILE_STATE_NORMAL && !ec) {
+	if (vf->vflags & RPMVERIFY_USER) {
+	    const char * fuser = uidToUname(vf->dsb.st_uid);
+	    if (fuser == NULL || vf->fuser == NULL || strcmp(fuser, vf->fuser))
+		res |= RPMVERIFY_USER;
+	}
 
-exit:
+	if (vf->vflags & RPMVERIFY_GROUP) {
+	    const char * fgroup = gidToGname(vf->dsb.st_gid);
+	    if (fgroup == NULL || vf->fgroup == NULL || strcmp(fgroup, vf->fgroup))
+		res |= RPMVERIFY_GROUP;
+	}
+    }
 
     if (spew) {	/* XXX no output w verify(...) probe. */
 	char buf[BUFSIZ];
@@ -295,9 +328,9 @@ exit:
 			 (vf->fflags & RPMFILE_PUBKEY)	? 'P' :
 			 (vf->fflags & RPMFILE_README)	? 'r' : ' '),
 			vf->fn);
-                if ((res & RPMVERIFY_LSTATFAIL) != 0 && errno != ENOENT) {
+                if ((res & RPMVERIFY_LSTATFAIL) != 0 && vf->err != ENOENT) {
 		    te += strlen(te);
-                    sprintf(te, " (%s)", strerror(errno));
+                    sprintf(te, " (%s)", strerror(vf->err));
                 }
 	    }
 	} else if (res || rpmIsVerbose()) {
@@ -479,15 +512,111 @@ assert(altNEVR != NULL);
     return rc;
 }
 
-int showVerifyPackage(QVA_t qva, rpmts ts, Header h)
+typedef struct rpmvp_s * rpmvp;
+
+/**
+ * Package being verified, with the files to check.
+ */
+struct rpmvp_s {
+/*@null@*/
+    rpmvp next;			/*!< Next package in iterator order. */
+/*@refcounted@*/
+    Header h;
+/*@refcounted@*/
+    rpmfi fi;
+/*@only@*/ /*@null@*/
+    rpmvf * vfs;		/*!< Files to verify (NULL if skipped). */
+    int nvfs;
+    int nfiles;			/*!< No. of files to verify. */
+};
+
+/**
+ * Gather the package files to verify.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param h		header
+ * @return		new package carrier
+ */
+/*@only@*/
+static rpmvp rpmvpNew(QVA_t qva, rpmts ts, Header h)
+	/*@*/
 {
     static int scareMem = 0;
     rpmVerifyAttrs omitMask = ((qva->qva_flags & VERIFY_ATTRS) ^ VERIFY_ATTRS);
+    rpmvp vp = xcalloc(1, sizeof(*vp));
+    int i;
+
+    vp->h = headerLink(h);
+    vp->fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, scareMem);
+    vp->nvfs = rpmfiFC(vp->fi);
+
+    /* Verify file digests. */
+    if (vp->nvfs > 0 && (qva->qva_flags & VERIFY_FILES))
+    for (i = 0; i < vp->nvfs; i++) {
+	int fflags = vp->fi->fflags[i];
+
+	/* If not querying %config, skip config files. */
+	if ((qva->qva_fflags & RPMFILE_CONFIG) && (fflags & RPMFILE_CONFIG))
+	    continue;
+
+	/* If not querying %doc, skip doc files. */
+	if ((qva->qva_fflags & RPMFILE_DOC) && (fflags & RPMFILE_DOC))
+	    continue;
+
+	/* If not verifying %ghost, skip ghost files. */
+	/* XXX the broken!!! logic disables %ghost queries always. */
+	if (!(qva->qva_fflags & RPMFILE_GHOST) && (fflags & RPMFILE_GHOST))
+	    continue;
+
+	/* Gather per-file data into a carrier. */
+	if (vp->vfs == NULL)
+	    vp->vfs = xcalloc(vp->nvfs, sizeof(*vp->vfs));
+	vp->vfs[i] = rpmvfNew(ts, vp->fi, i, omitMask);
+	vp->nfiles++;
+    }
+
+    return vp;
+}
+
+/**
+ * Destroy a package carrier.
+ * @param vp		package carrier
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmvp rpmvpFree(/*@only@*/ rpmvp vp)
+	/*@modifies vp @*/
+{
+    int i;
+
+    if (vp->vfs != NULL)
+    for (i = 0; i < vp->nvfs; i++)
+	vp->vfs[i] = rpmvfFree(vp->vfs[i]);
+    vp->vfs = _free(vp->vfs);
+    vp->fi = rpmfiFree(vp->fi);
+    (void)headerFree(vp->h);
+    vp->h = NULL;
+    vp = _free(vp);
+    return NULL;
+}
+
+/**
+ * Verify (and report on) a package, checking any files not yet checked.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @param vp		package carrier (freed)
+ * @return		0 on success
+ */
+static int rpmvpVerify(QVA_t qva, rpmts ts, /*@only@*/ rpmvp vp)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies qva, ts, vp, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+    Header h = vp->h;
+    rpmfi fi = vp->fi;
     int spew = (qva->qva_mode != 'v');	/* XXX no output w verify(...) probe. */
     int ec = 0;
     int i;
-rpmfi fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, scareMem);
-uint32_t fc = rpmfiFC(fi);
 
   {
     /* Verify header digest/signature. */
@@ -506,39 +635,21 @@ uint32_t fc = rpmfiFC(fi);
 	msg = _free(msg);
     }
 
-    /* Verify file digests. */
-    if (fc > 0 && (qva->qva_flags & VERIFY_FILES))
-#if defined(_OPENMP)
-    #pragma omp parallel for private(i) reduction(+:ec)
-#endif
-    for (i = 0; i < (int)fc; i++) {
-	int fflags = fi->fflags[i];
-	rpmvf vf;
+    /* Verify per-file metadata. */
+    if (vp->vfs != NULL)
+    for (i = 0; i < vp->nvfs; i++) {
+	rpmvf vf = vp->vfs[i];
 	int rc;
 
-	/* If not querying %config, skip config files. */
-	if ((qva->qva_fflags & RPMFILE_CONFIG) && (fflags & RPMFILE_CONFIG))
-	    continue;
-
-	/* If not querying %doc, skip doc files. */
-	if ((qva->qva_fflags & RPMFILE_DOC) && (fflags & RPMFILE_DOC))
-	    continue;
-
-	/* If not verifying %ghost, skip ghost files. */
-	/* XXX the broken!!! logic disables %ghost queries always. */
-	if (!(qva->qva_fflags & RPMFILE_GHOST) && (fflags & RPMFILE_GHOST))
+	if (vf == NULL)
 	    continue;
-
-	/* Gather per-file data into a carrier. */
-	vf = rpmvfNew(ts, fi, i, omitMask);
-
-	/* Verify per-file metadata. */
-	rc = rpmvfVerify(vf, spew);
+	if (!vf->done) {
+	    rpmvfCheck(vf);
+	    vf->done = 1;
+	}
+	rc = rpmvfReport(vf, spew);
 	if (rc)
 	    ec += rc;
-
-	(void) rpmvfFree(vf);
-	vf = NULL;
     }
 
     /* Run verify/sanity scripts (if any). */
@@ -576,11 +687,268 @@ uint32_t fc = rpmfiFC(fi);
     }
   }
 
-    fi = rpmfiFree(fi);
+    vp = rpmvpFree(vp);
 
     return ec;
 }
 
+#if defined(WITH_PTHREADS)
+/*
+ * Cross-package verify pipeline (enabled with --jobs N):
+ *
+ *	producer:  rpmcliArgIter() walks rpmmiNext(), showVerifyPackage()
+ *		   queues the files of each package.
+ *	workers:   N threads stat and digest distinct files concurrently,
+ *		   hinting the kernel to read ahead the next queued files.
+ *	collector: the main thread reports on each package in iterator
+ *		   order, once all of its files have been checked.
+ *
+ * Messages logged by a worker (e.g. digest read failures) go straight
+ * to rpmlog(), whose saved message store is locked for this.
+ *
+ * All pipeline state is protected by a single yarn lock, whose value is
+ * bumped on every change so that waiters can sleep until something moves.
+ */
+#define	RPMVP_NFILES	64	/* max. queued files per thread */
+#define	RPMVP_NAHEAD	4	/* max. files read ahead per thread */
+
+typedef struct rpmvpipe_s * rpmvpipe;
+
+/**
+ * Cross-package verify pipeline.
+ */
+struct rpmvpipe_s {
+    yarnLock lock;		/*!< Pipeline state (bumped on change). */
+/*@dependent@*/
+    QVA_t qva;
+/*@dependent@*/
+    rpmts ts;
+    int nthreads;
+    yarnThread * threads;	/*!< Worker threads. */
+/*@null@*/
+    rpmvp pkgs;			/*!< Unreported packages in iterator order. */
+    rpmvp * ptail;
+    unsigned nfiles;		/*!< No. of files in unreported packages. */
+/*@null@*/ /*@dependent@*/
+    rpmvf todo;			/*!< Files waiting for a worker. */
+    rpmvf * qtail;
+/*@null@*/ /*@dependent@*/
+    rpmvf ahead;		/*!< 1st queued file not read ahead. */
+    unsigned nahead;		/*!< No. of queued files read ahead. */
+    int stop;			/*!< Are the threads to exit? */
+};
+
+/*@only@*/ /*@null@*/ /*@unchecked@*/
+static rpmvpipe _rpmvpipe = NULL;
+
+/**
+ * Hint the kernel to read ahead a file whose digest will be checked.
+ * @param fn		file name
+ */
+static void rpmvpipeReadAhead(const char * fn)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+#if defined(POSIX_FADV_WILLNEED)
+    FD_t fd = Fopen(fn, "r.fdio");
+    if (fd != NULL && !Ferror(fd))
+	(void) Fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    if (fd != NULL)
+	(void) Fclose(fd);
+#endif
+}
+
+/**
+ * Worker thread: check queued files until stopped.
+ * @param _vpipe	verify pipeline
+ */
+static void rpmvpipeWorker(void * _vpipe)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies _vpipe, h_errno, fileSystem, internalState @*/
+{
+    rpmvpipe vpipe = _vpipe;
+
+    for (;;) {
+	const char * fns[RPMVP_NAHEAD];
+	int nfns = 0;
+	rpmvf vf;
+
+	yarnPossess(vpipe->lock);
+	while (!vpipe->stop && vpipe->todo == NULL)
+	    yarnWaitFor(vpipe->lock, NOT_TO_BE, yarnPeekLock(vpipe->lock));
+	if ((vf = vpipe->todo) == NULL) {
+	    yarnRelease(vpipe->lock);
+	    break;
+	}
+	if ((vpipe->todo = vf->next) == NULL)
+	    vpipe->qtail = &vpipe->todo;
+
+	/* Files before vpipe->ahead have been read ahead. */
+	if (vpipe->ahead == vf)
+	    vpipe->ahead = vf->next;
+	else if (vpipe->nahead > 0)
+	    vpipe->nahead--;
+	while (vpipe->ahead != NULL
+	    && vpipe->nahead < RPMVP_NAHEAD * (unsigned) vpipe->nthreads
+	    && nfns < RPMVP_NAHEAD)
+	{
+	    rpmvf avf = vpipe->ahead;
+	    if (avf->fstate == RPMFILE_STATE_NORMAL && S_ISREG(avf->sb.st_mode)
+	     && (avf->vflags & (RPMVERIFY_FDIGEST | RPMVERIFY_HMAC)))
+		fns[nfns++] = xstrdup(avf->fn);
+	    vpipe->ahead = avf->next;
+	    vpipe->nahead++;
+	}
+	yarnRelease(vpipe->lock);
+
+	while (nfns > 0) {
+	    rpmvpipeReadAhead(fns[--nfns]);
+	    fns[nfns] = _free(fns[nfns]);
+	}
+
+	rpmvfCheck(vf);
+
+	yarnPossess(vpipe->lock);
+	vf->done = 1;
+	yarnTwist(vpipe->lock, BY, 1);
+    }
+}
+
+/**
+ * Report on packages in iterator order until at most maxfiles are queued.
+ * @param vpipe		verify pipeline
+ * @param maxfiles	max. no. of files left queued
+ * @return		0 on success
+ */
+static int rpmvpipeCollect(rpmvpipe vpipe, unsigned maxfiles)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies vpipe, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+    int ec = 0;
+
+    yarnPossess(vpipe->lock);
+    while (vpipe->pkgs != NULL && vpipe->nfiles > maxfiles) {
+	rpmvp vp = vpipe->pkgs;
+	int i;
+
+	if (vp->vfs != NULL)
+	for (i = 0; i < vp->nvfs; i++) {
+	    rpmvf vf = vp->vfs[i];
+	    while (vf != NULL && !vf->done)
+		yarnWaitFor(vpipe->lock, NOT_TO_BE, yarnPeekLock(vpipe->lock));
+	}
+	if ((vpipe->pkgs = vp->next) == NULL)
+	    vpipe->ptail = &vpipe->pkgs;
+	vpipe->nfiles -= vp->nfiles;
+	yarnRelease(vpipe->lock);
+
+	ec += rpmvpVerify(vpipe->qva, vpipe->ts, vp);
+
+	yarnPossess(vpipe->lock);
+    }
+    yarnRelease(vpipe->lock);
+    return ec;
+}
+
+/**
+ * Queue the files of a package, reporting on the oldest packages.
+ * @param vpipe		verify pipeline
+ * @param vp		package carrier
+ * @return		0 on success
+ */
+static int rpmvpipeQueue(rpmvpipe vpipe, /*@only@*/ rpmvp vp)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies vpipe, vp, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+    int i;
+
+    yarnPossess(vpipe->lock);
+    *vpipe->ptail = vp;
+    vpipe->ptail = &vp->next;
+    vpipe->nfiles += vp->nfiles;
+    if (vp->vfs != NULL)
+    for (i = 0; i < vp->nvfs; i++) {
+	rpmvf vf = vp->vfs[i];
+	if (vf == NULL)
+	    continue;
+	*vpipe->qtail = vf;
+	vpipe->qtail = &vf->next;
+	if (vpipe->ahead == NULL)
+	    vpipe->ahead = vf;
+    }
+    yarnTwist(vpipe->lock, BY, 1);
+
+    return rpmvpipeCollect(vpipe, RPMVP_NFILES * vpipe->nthreads);
+}
+
+/**
+ * Create a verify pipeline, launching the worker threads.
+ * @param qva		parsed query/verify options
+ * @param ts		transaction set
+ * @return		new verify pipeline
+ */
+static rpmvpipe rpmvpipeNew(QVA_t qva, rpmts ts)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    rpmvpipe vpipe = xcalloc(1, sizeof(*vpipe));
+    int i;
+
+    vpipe->lock = yarnNewLock(0);
+    vpipe->qva = qva;
+    vpipe->ts = ts;
+    vpipe->nthreads = qva->qva_jobs;
+    vpipe->ptail = &vpipe->pkgs;
+    vpipe->qtail = &vpipe->todo;
+    vpipe->threads = xcalloc(vpipe->nthreads, sizeof(*vpipe->threads));
+    for (i = 0; i < vpipe->nthreads; i++)
+	vpipe->threads[i] = yarnLaunch(rpmvpipeWorker, vpipe);
+    return vpipe;
+}
+
+/**
+ * Report on all queued packages, then destroy the verify pipeline.
+ * @param vpipe		verify pipeline
+ * @retval *ecp		sum of package verify failures
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmvpipe rpmvpipeFree(/*@only@*/ rpmvpipe vpipe, int * ecp)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies vpipe, *ecp, rpmGlobalMacroContext,
+		fileSystem, internalState @*/
+{
+    int i;
+
+    *ecp = rpmvpipeCollect(vpipe, 0);
+
+    yarnPossess(vpipe->lock);
+    vpipe->stop = 1;
+    yarnTwist(vpipe->lock, BY, 1);
+    for (i = 0; i < vpipe->nthreads; i++)
+	vpipe->threads[i] = yarnJoin(vpipe->threads[i]);
+    vpipe->threads = _free(vpipe->threads);
+    vpipe->lock = yarnFreeLock(vpipe->lock);
+    vpipe = _free(vpipe);
+    return NULL;
+}
+#endif	/* WITH_PTHREADS */
+
+int showVerifyPackage(QVA_t qva, rpmts ts, Header h)
+{
+    rpmvp vp = rpmvpNew(qva, ts, h);
+
+#if defined(WITH_PTHREADS)
+    /* Reports are deferred until the package files have been checked. */
+    if (_rpmvpipe != NULL && _rpmvpipe->qva == qva)
+	return rpmvpipeQueue(_rpmvpipe, vp);
+#endif
+
+    return rpmvpVerify(qva, ts, vp);
+}
+
 int rpmcliVerify(rpmts ts, QVA_t qva, const char ** argv)
 {
     rpmdepFlags depFlags = qva->depFlags, odepFlags;
@@ -588,11 +956,6 @@ int rpmcliVerify(rpmts ts, QVA_t qva, const char ** argv)
     rpmVSFlags vsflags, ovsflags;
     int ec = 0;
 
-#if defined(_OPENMP)
-(void) tagName(0);	/* XXX instantiate the tagname store. */
-omp_set_nested(1);	/* XXX permit nested thread teams. */
-#endif
-
     if (qva->qva_showPackage == NULL)
         qva->qva_showPackage = showVerifyPackage;
 
@@ -609,7 +972,18 @@ omp_set_nested(1);	/* XXX permit nested thread teams. */
     odepFlags = rpmtsSetDFlags(ts, depFlags);
     otransFlags = rpmtsSetFlags(ts, transFlags);
     ovsflags = rpmtsSetVSFlags(ts, vsflags);
+#if defined(WITH_PTHREADS)
+    if (qva->qva_jobs > 1 && _rpmvpipe == NULL)
+	_rpmvpipe = rpmvpipeNew(qva, ts);
+#endif
     ec = rpmcliArgIter(ts, qva, argv);
+#if defined(WITH_PTHREADS)
+    if (_rpmvpipe != NULL && _rpmvpipe->qva == qva) {
+	int rc = 0;
+	_rpmvpipe = rpmvpipeFree(_rpmvpipe, &rc);
+	ec += rc;
+    }
+#endif
     vsflags = rpmtsSetVSFlags(ts, ovsflags);
     transFlags = rpmtsSetFlags(ts, otransFlags);
     depFlags = rpmtsSetDFlags(ts, odepFlags);
@@ -1268,6 +1268,27 @@ DBIDEBUG(dbi, (stderr, "<-- %s(%p,%p,%p,0x%x) dbc %p %s rc %d\n", __FUNCTION__,
     return rc;
 }
 
+/**
+ * Release headers cached across secondary index callbacks.
+ * The cached headers point into Berkeley DB owned blobs (headerLazyLoad does
+ * not copy), so they are valid only while a single primary put/del runs.
+ * @param rpmdb		rpm database
+ */
+static void db3HdrCacheFlush(/*@null@*/ rpmdb rpmdb)
+	/*@modifies rpmdb @*/
+{
+    size_t i;
+
+    if (rpmdb == NULL)
+	return;
+    for (i = 0; i < sizeof(rpmdb->db_hdrcache)/sizeof(rpmdb->db_hdrcache[0]); i++) {
+	struct rpmdbHdrCache_s * hc = &rpmdb->db_hdrcache[i];
+	if (hc->h != NULL)
+	    (void) headerFree(hc->h);
+	memset(hc, 0, sizeof(*hc));
+    }
+}
+
 static int db3cput(dbiIndex dbi, DBC * dbcursor, DBT * key, DBT * data,
 		/*@unused@*/ unsigned int flags)
 	/*@globals fileSystem @*/
@@ -1292,6 +1313,8 @@ flags = DB_KEYLAST;
 	rc = cvtdberr(dbi, "dbcursor->c_put", rc, _debug);
 #endif
     }
+    if (dbi->dbi_rpmtag == RPMDBI_PACKAGES)
+	db3HdrCacheFlush(dbi->dbi_rpmdb);
 
 DBIDEBUG(dbi, (stderr, "<-- %s(%p,%p,%p,%p,0x%x) rc %d %s%s\n", __FUNCTION__, dbi, dbcursor, key, data, flags, rc, _DBCFLAGS(flags), _KEYDATA(key, NULL, data, NULL)));
     return rc;
@@ -1406,6 +1429,8 @@ assert(db != NULL);
 #endif
 	}
     }
+    if (dbi->dbi_rpmtag == RPMDBI_PACKAGES)
+	db3HdrCacheFlush(dbi->dbi_rpmdb);
 
 DBIDEBUG(dbi, (stderr, "<-- %s(%p,%p,%p,%p,0x%x) rc %d %s%s\n", __FUNCTION__, dbi, dbcursor, key, data, flags, rc, _DBCFLAGS(flags), _KEYDATA(key, NULL, data, NULL)));
     return rc;
@@ -1500,6 +1525,7 @@ assert(db != NULL);
     rc = db->associate(db, _txnid, secondary, callback, flags);
 /*@=moduncon@*/
     rc = cvtdberr(dbi, "db->associate", rc, _debug);
+    db3HdrCacheFlush(dbi->dbi_rpmdb);
 
     if (dbi->dbi_debug || dbisecondary->dbi_debug) {
     	const char * tag2 = xstrdup(tagName(dbisecondary->dbi_rpmtag));
@@ -1582,6 +1608,9 @@ static int db3close(/*@only@*/ dbiIndex dbi, /*@unused@*/ unsigned int flags)
 
     flags = 0;	/* XXX unused */
 
+    if (dbi->dbi_rpmtag == RPMDBI_PACKAGES)
+	db3HdrCacheFlush(rpmdb);
+
     /*
      * Get the prefix/root component and directory path.
      */
@@ -1736,6 +1765,54 @@ static int uint64Cmp(const void * _a, const void * _b)
 	   ((*a > *b) ?  1 : 0));
 }
 
+/**
+ * Return the decoded header for a primary record, loading it at most once
+ * for all the secondary indices associated with a single put/del.
+ * @param dbi		index database handle
+ * @param hdrNum	primary key
+ * @param data		header blob
+ * @return		new header reference (NULL on error)
+ */
+/*@null@*/
+static Header db3HdrCacheGet(dbiIndex dbi, uint32_t hdrNum, const DBT * data)
+	/*@modifies dbi @*/
+{
+    rpmdb rpmdb = dbi->dbi_rpmdb;
+    struct rpmdbHdrCache_s * hc = rpmdb->db_hdrcache;
+    rpmop op;
+    Header h;
+    size_t i;
+
+    /* XXX BDB passes old and new blobs on update: 2 slots suffice. */
+    for (i = 0; i < 2; i++) {
+	if (hc[i].h == NULL || hc[i].hdrNum != hdrNum || hc[i].blob != data->data
+	 || hc[i].size != data->size)
+	    continue;
+	op = dbiStatsAccumulator(dbi, 20);	/* RPMTS_OP_DBHDRHIT */
+	(void) rpmswEnter(op, 0);
+	(void) rpmswExit(op, data->size);
+	return headerLink(hc[i].h);
+    }
+
+    op = dbiStatsAccumulator(dbi, 21);		/* RPMTS_OP_DBHDRMISS */
+    (void) rpmswEnter(op, 0);
+    /* XXX needs PROT_READ somewhen. */
+    h = headerLazyLoad(data->data);
+    (void) rpmswExit(op, data->size);
+    if (h == NULL)
+	return NULL;
+
+    /* Replace the older slot, keeping the most recent load in slot 0. */
+    if (hc[1].h != NULL)
+	(void) headerFree(hc[1].h);
+    hc[1] = hc[0];
+    hc[0].h = headerLink(h);
+    hc[0].hdrNum = hdrNum;
+    hc[0].blob = data->data;
+    hc[0].size = data->size;
+    return h;
+}
+
 static int
 db3Acallback(DB * db, const DBT * key, const DBT * data, DBT * _r)
 	/*@globals internalState @*/
@@ -1774,15 +1851,13 @@ assert(rpmdb);
 	rpmdb->db_maxkey = hdrNum;
 
     h = headerLink(rpmdb->db_h);
+    if (h == NULL)
+	h = db3HdrCacheGet(dbi, hdrNum, data);
     if (h == NULL) {
-	/* XXX needs PROT_READ somewhen. */
-	h = headerLoad(data->data);
-	if (h == NULL) {
-	    rpmlog(RPMLOG_ERR,
+	rpmlog(RPMLOG_ERR,
 		_("db3: header #%u cannot be loaded -- skipping.\n"),
 		(unsigned)hdrNum);
-	    goto exit;
-	}
+	goto exit;
     }
 
     memset(_r, 0, sizeof(*_r));
@@ -24,6 +24,7 @@ fingerPrintCache fpCacheCreate(int sizeHint)
 
     fpc = xmalloc(sizeof(*fpc));
     fpc->ht = htCreate(sizeHint * 2, 0, 1, NULL, NULL);
+    fpc->arena = NULL;
 assert(fpc->ht != NULL);
     return fpc;
 }
@@ -162,7 +163,7 @@ static fingerPrint doLookup(fingerPrintCache cache,
 		fp.subDir = NULL;
 	    fp.baseName = baseName;
 	    if (!scareMem && fp.subDir != NULL)
-		fp.subDir = xstrdup(fp.subDir);
+		fp.subDir = rpmioArenaStrdup(cache->arena, fp.subDir);
 	/*@-compdef@*/ /* FIX: fp.entry.{dirName,dev,ino} undef @*/
 	    return fp;
 	/*@=compdef@*/
@@ -313,7 +314,7 @@ void fpLookupSubdir(hashTable symlinks, hashTable fphash, fingerPrintCache fpc,
     char * t;
     char * te;
 
-    struct rpmffi_s * ffi = xmalloc(sizeof(*ffi));
+    struct rpmffi_s * ffi = rpmioArenaAlloc(fpc->arena, sizeof(*ffi));
     ffi->p = p;
     ffi->fileno = filenr;
 
@@ -34,6 +34,8 @@ struct fprintCacheEntry_s {
  */
 struct fprintCache_s {
     hashTable ht;			/*!< hashed by dirName */
+/*@dependent@*/ /*@null@*/
+    rpmioArena arena;			/*!< sub-directory/file info storage */
 };
 
 #if defined(_FPRINT_INTERNAL)
@@ -147,6 +149,7 @@ void fpLookupList(fingerPrintCache cache, const char ** dirNames,
 /**
  * Check file for to be installed symlinks in their path,
  *  correct their fingerprint and add it to newht.
+ * The file info added is allocated from fpc->arena (if set).
  * @param ht		hash table containing all files fingerprints
  * @param newht		hash table to add the corrected fingerprints
  * @param fpc		fingerprint cache
@@ -5632,6 +5632,9 @@ static sprintfToken hsaNext(/*@returned@*/ headerSprintfArgs hsa)
     if (hsa != NULL && hsa->i < hsa->numTokens) {
 	fmt = hsa->format + hsa->i;
 	if (hsa->hi == NULL) {
+	    /* headerInit() failed, there are no tags to iterate. */
+	    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2)
+		return NULL;
 	    hsa->i++;
 	} else {
 	    HE_t he = rpmheClean(&tag->he);
@@ -6807,21 +6810,82 @@ rpmecFree(const headerSprintfExtension exts, /*@only@*/ HE_t ec)
     return NULL;
 }
 
-char * headerSprintf(Header h, const char * fmt,
+/**
+ * Compiled headerSprintf query format.
+ */
+struct headerSprintfProg_s {
+    struct headerSprintfArgs_s hsa;	/*!< Parsed format and output buffer. */
+/*@null@*/
+    spew_t spew;			/*!< xml/yaml/json/mongo markup. */
+/*@null@*/
+    sprintfTag iter;			/*!< Iterated "*" tag (if any). */
+};
+
+/**
+ * Clean per-header values cached in a headerSprintf format array.
+ * @param format	sprintf format array
+ * @param num		number of elements
+ */
+static void cleanFormat(/*@null@*/ sprintfToken format, size_t num)
+	/*@modifies *format @*/
+{
+    unsigned i;
+
+    if (format == NULL) return;
+
+    for (i = 0; i < (unsigned) num; i++) {
+	switch (format[i].type) {
+	case PTOK_TAG:
+	    (void) rpmheClean(&format[i].u.tag.he);
+	    /*@switchbreak@*/ break;
+	case PTOK_ARRAY:
+	    cleanFormat(format[i].u.array.format,
+			format[i].u.array.numTokens);
+	    /*@switchbreak@*/ break;
+	case PTOK_COND:
+	    cleanFormat(format[i].u.cond.ifFormat,
+			format[i].u.cond.numIfTokens);
+	    cleanFormat(format[i].u.cond.elseFormat,
+			format[i].u.cond.numElseTokens);
+	    (void) rpmheClean(&format[i].u.cond.tag.he);
+	    /*@switchbreak@*/ break;
+	case PTOK_NONE:
+	case PTOK_STRING:
+	default:
+	    /*@switchbreak@*/ break;
+	}
+    }
+}
+
+headerSprintfProg headerSprintfFree(headerSprintfProg prog)
+{
+    headerSprintfArgs hsa;
+
+    if (prog == NULL)
+	return NULL;
+    hsa = &prog->hsa;
+    if (hsa->ec != NULL)
+	hsa->ec = rpmecFree(hsa->exts, hsa->ec);
+    hsa->nec = 0;
+    hsa->format = freeFormat(hsa->format, hsa->numTokens);
+    hsa->val = _free(hsa->val);
+    hsa->fmt = _free(hsa->fmt);
+    prog = _free(prog);
+    return NULL;
+}
+
+headerSprintfProg headerSprintfCompile(const char * fmt,
 		headerTagTableEntry tags,
 		headerSprintfExtension exts,
 		errmsg_t * errmsg)
 {
-    headerSprintfArgs hsa = memset(alloca(sizeof(*hsa)), 0, sizeof(*hsa));
-    sprintfToken nextfmt;
+    headerSprintfProg prog = xcalloc(1, sizeof(*prog));
+    headerSprintfArgs hsa = &prog->hsa;
     sprintfTag tag;
-    char * t, * te;
-    size_t need;
-spew_t spew = NULL;
 
 /*@-modfilesys@*/
 if (_hdrqf_debug)
-fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, exts, errmsg);
+fprintf(stderr, "==> headerSprintfCompile(\"%s\", %p, %p, %p)\n", fmt, tags, exts, errmsg);
 /*@=modfilesys@*/
 
     /* Set some reasonable defaults */
@@ -6831,9 +6895,6 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
     if (exts == NULL)
 	exts = headerCompoundFormats;
  
-/*@-assignexpose -castexpose @*/
-    hsa->h = headerLink(h);
-/*@=assignexpose =castexpose @*/
     hsa->fmt = xstrdup(fmt);
 /*@-assignexpose -dependenttrans@*/
     hsa->exts = exts;
@@ -6841,8 +6902,13 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
 /*@=assignexpose =dependenttrans@*/
     hsa->errmsg = NULL;
 
-    if (parseFormat(hsa, hsa->fmt, &hsa->format, &hsa->numTokens, NULL, PARSER_BEGIN))
-	goto exit;
+    if (parseFormat(hsa, hsa->fmt, &hsa->format, &hsa->numTokens, NULL, PARSER_BEGIN)) {
+/*@-dependenttrans -observertrans @*/
+	if (errmsg)
+	    *errmsg = hsa->errmsg;
+/*@=dependenttrans =observertrans @*/
+	return headerSprintfFree(prog);
+    }
 
     hsa->nec = 0;
     hsa->ec = rpmecNew(hsa->exts, &hsa->nec);
@@ -6855,20 +6921,59 @@ fprintf(stderr, "==> headerSprintf(%p, \"%s\", %p, %p, %p)\n", h, fmt, tags, ext
 	    ? &hsa->format->u.array.format->u.tag :
 	NULL));
 
-spew = NULL;
-    /* XXX Ick: +1 needed to handle :extractor |transformer marking. */
-    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
-     && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "xml"))
-	spew = &_xml_spew;
-    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
-     && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "yaml"))
-	spew = &_yaml_spew;
-    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
-     && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "json"))
-	spew = &_json_spew;
-    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2
-     && tag->av != NULL && tag->av[0] != NULL && !strcmp(tag->av[0]+1, "mongo"))
-	spew = &_mongo_spew;
+    /* hsaNext() overwrites the "*" tagno while iterating, remember it. */
+    if (tag != NULL && tag->tagno != NULL && tag->tagno[0] == (rpmTag)-2) {
+	prog->iter = tag;
+	/* XXX Ick: +1 needed to handle :extractor |transformer marking. */
+	if (tag->av != NULL && tag->av[0] != NULL) {
+	    if (!strcmp(tag->av[0]+1, "xml"))
+		prog->spew = &_xml_spew;
+	    else if (!strcmp(tag->av[0]+1, "yaml"))
+		prog->spew = &_yaml_spew;
+	    else if (!strcmp(tag->av[0]+1, "json"))
+		prog->spew = &_json_spew;
+	    else if (!strcmp(tag->av[0]+1, "mongo"))
+		prog->spew = &_mongo_spew;
+	}
+    }
+
+    if (errmsg)
+	*errmsg = NULL;
+    return prog;
+}
+
+const char * headerSprintfExec(headerSprintfProg prog, Header h,
+		errmsg_t * errmsg)
+{
+    headerSprintfArgs hsa = &prog->hsa;
+    spew_t spew = prog->spew;
+    sprintfToken nextfmt;
+    char * t, * te;
+    size_t need;
+    int i;
+
+/*@-modfilesys@*/
+if (_hdrqf_debug)
+fprintf(stderr, "==> headerSprintfExec(%p, %p, %p)\n", prog, h, errmsg);
+/*@=modfilesys@*/
+
+    /* Discard values cached from the previous header. */
+    cleanFormat(hsa->format, hsa->numTokens);
+    for (i = 0; i < hsa->nec; i++)
+	(void) rpmheClean(&hsa->ec[i]);
+    if (prog->iter != NULL)
+	prog->iter->tagno[0] = (rpmTag)-2;
+    if (hsa->val == NULL) {
+	hsa->val = xstrdup("");
+	hsa->alloced = 0;
+    }
+    hsa->val[0] = '\0';
+    hsa->vallen = 0;
+    hsa->errmsg = NULL;
+
+/*@-assignexpose -castexpose @*/
+    hsa->h = headerLink(h);
+/*@=assignexpose =castexpose @*/
 
     if (spew && spew->spew_init && spew->spew_init[0]) {
 	char * spew_init = rpmExpand(spew->spew_init, NULL);
@@ -6891,36 +6996,54 @@ spew = NULL;
     }
     hsa = hsaFini(hsa);
 
-    if (spew && spew->spew_chomp) {
-	if (hsa->val[hsa->vallen - 1] == spew->spew_chomp)
-	    hsa->vallen--;
-    }
+    if (hsa->val != NULL) {
+	if (spew && spew->spew_chomp) {
+	    if (hsa->vallen > 0 && hsa->val[hsa->vallen - 1] == spew->spew_chomp)
+		hsa->vallen--;
+	}
 
-    if (spew && spew->spew_fini && spew->spew_fini[0]) {
-	char * spew_fini = rpmExpand(spew->spew_fini, NULL);
-	need = strlen(spew_fini);
-	t = hsaReserve(hsa, need);
-	te = stpcpy(t, spew_fini);
-	hsa->vallen += (te - t);
-	spew_fini = _free(spew_fini);
+	if (spew && spew->spew_fini && spew->spew_fini[0]) {
+	    char * spew_fini = rpmExpand(spew->spew_fini, NULL);
+	    need = strlen(spew_fini);
+	    t = hsaReserve(hsa, need);
+	    te = stpcpy(t, spew_fini);
+	    hsa->vallen += (te - t);
+	    spew_fini = _free(spew_fini);
+	}
+	hsa->val[hsa->vallen] = '\0';
     }
 
-    if (hsa->val != NULL && hsa->vallen < hsa->alloced)
-	hsa->val = xrealloc(hsa->val, hsa->vallen+1);	
-
-    hsa->ec = rpmecFree(hsa->exts, hsa->ec);
-    hsa->nec = 0;
-    hsa->format = freeFormat(hsa->format, hsa->numTokens);
-
-exit:
 /*@-dependenttrans -observertrans @*/
     if (errmsg)
 	*errmsg = hsa->errmsg;
 /*@=dependenttrans =observertrans @*/
     (void)headerFree(hsa->h);
     hsa->h = NULL;
-    hsa->fmt = _free(hsa->fmt);
 /*@-retexpose@*/
     return hsa->val;
 /*@=retexpose@*/
 }
+
+char * headerSprintf(Header h, const char * fmt,
+		headerTagTableEntry tags,
+		headerSprintfExtension exts,
+		errmsg_t * errmsg)
+{
+    headerSprintfProg prog = headerSprintfCompile(fmt, tags, exts, errmsg);
+    headerSprintfArgs hsa;
+    char * val = NULL;
+
+    if (prog == NULL)
+	return NULL;
+
+    if (headerSprintfExec(prog, h, errmsg) != NULL) {
+	/* Steal the output buffer rather than copying it. */
+	hsa = &prog->hsa;
+	val = hsa->val;
+	if (hsa->vallen < hsa->alloced)
+	    val = xrealloc(val, hsa->vallen+1);
+	hsa->val = NULL;
+    }
+    prog = headerSprintfFree(prog);
+    return val;
+}
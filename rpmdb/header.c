@@ -12,6 +12,7 @@
 
 #include <rpmiotypes.h>
 #include <rpmio.h>		/* XXX for rpmioPool et al */
+#include <rpmlog.h>
 #define	_RPMTAG_INTERNAL
 #include <header_internal.h>
 
@@ -129,6 +130,16 @@ static void headerScrub(void * _h)	/* XXX headerFini already in use */
 	    entry->length = 0;
 	}
 	h->index = _free(h->index);
+    } else if (h->blob != NULL) {
+	/* Lazy headers have no region entry: release the blob directly. */
+	if (h->flags & HEADERFLAG_MAPPED) {
+	    if (munmap(h->blob, h->bloblen) != 0)
+		fprintf(stderr, "==> munmap(%p[%u]) error(%d): %s\n",
+			h->blob, (unsigned)h->bloblen, errno, strerror(errno));
+	} else if (h->flags & HEADERFLAG_ALLOCATED)
+	    free(h->blob);
+	h->blob = NULL;
+	h->bloblen = 0;
     }
     h->origin = _free(h->origin);
     h->baseurl = _free(h->baseurl);
@@ -186,6 +197,7 @@ Header headerNew(void)
     memset(&h->h_getops, 0, sizeof(h->h_getops));
     h->indexAlloced = INDEX_MALLOC_SIZE;
     h->indexUsed = 0;
+    h->ril = 0;
     h->flags = HEADERFLAG_SORTED;
 
     h->index = (h->indexAlloced
@@ -197,6 +209,10 @@ Header headerNew(void)
 /*@=globstate =nullret =observertrans @*/
 }
 
+/* forward refs */
+static int headerUnlazy(Header h)
+	/*@modifies h @*/;
+
 /**
  */
 static int indexCmp(const void * avp, const void * bvp)
@@ -216,6 +232,8 @@ static
 void headerSort(Header h)
 	/*@modifies h @*/
 {
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h))
+	return;
     if (!(h->flags & HEADERFLAG_SORTED)) {
 	qsort(h->index, h->indexUsed, sizeof(*h->index), indexCmp);
 	h->flags |= HEADERFLAG_SORTED;
@@ -249,6 +267,8 @@ static
 void headerUnsort(Header h)
 	/*@modifies h @*/
 {
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h))
+	return;
     qsort(h->index, h->indexUsed, sizeof(*h->index), offsetCmp);
 }
 
@@ -647,6 +667,10 @@ void * headerUnload(Header h, size_t * lenp)
 	(void) rpmswEnter(sw, 0);
 
     /* Sort entries by (offset,tag). */
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h)) {
+	if (sw != NULL)	(void) rpmswExit(sw, 0);
+	return NULL;
+    }
     headerUnsort(h);
 
     /* Compute (il,dl) for all tags, including those deleted in region. */
@@ -866,6 +890,8 @@ indexEntry findEntry(/*@null@*/ Header h, rpmTag tag, rpmTagType type)
     struct indexEntry_s key;
 
     if (h == NULL) return NULL;
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h))
+	return NULL;
     if (!(h->flags & HEADERFLAG_SORTED)) headerSort(h);
 
     key.info.tag = tag;
@@ -910,11 +936,12 @@ static
 int headerRemoveEntry(Header h, rpmTag tag)
 	/*@modifies h @*/
 {
-    indexEntry last = h->index + h->indexUsed;
+    indexEntry last;
     indexEntry entry, first;
     int ne;
 
     entry = findEntry(h, tag, 0);
+    last = h->index + h->indexUsed;
     if (!entry) return 1;
 
     /* Make sure entry points to the first occurence of this tag. */
@@ -945,66 +972,36 @@ int headerRemoveEntry(Header h, rpmTag tag)
     return 0;
 }
 
-Header headerLoad(void * uh)
+/**
+ * Decode the tag index of a header blob.
+ * @param h		header (h->blob and h->bloblen are set)
+ * @return		0 on success
+ */
+static int headerLoadIndex(Header h)
+	/*@modifies h @*/
 {
-    void * sw = NULL;
-    rpmuint32_t * ei = (rpmuint32_t *) uh;
+    rpmuint32_t * ei = (rpmuint32_t *) h->blob;
     rpmuint32_t il = (rpmuint32_t) ntohl(ei[0]);		/* index length */
     rpmuint32_t dl = (rpmuint32_t) ntohl(ei[1]);		/* data length */
-    /*@-sizeoftype@*/
-    size_t pvlen = sizeof(il) + sizeof(dl) +
-               (il * sizeof(struct entryInfo_s)) + dl;
-    /*@=sizeoftype@*/
-    void * pv = uh;
-    Header h = NULL;
+    size_t pvlen = h->bloblen;
     entryInfo pe;
     unsigned char * dataStart;
     unsigned char * dataEnd;
     indexEntry entry; 
     rpmuint32_t rdlen;
-    int i;
 
-    /* Sanity checks on header intro. */
-    if (hdrchkTags(il) || hdrchkData(dl))
-	goto errxit;
-
-    ei = (rpmuint32_t *) pv;
     /*@-castexpose@*/
     pe = (entryInfo) &ei[2];
     /*@=castexpose@*/
     dataStart = (unsigned char *) (pe + il);
     dataEnd = dataStart + dl;
 
-    h = headerGetPool(_headerPool);
-    memset(&h->h_loadops, 0, sizeof(h->h_loadops));
-    if ((sw = headerGetStats(h, 18)) != NULL)	/* RPMTS_OP_HDRLOAD */
-	(void) rpmswEnter(sw, 0);
-    {	unsigned char * hmagic = header_magic;
-	(void) memcpy(h->magic, hmagic, sizeof(h->magic));
-    }
-    /*@-assignexpose -kepttrans@*/
-    h->blob = uh;
-    h->bloblen = pvlen;
-    /*@=assignexpose =kepttrans@*/
-    h->origin = NULL;
-    h->baseurl = NULL;
-    h->digest = NULL;
-    h->parent = NULL;
-    h->rpmdb = NULL;
-    memset(&h->sb, 0, sizeof(h->sb));
-    h->instance = 0;
-    h->startoff = 0;
-    h->endoff = (rpmuint32_t) pvlen;
-    memset(&h->h_getops, 0, sizeof(h->h_getops));
     h->indexAlloced = il + 1;
     h->indexUsed = il;
     h->index = DRD_xcalloc(h->indexAlloced, sizeof(*h->index));
-    h->flags = HEADERFLAG_SORTED;
-    h = headerLink(h);
-assert(h != NULL);
+    h->flags |= HEADERFLAG_SORTED;
 
     entry = h->index;
-    i = 0;
     if (!(htonl(pe->tag) < HEADER_I18NTABLE)) {
 	h->flags |= HEADERFLAG_LEGACY;
 	entry->info.type = REGION_TAG_TYPE;
@@ -1021,7 +1018,7 @@ assert(h != NULL);
 	rdlen = regionSwab(entry+1, il, 0, pe, dataStart, dataEnd, entry->info.offset);
 #if 0	/* XXX don't check, the 8/98 i18n bug fails here. */
 	if (rdlen != dl)
-	    goto errxit;
+	    return -1;
 #endif
 	entry->rdlen = rdlen;
 	entry++;
@@ -1036,14 +1033,14 @@ assert(h != NULL);
 	entry->info.count = (rpmuint32_t) htonl(pe->count);
 
 	if (hdrchkType(entry->info.type))
-	    goto errxit;
+	    return -1;
 	if (hdrchkTags(entry->info.count))
-	    goto errxit;
+	    return -1;
 
 	{   rpmint32_t off = (rpmint32_t) ntohl(pe->offset);
 
 	    if (hdrchkData(off))
-		goto errxit;
+		return -1;
 	    if (off) {
 /*@-sizeoftype@*/
 		size_t nb = REGION_TAG_COUNT;
@@ -1053,7 +1050,7 @@ assert(h != NULL);
 assert((rpmint32_t)rdl >= 0);	/* XXX insurance */
 		ril = (rpmuint32_t)(rdl/sizeof(*pe));
 		if (hdrchkTags(ril) || hdrchkData(rdl))
-		    goto errxit;
+		    return -1;
 		entry->info.tag = (rpmuint32_t) htonl(pe->tag);
 	    } else {
 		ril = il;
@@ -1071,7 +1068,7 @@ assert((rpmint32_t)rdl >= 0);	/* XXX insurance */
 	entry->length = pvlen - sizeof(il) - sizeof(dl);
 	rdlen = regionSwab(entry+1, (ril-1), 0, pe+1, dataStart, dataEnd, entry->info.offset);
 	if (rdlen == 0)
-	    goto errxit;
+	    return -1;
 	entry->rdlen = rdlen;
 
 	if (ril < (rpmuint32_t)h->indexUsed) {
@@ -1083,7 +1080,7 @@ assert((rpmint32_t)rdl >= 0);	/* XXX insurance */
 	    /* Load dribble entries from region. */
 	    rc = regionSwab(newEntry, (rpmuint32_t)ne, 0, pe+ril, dataStart, dataEnd, rid);
 	    if (rc == 0)
-		goto errxit;
+		return -1;
 	    rdlen += rc;
 
 	  { indexEntry firstEntry = newEntry;
@@ -1110,6 +1107,305 @@ assert((rpmint32_t)rdl >= 0);	/* XXX insurance */
 
     h->flags &= ~HEADERFLAG_SORTED;
     headerSort(h);
+    return 0;
+}
+
+/**
+ * Check a header blob for lazy tag lookup.
+ * The tag index is not decoded, but the entries are checked as regionSwab()
+ * does (offsets increasing within the region and the dribbles, non-zero
+ * in-bounds lengths), and the region entries must be sorted by tag. Only
+ * the last entry of the region and of the dribbles touches the tag data.
+ * Anything unusual is left to headerLoadIndex().
+ * @param h		header (h->blob and h->bloblen are set)
+ * @return		0 if lazy lookup is possible
+ */
+static int headerLazyCheck(Header h)
+	/*@modifies h @*/
+{
+    rpmuint32_t * ei = (rpmuint32_t *) h->blob;
+    rpmuint32_t il = (rpmuint32_t) ntohl(ei[0]);		/* index length */
+    rpmuint32_t dl = (rpmuint32_t) ntohl(ei[1]);		/* data length */
+    /*@-castexpose@*/
+    entryInfo pe = (entryInfo) &ei[2];
+    /*@=castexpose@*/
+    unsigned char * dataStart = (unsigned char *) (pe + il);
+    rpmuint32_t ril;
+    rpmuint32_t first;
+    rpmuint32_t prev = 0;
+    rpmuint32_t i;
+
+    if (il == 0)
+	return -1;
+
+    if (!(ntohl(pe->tag) < HEADER_I18NTABLE)) {
+	h->flags |= HEADERFLAG_LEGACY;
+	first = 0;
+	ril = il;
+    } else {
+	rpmint32_t off = (rpmint32_t) ntohl(pe->offset);
+
+	h->flags &= ~HEADERFLAG_LEGACY;
+	first = 1;
+	ril = il;
+	if (hdrchkType(ntohl(pe->type)) || hdrchkData(off))
+	    return -1;
+	if (off) {
+	    /*@-sizeoftype@*/
+	    rpmuint32_t stei[4];
+	    rpmuint32_t rdl;
+	    if ((size_t)off + REGION_TAG_COUNT > (size_t)dl)
+		return -1;
+	    memcpy(stei, dataStart + off, REGION_TAG_COUNT);
+	    /*@=sizeoftype@*/
+	    rdl = (rpmuint32_t)-ntohl(stei[2]);	/* negative offset */
+	    if ((rpmint32_t)rdl < 0 || hdrchkData(rdl))
+		return -1;
+	    ril = (rpmuint32_t)(rdl/sizeof(*pe));
+	    if (ril < 1 || ril > il)
+		return -1;
+	}
+    }
+
+    for (i = first; i < il; i++) {
+	rpmuint32_t tag = (rpmuint32_t) ntohl(pe[i].tag);
+	rpmuint32_t type = (rpmuint32_t) ntohl(pe[i].type);
+	rpmint32_t off = (rpmint32_t) ntohl(pe[i].offset);
+	rpmuint32_t ie = (i < ril ? ril : il);
+	rpmuint32_t length;
+
+	if (hdrchkType(type) || hdrchkData(ntohl(pe[i].count)))
+	    return -1;
+	if (hdrchkData(off) || hdrchkAlign(type, off) || (rpmuint32_t)off >= dl)
+	    return -1;
+	/* The tag data store length, as computed by regionSwab(). */
+	if (i + 1 < ie)
+	    length = (rpmuint32_t)ntohl(pe[i+1].offset) - (rpmuint32_t)off;
+	else {
+	    rpmTagData p;
+	    rpmTagData pend;
+	    p.ptr = dataStart + off;
+	    pend.ui8p = (rpmuint8_t *) (dataStart + dl);
+	    length = dataLength(type, &p, ntohl(pe[i].count), 1, &pend);
+	}
+	if (length == 0 || hdrchkData(length) || (rpmuint32_t)off + length > dl)
+	    return -1;
+	if (tag >= HEADER_IMAGE && tag < HEADER_REGIONS)
+	    return -1;
+	if (i < ril) {
+	    if (tag < prev)
+		return -1;
+	    prev = tag;
+	}
+    }
+
+    h->ril = ril;
+    return 0;
+}
+
+/**
+ * Decode (and swab) a single entry from a lazy header blob.
+ * @param h		header
+ * @param pe		1st element in tag array, big-endian
+ * @param i		entry to decode
+ * @param ie		end of the entry's segment (region or dribbles)
+ * @param regionid	region offset
+ * @retval entry	decoded entry
+ * @return		decoded entry (NULL on error)
+ */
+/*@null@*/
+static indexEntry headerLazyDecode(Header h, entryInfo pe,
+		rpmuint32_t i, rpmuint32_t ie, rpmint32_t regionid,
+		/*@out@*/ /*@returned@*/ indexEntry entry)
+	/*@modifies *entry @*/
+{
+    rpmuint32_t * ei = (rpmuint32_t *) h->blob;
+    rpmuint32_t il = (rpmuint32_t) ntohl(ei[0]);		/* index length */
+    rpmuint32_t dl = (rpmuint32_t) ntohl(ei[1]);		/* data length */
+    unsigned char * dataStart = (unsigned char *) (((entryInfo)&ei[2]) + il);
+    rpmTagData p;
+    rpmTagData pend;
+
+    entry->info.tag = (rpmuint32_t) ntohl(pe[i].tag);
+    entry->info.type = (rpmuint32_t) ntohl(pe[i].type);
+    entry->info.count = (rpmuint32_t) ntohl(pe[i].count);
+    entry->info.offset = (rpmint32_t) ntohl(pe[i].offset);
+    entry->data = dataStart + entry->info.offset;
+
+    /* Compute the tag data store length using offsets (as regionSwab). */
+    if (i + 1 < ie)
+	entry->length = ((rpmuint32_t)ntohl(pe[i+1].offset) - entry->info.offset);
+    else {
+	p.ptr = entry->data;
+	pend.ui8p = (rpmuint8_t *) (dataStart + dl);
+	entry->length = dataLength(entry->info.type, &p, entry->info.count, 1, &pend);
+    }
+    if (entry->length == 0 || hdrchkData(entry->length)
+     || entry->info.offset + entry->length > dl)
+	return NULL;
+
+    entry->rdlen = 0;
+    entry->info.offset = regionid;
+    return entry;
+}
+
+/**
+ * Find a tag in a lazy header blob, decoding only its entry.
+ * Dribble entries (after the region) replace region entries, region
+ * entries are found with a binary search on the big-endian tag array.
+ * @param h		header
+ * @param tag		entry tag
+ * @retval entry	decoded entry
+ * @return		decoded entry (NULL if not found)
+ */
+/*@null@*/
+static indexEntry headerLazyEntry(Header h, rpmTag tag,
+		/*@out@*/ indexEntry entry)
+	/*@modifies *entry @*/
+{
+    rpmuint32_t * ei = (rpmuint32_t *) h->blob;
+    rpmuint32_t il = (rpmuint32_t) ntohl(ei[0]);		/* index length */
+    /*@-castexpose@*/
+    entryInfo pe = (entryInfo) &ei[2];
+    /*@=castexpose@*/
+    rpmuint32_t ril = h->ril;
+    rpmint32_t rid = -(rpmint32_t)(ril * sizeof(*pe));
+    rpmuint32_t l, u;
+    rpmuint32_t i;
+
+    for (i = ril; i < il; i++) {
+	if ((rpmuint32_t) ntohl(pe[i].tag) == (rpmuint32_t) tag)
+	    return headerLazyDecode(h, pe, i, il, rid+1, entry);
+    }
+    /* A dribbled HEADER_BASENAMES replaces HEADER_OLDFILENAMES. */
+    if (tag == HEADER_OLDFILENAMES) {
+	for (i = ril; i < il; i++) {
+	    if ((rpmuint32_t) ntohl(pe[i].tag) == HEADER_BASENAMES)
+		return NULL;
+	}
+    }
+
+    l = ((h->flags & HEADERFLAG_LEGACY) ? 0 : 1);
+    u = ril;
+    while (l < u) {
+	rpmuint32_t t;
+	i = (l + u) / 2;
+	t = (rpmuint32_t) ntohl(pe[i].tag);
+	if ((rpmuint32_t) tag < t)
+	    u = i;
+	else if ((rpmuint32_t) tag > t)
+	    l = i + 1;
+	else
+	    return headerLazyDecode(h, pe, i, ril, rid, entry);
+    }
+    return NULL;
+}
+
+/**
+ * Decode the tag index of a lazy header.
+ * On failure the header stays lazy (tags remain retrievable from the blob),
+ * and the (empty) tag index isn't visible to iterators or modifications.
+ * @param h		header
+ * @return		0 on success, -1 on failure
+ */
+static int headerUnlazy(Header h)
+	/*@modifies h @*/
+{
+    if (headerLoadIndex(h)) {
+	rpmlog(RPMLOG_ERR, _("header %p: failed to decode tag index\n"),
+		(void *)h);
+	h->index = _free(h->index);
+	h->indexUsed = 0;
+	h->indexAlloced = 0;
+	h->flags &= ~HEADERFLAG_SORTED;
+	return -1;
+    }
+    h->flags &= ~HEADERFLAG_LAZY;
+    return 0;
+}
+
+/**
+ * Find matching (tag,type) entry in header, without decoding the tag index
+ * of a lazy header.
+ * @param h		header
+ * @param tag		entry tag
+ * @param type		entry type (0 for any)
+ * @retval ie		entry store (lazy header)
+ * @return 		header entry
+ */
+/*@null@*/
+static indexEntry headerFindEntry(Header h, rpmTag tag, rpmTagType type,
+		/*@out@*/ indexEntry ie)
+	/*@modifies h, *ie @*/
+{
+    if ((h->flags & HEADERFLAG_LAZY)
+     && !((rpmuint32_t)tag >= HEADER_IMAGE && (rpmuint32_t)tag < HEADER_REGIONS))
+    {
+	indexEntry entry = headerLazyEntry(h, tag, ie);
+	if (entry != NULL && type != 0 && entry->info.type != type)
+	    entry = NULL;
+	return entry;
+    }
+    return findEntry(h, tag, type);
+}
+
+/**
+ * Convert header blob to in-memory representation.
+ * @param uh		on-disk header blob (i.e. with offsets)
+ * @param lazy		decode the tag index on demand?
+ * @return		header
+ */
+/*@null@*/
+static Header headerLoadBlob(/*@kept@*/ void * uh, int lazy)
+	/*@modifies uh @*/
+{
+    void * sw = NULL;
+    rpmuint32_t * ei = (rpmuint32_t *) uh;
+    rpmuint32_t il = (rpmuint32_t) ntohl(ei[0]);		/* index length */
+    rpmuint32_t dl = (rpmuint32_t) ntohl(ei[1]);		/* data length */
+    /*@-sizeoftype@*/
+    size_t pvlen = sizeof(il) + sizeof(dl) +
+               (il * sizeof(struct entryInfo_s)) + dl;
+    /*@=sizeoftype@*/
+    Header h = NULL;
+
+    /* Sanity checks on header intro. */
+    if (hdrchkTags(il) || hdrchkData(dl))
+	goto errxit;
+
+    h = headerGetPool(_headerPool);
+    memset(&h->h_loadops, 0, sizeof(h->h_loadops));
+    if ((sw = headerGetStats(h, 18)) != NULL)	/* RPMTS_OP_HDRLOAD */
+	(void) rpmswEnter(sw, 0);
+    {	unsigned char * hmagic = header_magic;
+	(void) memcpy(h->magic, hmagic, sizeof(h->magic));
+    }
+    /*@-assignexpose -kepttrans@*/
+    h->blob = uh;
+    h->bloblen = pvlen;
+    /*@=assignexpose =kepttrans@*/
+    h->origin = NULL;
+    h->baseurl = NULL;
+    h->digest = NULL;
+    h->parent = NULL;
+    h->rpmdb = NULL;
+    memset(&h->sb, 0, sizeof(h->sb));
+    h->instance = 0;
+    h->startoff = 0;
+    h->endoff = (rpmuint32_t) pvlen;
+    memset(&h->h_getops, 0, sizeof(h->h_getops));
+    h->index = NULL;
+    h->indexAlloced = 0;
+    h->indexUsed = 0;
+    h->ril = 0;
+    h->flags = 0;
+    h = headerLink(h);
+assert(h != NULL);
+
+    if (lazy && headerLazyCheck(h) == 0)
+	h->flags |= HEADERFLAG_LAZY;
+    else if (headerLoadIndex(h))
+	goto errxit;
 
     if (sw != NULL)	(void) rpmswExit(sw, pvlen);
 
@@ -1122,6 +1418,7 @@ errxit:
     /*@-usereleased@*/
     if (h) {
 	h->index = _free(h->index);
+	h->blob = NULL;		/* XXX the caller frees the blob. */
 	yarnPossess(h->_item.use);	/* XXX rpmioPutItem expects locked. */
 	h = (Header) rpmioPutPool((rpmioItem)h);
     }
@@ -1131,6 +1428,16 @@ errxit:
     /*@=refcounttrans =globstate@*/
 }
 
+Header headerLoad(void * uh)
+{
+    return headerLoadBlob(uh, 0);
+}
+
+Header headerLazyLoad(void * uh)
+{
+    return headerLoadBlob(uh, 1);
+}
+
 int headerGetMagic(Header h, unsigned char ** magicp, size_t * nmagicp)
 {
     unsigned char * hmagic = header_magic;
@@ -1373,7 +1680,7 @@ static Header headerMap(const void * uh, int map)
 	    fprintf(stderr, "==> mprotect(%p[%u],0x%x) error(%d): %s\n",
 			nuh, (unsigned)pvlen, PROT_READ,
 			errno, strerror(errno));
-	nh = headerLoad(nuh);
+	nh = headerLazyLoad(nuh);
 	if (nh != NULL) {
 assert(nh->bloblen == pvlen);
 	    nh->flags |= HEADERFLAG_MAPPED;
@@ -1385,7 +1692,7 @@ assert(nh->bloblen == pvlen);
 	}
     } else {
 	nuh = memcpy(xmalloc(pvlen), uh, pvlen);
-	if ((nh = headerLoad(nuh)) != NULL)
+	if ((nh = headerLazyLoad(nuh)) != NULL)
 	    nh->flags |= HEADERFLAG_ALLOCATED;
 	else
 	    nuh = _free(nuh);
@@ -1402,8 +1709,10 @@ Header headerCopyLoad(const void * uh)
 
 int headerIsEntry(Header h, rpmTag tag)
 {
+    struct indexEntry_s ie;
+    if (h == NULL) return 0;
     /*@-mods@*/		/*@ FIX: h modified by sort. */
-    return (findEntry(h, tag, 0) ? 1 : 0);
+    return (headerFindEntry(h, tag, 0, &ie) ? 1 : 0);
     /*@=mods@*/	
 }
 
@@ -1602,6 +1911,7 @@ headerFindI18NString(Header h, indexEntry entry)
 	/*@*/
 {
     const char *lang, *l, *le;
+    struct indexEntry_s ie;
     indexEntry table;
 
     /* XXX Drepper sez' this is the order. */
@@ -1612,7 +1922,7 @@ headerFindI18NString(Header h, indexEntry entry)
 	    return entry->data;
     
     /*@-mods@*/
-    if ((table = findEntry(h, HEADER_I18NTABLE, RPM_STRING_ARRAY_TYPE)) == NULL)
+    if ((table = headerFindEntry(h, HEADER_I18NTABLE, RPM_STRING_ARRAY_TYPE, &ie)) == NULL)
 	return entry->data;
     /*@=mods@*/
 
@@ -1654,12 +1964,13 @@ static int intGetEntry(Header h, HE_t he, int flags)
 	/*@modifies he @*/
 {
     int minMem = 0;
+    struct indexEntry_s ie;
     indexEntry entry;
     int rc;
 
     /* First find the tag */
 /*@-mods@*/		/*@ FIX: h modified by sort. */
-    entry = findEntry(h, he->tag, 0);
+    entry = headerFindEntry(h, he->tag, 0, &ie);
 /*@=mods@*/
     if (entry == NULL) {
 	he->t = 0;
@@ -1778,6 +2089,9 @@ int headerAddEntry(Header h, HE_t he)
     if (hdrchkData(he->c))
 	return rc;
 
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h))
+	return rc;
+
     data.ptr = grabData(he, &length);
     if (data.ptr == NULL || length == 0)
 	return rc;
@@ -2085,8 +2399,13 @@ HeaderIterator headerFini(/*@only@*/ HeaderIterator hi)
 
 HeaderIterator headerInit(Header h)
 {
-    HeaderIterator hi = xmalloc(sizeof(*hi));
+    HeaderIterator hi;
+
+    /* Don't iterate over an empty index, the tags are still in the blob. */
+    if ((h->flags & HEADERFLAG_LAZY) && headerUnlazy(h))
+	return NULL;
 
+    hi = xmalloc(sizeof(*hi));
     headerSort(h);
 
 /*@-assignexpose -castexpose @*/
@@ -2100,14 +2419,18 @@ assert(hi->h != NULL);
 int headerNext(HeaderIterator hi, HE_t he, /*@unused@*/ unsigned int flags)
 {
     void * sw;
-    Header h = hi->h;
-    size_t slot = hi->next_index;
+    Header h;
+    size_t slot;
     indexEntry entry = NULL;
     int rc;
 
     /* Insure that *he is reliably initialized. */
     memset(he, 0, sizeof(*he));
 
+    if (hi == NULL)
+	return 0;
+    h = hi->h;
+
     for (slot = hi->next_index; slot < h->indexUsed; slot++) {
 	entry = h->index + slot;
 	if (!ENTRY_IS_REGION(entry))
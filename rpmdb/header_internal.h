@@ -108,6 +108,7 @@ struct headerToken_s {
     indexEntry index;	/*!< Array of tags. */
     size_t indexUsed;	/*!< Current size of tag array. */
     size_t indexAlloced;	/*!< Allocated size of tag array. */
+    rpmuint32_t ril;		/*!< No. of region entries (lazy headers). */
     rpmuint32_t flags;
 #define HEADERFLAG_SORTED	(1 << 0) /*!< Are header entries sorted? */
 #define HEADERFLAG_ALLOCATED	(1 << 1) /*!< Is 1st header region allocated? */
@@ -116,6 +117,7 @@ struct headerToken_s {
 #define HEADERFLAG_SIGNATURE	(1 << 4) /*!< Signature header? */
 #define HEADERFLAG_MAPPED	(1 << 5) /*!< Is 1st header region mmap'd? */
 #define HEADERFLAG_RDONLY	(1 << 6) /*!< Is 1st header region rdonly? */
+#define HEADERFLAG_LAZY		(1 << 7) /*!< Is tag array decoded on demand? */
 #if defined(__LCLINT__)
 /*@refs@*/
     int nrefs;			/*!< (unused) keep splint happy */
@@ -426,6 +426,16 @@ dbiIndexSet dbiFreeIndexSet(dbiIndexSet set) {
     return set;
 }
 
+/**
+ * Iterator selector evaluation plan (one per rpmmiAddPattern() pattern).
+ */
+typedef struct miPlan_s * miPlan;
+struct miPlan_s {
+    int			native;		/*!< Compare integer values natively? */
+    unsigned long long	val;		/*!< Integer value to compare. */
+    int			pushed;		/*!< Pushed down to an index scan? */
+};
+
 struct rpmmi_s {
     struct rpmioItem_s _item;	/*!< usage mutex and pool identifier. */
 /*@dependent@*/ /*@null@*/
@@ -453,6 +463,14 @@ struct rpmmi_s {
     int			mi_nre;
 /*@only@*/ /*@null@*/
     miRE		mi_re;
+/*@only@*/ /*@null@*/
+    miPlan		mi_plan;	/* Iterator selector plan (or NULL). */
+/*@only@*/ /*@null@*/
+    void *		mi_bulk;	/* Bulk fetch buffer (or NULL). */
+    size_t		mi_bulklen;	/* Bulk fetch buffer length. */
+    DBT			mi_bulkv;	/* Bulk fetch (key,data) pairs. */
+/*@dependent@*/ /*@null@*/
+    void *		mi_bulkp;	/* Next (key,data) pair in mi_bulkv. */
 
 };
 
@@ -941,6 +959,12 @@ fprintf(stderr, "==> rpmdbNew(%s, %s, 0x%x, 0%o, 0x%x) db %p\n", root, home, mod
     memset(&db->db_getops, 0, sizeof(db->db_getops));
     memset(&db->db_putops, 0, sizeof(db->db_putops));
     memset(&db->db_delops, 0, sizeof(db->db_delops));
+    memset(&db->db_hdrhits, 0, sizeof(db->db_hdrhits));
+    memset(&db->db_hdrmisses, 0, sizeof(db->db_hdrmisses));
+    memset(&db->db_lioflushes, 0, sizeof(db->db_lioflushes));
+    memset(db->db_hdrcache, 0, sizeof(db->db_hdrcache));
+    db->db_generation = 0;
+    db->db_genloaded = 0;
 
     /*@-globstate@*/
     return rpmdbLink(db, __FUNCTION__);
@@ -1482,6 +1506,12 @@ void * dbiStatsAccumulator(dbiIndex dbi, int opx)
     case 15:	/* RPMTS_OP_DBPUT */
 	sw = &dbi->dbi_rpmdb->db_putops;
 	break;
+    case 20:	/* RPMTS_OP_DBHDRHIT */
+	sw = &dbi->dbi_rpmdb->db_hdrhits;
+	break;
+    case 21:	/* RPMTS_OP_DBHDRMISS */
+	sw = &dbi->dbi_rpmdb->db_hdrmisses;
+	break;
     default:	/* XXX wrong, but let's not return NULL. */
     case 16:	/* RPMTS_OP_DBDEL */
 	sw = &dbi->dbi_rpmdb->db_delops;
@@ -1580,6 +1610,7 @@ assert(dbi != NULL);				/* XXX sanity */
 
     (void) mireFreeAll(mi->mi_re, mi->mi_nre);
     mi->mi_re = NULL;
+    mi->mi_plan = _free(mi->mi_plan);
 
     (void) rpmbfFree(mi->mi_bf);
     mi->mi_bf = NULL;
@@ -1589,6 +1620,10 @@ assert(dbi != NULL);				/* XXX sanity */
     mi->mi_keylen = 0;
     mi->mi_primary = _free(mi->mi_primary);
 
+    mi->mi_bulk = _free(mi->mi_bulk);
+    mi->mi_bulklen = 0;
+    mi->mi_bulkp = NULL;
+
     /* XXX this needs to be done elsewhere, not within destructor. */
     (void) rpmdbCheckSignals();
 }
@@ -1855,6 +1890,9 @@ fprintf(stderr, "    mire %p[%u] realloc\n", mi->mi_re, mi->mi_nre+1);
     if (mi->mi_nre > 1)
 	qsort(mi->mi_re, mi->mi_nre, sizeof(*mi->mi_re), mireCmp);
 
+    /* Re-plan iterator selector evaluation on next rpmmiNext(). */
+    mi->mi_plan = _free(mi->mi_plan);
+
 exit:
 if (_rpmmi_debug)
 fprintf(stderr, "<-- %s(%p, %u(%s), %u, \"%s\") rc %d mi_re %p[%u]\n", __FUNCTION__, mi, (unsigned)tag, tagName(tag), (unsigned)mode, pattern, rc, (mi ? mi->mi_re: NULL), (unsigned)(mi ? mi->mi_nre : 0));
@@ -1905,25 +1943,49 @@ static char * bin2hex(const void *data, size_t size)
     return val;
 }
 
+/**
+ * Match an integer tag value against an iterator selector.
+ * Planned integer predicates are compared natively, otherwise the value
+ * is converted to a string and matched against the pattern.
+ * @param mi		rpm database iterator
+ * @param i		iterator selector index
+ * @param mire		iterator selector
+ * @param val		integer tag value
+ * @return		0 on match, -1 on mismatch
+ */
+static int mireUintExec(const rpmmi mi, int i, miRE mire,
+		unsigned long long val)
+	/*@modifies mire @*/
+{
+    char numbuf[32];
+
+    if (mi->mi_plan != NULL && mi->mi_plan[i].native)
+	return (val == mi->mi_plan[i].val ? 0 : -1);
+/*@-duplicatequals@*/
+    sprintf(numbuf, "%llu", val);
+/*@=duplicatequals@*/
+    return mireRegexec(mire, numbuf, 0);
+}
+
 /**
  * Return iterator selector match.
  * @param mi		rpm database iterator
+ * @param h		header (usually lazily loaded)
  * @return		1 if header should be skipped
  */
 /*@-onlytrans@*/	/* XXX miRE array, not refcounted. */
-static int mireSkip (const rpmmi mi)
+static int mireSkip (const rpmmi mi, Header h)
 	/*@globals internalState @*/
-	/*@modifies mi->mi_re, internalState @*/
+	/*@modifies mi->mi_re, h, internalState @*/
 {
     HE_t he = memset(alloca(sizeof(*he)), 0, sizeof(*he));
-    char numbuf[32];
     miRE mire;
     int ntags = 0;
     int nmatches = 0;
     int i;
     int rc;
 
-    if (mi->mi_h == NULL)	/* XXX can't happen */
+    if (h == NULL)	/* XXX can't happen */
 	return 1;
 
     /*
@@ -1938,7 +2000,7 @@ static int mireSkip (const rpmmi mi)
 
 	he->tag = mire->tag;
 
-	if (!headerGet(mi->mi_h, he, 0)) {
+	if (!headerGet(h, he, 0)) {
 	    if (he->tag != RPMTAG_EPOCH) {
 		ntags++;
 		continue;
@@ -1954,37 +2016,31 @@ static int mireSkip (const rpmmi mi)
 	    switch (he->t) {
 	    case RPM_UINT8_TYPE:
 		for (j = 0; j < (unsigned) he->c; j++) {
-		    sprintf(numbuf, "%u", (unsigned) he->p.ui8p[j]);
-		    rc = mireRegexec(mire, numbuf, 0);
+		    rc = mireUintExec(mi, i, mire, he->p.ui8p[j]);
 		    if ((rc >= 0 && !mire->notmatch) || (rc < 0 && mire->notmatch))
 			anymatch++;
 		}
 		/*@switchbreak@*/ break;
 	    case RPM_UINT16_TYPE:
 		for (j = 0; j < (unsigned) he->c; j++) {
-		    sprintf(numbuf, "%u", (unsigned) he->p.ui16p[j]);
-		    rc = mireRegexec(mire, numbuf, 0);
+		    rc = mireUintExec(mi, i, mire, he->p.ui16p[j]);
 		    if ((rc >= 0 && !mire->notmatch) || (rc < 0 && mire->notmatch))
 			anymatch++;
 		}
 		/*@switchbreak@*/ break;
 	    case RPM_UINT32_TYPE:
 		for (j = 0; j < (unsigned) he->c; j++) {
-		    sprintf(numbuf, "%u", (unsigned) he->p.ui32p[j]);
-		    rc = mireRegexec(mire, numbuf, 0);
+		    rc = mireUintExec(mi, i, mire, he->p.ui32p[j]);
 		    if ((rc >= 0 && !mire->notmatch) || (rc < 0 && mire->notmatch))
 			anymatch++;
 		}
 		/*@switchbreak@*/ break;
 	    case RPM_UINT64_TYPE:
-/*@-duplicatequals@*/
 		for (j = 0; j < (unsigned) he->c; j++) {
-		    sprintf(numbuf, "%llu", (unsigned long long)he->p.ui64p[j]);
-		    rc = mireRegexec(mire, numbuf, 0);
+		    rc = mireUintExec(mi, i, mire, he->p.ui64p[j]);
 		    if ((rc >= 0 && !mire->notmatch) || (rc < 0 && mire->notmatch))
 			anymatch++;
 		}
-/*@=duplicatequals@*/
 		/*@switchbreak@*/ break;
 	    case RPM_STRING_TYPE:
 		rc = mireRegexec(mire, he->p.str, 0);
@@ -2032,6 +2088,256 @@ assert(he->p.ptr != NULL);
 }
 /*@=onlytrans@*/
 
+/**
+ * Return integer value of a pattern that matches a single integer.
+ * @param mire		iterator selector
+ * @retval *valp	integer value
+ * @return		1 if the pattern is an integer equality test
+ */
+static int mireIsUint(miRE mire, /*@out@*/ unsigned long long * valp)
+	/*@modifies *valp @*/
+{
+    const char * s = mire->pattern;
+    const char * se;
+    int anchored = 0;
+
+    if (s == NULL)
+	return 0;
+    switch (mire->mode) {
+    default:
+	return 0;
+	/*@notreached@*/ break;
+    case RPMMIRE_STRCMP:
+    case RPMMIRE_GLOB:
+	break;
+    case RPMMIRE_REGEX:
+    case RPMMIRE_PCRE:
+	anchored = 1;
+	if (*s++ != '^')
+	    return 0;
+	break;
+    }
+
+    /* Integers are matched as "%llu" strings: no leading zeroes. */
+    se = s;
+    while (*se >= '0' && *se <= '9')
+	se++;
+    if (se == s || (se - s) > 19 || (*s == '0' && (se - s) > 1))
+	return 0;
+    if (anchored && *se++ != '$')
+	return 0;
+    if (*se != '\0')
+	return 0;
+
+    *valp = strtoull(s, NULL, 10);
+    return 1;
+}
+
+/**
+ * Retrieve primary keys from an integer index.
+ * @param db		rpm database
+ * @param tag		rpm tag
+ * @param val		integer value
+ * @retval *matches	set of primary keys (or NULL)
+ * @return		0 on success
+ */
+static int dbiUintKeys(rpmdb db, rpmTag tag, uint32_t val,
+		/*@out@*/ dbiIndexSet * matches)
+	/*@globals internalState @*/
+	/*@modifies *matches, internalState @*/
+{
+    DBC * dbcursor = NULL;
+    DBT k = DBT_INIT;
+    DBT p = DBT_INIT;
+    DBT v = DBT_INIT;
+    uint32_t _ube = _hton_ui(val);	/* XXX network order integer keys */
+    uint32_t _flags = DB_SET;
+    dbiIndexSet set = NULL;
+    dbiIndex dbi;
+    int rc;
+    int xx;
+
+    *matches = NULL;
+    dbi = dbiOpen(db, tag, 0);
+    if (dbi == NULL)
+	return 1;
+
+    k.data = &_ube;
+    k.size = (UINT32_T) sizeof(_ube);
+    p.flags |= DB_DBT_PARTIAL;
+    v.flags |= DB_DBT_PARTIAL;
+
+    xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, 0);
+    while ((rc = dbiPget(dbi, dbcursor, &k, &p, &v, _flags)) == 0) {
+	uint32_t hdrNum;
+
+	_flags = DB_NEXT_DUP;
+	memcpy(&hdrNum, p.data, sizeof(hdrNum));
+	hdrNum = _ntoh_ui(hdrNum);
+	if (set == NULL)
+	    set = xcalloc(1, sizeof(*set));
+	(void) dbiAppendSet(set, &hdrNum, 1, sizeof(hdrNum), 0);
+    }
+    xx = dbiCclose(dbi, dbcursor, 0);
+    dbcursor = NULL;
+
+    if (rc == DB_NOTFOUND)
+	rc = 0;
+    if (rc == 0) {
+	*matches = set;
+	set = NULL;
+    }
+    set = dbiFreeIndexSet(set);
+    return (rc ? 1 : 0);
+}
+
+/**
+ * Can iterator selectors on a tag be answered by a secondary index?
+ * Patterns on a tag are or'd, so all must be positive, and must not match
+ * values that are not indexed (empty strings, install context Requires:,
+ * YAML mark up). Only tags whose index keys are the header values unchanged
+ * are answered from the index: loadDBT() stores Filedigests as binary and
+ * Pubkeys as fingerprints, and only element 0 of {INSTALL,REMOVE}TID is
+ * indexed (headers carry {tid,0}).
+ * @param mi		rpm database iterator
+ * @param i		1st iterator selector on the tag
+ * @param j		last+1 iterator selector on the tag
+ * @return		1 if the index can be scanned
+ */
+static int mireIndexable(const rpmmi mi, int i, int j)
+	/*@modifies mi->mi_re @*/
+{
+    miRE mire = mi->mi_re;
+    rpmTag tag = (rpmTag) mire[i].tag;
+    int k;
+
+    switch (tag) {
+    case RPMTAG_REQUIRENAME:
+    case RPMTAG_FILEDIGESTS:
+    case RPMTAG_PUBKEYS:
+    case RPMTAG_INSTALLTID:
+    case RPMTAG_REMOVETID:
+    case RPMTAG_REQUIREYAMLENTRY:
+    case RPMTAG_PROVIDEYAMLENTRY:
+    case RPMTAG_CONFLICTYAMLENTRY:
+    case RPMTAG_OBSOLETEYAMLENTRY:
+	return 0;
+	/*@notreached@*/ break;
+    default:
+	break;
+    }
+
+    for (k = i; k < j; k++) {
+	if (mire[k].notmatch)
+	    return 0;
+    }
+
+    switch (tagType(tag) & RPM_MASK_TYPE) {
+    default:
+	return 0;
+	/*@notreached@*/ break;
+    case RPM_UINT8_TYPE:
+    case RPM_UINT16_TYPE:
+    case RPM_UINT32_TYPE:
+	for (k = i; k < j; k++) {
+	    if (!mi->mi_plan[k].native || mi->mi_plan[k].val > 0xffffffffULL)
+		return 0;
+	}
+	break;
+    case RPM_STRING_TYPE:
+    case RPM_STRING_ARRAY_TYPE:
+	for (k = i; k < j; k++) {
+	    if (mireRegexec(mire + k, "", 0) >= 0)
+		return 0;
+	}
+	break;
+    }
+
+    return (dbiOpen(mi->mi_db, tag, 0) != NULL);
+}
+
+/**
+ * Plan iterator selector evaluation.
+ * Integer equality tests are compared natively. If the iterator is
+ * a full Packages scan, the patterns on the 1st indexed tag are turned
+ * into secondary index key scans, and only the matching header instances
+ * are retrieved. All patterns are still applied to each header.
+ * @param mi		rpm database iterator
+ */
+static void rpmmiPlan(rpmmi mi)
+	/*@globals internalState @*/
+	/*@modifies mi, internalState @*/
+{
+    miRE mire = mi->mi_re;
+    dbiIndexSet set = NULL;
+    int i, j, k;
+
+    mi->mi_plan = xcalloc(mi->mi_nre, sizeof(*mi->mi_plan));
+    for (i = 0; i < mi->mi_nre; i++)
+	mi->mi_plan[i].native = mireIsUint(mire + i, &mi->mi_plan[i].val);
+
+    /* Only full Packages scans are narrowed using an index. */
+    if (mi->mi_set != NULL || mi->mi_keyp != NULL
+     || mi->mi_rpmtag != RPMDBI_PACKAGES)
+	goto exit;
+
+    for (i = 0; i < mi->mi_nre; i = j) {
+	rpmTag tag = (rpmTag) mire[i].tag;
+	int rc = 0;
+
+	/* The patterns on a tag are adjacent (sorted by tag). */
+	j = i + 1;
+	while (j < mi->mi_nre && mire[j].tag == mire[i].tag)
+	    j++;
+	if (!mireIndexable(mi, i, j))
+	    continue;
+
+	set = xcalloc(1, sizeof(*set));
+	for (k = i; rc == 0 && k < j; k++) {
+	    dbiIndexSet kset = NULL;
+	    if (mi->mi_plan[k].native)
+		rc = dbiUintKeys(mi->mi_db, tag,
+				(uint32_t)mi->mi_plan[k].val, &kset);
+	    else
+		rc = dbiMireKeys(mi->mi_db, tag, mire[k].mode,
+				mire[k].pattern, &kset, NULL);
+	    if (rc == 0 && kset != NULL)
+		(void) dbiAppendSet(set, kset->recs, kset->count,
+				sizeof(*kset->recs), 0);
+	    kset = dbiFreeIndexSet(kset);
+	}
+	if (rc) {
+	    set = dbiFreeIndexSet(set);
+	    continue;
+	}
+	for (k = i; k < j; k++)
+	    mi->mi_plan[k].pushed = 1;
+	break;
+    }
+
+    if (set != NULL) {
+	/* Sort, and remove duplicate header instances. */
+	if (set->count > 1) {
+	    qsort(set->recs, set->count, sizeof(*set->recs), hdrNumCmp);
+	    for (i = 1, j = 1; i < (int)set->count; i++) {
+		if (set->recs[i].hdrNum != set->recs[j-1].hdrNum)
+		    set->recs[j++] = set->recs[i];
+	    }
+	    set->count = j;
+	}
+	mi->mi_set = set;
+	mi->mi_sorted = 1;
+    }
+
+exit:
+if (_rpmmi_debug) {
+    for (i = 0; i < mi->mi_nre; i++)
+	fprintf(stderr, "    plan: %s(%u) %s\"%s\" mode %d -> %s\n", tagName(mire[i].tag), (unsigned)mire[i].tag, (mire[i].notmatch ? "!" : ""), mire[i].pattern, (int)mire[i].mode, (mi->mi_plan[i].pushed ? "index scan" : mi->mi_plan[i].native ? "native compare" : "filter"));
+fprintf(stderr, "<-- %s(%p) mi_re %p[%u] mi_set %p[%u]\n", __FUNCTION__, mi, mi->mi_re, (unsigned)mi->mi_nre, mi->mi_set, (unsigned)(mi->mi_set ? mi->mi_set->count : 0));
+}
+    return;
+}
+
 int rpmmiSetRewrite(rpmmi mi, int rewrite)
 {
     int rc;
@@ -2058,6 +2364,9 @@ int rpmmiSetModified(rpmmi mi, int modified)
 /*@unchecked@*/
 static int _rpmmi_usermem = 1;
 
+/*@unchecked@*/
+static int _rpmmi_bulk = -1;
+
 static int rpmmiGet(dbiIndex dbi, DBC * dbcursor, DBT * kp, DBT * pk, DBT * vp,
                 unsigned int flags)
 	/*@globals internalState @*/
@@ -2114,6 +2423,117 @@ fprintf(stderr, "<-- %s(%p(%s),%p,%p,%p,0x%x) rc %d\n", __FUNCTION__, dbi, tagNa
     return rc;
 }
 
+/**
+ * Set up bulk retrieval of a known set of header instances.
+ * The set is sorted by header instance, so that headers are read in
+ * Packages key order, %{_rpmmi_bulk} bytes at a time.
+ * @param mi		rpm database iterator
+ * @param dbi		Packages index database handle
+ * @return		1 if bulk retrieval is used
+ */
+static int rpmmiBulkInit(rpmmi mi, dbiIndex dbi)
+	/*@globals _rpmmi_bulk, rpmGlobalMacroContext, h_errno @*/
+	/*@modifies mi, _rpmmi_bulk, rpmGlobalMacroContext @*/
+{
+    if (_rpmmi_bulk < 0)
+	_rpmmi_bulk = rpmExpandNumeric("%{?_rpmmi_bulk}");
+    if (_rpmmi_bulk <= 0 || !_rpmmi_usermem)
+	return 0;
+    if (mi->mi_set == NULL || mi->mi_set->count < 2)
+	return 0;
+    /* DB_SET_RANGE needs key order, rewriting headers needs DB_SET. */
+    if (dbi->dbi_rpmdb->db_api != 3 || dbi->dbi_type != DB_BTREE
+     || (mi->mi_cflags & DB_WRITECURSOR))
+	return 0;
+
+    if (!mi->mi_sorted)
+	(void) rpmmiSort(mi);
+
+    /* Bulk buffers are multiples of 1Kb. */
+    mi->mi_bulklen = ((size_t)_rpmmi_bulk + 1023) & ~((size_t)1023);
+    mi->mi_bulk = xmalloc(mi->mi_bulklen);
+    memset(&mi->mi_bulkv, 0, sizeof(mi->mi_bulkv));
+    mi->mi_bulkp = NULL;
+    return 1;
+}
+
+/**
+ * Retrieve header blob for mi->mi_offset from the bulk fetch buffer.
+ * The buffer is refilled with DB_SET_RANGE|DB_MULTIPLE_KEY whenever the
+ * (sorted) header instance is past the last key in the buffer. The matched
+ * pair is left in the buffer, as the next instance in the set may be the
+ * same header (e.g. several Basenames from one package) that was skipped.
+ * @param mi		rpm database iterator
+ * @param dbi		Packages index database handle
+ * @retval *vp		header blob (in the bulk buffer)
+ * @return		0 on success, DB_NOTFOUND if not in Packages
+ */
+static int rpmmiBulkGet(rpmmi mi, dbiIndex dbi, DBT * vp)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies mi, dbi, *vp, fileSystem, internalState @*/
+{
+    int refilled = 0;
+    int rc;
+
+    while (1) {
+	while (mi->mi_bulkp != NULL) {
+	    void * save = mi->mi_bulkp;
+	    void * kp;
+	    void * dp;
+	    u_int32_t klen;
+	    u_int32_t dlen;
+	    int cmp;
+
+	    DB_MULTIPLE_KEY_NEXT(mi->mi_bulkp, &mi->mi_bulkv, kp, klen, dp, dlen);
+	    if (mi->mi_bulkp == NULL)
+		break;
+	    if (klen != (u_int32_t)sizeof(mi->mi_offset))
+		continue;
+	    cmp = memcmp(kp, &mi->mi_offset, sizeof(mi->mi_offset));
+	    if (cmp < 0)
+		continue;
+	    if (cmp > 0) {
+		/* Not in Packages: leave the pair for the next instance. */
+		mi->mi_bulkp = save;
+		return DB_NOTFOUND;
+	    }
+	    /* Leave the pair for a duplicate instance. */
+	    mi->mi_bulkp = save;
+	    vp->data = dp;
+	    vp->size = dlen;
+	    return 0;
+	}
+	if (refilled)
+	    return DB_NOTFOUND;
+
+	/* Refill the buffer, starting with mi->mi_offset. */
+	{   DBT k = DBT_INIT;
+	    k.data = &mi->mi_offset;
+	    k.size = (UINT32_T)sizeof(mi->mi_offset);
+	    memset(&mi->mi_bulkv, 0, sizeof(mi->mi_bulkv));
+	    mi->mi_bulkv.data = mi->mi_bulk;
+	    mi->mi_bulkv.ulen = (u_int32_t)mi->mi_bulklen;
+	    mi->mi_bulkv.flags = DB_DBT_USERMEM;
+	    rc = dbiGet(dbi, mi->mi_dbc, &k, &mi->mi_bulkv,
+			DB_SET_RANGE | DB_MULTIPLE_KEY);
+	    if (rc == DB_BUFFER_SMALL) {
+		/* A single header is larger than the buffer: grow it. */
+		size_t nb = ((size_t)mi->mi_bulkv.size + 1023) & ~((size_t)1023);
+		if (nb <= mi->mi_bulklen)
+		    nb = 2 * mi->mi_bulklen;
+		mi->mi_bulklen = nb;
+		mi->mi_bulk = xrealloc(mi->mi_bulk, mi->mi_bulklen);
+		continue;
+	    }
+	}
+	if (rc)
+	    return rc;
+	DB_MULTIPLE_INIT(mi->mi_bulkp, &mi->mi_bulkv);
+	refilled = 1;
+    }
+    /*@notreached@*/
+}
+
 Header rpmmiNext(rpmmi mi)
 {
     dbiIndex dbi;
@@ -2124,6 +2544,7 @@ Header rpmmiNext(rpmmi mi)
     size_t uhlen;
 rpmTag tag;
 unsigned int _flags;
+    int prefiltered;
     int map;
     int rc;
     int xx;
@@ -2131,6 +2552,10 @@ unsigned int _flags;
     if (mi == NULL)
 	return NULL;
 
+    /* Plan iterator selector evaluation on 1st call. */
+    if (mi->mi_nre > 0 && mi->mi_plan == NULL)
+	rpmmiPlan(mi);
+
     /* Find the tag to open. */
     tag = (mi->mi_set == NULL && mi->mi_primary != NULL
 		? mi->mi_rpmtag : RPMDBI_PACKAGES);
@@ -2159,6 +2584,8 @@ fprintf(stderr, "--> %s(%p) dbi %p(%s)\n", __FUNCTION__, mi, dbi, tagName(tag));
 if (k.data && k.size == 0) k.size = (UINT32_T) strlen((char *)k.data);
 if (k.data && k.size == 0) k.size++;	/* XXX "/" fixup. */
 	_flags = DB_SET;
+	if (mi->mi_set && mi->mi_setx == 0)
+	    xx = rpmmiBulkInit(mi, dbi);
     } else
 	_flags = (mi->mi_setx ? DB_NEXT_DUP : DB_SET);
 
@@ -2181,9 +2608,13 @@ next:
 	    goto next;
 
 	/* Fetch header by offset. */
-	k.data = &mi->mi_offset;
-	k.size = (UINT32_T)sizeof(mi->mi_offset);
-	rc = rpmmiGet(dbi, mi->mi_dbc, &k, NULL, &v, DB_SET);
+	if (mi->mi_bulk != NULL)
+	    rc = rpmmiBulkGet(mi, dbi, &v);
+	else {
+	    k.data = &mi->mi_offset;
+	    k.size = (UINT32_T)sizeof(mi->mi_offset);
+	    rc = rpmmiGet(dbi, mi->mi_dbc, &k, NULL, &v, DB_SET);
+	}
     }
     else if (dbi->dbi_primary) {
 	rc = rpmmiGet(dbi, mi->mi_dbc, &k, &p, &v, _flags);
@@ -2235,12 +2666,32 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
     if (uh == NULL)
 	return NULL;
 
+    /*
+     * Apply iterator selectors to a lazily loaded header before copying
+     * the blob (mapped blobs are loaded lazily in place below).
+     */
+    prefiltered = 0;
+    if (mi->mi_nre > 0 && !(map && mi->mi_bulk == NULL)) {
+	Header h = headerLazyLoad(uh);
+	if (h != NULL) {
+	    int skip;
+	    (void) headerSetInstance(h, _ntoh_ui(mi->mi_offset));
+	    skip = mireSkip(mi, h);
+	    (void) headerFree(h);
+	    h = NULL;
+	    if (skip)
+		goto next;
+	    prefiltered = 1;
+	}
+    }
+
     /* Rewrite current header (if necessary) and unlink. */
     xx = miFreeHeader(mi, dbi);
 
-    if (map) {
+    /* Headers in the bulk buffer are copied, the buffer is reused. */
+    if (map && mi->mi_bulk == NULL) {
 /*@-onlytrans@*/
-	mi->mi_h = headerLoad(uh);
+	mi->mi_h = headerLazyLoad(uh);
 /*@=onlytrans@*/
 	if (mi->mi_h) {
 	    mi->mi_h->flags |= HEADERFLAG_MAPPED;
@@ -2263,7 +2714,7 @@ assert((size_t)k.size == sizeof(mi->mi_offset));
     }
 
     /* Skip this header if iterator selector (if any) doesn't match. */
-    if (mireSkip(mi))
+    if (!prefiltered && mireSkip(mi, mi->mi_h))
 	goto next;
 
     /* Mark header with its instance number. */
@@ -2501,7 +2952,7 @@ assert(keylen == sizeof(hdrNum));
 		    k.size = sizeof(offset);
 
 		    xx = dbiGet(dbi, pdbc, &k, &v, DB_SET);
-		    h = headerLoad(v.data);
+		    h = headerLazyLoad(v.data);
 		    tmp = (char*)((size_t)keyp + strlen(keyp) + 1);
 
 		    for (j = 0; j < (int)(sizeof(checkTags)/sizeof(checkTags[0])) &&
@@ -2626,12 +3077,103 @@ assert(keylen == sizeof(he->p.ui64p[0]));
     mi->mi_offset = 0;
     mi->mi_nre = 0;
     mi->mi_re = NULL;
+    mi->mi_plan = NULL;
+    mi->mi_bulk = NULL;
+    mi->mi_bulklen = 0;
+    memset(&mi->mi_bulkv, 0, sizeof(mi->mi_bulkv));
+    mi->mi_bulkp = NULL;
 
 exit:
     return mi;
 }
 /*@=dependenttrans =exposetrans =globstate @*/
 
+/**
+ * Key of the persistent rpmdb generation in the Depcache index.
+ * Dependency keys (DNEVR) always start with "<type> ", so never collide.
+ */
+/*@unchecked@*/ /*@observer@*/
+static const char _depcache_genkey[] = ".generation";
+
+/**
+ * Load (and optionally bump) the rpmdb generation kept in Depcache.
+ * @param db		rpm database
+ * @param bump		increment and store the generation?
+ * @return		0 on success, -1 if no Depcache index is usable
+ */
+static int rpmdbDepcacheGeneration(rpmdb db, int bump)
+	/*@globals fileSystem @*/
+	/*@modifies db, fileSystem @*/
+{
+    unsigned int _flags = (bump ? DB_WRITECURSOR : 0);
+    DBC * dbcursor = NULL;
+    rpmuint32_t gen = 0;
+    dbiIndex dbi;
+    DBT k;
+    DBT v;
+    int xx;
+
+    if ((dbi = dbiOpen(db, RPMDBI_DEPCACHE, 0)) == NULL)
+	return -1;
+
+    memset(&k, 0, sizeof(k));
+    memset(&v, 0, sizeof(v));
+/*@-observertrans@*/
+    k.data = (void *) _depcache_genkey;
+/*@=observertrans@*/
+    k.size = (UINT32_T) (sizeof(_depcache_genkey) - 1);
+
+    xx = dbiCopen(dbi, dbiTxnid(dbi), &dbcursor, _flags);
+    xx = dbiGet(dbi, dbcursor, &k, &v, DB_SET);
+    if (xx == 0 && v.data != NULL && v.size == sizeof(gen))
+	memcpy(&gen, v.data, sizeof(gen));
+
+    /* Never step back from a generation already seen by this process. */
+    if (gen < db->db_generation)
+	gen = db->db_generation;
+
+    if (bump) {
+	gen++;
+	memset(&k, 0, sizeof(k));
+	memset(&v, 0, sizeof(v));
+/*@-observertrans@*/
+	k.data = (void *) _depcache_genkey;
+/*@=observertrans@*/
+	k.size = (UINT32_T) (sizeof(_depcache_genkey) - 1);
+	v.data = &gen;
+	v.size = (UINT32_T) sizeof(gen);
+	xx = dbiPut(dbi, dbcursor, &k, &v, 0);
+    }
+    xx = dbiCclose(dbi, dbcursor, _flags);
+
+    db->db_generation = gen;
+    return 0;
+}
+
+rpmuint32_t rpmdbGeneration(rpmdb db)
+{
+    if (db == NULL)
+	return 0;
+    if (!db->db_genloaded) {
+	(void) rpmdbDepcacheGeneration(db, 0);
+	db->db_genloaded = 1;
+    }
+    return db->db_generation;
+}
+
+/**
+ * Bump the rpmdb generation after a header is added or removed.
+ * @param db		rpm database
+ */
+static void rpmdbBumpGeneration(rpmdb db)
+	/*@globals fileSystem @*/
+	/*@modifies db, fileSystem @*/
+{
+    if (rpmdbDepcacheGeneration(db, 1))
+	db->db_generation++;
+    db->db_genloaded = 1;
+}
+
 /* XXX psm.c */
 int rpmdbRemove(rpmdb db, /*@unused@*/ int rid, uint32_t hdrNum,
 		/*@unused@*/ rpmts ts)
@@ -2736,6 +3278,7 @@ int rpmdbRemove(rpmdb db, /*@unused@*/ int rid, uint32_t hdrNum,
     /* Unreference header used by associated secondary index callbacks. */
     (void) headerFree(h);
     h = NULL;
+    rpmdbBumpGeneration(db);
     rc = RPMRC_OK;		/* XXX RPMRC */
 
 exit:
@@ -2875,6 +3418,7 @@ assert(v.data != NULL);
 	}
 
     } while (dbix-- > 0);
+    rpmdbBumpGeneration(db);
     rc = RPMRC_OK;			/* XXX RPMRC */
 
 exit:
@@ -481,12 +481,21 @@ struct rpmdb_s {
 
 /*@refcounted@*/
     Header db_h;		/*!< Currently active header */
+    struct rpmdbHdrCache_s {
+/*@refcounted@*/ /*@null@*/
+	Header h;		/*!< Decoded header. */
+	uint32_t hdrNum;	/*!< Primary key. */
+/*@dependent@*/ /*@null@*/
+	const void * blob;	/*!< Header blob (owned by Berkeley DB). */
+	uint32_t size;		/*!< Header blob size. */
+    } db_hdrcache[2];		/*!< Per-put secondary callback headers. */
 
     rpmdb	db_next;	/*!< Chain of rpmdbOpen'ed rpmdb's. */
     int		db_opens;	/*!< No. of opens for this rpmdb. */
 
     void *	db_dbenv;	/*!< Berkeley DB_ENV handle. */
     void *	db_txn;		/*!< Berkeley DB_TXN handle */
+    int		db_liopending;	/*!< No. of unflushed rpmlio records. */
     DB_LOGC *	db_logc;	/*!< Berkeley DB_LOGC handle */
     DB_MPOOLFILE *db_mpf;	/*!< Berkeley DB_MPOOLFILE handle */
 
@@ -498,6 +507,12 @@ struct rpmdb_s {
     struct rpmop_s db_getops;	/*!< dbiGet statistics. */
     struct rpmop_s db_putops;	/*!< dbiPut statistics. */
     struct rpmop_s db_delops;	/*!< dbiDel statistics. */
+    struct rpmop_s db_hdrhits;	/*!< Secondary callback header cache hits. */
+    struct rpmop_s db_hdrmisses;	/*!< Secondary callback header cache misses. */
+    struct rpmop_s db_lioflushes;	/*!< rpmlioFlush statistics. */
+
+    rpmuint32_t	db_generation;	/*!< Bumped by rpmdbAdd/rpmdbRemove. */
+    int		db_genloaded;	/*!< Persistent generation loaded? */
 
 #if defined(__LCLINT__)
 /*@refs@*/
@@ -1192,6 +1207,17 @@ int rpmdbCloseDBI(/*@null@*/ rpmdb db, int tag)
 	/*@globals fileSystem @*/
 	/*@modifies db, fileSystem @*/;
 
+/**
+ * Return the rpmdb generation, bumped by every rpmdbAdd()/rpmdbRemove().
+ * The generation is kept persistently in the Depcache index (if configured)
+ * so that cached dependency results can be validated across processes.
+ * @param db		rpm database
+ * @return		rpmdb generation (0 if no db)
+ */
+rpmuint32_t rpmdbGeneration(/*@null@*/ rpmdb db)
+	/*@globals fileSystem @*/
+	/*@modifies db, fileSystem @*/;
+
 /** \ingroup rpmdb
  * Close all database indices and free rpmdb.
  * @param db		rpm database
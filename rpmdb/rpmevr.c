@@ -3,8 +3,14 @@
  */
 #include "system.h"
 
+#if defined(WITH_PTHREADS)
+#include <pthread.h>
+#endif
+
 #include <rpmiotypes.h>
+#include <rpmio.h>		/* XXX rpmioArena */
 #include <rpmmacro.h>
+#include <rpmhash.h>
 #define	_MIRE_INTERNAL
 #include <mire.h>
 
@@ -146,46 +152,117 @@ const char * evr_tuple_match = NULL;
 /*@unchecked@*/ /*@refcounted@*/ /*@null@*/
 miRE evr_tuple_mire = NULL;
 
+/**
+ * Return the EVR tuple regex, compiled only if %{evr_tuple_match} is set.
+ * @return		tuple regex (NULL uses rpmEVRscan())
+ */
+/*@null@*/
 static miRE rpmEVRmire(void)
 	/*@*/
 {
 /*@-globs -internalglobs -mods @*/
-    if (evr_tuple_mire == NULL) {
+    if (evr_tuple_match == NULL) {
 	int xx;
 	evr_tuple_match = rpmExpand("%{?evr_tuple_match}", NULL);
-	if (evr_tuple_match == NULL || evr_tuple_match[0] == '\0')
+	if (evr_tuple_match == NULL || evr_tuple_match[0] == '\0'
+	 || !strcmp(evr_tuple_match, _evr_tuple_match))
+	{
+	    evr_tuple_match = _free(evr_tuple_match);
 	    evr_tuple_match = xstrdup(_evr_tuple_match);
-
-	evr_tuple_mire = mireNew(RPMMIRE_REGEX, 0);
-	xx = mireSetCOptions(evr_tuple_mire, RPMMIRE_REGEX, 0, 0, NULL);
-	xx = mireRegcomp(evr_tuple_mire, evr_tuple_match);
-
+	} else {
+	    evr_tuple_mire = mireNew(RPMMIRE_REGEX, 0);
+	    xx = mireSetCOptions(evr_tuple_mire, RPMMIRE_REGEX, 0, 0, NULL);
+	    xx = mireRegcomp(evr_tuple_mire, evr_tuple_match);
+	}
     }
 /*@=globs =internalglobs =mods @*/
-assert(evr_tuple_match != NULL && evr_tuple_mire != NULL);
+assert(evr_tuple_match != NULL);
 /*@-globstate -retalias@*/
     return evr_tuple_mire;
 /*@=globstate =retalias@*/
 }
 
-int rpmEVRparse(const char * evrstr, EVR_t evr)
-	/*@modifies evrstr, evr @*/
+/**
+ * Split an EVR string like the default evr_tuple_match pattern
+ *	^(?:([^:-]+):)?([^:-]+)(?:-([^:-]+))?(?::([^:-]+))?$
+ * without running a regex.
+ * @param s		[epoch:]version[-release][:distepoch] string
+ * @retval offsets	{start,end} offsets of \0 .. \4 (-1 if unmatched)
+ * @return		0 on match, -1 otherwise
+ */
+static int rpmEVRscan(const char * s, int * offsets)
+	/*@modifies offsets @*/
+{
+    int tok[4 * 2];		/* token {start,end} offsets */
+    char sep[4];		/* separator after each token */
+    int o[5 * 2];		/* \0 .. \4 offsets (copied on match) */
+    int ntok = 0;
+    const char * t = s;
+    int ix;
+    int i;
+
+    /* Split into non-empty tokens at ':' and '-'. */
+    for (;;) {
+	const char * te = t + strcspn(t, ":-");
+	if (te == t || ntok == 4)
+	    return -1;
+	tok[2*ntok] = (int)(t - s);
+	tok[2*ntok+1] = (int)(te - s);
+	sep[ntok++] = *te;
+	if (*te == '\0')
+	    break;
+	t = te + 1;
+    }
+
+    /* A leading "E:" is tried first, just like the regex. */
+    memset(o, -1, sizeof(o));
+    i = 0;
+    if (ntok > 1 && sep[0] == ':') {
+	o[2*RPMEVR_E] = tok[0];
+	o[2*RPMEVR_E+1] = tok[1];
+	i++;
+    }
+    o[2*RPMEVR_V] = tok[2*i];
+    o[2*RPMEVR_V+1] = tok[2*i+1];
+    ix = RPMEVR_V;
+    for (i++; i < ntok; i++) {
+	if (sep[i-1] == '-' && ix < RPMEVR_R)
+	    ix = RPMEVR_R;
+	else if (sep[i-1] == ':' && ix < RPMEVR_D)
+	    ix = RPMEVR_D;
+	else
+	    return -1;
+	o[2*ix] = tok[2*i];
+	o[2*ix+1] = tok[2*i+1];
+    }
+    o[0] = 0;
+    o[1] = tok[2*ntok-1];
+    memcpy(offsets, o, sizeof(o));
+    return 0;
+}
+
+/**
+ * Split an EVR string in place into epoch, version, release and distepoch.
+ * @param evr		EVR container
+ * @param str		[epoch:]version[-release][:distepoch] string (modified)
+ */
+static void rpmEVRsplit(EVR_t evr, char * str)
+	/*@modifies evr, str @*/
 {
     miRE mire = rpmEVRmire();
     int noffsets = 6 * 3;
     int offsets[6 * 3];
-    size_t nb;
+    size_t nb = strlen(str);
     int xx;
     int i;
 
-    memset(evr, 0, sizeof(*evr));
-    evr->str = xstrdup(evrstr);
-    nb = strlen(evr->str);
-
     memset(offsets, -1, sizeof(offsets));
-    xx = mireSetEOptions(mire, offsets, noffsets);
-
-    xx = mireRegexec(mire, evr->str, strlen(evr->str));
+    if (mire != NULL) {
+	xx = mireSetEOptions(mire, offsets, noffsets);
+	xx = mireRegexec(mire, str, nb);
+	xx = mireSetEOptions(mire, NULL, 0);
+    } else
+	xx = rpmEVRscan(str, offsets);
 
     for (i = 0; i < noffsets; i += 2) {
 	int ix;
@@ -204,7 +281,7 @@ int rpmEVRparse(const char * evrstr, EVR_t evr)
 
 assert(offsets[i  ] >= 0 && offsets[i  ] <= (int)nb);
 assert(offsets[i+1] >= 0 && offsets[i+1] <= (int)nb);
-	{   char * te = (char *) evr->str;
+	{   char * te = str;
 	    evr->F[ix] = te + offsets[i];
 	    te += offsets[i+1];
 	    *te = '\0';
@@ -221,12 +298,89 @@ assert(offsets[i+1] >= 0 && offsets[i+1] <= (int)nb);
 /*@=observertrans =readonlytrans@*/
 
     evr->Elong = strtoul(evr->F[RPMEVR_E], NULL, 10);
+}
 
-    xx = mireSetEOptions(mire, NULL, 0);
-
+int rpmEVRparse(const char * evrstr, EVR_t evr)
+	/*@modifies evrstr, evr @*/
+{
+    memset(evr, 0, sizeof(*evr));
+    evr->str = xstrdup(evrstr);
+    rpmEVRsplit(evr, (char *)evr->str);
     return 0;
 }
 
+/*
+ * Interned EVR strings, each parsed once and kept for the process lifetime.
+ * Ids index a table of fixed size blocks that are never moved, so that
+ * rpmEVRlookup() needs no lock.
+ */
+#define	RPMEVR_IDSHIFT	10
+#define	RPMEVR_NIDS	(1 << RPMEVR_IDSHIFT)	/* ids per block */
+#define	RPMEVR_NBLOCKS	256			/* max. no. of blocks */
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static hashTable _evr_ht;
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static rpmioArena _evr_arena;
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static EVR_t * _evr_blocks[RPMEVR_NBLOCKS];
+/*@unchecked@*/
+static rpmuint32_t _evr_nids;
+
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_mutex_t _evr_lock = PTHREAD_MUTEX_INITIALIZER;
+#define	EVR_LOCK()	(void) pthread_mutex_lock(&_evr_lock)
+#define	EVR_UNLOCK()	(void) pthread_mutex_unlock(&_evr_lock)
+#else
+#define	EVR_LOCK()
+#define	EVR_UNLOCK()
+#endif
+
+rpmuint32_t rpmEVRintern(const char * evrstr)
+{
+    const void ** data = NULL;
+    rpmuint32_t id = 0;
+
+    if (evrstr == NULL)
+	return id;
+
+    EVR_LOCK();
+    if (_evr_ht == NULL) {
+	_evr_ht = htCreate(RPMEVR_NIDS, 0, 0, NULL, NULL);
+	_evr_arena = rpmioNewArena("evr", 0);
+    }
+    if (!htGetEntry(_evr_ht, evrstr, &data, NULL, NULL))
+	id = (rpmuint32_t)(unsigned long) data[0];
+    else if (_evr_nids < RPMEVR_NBLOCKS * RPMEVR_NIDS) {
+	EVR_t evr = rpmioArenaAlloc(_evr_arena, sizeof(*evr));
+	const char * key = rpmioArenaStrdup(_evr_arena, evrstr);
+	char * str = rpmioArenaStrdup(_evr_arena, evrstr);
+	rpmuint32_t ix = _evr_nids;
+
+	memset(evr, 0, sizeof(*evr));
+	evr->str = str;
+	rpmEVRsplit(evr, str);
+
+	if (_evr_blocks[ix >> RPMEVR_IDSHIFT] == NULL)
+	    _evr_blocks[ix >> RPMEVR_IDSHIFT] =
+		xcalloc(RPMEVR_NIDS, sizeof(*_evr_blocks[0]));
+	_evr_blocks[ix >> RPMEVR_IDSHIFT][ix & (RPMEVR_NIDS - 1)] = evr;
+	id = ++_evr_nids;
+	htAddEntry(_evr_ht, key, (void *)(unsigned long) id);
+    }
+    EVR_UNLOCK();
+
+    return id;
+}
+
+EVR_t rpmEVRlookup(rpmuint32_t id)
+{
+assert(id > 0);
+    id--;
+    return _evr_blocks[id >> RPMEVR_IDSHIFT][id & (RPMEVR_NIDS - 1)];
+}
+
 /**
  * Dressed rpmEVRcmp, handling missing values.
  * @param a		1st string
@@ -159,6 +159,24 @@ int rpmEVRcmp(const char *a, const char *b)
 int rpmEVRparse(const char * evrstr, EVR_t evr)
 	/*@modifies evrstr, evr @*/;
 
+/** \ingroup rpmds
+ * Intern an EVR string, parsing it (once) into a shared EVR container.
+ * @param evrstr	[epoch:]version[-release][:distepoch] string
+ * @return		EVR id (0 if the intern table is full)
+ */
+rpmuint32_t rpmEVRintern(/*@null@*/ const char * evrstr)
+	/*@globals internalState @*/
+	/*@modifies internalState @*/;
+
+/** \ingroup rpmds
+ * Return the parsed EVR container of an interned EVR string.
+ * @param id		EVR id from rpmEVRintern()
+ * @return		shared EVR container (read-only, never freed)
+ */
+/*@observer@*/
+EVR_t rpmEVRlookup(rpmuint32_t id)
+	/*@*/;
+
 /** \ingroup rpmds
  * Compare EVR containers for equality.
  * @param a		1st EVR container
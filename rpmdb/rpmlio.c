@@ -7,6 +7,7 @@
 #include <rpmiotypes.h>
 #include <rpmtypes.h>
 #include <argv.h>
+#include <rpmmacro.h>
 
 #include <rpmtag.h>
 #define _RPMDB_INTERNAL
@@ -22,6 +23,47 @@ int _rpmlio_debug = 0;
 static int _enable_syscall_logging = 0;
 /*@unchecked@*/
 static int _enable_scriptlet_logging = 0;
+/*@unchecked@*/
+static int _rpmlio_batch = -1;
+
+#if defined(SUPPORT_FILE_ACID)
+/**
+ * Return log flags for a file operation record.
+ * With %_rpmlio_batch, records are left in the log buffer (and counted)
+ * until the next rpmlioFlush() rather than flushed one by one.
+ * @param rpmdb		rpm database
+ * @return		DB_FLUSH or 0 if batching
+ */
+static uint32_t rpmlioLogFlags(rpmdb rpmdb)
+	/*@globals _rpmlio_batch, rpmGlobalMacroContext, h_errno @*/
+	/*@modifies rpmdb, _rpmlio_batch, rpmGlobalMacroContext @*/
+{
+    if (_rpmlio_batch < 0)
+	_rpmlio_batch = rpmExpandNumeric("%{?_rpmlio_batch}");
+    if (!_rpmlio_batch)
+	return DB_FLUSH;
+    rpmdb->db_liopending++;
+    return 0;
+}
+#endif	/* SUPPORT_FILE_ACID */
+
+int rpmlioFlush(rpmdb rpmdb)
+{
+    int rc = 0;
+#if defined(SUPPORT_FILE_ACID)
+    DB_ENV * dbenv = (rpmdb ? rpmdb->db_dbenv : NULL);
+    int npending;
+    if (!(dbenv && rpmdb->db_liopending > 0)) return 0;
+    npending = rpmdb->db_liopending;
+    (void) rpmswEnter(&rpmdb->db_lioflushes, 0);
+    rc = dbenv->log_flush(dbenv, NULL);
+    (void) rpmswExit(&rpmdb->db_lioflushes, npending);
+    rpmdb->db_liopending = 0;
+if (_rpmlio_debug)
+fprintf(stderr, "<== %s(%p) %d records rc %d\n", __FUNCTION__, rpmdb, npending, rc);
+#endif	/* SUPPORT_FILE_ACID */
+    return rc;
+}
 
 int rpmlioCreat(rpmdb rpmdb, const char * fn, mode_t mode,
 		const uint8_t * b, size_t blen,
@@ -44,7 +86,7 @@ int rpmlioCreat(rpmdb rpmdb, const char * fn, mode_t mode,
     Bdbt.size = blen;
     Ddbt.data = (void *)d;
     Ddbt.size = dlen;
-    rc = logio_Creat_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, mode, &Bdbt, &Ddbt, dalgo);
+    rc = logio_Creat_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, mode, &Bdbt, &Ddbt, dalgo);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o, %p[%u], %p[%u], %u) rc %d\n", __FUNCTION__, fn, mode, b, (unsigned)blen, d, (unsigned)dlen, (unsigned)dalgo, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -72,7 +114,7 @@ int rpmlioUnlink(rpmdb rpmdb, const char * fn, mode_t mode,
     Bdbt.size = blen;
     Ddbt.data = (void *)d;
     Ddbt.size = dlen;
-    rc = logio_Unlink_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, mode, &Bdbt, &Ddbt, dalgo);
+    rc = logio_Unlink_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, mode, &Bdbt, &Ddbt, dalgo);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o, %p[%u], %p[%u], %u) rc %d\n", __FUNCTION__, fn, mode, b, (unsigned)blen, d, (unsigned)dlen, (unsigned)dalgo, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -104,7 +146,7 @@ int rpmlioRename(rpmdb rpmdb, const char * oldname, const char * newname,
     Bdbt.size = blen;
     Ddbt.data = (void *)d;
     Ddbt.size = dlen;
-    rc = logio_Rename_log(dbenv, _txn, &_lsn, DB_FLUSH, &ONdbt, &NNdbt, mode, &Bdbt, &Ddbt, dalgo);
+    rc = logio_Rename_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &ONdbt, &NNdbt, mode, &Bdbt, &Ddbt, dalgo);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, %s, 0%o, %p[%u], %p[%u], %u) rc %d\n", __FUNCTION__, oldname, newname, mode, b, (unsigned)blen, d, (unsigned)dlen, (unsigned)dalgo, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -124,7 +166,7 @@ int rpmlioMkdir(rpmdb rpmdb, const char * dn, mode_t mode)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     DNdbt.data = (void *)dn;
     DNdbt.size = strlen(dn) + 1;	/* trailing NUL too */
-    rc = logio_Mkdir_log(dbenv, _txn, &_lsn, DB_FLUSH, &DNdbt, mode);
+    rc = logio_Mkdir_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &DNdbt, mode);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o) rc %d\n", __FUNCTION__, dn, mode, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -144,7 +186,7 @@ int rpmlioRmdir(rpmdb rpmdb, const char * dn, mode_t mode)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     DNdbt.data = (void *)dn;
     DNdbt.size = strlen(dn) + 1;	/* trailing NUL too */
-    rc = logio_Rmdir_log(dbenv, _txn, &_lsn, DB_FLUSH, &DNdbt, mode);
+    rc = logio_Rmdir_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &DNdbt, mode);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o) rc %d\n", __FUNCTION__, dn, mode, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -170,7 +212,7 @@ int rpmlioLsetfilecon(rpmdb rpmdb, const char * fn, const char * context)
     CONTEXTdbt.data = (void *)context;
 /*@=observertrans@*/
     CONTEXTdbt.size = strlen(context) + 1;	/* trailing NUL too */
-    rc = logio_Lsetfilecon_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, &CONTEXTdbt);
+    rc = logio_Lsetfilecon_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, &CONTEXTdbt);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, \"%s\") rc %d\n", __FUNCTION__, fn, context, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -190,7 +232,7 @@ int rpmlioChown(rpmdb rpmdb, const char * fn, uid_t uid, gid_t gid)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Chown_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, uid, gid);
+    rc = logio_Chown_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, uid, gid);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, %u, %u) rc %d\n", __FUNCTION__, fn, (unsigned)uid, (unsigned)gid, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -210,7 +252,7 @@ int rpmlioLchown(rpmdb rpmdb, const char * fn, uid_t uid, gid_t gid)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Lchown_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, uid, gid);
+    rc = logio_Lchown_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, uid, gid);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, %u, %u) rc %d\n", __FUNCTION__, fn, (unsigned)uid, (unsigned)gid, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -230,7 +272,7 @@ int rpmlioChmod(rpmdb rpmdb, const char * fn, mode_t mode)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Chmod_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, mode);
+    rc = logio_Chmod_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, mode);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o) rc %d\n", __FUNCTION__, fn, mode, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -250,7 +292,7 @@ int rpmlioUtime(rpmdb rpmdb, const char * fn, time_t actime, time_t modtime)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Utime_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, actime, modtime);
+    rc = logio_Utime_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, actime, modtime);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0x%x, 0x%x) rc %d\n", __FUNCTION__, fn, (unsigned)actime, (unsigned)modtime, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -273,7 +315,7 @@ int rpmlioSymlink(rpmdb rpmdb, const char * ln, const char * fn)
     LNdbt.size = strlen(ln) + 1;	/* trailing NUL too */
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Symlink_log(dbenv, _txn, &_lsn, DB_FLUSH, &LNdbt, &FNdbt);
+    rc = logio_Symlink_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &LNdbt, &FNdbt);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, %s) rc %d\n", __FUNCTION__, ln, fn, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -296,7 +338,7 @@ int rpmlioLink(rpmdb rpmdb, const char * ln, const char * fn)
     LNdbt.size = strlen(ln) + 1;	/* trailing NUL too */
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Link_log(dbenv, _txn, &_lsn, DB_FLUSH, &LNdbt, &FNdbt);
+    rc = logio_Link_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &LNdbt, &FNdbt);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, %s) rc %d\n", __FUNCTION__, ln, fn, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -316,7 +358,7 @@ int rpmlioMknod(rpmdb rpmdb, const char * fn, mode_t mode, dev_t dev)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Mknod_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, mode, dev);
+    rc = logio_Mknod_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, mode, dev);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o, 0x%x) rc %d\n", __FUNCTION__, fn, mode, (unsigned)dev, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -336,7 +378,7 @@ int rpmlioMkfifo(rpmdb rpmdb, const char * fn, mode_t mode)
     if (!(dbenv && _txn && _enable_syscall_logging)) return 0;
     FNdbt.data = (void *)fn;
     FNdbt.size = strlen(fn) + 1;	/* trailing NUL too */
-    rc = logio_Mkfifo_log(dbenv, _txn, &_lsn, DB_FLUSH, &FNdbt, mode);
+    rc = logio_Mkfifo_log(dbenv, _txn, &_lsn, rpmlioLogFlags(rpmdb), &FNdbt, mode);
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%s, 0%o) rc %d\n", __FUNCTION__, fn, mode, rc);
 #endif	/* SUPPORT_FILE_ACID */
@@ -361,6 +403,7 @@ int rpmlioPrein(rpmdb rpmdb, const char ** av, const char * body)
     BODYdbt.data = (void *)body;
     BODYdbt.size = strlen(body) + 1;	/* trailing NUL too */
     rc = logio_Prein_log(dbenv, _txn, &_lsn, DB_FLUSH, &AVdbt, &BODYdbt);
+    rpmdb->db_liopending = 0;
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%p,%p) rc %d\n", __FUNCTION__, av, body, rc);
     cmd = _free(cmd);
@@ -386,6 +429,7 @@ int rpmlioPostin(rpmdb rpmdb, const char ** av, const char * body)
     BODYdbt.data = (void *)body;
     BODYdbt.size = strlen(body) + 1;	/* trailing NUL too */
     rc = logio_Postin_log(dbenv, _txn, &_lsn, DB_FLUSH, &AVdbt, &BODYdbt);
+    rpmdb->db_liopending = 0;
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%p,%p) rc %d\n", __FUNCTION__, av, body, rc);
     cmd = _free(cmd);
@@ -411,6 +455,7 @@ int rpmlioPreun(rpmdb rpmdb, const char ** av, const char * body)
     BODYdbt.data = (void *)body;
     BODYdbt.size = strlen(body) + 1;	/* trailing NUL too */
     rc = logio_Preun_log(dbenv, _txn, &_lsn, DB_FLUSH, &AVdbt, &BODYdbt);
+    rpmdb->db_liopending = 0;
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%p,%p) rc %d\n", __FUNCTION__, av, body, rc);
     cmd = _free(cmd);
@@ -436,6 +481,7 @@ int rpmlioPostun(rpmdb rpmdb, const char ** av, const char * body)
     BODYdbt.data = (void *)body;
     BODYdbt.size = strlen(body) + 1;	/* trailing NUL too */
     rc = logio_Postun_log(dbenv, _txn, &_lsn, DB_FLUSH, &AVdbt, &BODYdbt);
+    rpmdb->db_liopending = 0;
 if (_rpmlio_debug)
 fprintf(stderr, "<== %s(%p,%p) rc %d\n", __FUNCTION__, av, body, rc);
     cmd = _free(cmd);
@@ -4,6 +4,25 @@
 /*@unchecked@*/
 extern int _rpmlio_debug;
 
+/**
+ * Flush batched file operation log records.
+ *
+ * With %_rpmlio_batch enabled, the rpmlioCreat() ... rpmlioMknod() records
+ * are written to the Berkeley DB log buffer without DB_FLUSH, and are made
+ * durable together here (called at the end of each package's file state
+ * machine), by the DB_FLUSH of the next scriptlet record (i.e. before any
+ * scriptlet runs), or by the transaction commit.
+ *
+ * A crash therefore may lose the records of the package being installed
+ * or erased, but never those of a package already done: recovery always
+ * sees complete packages, plus at most one partial package whose file
+ * operations must be (as before) re-checked against the file system.
+ * @param rpmdb		rpm database
+ * @return		0 on success
+ */
+int rpmlioFlush(rpmdb rpmdb)
+	/*@*/;
+
 int rpmlioCreat(rpmdb rpmdb, const char * fn, mode_t mode,
 		const uint8_t * b, size_t blen,
 		const uint8_t * d, size_t dlen, uint32_t dalgo)
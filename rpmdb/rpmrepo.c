@@ -50,6 +50,8 @@ extern int sqlite3_close(sqlite3 * db)
 #include <rpmio.h>	/* for *Pool methods */
 #include <rpmlog.h>
 #include <rpmurl.h>
+#include <rpmhash.h>
+#include <yarn.h>
 #include <poptIO.h>
 
 #define	_RPMREPO_INTERNAL
@@ -1354,19 +1356,22 @@ int rpmrepoDoFinalMove(rpmrepo repo)
 /**
  * Read a header from a repository package file, computing package file digest.
  * @param repo		repository
+ * @param ts		transaction set
  * @param path		package file path
+ * @param instance	package instance (i.e. 1 + index in pkglist)
+ * @param rlock		rpmReadPackageFile() serialization lock (or NULL)
  * @return		header (NULL on error)
  */
-static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
+static Header rpmrepoReadHeader(rpmrepo repo, rpmts ts, const char * path,
+		uint32_t instance, /*@null@*/ yarnLock rlock)
 	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
-	/*@modifies repo, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies ts, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
     /* XXX todo: read the payload and collect the blessed file digest. */
     FD_t fd = Fopen(path, "r.ufdio");
     Header h = NULL;
 
     if (fd != NULL) {
-	rpmts ts = repo->_ts;
 	uint32_t algo = repo->pkgalgo;
 	rpmRC rpmrc;
 
@@ -1374,7 +1379,12 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
 	    fdInitDigest(fd, algo, 0);
 
 	/* XXX what if path needs expansion? */
+	/* XXX rpmReadPackageFile() isn't thread safe (e.g. pgpStashKeyid). */
+	if (rlock != NULL)
+	    yarnPossess(rlock);
 	rpmrc = rpmReadPackageFile(ts, fd, path, &h);
+	if (rlock != NULL)
+	    yarnRelease(rlock);
 	if (algo != PGPHASHALGO_NONE) {
 	    char buffer[32 * BUFSIZ];
 	    size_t nb = sizeof(buffer);
@@ -1408,7 +1418,7 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
 	case RPMRC_OK:
 	    if (repo->baseurl)
 		(void) headerSetBaseURL(h, repo->baseurl);
-	    (void) headerSetInstance(h, (uint32_t)repo->current+1);
+	    (void) headerSetInstance(h, instance);
 	    break;
 	}
     }
@@ -1417,43 +1427,58 @@ static Header rpmrepoReadHeader(rpmrepo repo, const char * path)
 
 /**
  * Return header query.
+ * @retval *progp	compiled query format (lazily created)
  * @param h		header
  * @param qfmt		query format
- * @return		query format result
+ * @retval *errp	error message (malloc'ed, on failure)
+ * @return		query format result (NULL on failure)
  */
-static const char * rfileHeaderSprintf(Header h, const char * qfmt)
-	/*@globals fileSystem @*/
-	/*@modifies h, fileSystem @*/
+/*@null@*/
+static const char * rfileHeaderSprintf(headerSprintfProg * progp, Header h,
+		const char * qfmt, /*@out@*/ const char ** errp)
+	/*@modifies *progp, h, *errp @*/
 {
     const char * msg = NULL;
-    const char * s = headerSprintf(h, qfmt, NULL, NULL, &msg);
-    if (s == NULL)
-	rpmrepoError(1, _("headerSprintf(%s): %s"), qfmt, msg);
-assert(s != NULL);
-    return s;
+    const char * s = NULL;
+
+    if (*progp == NULL)
+	*progp = headerSprintfCompile(qfmt, NULL, NULL, &msg);
+    if (*progp != NULL)
+	s = headerSprintfExec(*progp, h, &msg);
+    if (s == NULL) {
+	char * t;
+	if (msg == NULL)
+	    msg = "";
+	t = xmalloc(sizeof("headerSprintf(): ") + strlen(qfmt) + strlen(msg));
+	(void) sprintf(t, "headerSprintf(%s): %s", qfmt, msg);
+	*errp = t;
+	return NULL;
+    }
+    return xstrdup(s);
 }
 
 #if defined(WITH_SQLITE)
 /**
  * Return header query, with "XXX" replaced by rpmdb header instance.
+ * @retval *progp	compiled query format (lazily created)
  * @param h		header
  * @param qfmt		query format
- * @return		query format result
+ * @retval *errp	error message (malloc'ed, on failure)
+ * @return		query format result (NULL on failure)
  */
-static const char * rfileHeaderSprintfHack(Header h, const char * qfmt)
-	/*@globals fileSystem @*/
-	/*@modifies h, fileSystem @*/
+/*@null@*/
+static const char * rfileHeaderSprintfHack(headerSprintfProg * progp, Header h,
+		const char * qfmt, /*@out@*/ const char ** errp)
+	/*@modifies *progp, h, *errp @*/
 {
     static const char mark[] = "'XXX'";
     static size_t nmark = sizeof("'XXX'") - 1;
-    const char * msg = NULL;
-    char * s = (char *) headerSprintf(h, qfmt, NULL, NULL, &msg);
+    char * s = (char *) rfileHeaderSprintf(progp, h, qfmt, errp);
     char * f, * fe;
     int nsubs = 0;
 
     if (s == NULL)
-	rpmrepoError(1, _("headerSprintf(%s): %s"), qfmt, msg);
-assert(s != NULL);
+	return NULL;
 
     /* XXX Find & replace 'XXX' with '%{DBINSTANCE}' the hard way. */
 /*@-nullptrarith@*/
@@ -1486,81 +1511,741 @@ assert(s != NULL);
 }
 #endif
 
+/**
+ * Render a single package's metadata for a repository metadata file.
+ * @param repo		repository
+ * @param rfile		repository metadata file (compiled formats are cached)
+ * @param h		header
+ * @retval *xmlp	xml fragment (NULL if none)
+ * @retval *sqlp	sqlite3 command (NULL if none)
+ * @retval *errp	error message (malloc'ed, on failure)
+ * @return		0 on success
+ */
+static int rpmrepoRenderMDFile(rpmrepo repo, rpmrfile rfile, Header h,
+		/*@out@*/ const char ** xmlp, /*@out@*/ const char ** sqlp,
+		/*@out@*/ const char ** errp)
+	/*@modifies rfile, h, *xmlp, *sqlp, *errp @*/
+{
+    *xmlp = NULL;
+    *sqlp = NULL;
+
+    if (rfile->xml_qfmt != NULL
+     && (*xmlp = rfileHeaderSprintf(&rfile->xml_prog, h, rfile->xml_qfmt,
+				errp)) == NULL)
+	return 1;
+
+#if defined(WITH_SQLITE)
+    if (REPO_ISSET(DATABASE)
+     && (*sqlp = rfileHeaderSprintfHack(&rfile->sql_prog, h, rfile->sql_qfmt,
+				errp)) == NULL)
+	return 1;
+#endif
+    return 0;
+}
+
 /**
  * Export a single package's metadata to repository metadata file(s).
  * @param repo		repository
  * @param rfile		repository metadata file
- * @param h		header
+ * @param xml		xml fragment (NULL if none)
+ * @param sql		sqlite3 command (NULL if none)
  * @return		0 on success
  */
-static int rpmrepoWriteMDFile(rpmrepo repo, rpmrfile rfile, Header h)
+static int rpmrepoWriteMDFile(rpmrepo repo, rpmrfile rfile,
+		/*@only@*/ /*@null@*/ const char * xml,
+		/*@only@*/ /*@null@*/ const char * sql)
 	/*@globals fileSystem @*/
-	/*@modifies rfile, h, fileSystem @*/
+	/*@modifies rfile, fileSystem @*/
 {
     int rc = 0;
 
-    if (rfile->xml_qfmt != NULL) {
-	if (rpmrfileXMLWrite(rfile, rfileHeaderSprintf(h, rfile->xml_qfmt)))
-	    rc = 1;
-    }
+    if (xml != NULL && rpmrfileXMLWrite(rfile, xml))
+	rc = 1;
 
 #if defined(WITH_SQLITE)
-    if (REPO_ISSET(DATABASE)) {
-	if (rpmrfileSQLWrite(rfile, rfileHeaderSprintfHack(h, rfile->sql_qfmt)))
-	    rc = 1;
+    if (sql != NULL && rpmrfileSQLWrite(rfile, sql))
+	rc = 1;
+#else
+    sql = _free(sql);
+#endif
+
+    return rc;
+}
+
+/**
+ * A package being rendered.
+ */
+typedef struct rpmrjob_s * rpmrjob;
+
+/**
+ * A package being rendered.
+ */
+struct rpmrjob_s {
+/*@only@*/ /*@null@*/
+    const char * xml[3];	/*!< primary/filelists/other xml. */
+/*@only@*/ /*@null@*/
+    const char * sql[3];	/*!< primary/filelists/other sqlite3. */
+/*@only@*/ /*@null@*/
+    const char * digest;	/*!< Package file digest. */
+    uint64_t size;		/*!< Package file st_size. */
+    int64_t mtime;		/*!< Package file st_mtime. */
+    uint64_t ino;		/*!< Package file st_ino. */
+    int cached;			/*!< Rendered from the fragment cache? */
+    int rc;			/*!< 1 if header read or rendering failed. */
+/*@only@*/ /*@null@*/
+    const char * errmsg;	/*!< Rendering error (reported by the writer). */
+    int done;			/*!< Is the job rendered? */
+};
+
+/**
+ * Package fragment cache (for --update).
+ *
+ * The cache is a flat, native endian file, ".repocache" in the output
+ * directory (i.e. not published with the repodata), that is mmap'ed while
+ * regenerating metadata. After a header identifying the cache format
+ * version and rendering parameters (including a digest of the query
+ * formats), each package has an 8 byte aligned record
+ *	struct rpmrcrec_s, path, digest, primary, filelists, other
+ * with the strings NUL terminated, and empty strings stored as length 0.
+ * Records are keyed by (path, size, mtime, inode): a matching package is
+ * exported from the cached fragments, without reading the header or
+ * computing the package digest. A new cache is written for every --update
+ * run, and renamed over the previous cache when complete.
+ */
+#define	RPMRCACHE_MAGIC		"rpmrepo\001"
+#define	RPMRCACHE_VERSION	2
+#define	RPMRCACHE_FILE		".repocache"
+#define	RPMRCACHE_ALIGN(_n)	(((_n) + 7) & ~((size_t)7))
+
+typedef struct rpmrcache_s * rpmrcache;
+
+/**
+ * Package fragment cache record.
+ */
+struct rpmrcrec_s {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t ino;
+    uint32_t len[5];		/*!< path/digest/primary/filelists/other. */
+    uint32_t pad;
+};
+
+/**
+ * Package fragment cache.
+ */
+struct rpmrcache_s {
+/*@relnull@*/
+    void * map;			/*!< Previous cache (mmap'ed). */
+    size_t nmap;
+/*@null@*/
+    hashTable ht;		/*!< Previous cache records, keyed by path. */
+/*@null@*/
+    FD_t fd;			/*!< Next cache. */
+/*@only@*/
+    const char * fn;		/*!< Cache file. */
+/*@only@*/
+    const char * key;		/*!< Rendering parameters. */
+    unsigned hits;
+};
+
+/**
+ * Load the previous package fragment cache.
+ * @param repo		repository
+ * @param cache		package fragment cache
+ * @param fn		previous cache file
+ */
+static void rpmrcacheLoad(rpmrepo repo, rpmrcache cache, const char * fn)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies cache, fileSystem, internalState @*/
+{
+    size_t nkey = strlen(cache->key) + 1;
+    struct stat sb, *st = &sb;
+    const char * b;
+    const char * be;
+    size_t off;
+    int fdno;
+
+    if ((fdno = open(fn, O_RDONLY)) < 0)
+	return;
+    if (fstat(fdno, st) == 0 && st->st_size > 0) {
+	cache->map = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED,
+			fdno, 0);
+	if (cache->map != (void *)-1)
+	    cache->nmap = (size_t)st->st_size;
+	else
+	    cache->map = NULL;
     }
+    (void) close(fdno);
+    if (cache->map == NULL)
+	return;
+
+    b = cache->map;
+    be = b + cache->nmap;
+
+    /* Discard caches rendered with different parameters. */
+    off = sizeof(RPMRCACHE_MAGIC) - 1;
+    if (cache->nmap < off + nkey || memcmp(b, RPMRCACHE_MAGIC, off)
+     || memcmp(b + off, cache->key, nkey))
+    {
+	if (!repo->quiet)
+	    rpmrepoError(0, _("Ignoring stale package cache %s"), fn);
+	return;
+    }
+    off = RPMRCACHE_ALIGN(off + nkey);
+
+    cache->ht = htCreate(repo->pkgcount + 1, 0, 0, NULL, NULL);
+    while (off + sizeof(struct rpmrcrec_s) <= cache->nmap) {
+	const struct rpmrcrec_s * rec = (const void *)(b + off);
+	const char * s = (const char *)(rec + 1);
+	size_t nb = sizeof(*rec);
+	int i;
+
+	/* Each string must be NUL terminated within the file. */
+	for (i = 0; i < 5; i++) {
+	    if (rec->len[i] > (size_t)(be - (b + off)) - nb)
+		break;
+	    nb += rec->len[i];
+	    if (rec->len[i] > 0 && s[rec->len[i] - 1] != '\0')
+		break;
+	    s += rec->len[i];
+	}
+	if (i < 5 || rec->len[0] == 0) {
+	    if (!repo->quiet)
+		rpmrepoError(0, _("Truncated package cache %s"), fn);
+	    break;
+	}
+	htAddEntry(cache->ht, b + off + sizeof(*rec), rec);
+	off += RPMRCACHE_ALIGN(nb);
+    }
+}
+
+/**
+ * Create a package fragment cache.
+ * @param repo		repository
+ * @return		new package fragment cache
+ */
+/*@only@*/
+static rpmrcache rpmrcacheNew(rpmrepo repo)
+	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrcache cache = xcalloc(1, sizeof(*cache));
+    const char * baseurl = (repo->baseurl ? repo->baseurl : "");
+    const char * qdigest = NULL;
+    const char * fn;
+    DIGEST_CTX ctx;
+    char * t;
+
+    /* Fragments change with the query formats, e.g. on rpm upgrades. */
+    ctx = rpmDigestInit(PGPHASHALGO_SHA1, RPMDIGEST_NONE);
+    if (repo->primary.xml_qfmt != NULL)
+	(void) rpmDigestUpdate(ctx, repo->primary.xml_qfmt,
+			strlen(repo->primary.xml_qfmt) + 1);
+    if (repo->filelists.xml_qfmt != NULL)
+	(void) rpmDigestUpdate(ctx, repo->filelists.xml_qfmt,
+			strlen(repo->filelists.xml_qfmt) + 1);
+    if (repo->other.xml_qfmt != NULL)
+	(void) rpmDigestUpdate(ctx, repo->other.xml_qfmt,
+			strlen(repo->other.xml_qfmt) + 1);
+    (void) rpmDigestFinal(ctx, &qdigest, NULL, 1);
+
+    t = xmalloc(strlen(repo->markup) + strlen(baseurl) + strlen(qdigest) + 48);
+    (void) sprintf(t, "%u %s %u %s %s", (unsigned)RPMRCACHE_VERSION,
+		repo->markup, (unsigned)repo->pkgalgo, qdigest, baseurl);
+    cache->key = t;
+    qdigest = _free(qdigest);
+
+    cache->fn = rpmGetPath(repo->outputdir, "/", RPMRCACHE_FILE, NULL);
+
+    /* XXX sqlite3 commands embed the header instance, render them anyways. */
+    if (!REPO_ISSET(DATABASE))
+	rpmrcacheLoad(repo, cache, cache->fn);
+
+    fn = rpmGetPath(cache->fn, ".new", NULL);
+    cache->fd = Fopen(fn, "w.ufdio");
+    if (cache->fd == NULL || Ferror(cache->fd)) {
+	rpmrepoError(0, _("Fopen(%s): %s"), fn, Fstrerror(cache->fd));
+	if (cache->fd != NULL)
+	    (void) Fclose(cache->fd);
+	cache->fd = NULL;
+    } else {
+	static const char zero[8];
+	size_t nb = sizeof(RPMRCACHE_MAGIC) - 1 + strlen(cache->key) + 1;
+	(void) Fwrite(RPMRCACHE_MAGIC, 1, sizeof(RPMRCACHE_MAGIC) - 1, cache->fd);
+	(void) Fwrite(cache->key, 1, strlen(cache->key) + 1, cache->fd);
+	if (RPMRCACHE_ALIGN(nb) > nb)
+	    (void) Fwrite(zero, 1, RPMRCACHE_ALIGN(nb) - nb, cache->fd);
+    }
+    fn = _free(fn);
+
+    return cache;
+}
+
+/**
+ * Destroy a package fragment cache.
+ * @param repo		repository
+ * @param cache		package fragment cache
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmrcache rpmrcacheFree(rpmrepo repo, /*@only@*/ rpmrcache cache)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies cache, fileSystem, internalState @*/
+{
+    if (!repo->quiet)
+	rpmrepoError(0, _("Reused %u/%u cached packages"),
+		cache->hits, repo->pkgcount);
+    if (cache->fd != NULL) {
+	const char * fn = rpmGetPath(cache->fn, ".new", NULL);
+	int ferr = Ferror(cache->fd);
+	/* The previous cache stays mapped until it is unmapped below. */
+	if (Fclose(cache->fd) != 0 || ferr || Rename(fn, cache->fn) != 0)
+	    (void) Unlink(fn);
+	fn = _free(fn);
+    }
+    cache->fd = NULL;
+    cache->ht = htFree(cache->ht);
+    if (cache->map != NULL)
+	(void) munmap(cache->map, cache->nmap);
+    cache->map = NULL;
+    cache->key = _free(cache->key);
+    cache->fn = _free(cache->fn);
+    cache = _free(cache);
+    return NULL;
+}
+
+/**
+ * Retrieve a package's fragments from the previous cache.
+ * Thread safe: the previous cache is read-only while rendering.
+ * @param cache		package fragment cache
+ * @param pkg		package file path
+ * @param job		rendered package (st_size/st_mtime/st_ino are set)
+ * @return		1 if cached, 0 otherwise
+ */
+static int rpmrcacheGet(rpmrcache cache, const char * pkg, rpmrjob job)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies job, fileSystem, internalState @*/
+{
+    const struct rpmrcrec_s * rec;
+    const void ** data = NULL;
+    struct stat sb, *st = &sb;
+    const char * s;
+    int i;
+
+    if (Stat(pkg, st) != 0)
+	return 0;
+    job->size = (uint64_t)st->st_size;
+    job->mtime = (int64_t)st->st_mtime;
+    job->ino = (uint64_t)st->st_ino;
+
+    if (cache == NULL || cache->ht == NULL
+     || htGetEntry(cache->ht, pkg, &data, NULL, NULL))
+	return 0;
+    rec = data[0];
+    if (rec->size != job->size || rec->mtime != job->mtime
+     || rec->ino != job->ino)
+	return 0;
+
+    s = (const char *)(rec + 1) + rec->len[0];
+    job->digest = (rec->len[1] > 0 ? xstrdup(s) : NULL);
+    s += rec->len[1];
+    for (i = 0; i < 3; i++) {
+	job->xml[i] = (rec->len[2+i] > 0 ? xstrdup(s) : NULL);
+	s += rec->len[2+i];
+    }
+    return 1;
+}
+
+/**
+ * Append a package's fragments to the next cache.
+ * @param cache		package fragment cache
+ * @param pkg		package file path
+ * @param job		rendered package
+ */
+static void rpmrcachePut(rpmrcache cache, const char * pkg, rpmrjob job)
+	/*@globals fileSystem @*/
+	/*@modifies cache, fileSystem @*/
+{
+    static const char zero[8];
+    struct rpmrcrec_s rec;
+    const char * s[5];
+    size_t nb;
+    int i;
+
+    if (cache == NULL || cache->fd == NULL)
+	return;
+
+    s[0] = pkg;
+    s[1] = job->digest;
+    s[2] = job->xml[0];
+    s[3] = job->xml[1];
+    s[4] = job->xml[2];
+
+    memset(&rec, 0, sizeof(rec));
+    rec.size = job->size;
+    rec.mtime = job->mtime;
+    rec.ino = job->ino;
+    nb = sizeof(rec);
+    for (i = 0; i < 5; i++) {
+	rec.len[i] = (s[i] != NULL && *s[i] != '\0' ? strlen(s[i]) + 1 : 0);
+	nb += rec.len[i];
+    }
+
+    (void) Fwrite(&rec, 1, sizeof(rec), cache->fd);
+    for (i = 0; i < 5; i++) {
+	if (rec.len[i] > 0)
+	    (void) Fwrite(s[i], 1, rec.len[i], cache->fd);
+    }
+    if (RPMRCACHE_ALIGN(nb) > nb)
+	(void) Fwrite(zero, 1, RPMRCACHE_ALIGN(nb) - nb, cache->fd);
+}
+
+/**
+ * Render a single package's metadata, from the cache or the package file.
+ * @param repo		repository
+ * @param ts		transaction set
+ * @param rfiles	primary/filelists/other metadata files
+ * @param pkg		package file path
+ * @param instance	package instance (i.e. 1 + index in pkglist)
+ * @param rlock		rpmReadPackageFile() serialization lock (or NULL)
+ * @param job		rendered package
+ * @return		0 on success
+ */
+static int rpmrepoRenderPkg(rpmrepo repo, rpmts ts, rpmrfile * rfiles,
+		const char * pkg, uint32_t instance, /*@null@*/ yarnLock rlock,
+		rpmrjob job)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies ts, *rfiles, job,
+		rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    Header h;
+    int i;
+
+    if (rpmrcacheGet(repo->cache, pkg, job)) {
+	job->cached = 1;
+	return 0;
+    }
+
+    h = rpmrepoReadHeader(repo, ts, pkg, instance, rlock);
+
+    /* XXX repoReadHeader() displays error. Continuing is foolish */
+    if (h == NULL)
+	return (job->rc = 1);
+
+#ifdef	REFERENCE
+    /* XXX todo: rpmGetPath(mydir, "/", filematrix[mydir], NULL); */
+    reldir = (pkgpath != NULL ? pkgpath : rpmGetPath(repo->basedir, "/", repo->directories[0], NULL));
+    self.primaryfile.write(po.do_primary_xml_dump(reldir, baseurl=repo->baseurl))
+    self.flfile.write(po.do_filelists_xml_dump())
+    self.otherfile.write(po.do_other_xml_dump())
 #endif
 
+    for (i = 0; i < 3; i++) {
+	if (rpmrepoRenderMDFile(repo, rfiles[i], h, &job->xml[i], &job->sql[i],
+			&job->errmsg))
+	{
+	    job->rc = 1;
+	    break;
+	}
+    }
+    if (job->rc == 0 && headerGetDigest(h) != NULL)
+	job->digest = xstrdup(headerGetDigest(h));
+
+    (void) headerFree(h);
+    h = NULL;
+    return job->rc;
+}
+
+/**
+ * Release a rendered package's fragments.
+ * @param job		rendered package
+ */
+static void rpmrjobClean(rpmrjob job)
+	/*@modifies job @*/
+{
+    int i;
+
+    for (i = 0; i < 3; i++) {
+	job->xml[i] = _free(job->xml[i]);
+	job->sql[i] = _free(job->sql[i]);
+    }
+    job->digest = _free(job->digest);
+    job->errmsg = _free(job->errmsg);
+}
+
+/**
+ * Export a single package's rendered metadata, displaying progress.
+ * Rendering errors are reported here, i.e. by the writer.
+ * @param repo		repository
+ * @param pkg		package file path
+ * @param job		rendered package
+ * @return		0 on success
+ */
+static int rpmrepoWritePkg(rpmrepo repo, const char * pkg, rpmrjob job)
+	/*@globals fileSystem @*/
+	/*@modifies repo, job, fileSystem @*/
+{
+    rpmrcache cache = repo->cache;
+    int rc = 0;
+
+    if (job->rc) {
+	if (job->errmsg != NULL)
+	    rpmrepoError(0, "%s", job->errmsg);
+	rpmrjobClean(job);
+	return 1;
+    }
+
+    if (cache != NULL) {
+	if (job->cached)
+	    cache->hits++;
+	rpmrcachePut(cache, pkg, job);
+    }
+
+    /* XXX all fragments are consumed, even after a write failure. */
+    if (rpmrepoWriteMDFile(repo, &repo->primary, job->xml[0], job->sql[0]))
+	rc = 1;
+    if (rpmrepoWriteMDFile(repo, &repo->filelists, job->xml[1], job->sql[1]))
+	rc = 1;
+    if (rpmrepoWriteMDFile(repo, &repo->other, job->xml[2], job->sql[2]))
+	rc = 1;
+    job->xml[0] = job->xml[1] = job->xml[2] = NULL;
+    job->sql[0] = job->sql[1] = job->sql[2] = NULL;
+    rpmrjobClean(job);
+
+    if (rc == 0 && !repo->quiet) {
+	if (repo->verbose)
+	    rpmrepoError(0, "%d/%d - %s", repo->current, repo->pkgcount, pkg);
+	else
+	    rpmrepoProgress(repo, pkg, repo->current, repo->pkgcount);
+    }
     return rc;
 }
 
+#if defined(WITH_PTHREADS)
 /**
- * Export all package metadata to repository metadata file(s).
+ * Package metadata rendering pipeline.
+ *
+ * Worker threads read, digest and render packages in pkglist order into
+ * per-package jobs, each worker with its own transaction set and compiled
+ * query formats. rpmReadPackageFile() isn't thread safe, so header reads
+ * are serialized; payload digests and rendering run in parallel. Workers
+ * never exit on errors, rendering errors are left in the job for the
+ * writer to report. The calling thread writes the rendered jobs in pkglist
+ * order, so the metadata files are identical to a serial run. Workers run
+ * at most RPMRP_NJOBS per thread ahead of the writer.
+ *
+ * All pipeline state is protected by a single yarn lock, whose value is
+ * bumped on every change.
+ */
+#define	RPMRP_NJOBS	16	/* max. rendered jobs per thread */
+
+typedef struct rpmrpipe_s * rpmrpipe;
+
+/**
+ * Package metadata rendering pipeline.
+ */
+struct rpmrpipe_s {
+    yarnLock lock;		/*!< Pipeline state (bumped on change). */
+    yarnLock rlock;		/*!< Serializes rpmReadPackageFile(). */
+/*@dependent@*/
+    rpmrepo repo;
+    int nthreads;
+    yarnThread * threads;	/*!< Worker threads. */
+    rpmrjob jobs;		/*!< One job per pkglist entry. */
+    unsigned njobs;
+    unsigned next;		/*!< Next job to render. */
+    unsigned nwritten;		/*!< No. of jobs written. */
+    int stop;			/*!< Are the threads to exit? */
+};
+
+/**
+ * Worker thread: read and render packages until done or stopped.
+ * @param _rpipe	rendering pipeline
+ */
+static void rpmrpipeWorker(void * _rpipe)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies _rpipe, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrpipe rpipe = _rpipe;
+    rpmrepo repo = rpipe->repo;
+    unsigned window = RPMRP_NJOBS * rpipe->nthreads;
+    rpmts ts = rpmtsCreate();
+    struct rpmrfile_s rfiles[3];
+    rpmrfile rfilep[3];
+    int i;
+
+    (void) rpmtsSetVSFlags(ts, rpmtsVSFlags(repo->_ts));
+
+    /* Private copies of the metadata files hold private compiled formats. */
+    rfiles[0] = repo->primary;		/* structure assignment */
+    rfiles[1] = repo->filelists;	/* structure assignment */
+    rfiles[2] = repo->other;		/* structure assignment */
+    for (i = 0; i < 3; i++) {
+	rfiles[i].xml_prog = NULL;
+	rfiles[i].sql_prog = NULL;
+	rfilep[i] = &rfiles[i];
+    }
+
+    for (;;) {
+	rpmrjob job;
+	unsigned ix;
+
+	yarnPossess(rpipe->lock);
+	while (!rpipe->stop && rpipe->next < rpipe->njobs
+	    && rpipe->next >= rpipe->nwritten + window)
+	    yarnWaitFor(rpipe->lock, NOT_TO_BE, yarnPeekLock(rpipe->lock));
+	if (rpipe->stop || rpipe->next >= rpipe->njobs) {
+	    yarnRelease(rpipe->lock);
+	    break;
+	}
+	ix = rpipe->next++;
+	yarnRelease(rpipe->lock);
+
+	job = rpipe->jobs + ix;
+	(void) rpmrepoRenderPkg(repo, ts, rfilep, repo->pkglist[ix],
+			(uint32_t)ix+1, rpipe->rlock, job);
+
+	yarnPossess(rpipe->lock);
+	job->done = 1;
+	yarnTwist(rpipe->lock, BY, 1);
+    }
+
+    for (i = 0; i < 3; i++) {
+	rfiles[i].xml_prog = headerSprintfFree(rfiles[i].xml_prog);
+	rfiles[i].sql_prog = headerSprintfFree(rfiles[i].sql_prog);
+    }
+    (void) rpmtsFree(ts);
+    ts = NULL;
+}
+
+/**
+ * Create a rendering pipeline, launching the worker threads.
+ * @param repo		repository
+ * @return		new rendering pipeline
+ */
+static rpmrpipe rpmrpipeNew(rpmrepo repo)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    rpmrpipe rpipe = xcalloc(1, sizeof(*rpipe));
+    int i;
+
+    rpipe->lock = yarnNewLock(0);
+    rpipe->rlock = yarnNewLock(0);
+    rpipe->repo = repo;
+    rpipe->njobs = argvCount(repo->pkglist);
+    rpipe->jobs = xcalloc(rpipe->njobs + 1, sizeof(*rpipe->jobs));
+    rpipe->nthreads = repo->workers;
+    rpipe->threads = xcalloc(rpipe->nthreads, sizeof(*rpipe->threads));
+    for (i = 0; i < rpipe->nthreads; i++)
+	rpipe->threads[i] = yarnLaunch(rpmrpipeWorker, rpipe);
+    return rpipe;
+}
+
+/**
+ * Stop the workers, then destroy the rendering pipeline.
+ * @param rpipe		rendering pipeline
+ * @return		NULL always
+ */
+/*@null@*/
+static rpmrpipe rpmrpipeFree(/*@only@*/ rpmrpipe rpipe)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies rpipe, fileSystem, internalState @*/
+{
+    unsigned ix;
+    int i;
+
+    yarnPossess(rpipe->lock);
+    rpipe->stop = 1;
+    yarnTwist(rpipe->lock, BY, 1);
+    for (i = 0; i < rpipe->nthreads; i++)
+	rpipe->threads[i] = yarnJoin(rpipe->threads[i]);
+    rpipe->threads = _free(rpipe->threads);
+
+    /* Discard anything rendered but not written (i.e. after an error). */
+    for (ix = 0; ix < rpipe->njobs; ix++)
+	rpmrjobClean(rpipe->jobs + ix);
+    rpipe->jobs = _free(rpipe->jobs);
+    rpipe->rlock = yarnFreeLock(rpipe->rlock);
+    rpipe->lock = yarnFreeLock(rpipe->lock);
+    rpipe = _free(rpipe);
+    return NULL;
+}
+
+/**
+ * Export all package metadata, rendering packages on worker threads.
  * @param repo		repository
  * @return		0 on success
  */
-static int repoWriteMetadataDocs(rpmrepo repo)
+static int rpmrpipeWriteMetadataDocs(rpmrepo repo)
 	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
 	/*@modifies repo, rpmGlobalMacroContext, fileSystem, internalState @*/
 {
-    const char ** pkglist = repo->pkglist;
-    const char * pkg;
+    rpmrpipe rpipe = rpmrpipeNew(repo);
+    unsigned ix;
     int rc = 0;
 
-    if (pkglist)
-    while ((pkg = *pkglist++) != NULL) {
-	Header h = rpmrepoReadHeader(repo, pkg);
+    for (ix = 0; ix < rpipe->njobs; ix++) {
+	rpmrjob job = rpipe->jobs + ix;
+
+	yarnPossess(rpipe->lock);
+	while (!job->done)
+	    yarnWaitFor(rpipe->lock, NOT_TO_BE, yarnPeekLock(rpipe->lock));
+	yarnRelease(rpipe->lock);
 
 	repo->current++;
 
-	/* XXX repoReadHeader() displays error. Continuing is foolish */
-	if (h == NULL) {
+	if (rpmrepoWritePkg(repo, repo->pkglist[ix], job)) {
 	    rc = 1;
 	    break;
 	}
 
-#ifdef	REFERENCE
-	/* XXX todo: rpmGetPath(mydir, "/", filematrix[mydir], NULL); */
-	reldir = (pkgpath != NULL ? pkgpath : rpmGetPath(repo->basedir, "/", repo->directories[0], NULL));
-	self.primaryfile.write(po.do_primary_xml_dump(reldir, baseurl=repo->baseurl))
-	self.flfile.write(po.do_filelists_xml_dump())
-	self.otherfile.write(po.do_other_xml_dump())
+	yarnPossess(rpipe->lock);
+	rpipe->nwritten++;
+	yarnTwist(rpipe->lock, BY, 1);
+    }
+
+    rpipe = rpmrpipeFree(rpipe);
+    return rc;
+}
+#endif	/* WITH_PTHREADS */
+
+/**
+ * Export all package metadata to repository metadata file(s).
+ * @param repo		repository
+ * @return		0 on success
+ */
+static int repoWriteMetadataDocs(rpmrepo repo)
+	/*@globals h_errno, rpmGlobalMacroContext, fileSystem, internalState @*/
+	/*@modifies repo, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    rpmrfile rfiles[3];
+    const char ** pkglist = repo->pkglist;
+    const char * pkg;
+    int rc = 0;
+
+#if defined(WITH_PTHREADS)
+    if (repo->workers > 1 && pkglist != NULL)
+	return rpmrpipeWriteMetadataDocs(repo);
 #endif
 
-	if (rpmrepoWriteMDFile(repo, &repo->primary, h)
-	 || rpmrepoWriteMDFile(repo, &repo->filelists, h)
-	 || rpmrepoWriteMDFile(repo, &repo->other, h))
-	    rc = 1;
+    rfiles[0] = &repo->primary;
+    rfiles[1] = &repo->filelists;
+    rfiles[2] = &repo->other;
 
-	(void) headerFree(h);
-	h = NULL;
-	if (rc) break;
+    if (pkglist)
+    while ((pkg = *pkglist++) != NULL) {
+	struct rpmrjob_s job;
 
-	if (!repo->quiet) {
-	    if (repo->verbose)
-		rpmrepoError(0, "%d/%d - %s", repo->current, repo->pkgcount, pkg);
-	    else
-		rpmrepoProgress(repo, pkg, repo->current, repo->pkgcount);
+	memset(&job, 0, sizeof(job));
+	(void) rpmrepoRenderPkg(repo, repo->_ts, rfiles, pkg,
+			(uint32_t)repo->current+1, NULL, &job);
+
+	repo->current++;
+
+	if (rpmrepoWritePkg(repo, pkg, &job)) {
+	    rc = 1;
+	    break;
 	}
     }
     return rc;
@@ -1628,8 +2313,12 @@ int rpmrepoDoPkgMetadata(rpmrepo repo)
     repo->baseurl = self._getFragmentUrl(repo->baseurl, 1)
 #endif
 
+    if (REPO_ISSET(UPDATE))
+	repo->cache = rpmrcacheNew(repo);
     if (repoWriteMetadataDocs(repo))
 	rc = 1;
+    if (repo->cache != NULL)
+	repo->cache = rpmrcacheFree(repo, repo->cache);
 
     if (!repo->quiet)
 	fprintf(stderr, "\n");
@@ -1696,6 +2385,10 @@ static struct poptOption _rpmrepoOptions[] = {
 	N_("<dir> = optional directory to output to"), N_("DIR") },
  { "skip-symlinks", 'S', POPT_BIT_SET,		&__repo.flags, REPO_FLAGS_NOFOLLOW,
 	N_("ignore symlinks of packages"), NULL },
+ { "workers", '\0', POPT_ARG_INT,		&__repo.workers, 0,
+	N_("read and render packages using N threads"), N_("N") },
+ { "update", '\0', POPT_BIT_SET,		&__repo.flags, REPO_FLAGS_UPDATE,
+	N_("reuse cached metadata for unchanged packages"), NULL },
  { "unique-md-filenames", '\0', POPT_BIT_SET|POPT_ARGFLAG_DOC_HIDDEN, &__repo.flags, REPO_FLAGS_UNIQUEMDFN,
 	N_("include the file's checksum in the filename, helps with proxies"), NULL },
 
@@ -1860,6 +2553,12 @@ static void rpmrepoFini(void * _repo)
     repo->other.Zdigest = _free(repo->other.Zdigest);
     repo->repomd.digest = _free(repo->repomd.digest);
     repo->repomd.Zdigest = _free(repo->repomd.Zdigest);
+    repo->primary.xml_prog = headerSprintfFree(repo->primary.xml_prog);
+    repo->primary.sql_prog = headerSprintfFree(repo->primary.sql_prog);
+    repo->filelists.xml_prog = headerSprintfFree(repo->filelists.xml_prog);
+    repo->filelists.sql_prog = headerSprintfFree(repo->filelists.sql_prog);
+    repo->other.xml_prog = headerSprintfFree(repo->other.xml_prog);
+    repo->other.sql_prog = headerSprintfFree(repo->other.sql_prog);
     repo->outputdir = _free(repo->outputdir);
     repo->pkglist = argvFree(repo->pkglist);
     repo->directories = argvFree(repo->directories);
@@ -70,6 +70,10 @@ struct rpmrfile_s {
 /*@null@*/
     const char * Zdigest;
     time_t ctime;
+/*@only@*/ /*@null@*/
+    struct headerSprintfProg_s * xml_prog;	/*!< Compiled xml_qfmt. */
+/*@only@*/ /*@null@*/
+    struct headerSprintfProg_s * sql_prog;	/*!< Compiled sql_qfmt. */
 };
 
 /**
@@ -89,8 +93,9 @@ typedef enum rpmrepoFlags_e {
     REPO_FLAGS_SPLIT		= _RFB( 4), /*!<    --split ... */
     REPO_FLAGS_NOFOLLOW		= _RFB( 5), /*!< -S,--skip-symlinks ... */
     REPO_FLAGS_UNIQUEMDFN	= _RFB( 6), /*!<    --unique-md-filenames ... */
+    REPO_FLAGS_UPDATE		= _RFB( 7), /*!<    --update ... */
 
-	/* 7-31 unused */
+	/* 8-31 unused */
 } rpmrepoFlags;
 
 #define REPO_ISSET(_FLAG) ((repo->flags & ((REPO_FLAGS_##_FLAG) & ~0x40000000)) != REPO_FLAGS_NONE)
@@ -151,6 +156,9 @@ struct rpmrepo_s {
     uint32_t pkgalgo;
     uint32_t algo;
     int compression;
+    int workers;		/*!< No. of package rendering threads. */
+/*@null@*/
+    struct rpmrcache_s * cache;	/*!< Package fragment cache. */
 /*@observer@*/
     const char * markup;
 /*@observer@*/ /*@null@*/
@@ -132,6 +132,10 @@ typedef /*@abstract@*/ struct headerTagIndices_s * headerTagIndices;
  */
 typedef /*@abstract@*/ const struct headerSprintfExtension_s * headerSprintfExtension;
 
+/** \ingroup header
+ */
+typedef /*@abstract@*/ struct headerSprintfProg_s * headerSprintfProg;
+
 /**
  * Pseudo-tags used by the rpmdb and rpmgi iterator API's.
  */
@@ -568,44 +572,32 @@ extern headerTagIndices rpmTags;
  */
 #if !defined(SWIG)
 struct headerTagIndices_s {
-/*@relnull@*/
-    int (*loadIndex) (headerTagTableEntry ** ipp, size_t * np,
-                int (*cmp) (const void * avp, const void * bvp))
-        /*@ modifies *ipp, *np */;	/*!< Load sorted tag index. */
-/*@relnull@*/
-    headerTagTableEntry * byName;	/*!< rpmTag's sorted by name. */
-    size_t byNameSize;			/*!< No. of entries. */
-    int (*byNameCmp) (const void * avp, const void * bvp)
-        /*@*/;				/*!< Compare entries by name. */
     rpmTag (*tagValue) (const char * name)
 	/*@*/;				/*!< Return value from name. */
-/*@relnull@*/
-    headerTagTableEntry * byValue;	/*!< rpmTag's sorted by value. */
-    size_t byValueSize;			/*!< No. of entries. */
-    int (*byValueCmp) (const void * avp, const void * bvp)
-        /*@*/;				/*!< Compare entries by value. */
     const char * (*tagName) (rpmTag value)
 	/*@*/;				/*!< Return name from value. */
     rpmTag (*tagType) (rpmTag value)
 	/*@*/;				/*!< Return type from value. */
-    size_t nameBufLen;			/*!< No. bytes allocated for nameBuf. */
 /*@relnull@*/
     const char ** aTags;		/*!< Arbitrary tags array (ARGV_t) */
-/*@owned@*/ /*@null@*/
-    char * nameBuf;			/* Name buffer. */
 /*@only@*/
     char * (*tagCanonicalize) (const char * s)
 	/*@*/;				/*!< Canonicalize arbitrary string. */
     rpmTag (*tagGenerate) (const char * s)
 	/*@*/;				/*!< Generate tag from string. */
+/*@owned@*/ /*@null@*/
+    struct tagHash_s * tagHash;		/*!< Tag name/value hash indices. */
 };
 #endif
 #endif	/* _RPMTAG_INTERNAL */
 
 /**
  * Return tag name from value.
+ * @note Known names are valid (and unchanged) until tagClean(), the
+ * "Tag_0x%08x" of an unknown tag is in a per-thread buffer, so tagName()
+ * is thread-safe.
  * @param tag		tag value
- * @return		tag name, "(unknown)" on not found
+ * @return		tag name, "Tag_0x%08x" on not found
  */
 /*@observer@*/
 const char * tagName(rpmTag tag)
@@ -756,6 +748,49 @@ char * headerSprintf(Header h, const char * fmt,
 	/*@globals headerCompoundFormats, fileSystem, internalState @*/
 	/*@modifies h, *errmsg, fileSystem, internalState @*/;
 
+/** \ingroup header
+ * Compile a query format for repeated use with headerSprintfExec().
+ * Tag and extension names are resolved once, here, rather than per header.
+ *
+ * @param fmt		format to use
+ * @param tags		array of tag name/value/type triples (NULL uses default)
+ * @param exts		formatting extensions chained table (NULL uses default)
+ * @retval errmsg	error message (if any)
+ * @return		compiled query format (NULL on parse error)
+ */
+/*@only@*/ /*@null@*/
+headerSprintfProg headerSprintfCompile(const char * fmt,
+		/*@null@*/ headerTagTableEntry tags,
+		/*@null@*/ headerSprintfExtension exts,
+		/*@null@*/ /*@out@*/ errmsg_t * errmsg)
+	/*@globals headerCompoundFormats @*/
+	/*@modifies *errmsg @*/;
+
+/** \ingroup header
+ * Return formatted output string from header tags using a compiled format.
+ * The returned string is owned by the compiled format, and is valid only
+ * until the next headerSprintfExec() or headerSprintfFree() call.
+ *
+ * @param prog		compiled query format
+ * @param h		header
+ * @retval errmsg	error message (if any)
+ * @return		formatted output string (NULL on error)
+ */
+/*@observer@*/ /*@null@*/
+const char * headerSprintfExec(headerSprintfProg prog, Header h,
+		/*@null@*/ /*@out@*/ errmsg_t * errmsg)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies prog, h, *errmsg, fileSystem, internalState @*/;
+
+/** \ingroup header
+ * Destroy a compiled query format.
+ * @param prog		compiled query format
+ * @return		NULL always
+ */
+/*@null@*/
+headerSprintfProg headerSprintfFree(/*@only@*/ /*@null@*/ headerSprintfProg prog)
+	/*@modifies prog @*/;
+
 /** \ingroup header
  * Retrieve extension or tag value from a header.
  *
@@ -927,6 +962,19 @@ Header headerLoad(/*@kept@*/ void * uh)
 	/*@globals fileSystem, internalState @*/
 	/*@modifies uh, fileSystem, internalState @*/;
 
+/** \ingroup header
+ * Convert header to in-memory representation, decoding tags on demand.
+ * The tag index is sanity checked but not decoded: tag lookups find and
+ * swab single entries from the blob until the header is modified, sorted
+ * or iterated, when the tag index is decoded as with headerLoad().
+ * @param uh		on-disk header blob (i.e. with offsets)
+ * @return		header
+ */
+/*@null@*/
+Header headerLazyLoad(/*@kept@*/ void * uh)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies uh, fileSystem, internalState @*/;
+
 /** \ingroup header
  * Make a copy and convert header to in-memory representation.
  * @param uh		on-disk header blob (i.e. with offsets)
@@ -14,6 +14,29 @@
 /*@access headerTagTableEntry @*/
 /*@access headerTagIndices @*/
 
+/**
+ * Tag name/value hash indices, built once from rpmTagTable.
+ */
+struct tagHash_s {
+/*@only@*/
+    struct tagHashEntry_s {
+/*@observer@*/
+	const char * name;	/*!< Tag table name (RPMTAG_FOO). */
+/*@only@*/
+	const char * cname;	/*!< Canonical name (Foo). */
+	rpmTag val;		/*!< Tag value. */
+	unsigned int type;	/*!< Tag type. */
+    } * tags;
+    size_t ntags;		/*!< No. of tags. */
+    unsigned int mask;		/*!< No. of slots - 1 (power of 2). */
+/*@only@*/
+    unsigned int * byName;	/*!< Name slots (tags index + 1). */
+/*@only@*/
+    unsigned int * byValue;	/*!< Value slots (tags index + 1). */
+/*@only@*/ /*@null@*/
+    const char ** aTags;	/*!< Arbitrary tags (ARGV_t). */
+};
+
 /**
  * Load/sort arbitrary tags.
  * @retval *argvp	arbitrary tag array
@@ -44,69 +67,6 @@ static int tagLoadATags(/*@null@*/ ARGV_t * argvp,
 /*@=nullstate@*/
 }
 
-/**
- * Compare tag table entries by name.
- * @param *avp		tag table entry a
- * @param *bvp		tag table entry b
- * @return		comparison
- */
-static int tagCmpName(const void * avp, const void * bvp)
-        /*@*/
-{
-    headerTagTableEntry a = *(headerTagTableEntry *) avp;
-    headerTagTableEntry b = *(headerTagTableEntry *) bvp;
-    return strcmp(a->name, b->name);
-}
-
-/**
- * Compare tag table entries by value.
- * @param *avp		tag table entry a
- * @param *bvp		tag table entry b
- * @return		comparison
- */
-static int tagCmpValue(const void * avp, const void * bvp)
-        /*@*/
-{
-    headerTagTableEntry a = *(headerTagTableEntry *) avp;
-    headerTagTableEntry b = *(headerTagTableEntry *) bvp;
-    int ret = ((int)a->val - (int)b->val);
-    /* Make sure that sort is stable, longest name first. */
-    if (ret == 0)
-	ret = ((int)strlen(b->name) - (int)strlen(a->name));
-    return ret;
-}
-
-/**
- * Load/sort a tag index.
- * @retval *ipp		tag index
- * @retval *np		no. of tags
- * @param cmp		sort compare routine
- * @return		0 always
- */
-static int tagLoadIndex(headerTagTableEntry ** ipp, size_t * np,
-		int (*cmp) (const void * avp, const void * bvp))
-	/*@modifies *ipp, *np @*/
-{
-    headerTagTableEntry tte, *ip;
-    size_t n = 0;
-
-    ip = xcalloc(rpmTagTableSize, sizeof(*ip));
-    n = 0;
-/*@-dependenttrans@*/ /*@-observertrans@*/ /*@-castexpose@*/ /*@-mods@*/ /*@-modobserver@*/
-    for (tte = rpmTagTable; tte->name != NULL; tte++) {
-	ip[n] = tte;
-	n++;
-    }
-assert(n == (size_t)rpmTagTableSize);
-/*@=dependenttrans@*/ /*@=observertrans@*/ /*@=castexpose@*/ /*@=mods@*/ /*@=modobserver@*/
-
-    if (n > 1)
-	qsort(ip, n, sizeof(*ip), cmp);
-    *ipp = ip;
-    *np = n;
-    return 0;
-}
-
 static char * _tagCanonicalize(const char * s)
 	/*@*/
 {
@@ -155,6 +115,298 @@ static rpmTag _tagGenerate(const char *s)
     return tag;
 }
 
+/**
+ * Hash a tag name, ignoring case (DJBX33A).
+ * @param s		tag name (without "RPMTAG_")
+ * @return		hash value
+ */
+static unsigned int tagHashName(const char * s)
+	/*@*/
+{
+    unsigned int h = 5381;
+    int c;
+
+    while ((c = (int) *s++) != 0)
+	h = ((h << 5) + h) + (unsigned int) xtolower(c);
+    return h;
+}
+
+/**
+ * Hash a tag value (Fibonacci hashing).
+ * @param tag		tag value
+ * @return		hash value
+ */
+static unsigned int tagHashValue(rpmTag tag)
+	/*@*/
+{
+    unsigned int h = (unsigned int) tag * 0x9e3779b1U;
+    return h ^ (h >> 16);
+}
+
+/**
+ * Find a tag by name.
+ * @param th		tag hash indices
+ * @param s		tag name (without "RPMTAG_")
+ * @return		tag entry (NULL if not found)
+ */
+/*@null@*/ /*@observer@*/
+static const struct tagHashEntry_s * tagHashFindName(struct tagHash_s * th,
+		const char * s)
+	/*@*/
+{
+    unsigned int i = tagHashName(s) & th->mask;
+    unsigned int ix;
+
+    while ((ix = th->byName[i]) != 0) {
+	const struct tagHashEntry_s * t = th->tags + (ix - 1);
+	if (!xstrcasecmp(s, t->name + (sizeof("RPMTAG_")-1)))
+	    return t;
+	i = (i + 1) & th->mask;
+    }
+    return NULL;
+}
+
+/**
+ * Find a tag by value.
+ * @param th		tag hash indices
+ * @param tag		tag value
+ * @return		tag entry (NULL if not found)
+ */
+/*@null@*/ /*@observer@*/
+static const struct tagHashEntry_s * tagHashFindValue(struct tagHash_s * th,
+		rpmTag tag)
+	/*@*/
+{
+    unsigned int i = tagHashValue(tag) & th->mask;
+    unsigned int ix;
+
+    while ((ix = th->byValue[i]) != 0) {
+	const struct tagHashEntry_s * t = th->tags + (ix - 1);
+	if (t->val == tag)
+	    return t;
+	i = (i + 1) & th->mask;
+    }
+    return NULL;
+}
+
+/**
+ * Destroy tag hash indices.
+ * @param th		tag hash indices
+ * @return		NULL always
+ */
+/*@null@*/
+static struct tagHash_s * tagHashFree(/*@only@*/ /*@null@*/ struct tagHash_s * th)
+	/*@modifies th @*/
+{
+    if (th != NULL) {
+	size_t i;
+	for (i = 0; i < th->ntags; i++)
+	    th->tags[i].cname = _free(th->tags[i].cname);
+	th->tags = _free(th->tags);
+	th->byName = _free(th->byName);
+	th->byValue = _free(th->byValue);
+	th->aTags = argvFree(th->aTags);
+	th = _free(th);
+    }
+    return NULL;
+}
+
+/**
+ * Build tag hash indices from rpmTagTable.
+ * @return		tag hash indices
+ */
+/*@only@*/
+static struct tagHash_s * tagHashNew(void)
+	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies rpmGlobalMacroContext, internalState @*/
+{
+    struct tagHash_s * th = xcalloc(1, sizeof(*th));
+    unsigned int nslots = 16;
+    headerTagTableEntry tte;
+    size_t n;
+
+    th->ntags = (size_t) rpmTagTableSize;
+    th->tags = xcalloc(th->ntags + 1, sizeof(*th->tags));
+    while (nslots < 2 * th->ntags)
+	nslots <<= 1;
+    th->mask = nslots - 1;
+    th->byName = xcalloc(nslots, sizeof(*th->byName));
+    th->byValue = xcalloc(nslots, sizeof(*th->byValue));
+
+/*@-dependenttrans@*/ /*@-observertrans@*/ /*@-castexpose@*/ /*@-mods@*/ /*@-modobserver@*/
+    for (tte = rpmTagTable, n = 0; tte->name != NULL; tte++, n++) {
+	struct tagHashEntry_s * t = th->tags + n;
+	unsigned int i;
+	unsigned int ix;
+
+	t->name = tte->name;
+	t->cname = _tagCanonicalize(tte->name);
+	t->val = tte->val;
+	t->type = tte->type;
+
+	i = tagHashName(t->name + (sizeof("RPMTAG_")-1)) & th->mask;
+	while ((ix = th->byName[i]) != 0
+	 && xstrcasecmp(th->tags[ix-1].name, t->name))
+	    i = (i + 1) & th->mask;
+	if (ix == 0)
+	    th->byName[i] = n + 1;
+
+	/* Aliases share a value: the longest name is returned. */
+	i = tagHashValue(t->val) & th->mask;
+	while ((ix = th->byValue[i]) != 0 && th->tags[ix-1].val != t->val)
+	    i = (i + 1) & th->mask;
+	if (ix == 0 || strlen(t->name) > strlen(th->tags[ix-1].name))
+	    th->byValue[i] = n + 1;
+    }
+assert(n == th->ntags);
+/*@=dependenttrans@*/ /*@=observertrans@*/ /*@=castexpose@*/ /*@=mods@*/ /*@=modobserver@*/
+
+    (void) tagLoadATags(&th->aTags, NULL);
+    return th;
+}
+
+/**
+ * Names of registered tags not in rpmTagTable (i.e. arbitrary tags).
+ * Lookup misses are never stored. Entries are never changed or removed
+ * (until tagClean), so the names returned stay valid without holding
+ * the lock.
+ */
+struct tagExtEntry_s {
+    rpmTag tag;			/*!< Tag value. */
+/*@only@*/ /*@null@*/
+    const char * name;		/*!< Tag name (NULL if empty slot). */
+};
+
+/*@unchecked@*/ /*@only@*/ /*@null@*/
+static struct tagExtEntry_s * _tagExt;
+/*@unchecked@*/
+static unsigned int _tagExtMask;
+/*@unchecked@*/
+static unsigned int _tagExtCount;
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_mutex_t _tagExtLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+/**
+ * Register the name of a tag not in rpmTagTable.
+ * @param tag		tag value
+ * @param name		tag name
+ */
+static void tagExtAdd(rpmTag tag, const char * name)
+	/*@globals _tagExt, _tagExtMask, _tagExtCount @*/
+	/*@modifies _tagExt, _tagExtMask, _tagExtCount @*/
+{
+    struct tagExtEntry_s * e;
+    unsigned int i;
+    int xx;
+
+#if defined(WITH_PTHREADS)
+    xx = pthread_mutex_lock(&_tagExtLock);
+#endif
+    if (_tagExt == NULL || 2 * (_tagExtCount + 1) > _tagExtMask + 1) {
+	unsigned int nslots = (_tagExt ? 2 * (_tagExtMask + 1) : 64);
+	struct tagExtEntry_s * ext = xcalloc(nslots, sizeof(*ext));
+	unsigned int j;
+
+	if (_tagExt != NULL)
+	for (j = 0; j <= _tagExtMask; j++) {
+	    if (_tagExt[j].name == NULL)
+		continue;
+	    i = tagHashValue(_tagExt[j].tag) & (nslots - 1);
+	    while (ext[i].name != NULL)
+		i = (i + 1) & (nslots - 1);
+	    ext[i] = _tagExt[j];
+	}
+	_tagExt = _free(_tagExt);
+	_tagExt = ext;
+	_tagExtMask = nslots - 1;
+    }
+
+    i = tagHashValue(tag) & _tagExtMask;
+    while ((e = _tagExt + i)->name != NULL && e->tag != tag)
+	i = (i + 1) & _tagExtMask;
+    if (e->name == NULL) {
+	e->tag = tag;
+	e->name = xstrdup(name);
+	_tagExtCount++;
+    }
+#if defined(WITH_PTHREADS)
+    xx = pthread_mutex_unlock(&_tagExtLock);
+#endif
+}
+
+/**
+ * Return the registered name of a tag not in rpmTagTable.
+ * @param tag		tag value
+ * @return		tag name (NULL if not registered)
+ */
+/*@observer@*/ /*@null@*/
+static const char * tagExtName(rpmTag tag)
+	/*@*/
+{
+    const char * name = NULL;
+    unsigned int i;
+    int xx;
+
+#if defined(WITH_PTHREADS)
+    xx = pthread_mutex_lock(&_tagExtLock);
+#endif
+    if (_tagExt != NULL) {
+	i = tagHashValue(tag) & _tagExtMask;
+	while (_tagExt[i].name != NULL && _tagExt[i].tag != tag)
+	    i = (i + 1) & _tagExtMask;
+	name = _tagExt[i].name;
+    }
+#if defined(WITH_PTHREADS)
+    xx = pthread_mutex_unlock(&_tagExtLock);
+#endif
+    return name;
+}
+
+#define	TAGUNKNOWN_LEN	sizeof("Tag_0x12345678")
+#if defined(WITH_PTHREADS)
+/*@unchecked@*/
+static pthread_key_t _tagUnknownKey;
+/*@unchecked@*/
+static pthread_once_t _tagUnknownOnce = PTHREAD_ONCE_INIT;
+
+static void tagUnknownKeyInit(void)
+	/*@globals _tagUnknownKey @*/
+	/*@modifies _tagUnknownKey @*/
+{
+    (void) pthread_key_create(&_tagUnknownKey, free);
+}
+#else
+/*@unchecked@*/
+static char _tagUnknownBuf[TAGUNKNOWN_LEN];
+#endif
+
+/**
+ * Format the name of an unknown tag in a per-thread buffer.
+ * @param tag		tag value
+ * @return		"Tag_0x%08x"
+ */
+/*@observer@*/
+static const char * tagUnknownName(rpmTag tag)
+	/*@*/
+{
+    char * b;
+    int xx;
+
+#if defined(WITH_PTHREADS)
+    xx = pthread_once(&_tagUnknownOnce, tagUnknownKeyInit);
+    if ((b = pthread_getspecific(_tagUnknownKey)) == NULL) {
+	b = xmalloc(TAGUNKNOWN_LEN);
+	xx = pthread_setspecific(_tagUnknownKey, b);
+    }
+#else
+    b = _tagUnknownBuf;
+#endif
+    xx = snprintf(b, TAGUNKNOWN_LEN, "Tag_0x%08x", (unsigned) tag);
+    return b;
+}
+
 /* forward refs */
 static const char * _tagName(rpmTag tag)
 	/*@globals rpmGlobalMacroContext, h_errno, internalState @*/
@@ -168,10 +420,9 @@ static rpmTag _tagValue(const char * tagstr)
 
 /*@unchecked@*/
 static struct headerTagIndices_s _rpmTags = {
-    tagLoadIndex,
-    NULL, 0, tagCmpName, _tagValue,
-    NULL, 0, tagCmpValue, _tagName, _tagType,
-    256, NULL, NULL, _tagCanonicalize, _tagGenerate
+    _tagValue, _tagName, _tagType,
+    NULL, _tagCanonicalize, _tagGenerate,
+    NULL
 };
 
 /*@-compmempass@*/
@@ -179,133 +430,88 @@ static struct headerTagIndices_s _rpmTags = {
 headerTagIndices rpmTags = &_rpmTags;
 /*@=compmempass@*/
 
-/*@-mods@*/
+/**
+ * Return tag hash indices, building them on first use.
+ * Concurrent first users may each build indices, but only the first
+ * one published (lock-free, compare-and-swap) is kept.
+ * @return		tag hash indices
+ */
+/*@observer@*/
+static struct tagHash_s * tagHashLoad(void)
+	/*@globals _rpmTags, rpmGlobalMacroContext, h_errno, internalState @*/
+	/*@modifies _rpmTags, rpmGlobalMacroContext, internalState @*/
+{
+    struct tagHash_s * th = _rpmTags.tagHash;
+    const char ** av;
+
+    if (th != NULL)
+	return th;
+
+    th = tagHashNew();
+
+    /* Register the arbitrary tag names before publishing the indices. */
+    for (av = th->aTags; av && *av; av++) {
+	char * s = _tagCanonicalize(*av);
+	tagExtAdd(_tagGenerate(s), s);
+	s = _free(s);
+    }
+
+#if defined(WITH_PTHREADS)
+    if (!__sync_bool_compare_and_swap(&_rpmTags.tagHash, NULL, th)) {
+	th = tagHashFree(th);
+	return _rpmTags.tagHash;
+    }
+#else
+    _rpmTags.tagHash = th;
+#endif
+
+    _rpmTags.aTags = th->aTags;
+    return th;
+}
+
 static const char * _tagName(rpmTag tag)
 {
-    char * nameBuf;
-    size_t nameBufLen = 0;
-    headerTagTableEntry t;
-    size_t i, l, u;
-    int comparison;
-    int xx;
-    char *s;
-
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byValue == NULL)
-	xx = tagLoadIndex(&_rpmTags.byValue, &_rpmTags.byValueSize,
-		tagCmpValue);
-    if (_rpmTags.nameBufLen == 0)
-	_rpmTags.nameBufLen = 256;
-    if (_rpmTags.nameBuf == NULL)
-	_rpmTags.nameBuf = xcalloc(1, _rpmTags.nameBufLen);
-    nameBuf = _rpmTags.nameBuf;
-    nameBuf[0] = nameBuf[1] = '\0';
-    nameBufLen = _rpmTags.nameBufLen;
+    struct tagHash_s * th = tagHashLoad();
+    const struct tagHashEntry_s * t;
+    const char * name;
 
     switch (tag) {
-    case RPMDBI_PACKAGES:
-	strncpy(nameBuf, "Packages", nameBufLen);
-	break;
-    case RPMDBI_DEPCACHE:
-	strncpy(nameBuf, "Depcache", nameBufLen);
-	break;
-    case RPMDBI_ADDED:
-	strncpy(nameBuf, "Added", nameBufLen);
-	break;
-    case RPMDBI_REMOVED:
-	strncpy(nameBuf, "Removed", nameBufLen);
-	break;
-    case RPMDBI_AVAILABLE:
-	strncpy(nameBuf, "Available", nameBufLen);
-	break;
-    case RPMDBI_HDLIST:
-	strncpy(nameBuf, "Hdlist", nameBufLen);
-	break;
-    case RPMDBI_ARGLIST:
-	strncpy(nameBuf, "Arglist", nameBufLen);
-	break;
-    case RPMDBI_FTSWALK:
-	strncpy(nameBuf, "Ftswalk", nameBufLen);
-	break;
-    case RPMDBI_SEQNO:
-	strncpy(nameBuf, "Seqno", nameBufLen);
-	break;
-    case RPMDBI_BTREE:
-	strncpy(nameBuf, "Btree", nameBufLen);
-	break;
-    case RPMDBI_HASH:
-	strncpy(nameBuf, "Hash", nameBufLen);
-	break;
-    case RPMDBI_QUEUE:
-	strncpy(nameBuf, "Queue", nameBufLen);
-	break;
-    case RPMDBI_RECNO:
-	strncpy(nameBuf, "Recno", nameBufLen);
-	break;
+    case RPMDBI_PACKAGES:	return "Packages";
+    case RPMDBI_DEPCACHE:	return "Depcache";
+    case RPMDBI_ADDED:		return "Added";
+    case RPMDBI_REMOVED:	return "Removed";
+    case RPMDBI_AVAILABLE:	return "Available";
+    case RPMDBI_HDLIST:		return "Hdlist";
+    case RPMDBI_ARGLIST:	return "Arglist";
+    case RPMDBI_FTSWALK:	return "Ftswalk";
+    case RPMDBI_SEQNO:		return "Seqno";
+    case RPMDBI_BTREE:		return "Btree";
+    case RPMDBI_HASH:		return "Hash";
+    case RPMDBI_QUEUE:		return "Queue";
+    case RPMDBI_RECNO:		return "Recno";
 
     /* XXX make sure rpmdb indices are identically named. */
-    case RPMTAG_CONFLICTS:
-	strncpy(nameBuf, "Conflictname", nameBufLen);
-	break;
-    case RPMTAG_HDRID:
-	strncpy(nameBuf, "Sha1header", nameBufLen);
-	break;
+    case RPMTAG_CONFLICTS:	return "Conflictname";
+    case RPMTAG_HDRID:		return "Sha1header";
 
     /* XXX make sure that h.['filenames'] in python "works". */
-    case 0x54aafb71:
-	strncpy(nameBuf, "Filenames", nameBufLen);
-	break;
+    case 0x54aafb71:		return "Filenames";
 
     default:
-	if (_rpmTags.byValue == NULL)
-	    break;
-	l = 0;
-	u = _rpmTags.byValueSize;
-	while (l < u) {
-	    i = (l + u) / 2;
-	    t = _rpmTags.byValue[i];
-	
-	    comparison = ((int)tag - (int)t->val);
-
-	    if (comparison < 0)
-		u = i;
-	    else if (comparison > 0)
-		l = i + 1;
-	    else {
-		/* Make sure that the bsearch retrieve is stable. */
-		while (i > 0 && tag == _rpmTags.byValue[i-1]->val) {
-		    i--;
-		    t = _rpmTags.byValue[i];
-		}
-		s = (*_rpmTags.tagCanonicalize) (t->name);
-		strncpy(nameBuf, s, nameBufLen);
-		s = _free(s);
-		/*@loopbreak@*/ break;
-	    }
-	}
 	break;
     }
-    if (nameBuf[0] == '\0')
-	xx = snprintf(nameBuf, nameBufLen, "Tag_0x%08x", (unsigned) tag);
-    nameBuf[nameBufLen-1] = '\0';
-/*@-globstate@*/	/* _rpmTags.nameBuf reachable. */
-    return nameBuf;
-/*@=globstate@*/
+
+    if ((t = tagHashFindValue(th, tag)) != NULL)
+	return t->cname;
+    if ((name = tagExtName(tag)) != NULL)
+	return name;
+    return tagUnknownName(tag);
 }
-/*@=mods@*/
 
 static unsigned int _tagType(rpmTag tag)
 {
-    headerTagTableEntry t;
-    size_t i, l, u;
-    int comparison;
-    int xx;
-
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byValue == NULL)
-	xx = tagLoadIndex(&_rpmTags.byValue, &_rpmTags.byValueSize, tagCmpValue);
+    struct tagHash_s * th = tagHashLoad();
+    const struct tagHashEntry_s * t;
 
     switch (tag) {
     case RPMDBI_PACKAGES:
@@ -323,29 +529,8 @@ static unsigned int _tagType(rpmTag tag)
     case RPMDBI_RECNO:
 	break;
     default:
-	if (_rpmTags.byValue == NULL)
-	    break;
-	l = 0;
-	u = _rpmTags.byValueSize;
-	while (l < u) {
-	    i = (l + u) / 2;
-	    t = _rpmTags.byValue[i];
-	
-	    comparison = ((int)tag - (int)t->val);
-
-	    if (comparison < 0)
-		u = i;
-	    else if (comparison > 0)
-		l = i + 1;
-	    else {
-		/* Make sure that the bsearch retrieve is stable. */
-		while (i > 0 && t->val == _rpmTags.byValue[i-1]->val) {
-		    i--;
-		    t = _rpmTags.byValue[i];
-		}
-		return t->type;
-	    }
-	}
+	if ((t = tagHashFindValue(th, tag)) != NULL)
+	    return t->type;
 	break;
     }
     return 0;
@@ -353,12 +538,10 @@ static unsigned int _tagType(rpmTag tag)
 
 static rpmTag _tagValue(const char * tagstr)
 {
-    headerTagTableEntry t;
-    int comparison;
-    size_t i, l, u;
-    const char * s;
+    struct tagHash_s * th;
+    const struct tagHashEntry_s * t;
+    char * s;
     rpmTag tag;
-    int xx;
 
     /* XXX headerSprintf looks up by "RPMTAG_FOO", not "FOO". */
     if (!strncasecmp(tagstr, "RPMTAG_", sizeof("RPMTAG_")-1))
@@ -391,31 +574,11 @@ static rpmTag _tagValue(const char * tagstr)
     if (!xstrcasecmp(tagstr, "Recno"))
 	return RPMDBI_RECNO;
 
-    if (_rpmTags.aTags == NULL)
-	xx = tagLoadATags(&_rpmTags.aTags, NULL);
-    if (_rpmTags.byName == NULL)
-	xx = tagLoadIndex(&_rpmTags.byName, &_rpmTags.byNameSize, tagCmpName);
-    if (_rpmTags.byName == NULL)
-	goto exit;
-
-    l = 0;
-    u = _rpmTags.byNameSize;
-    while (l < u) {
-	i = (l + u) / 2;
-	t = _rpmTags.byName[i];
-	
-	comparison = xstrcasecmp(tagstr, t->name + (sizeof("RPMTAG_")-1));
-
-	if (comparison < 0)
-	    u = i;
-	else if (comparison > 0)
-	    l = i + 1;
-	else
-	    return t->val;
-    }
+    th = tagHashLoad();
+    if ((t = tagHashFindName(th, tagstr)) != NULL)
+	return t->val;
 
-exit:
-    /* Generate an arbitrary tag string. */
+    /* Generate an arbitrary tag value (lookup misses aren't remembered). */
     s = _tagCanonicalize(tagstr);
     tag = _tagGenerate(s);
     s = _free(s);
@@ -452,10 +615,16 @@ void tagClean(headerTagIndices _rpmTags)
     if (_rpmTags == NULL)
 	_rpmTags = rpmTags;
    if (_rpmTags) {
-	_rpmTags->nameBuf = _free(_rpmTags->nameBuf);
-	_rpmTags->byName = _free(_rpmTags->byName);
-	_rpmTags->byValue = _free(_rpmTags->byValue);
-	_rpmTags->aTags = argvFree(_rpmTags->aTags);
+	_rpmTags->aTags = NULL;		/* XXX owned by _rpmTags->tagHash */
+	_rpmTags->tagHash = tagHashFree(_rpmTags->tagHash);
+    }
+    if (_tagExt != NULL) {
+	unsigned int i;
+	for (i = 0; i <= _tagExtMask; i++)
+	    _tagExt[i].name = _free(_tagExt[i].name);
+	_tagExt = _free(_tagExt);
+	_tagExtMask = 0;
+	_tagExtCount = 0;
     }
 }
 
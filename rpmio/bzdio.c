@@ -110,6 +110,11 @@ assert(fmode != NULL);		/* XXX return NULL instead? */
 	if (verbosity < 0) verbosity = 0;
 	if (verbosity < 4) verbosity++;
 	/*@switchbreak@*/ break;
+    case 'T':
+	/* XXX Concatenated (i.e. pbzip2) streams are not read by bzdio. */
+	while (*s >= '0' && *s <= '9')
+	    s++;
+	/*@switchbreak@*/ break;
     default:
 	if (c >= (int)'0' && c <= (int)'9')
 	    level = c - (int)'0';
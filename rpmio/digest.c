@@ -914,6 +914,46 @@ DPRINTF((stderr, "==> ctx %p ==== Update(%s,%p[%u]) param %p\n", ctx, ctx->name,
 }
 /*@=mustmod@*/
 
+/**
+ * No. of bytes passed to each digest in turn by rpmDigestUpdateMulti().
+ * A slice stays in L1 cache while all the digests read it, and is a
+ * multiple of every digest block size.
+ */
+#define	DIGEST_SLICE	(4 * 1024)
+
+/*@-mustmod@*/ /* LCL: ctx->param may be modified, but ctx is abstract @*/
+int
+rpmDigestUpdateMulti(DIGEST_CTX * ctxs, size_t nctxs,
+		const void * data, size_t len)
+{
+    const byte * b = data;
+    int rc = 0;
+
+    if (ctxs == NULL)
+	return -1;
+
+    /* A single digest has nothing to share. */
+    if (nctxs == 1)
+	return rpmDigestUpdate(ctxs[0], data, len);
+
+    while (len > 0) {
+	size_t nb = (len > DIGEST_SLICE ? DIGEST_SLICE : len);
+	size_t i;
+
+	for (i = 0; i < nctxs; i++) {
+	    DIGEST_CTX ctx = ctxs[i];
+	    if (ctx == NULL)
+		continue;
+	    if ((*ctx->Update) (ctx->param, b, nb))
+		rc = -1;
+	}
+	b += nb;
+	len -= nb;
+    }
+    return rc;
+}
+/*@=mustmod@*/
+
 #define	HMAC_IPAD	0x36
 #define	HMAC_OPAD	0x5c
 
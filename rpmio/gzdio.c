@@ -14,6 +14,7 @@ typedef	enum { true = 1, false = 0 } bool;
 #include "rpmio_internal.h"
 #include <rpmmacro.h>
 #include <rpmcb.h>
+#include <yarn.h>
 
 #if defined(WITH_ZLIB)
 
@@ -42,8 +43,11 @@ typedef struct rsync_state_s {
     unsigned char win[RSYNC_WIN];	/* window elements */
 } * rsync_state;
 
+typedef struct rpmGZPOOL_s * rpmGZPOOL;
+
 typedef struct rpmGZFILE_s {
     gzFile gz;				/* gzFile is a pointer */
+    rpmGZPOOL pool;			/* parallel compressor (or NULL) */
     struct rsync_state_s rs;
     struct cpio_state_s cs;
     rpmuint32_t nb;			/* bytes pending for sync */
@@ -221,6 +225,350 @@ rsyncable_gzwrite(rpmGZFILE rpmgz, const unsigned char *const buf, const size_t
     return n_written;
 }
 
+#if defined(WITH_PTHREADS)
+/* =============================================================== */
+/**
+ * Parallel gzip compression (for "w9T8.gzdio" et al).
+ *
+ * As in pigz, the input is cut into GZ_BLOCK sized blocks that are
+ * compressed concurrently as raw deflate streams, each primed with the
+ * last GZ_DICT bytes of the previous block as dictionary. Every block but
+ * the last ends with a sync flush, so that the blocks concatenate into a
+ * single standard gzip member, whose crc is combined from the block crc's.
+ * Blocks are written in order by the thread calling gzdWrite/gzdClose.
+ *
+ * All pool state is protected by a single yarn lock, whose value is
+ * bumped on every change.
+ */
+#define	GZ_BLOCK	(128 * 1024)	/* uncompressed block size */
+#define	GZ_DICT		(32 * 1024)	/* deflate window/dictionary size */
+#define	GZ_NJOBS	2		/* max. queued blocks per thread */
+
+typedef struct rpmGZJOB_s * rpmGZJOB;
+
+/**
+ * A block being compressed.
+ */
+struct rpmGZJOB_s {
+/*@null@*/ /*@dependent@*/
+    rpmGZJOB next;		/*!< Next block waiting for a compressor. */
+/*@null@*/ /*@dependent@*/
+    rpmGZJOB wnext;		/*!< Next block in output order. */
+    unsigned char * in;		/*!< Dictionary, then uncompressed data. */
+    size_t ndict;
+    size_t nin;
+/*@only@*/ /*@null@*/
+    unsigned char * out;	/*!< Compressed data. */
+    size_t nout;
+    uLong crc;			/*!< crc32 of the uncompressed data. */
+    int last;			/*!< Finish the deflate stream? */
+    int rc;			/*!< Z_OK on success. */
+    int done;			/*!< Is the block compressed? */
+};
+
+/**
+ * Parallel gzip compressor.
+ */
+struct rpmGZPOOL_s {
+    yarnLock lock;		/*!< Pool state (bumped on change). */
+    int level;
+    int nthreads;
+    yarnThread * threads;	/*!< Compressor threads. */
+/*@null@*/ /*@dependent@*/
+    rpmGZJOB todo;		/*!< Blocks waiting for a compressor. */
+    rpmGZJOB * qtail;
+/*@null@*/ /*@only@*/
+    rpmGZJOB head;		/*!< Unwritten blocks, in output order. */
+    rpmGZJOB * wtail;
+    unsigned njobs;		/*!< No. of unwritten blocks. */
+    int stop;			/*!< Are the threads to exit? */
+
+/*@only@*/ /*@null@*/
+    rpmGZJOB job;		/*!< Block being filled. */
+    unsigned char dict[GZ_DICT];	/*!< Tail of the previous block. */
+    size_t ndict;
+    int fdno;			/*!< Output file descriptor. */
+    uLong crc;			/*!< crc32 of the written blocks. */
+    uLong isize;		/*!< Uncompressed size (mod 2^32). */
+    int error;			/*!< Has a write failed? */
+};
+
+/**
+ * Write a buffer, retrying short writes.
+ * @param fdno		file descriptor
+ * @param b		buffer
+ * @param nb		no. of bytes
+ * @return		0 on success
+ */
+static int gzpoolWriteAll(int fdno, const unsigned char * b, size_t nb)
+	/*@globals fileSystem, errno @*/
+	/*@modifies fileSystem, errno @*/
+{
+    while (nb > 0) {
+	ssize_t rc = write(fdno, b, nb);
+	if (rc < 0 && errno == EINTR)
+	    continue;
+	if (rc <= 0)
+	    return -1;
+	b += rc;
+	nb -= rc;
+    }
+    return 0;
+}
+
+/**
+ * Compressor thread: deflate queued blocks until stopped.
+ * @param _pool		parallel gzip compressor
+ */
+static void gzpoolWorker(void * _pool)
+	/*@modifies _pool @*/
+{
+    rpmGZPOOL pool = _pool;
+    z_stream strm;
+    int xx;
+
+    memset(&strm, 0, sizeof(strm));
+    xx = deflateInit2(&strm, pool->level, Z_DEFLATED, -15, 8,
+			Z_DEFAULT_STRATEGY);
+
+    for (;;) {
+	rpmGZJOB job;
+	size_t nout;
+
+	yarnPossess(pool->lock);
+	while (!pool->stop && pool->todo == NULL)
+	    yarnWaitFor(pool->lock, NOT_TO_BE, yarnPeekLock(pool->lock));
+	if ((job = pool->todo) == NULL) {
+	    yarnRelease(pool->lock);
+	    break;
+	}
+	if ((pool->todo = job->next) == NULL)
+	    pool->qtail = &pool->todo;
+	yarnRelease(pool->lock);
+
+	job->crc = crc32(crc32(0L, Z_NULL, 0), job->in + job->ndict,
+			(uInt)job->nin);
+
+	/* XXX sync flush adds an empty stored block (5 bytes). */
+	nout = deflateBound(&strm, (uLong)job->nin) + 16;
+	job->out = xmalloc(nout);
+	job->rc = (xx == Z_OK ? deflateReset(&strm) : xx);
+	if (job->rc == Z_OK && job->ndict > 0)
+	    job->rc = deflateSetDictionary(&strm, job->in, (uInt)job->ndict);
+	if (job->rc == Z_OK) {
+	    strm.next_in = job->in + job->ndict;
+	    strm.avail_in = (uInt)job->nin;
+	    strm.next_out = job->out;
+	    strm.avail_out = (uInt)nout;
+	    job->rc = deflate(&strm, (job->last ? Z_FINISH : Z_SYNC_FLUSH));
+	    if (job->rc == Z_STREAM_END || (job->rc == Z_OK && !job->last))
+		job->rc = (strm.avail_in == 0 ? Z_OK : Z_BUF_ERROR);
+	    else if (job->rc == Z_OK)
+		job->rc = Z_BUF_ERROR;
+	    job->nout = nout - strm.avail_out;
+	}
+
+	yarnPossess(pool->lock);
+	job->done = 1;
+	yarnTwist(pool->lock, BY, 1);
+    }
+
+    if (xx == Z_OK)
+	xx = deflateEnd(&strm);
+}
+
+/**
+ * Write compressed blocks in order until at most maxjobs are unwritten.
+ * @param pool		parallel gzip compressor
+ * @param maxjobs	max. no. of unwritten blocks
+ * @return		0 on success
+ */
+static int gzpoolCollect(rpmGZPOOL pool, unsigned maxjobs)
+	/*@globals fileSystem, errno @*/
+	/*@modifies pool, fileSystem, errno @*/
+{
+    yarnPossess(pool->lock);
+    while (pool->head != NULL && pool->njobs > maxjobs) {
+	rpmGZJOB job = pool->head;
+
+	while (!job->done)
+	    yarnWaitFor(pool->lock, NOT_TO_BE, yarnPeekLock(pool->lock));
+	if ((pool->head = job->wnext) == NULL)
+	    pool->wtail = &pool->head;
+	pool->njobs--;
+	yarnTwist(pool->lock, BY, 1);
+
+	if (job->rc != Z_OK
+	 || gzpoolWriteAll(pool->fdno, job->out, job->nout))
+	    pool->error = 1;
+	pool->crc = crc32_combine(pool->crc, job->crc, (z_off_t)job->nin);
+	pool->isize += (uLong)job->nin;
+	job->in = _free(job->in);
+	job->out = _free(job->out);
+	job = _free(job);
+
+	yarnPossess(pool->lock);
+    }
+    yarnRelease(pool->lock);
+    return (pool->error ? -1 : 0);
+}
+
+/**
+ * Queue the block being filled for compression.
+ * @param pool		parallel gzip compressor
+ * @param last		is this the last block?
+ * @return		0 on success
+ */
+static int gzpoolQueue(rpmGZPOOL pool, int last)
+	/*@globals fileSystem, errno @*/
+	/*@modifies pool, fileSystem, errno @*/
+{
+    rpmGZJOB job = pool->job;
+
+    if (job == NULL) {
+	job = xcalloc(1, sizeof(*job));
+	job->in = xmalloc(GZ_DICT + GZ_BLOCK);
+	memcpy(job->in, pool->dict, pool->ndict);
+	job->ndict = pool->ndict;
+    }
+    pool->job = NULL;
+    job->last = last;
+
+    /* The next block is primed with the tail of this block. */
+    if (job->nin >= GZ_DICT) {
+	memcpy(pool->dict, job->in + job->ndict + job->nin - GZ_DICT, GZ_DICT);
+	pool->ndict = GZ_DICT;
+    } else if (job->nin > 0) {
+	size_t nkeep = GZ_DICT - job->nin;
+	if (nkeep > pool->ndict)
+	    nkeep = pool->ndict;
+	memmove(pool->dict, pool->dict + pool->ndict - nkeep, nkeep);
+	memcpy(pool->dict + nkeep, job->in + job->ndict, job->nin);
+	pool->ndict = nkeep + job->nin;
+    }
+
+    yarnPossess(pool->lock);
+    *pool->qtail = job;
+    pool->qtail = &job->next;
+    *pool->wtail = job;
+    pool->wtail = &job->wnext;
+    pool->njobs++;
+    yarnTwist(pool->lock, BY, 1);
+
+    return gzpoolCollect(pool, GZ_NJOBS * pool->nthreads);
+}
+
+/**
+ * Create a parallel gzip compressor, writing the gzip header.
+ * @param fdno		output file descriptor
+ * @param level		compression level
+ * @param nthreads	no. of compressor threads
+ * @return		new parallel gzip compressor (NULL on error)
+ */
+/*@null@*/
+static rpmGZPOOL gzpoolNew(int fdno, int level, int nthreads)
+	/*@globals fileSystem, errno @*/
+	/*@modifies fileSystem, errno @*/
+{
+    /* gzip header: deflate, no flags, no mtime, xfl, unix. */
+    unsigned char hdr[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    rpmGZPOOL pool;
+    int i;
+
+    hdr[8] = (level == 9 ? 2 : (level == 1 ? 4 : 0));
+    if (gzpoolWriteAll(fdno, hdr, sizeof(hdr)))
+	return NULL;
+
+    pool = xcalloc(1, sizeof(*pool));
+    pool->lock = yarnNewLock(0);
+    pool->level = level;
+    pool->nthreads = nthreads;
+    pool->qtail = &pool->todo;
+    pool->wtail = &pool->head;
+    pool->fdno = fdno;
+    pool->crc = crc32(0L, Z_NULL, 0);
+    pool->threads = xcalloc(nthreads, sizeof(*pool->threads));
+    for (i = 0; i < nthreads; i++)
+	pool->threads[i] = yarnLaunch(gzpoolWorker, pool);
+    return pool;
+}
+
+/**
+ * Compress a buffer.
+ * @param pool		parallel gzip compressor
+ * @param buf		uncompressed data
+ * @param count		no. of bytes
+ * @return		no. of bytes consumed (-1 on error)
+ */
+static ssize_t gzpoolWrite(rpmGZPOOL pool, const unsigned char * buf,
+		size_t count)
+	/*@globals fileSystem, errno @*/
+	/*@modifies pool, fileSystem, errno @*/
+{
+    size_t nleft = count;
+
+    while (nleft > 0) {
+	rpmGZJOB job = pool->job;
+	size_t nb;
+
+	if (job == NULL) {
+	    job = pool->job = xcalloc(1, sizeof(*job));
+	    job->in = xmalloc(GZ_DICT + GZ_BLOCK);
+	    memcpy(job->in, pool->dict, pool->ndict);
+	    job->ndict = pool->ndict;
+	}
+	nb = GZ_BLOCK - job->nin;
+	if (nb > nleft)
+	    nb = nleft;
+	memcpy(job->in + job->ndict + job->nin, buf, nb);
+	job->nin += nb;
+	buf += nb;
+	nleft -= nb;
+	if (job->nin == GZ_BLOCK && gzpoolQueue(pool, 0))
+	    return -1;
+    }
+    return (pool->error ? -1 : (ssize_t)count);
+}
+
+/**
+ * Finish the gzip stream, then destroy the parallel gzip compressor.
+ * @param pool		parallel gzip compressor
+ * @return		0 on success
+ */
+static int gzpoolClose(/*@only@*/ rpmGZPOOL pool)
+	/*@globals fileSystem, errno @*/
+	/*@modifies pool, fileSystem, errno @*/
+{
+    unsigned char trailer[8];
+    int rc;
+    int i;
+
+    rc = gzpoolQueue(pool, 1);
+    if (gzpoolCollect(pool, 0))
+	rc = -1;
+
+    yarnPossess(pool->lock);
+    pool->stop = 1;
+    yarnTwist(pool->lock, BY, 1);
+    for (i = 0; i < pool->nthreads; i++)
+	pool->threads[i] = yarnJoin(pool->threads[i]);
+    pool->threads = _free(pool->threads);
+    pool->lock = yarnFreeLock(pool->lock);
+
+    /* gzip trailer: crc32 and isize, little endian. */
+    for (i = 0; i < 4; i++) {
+	trailer[i] = (unsigned char)((pool->crc >> (8 * i)) & 0xff);
+	trailer[4+i] = (unsigned char)((pool->isize >> (8 * i)) & 0xff);
+    }
+    if (rc == 0 && gzpoolWriteAll(pool->fdno, trailer, sizeof(trailer)))
+	rc = -1;
+    if (close(pool->fdno) != 0)
+	rc = -1;
+    pool = _free(pool);
+    return rc;
+}
+#endif	/* WITH_PTHREADS */
+
 /* =============================================================== */
 /*@-moduncon@*/
 
@@ -242,6 +590,54 @@ static inline /*@dependent@*/ /*@null@*/ void * gzdFileno(FD_t fd)
     return rc;
 }
 
+/**
+ * Open a gzip stream, in parallel if a "T[0-9]*" thread count is present.
+ * @param path		file path (or NULL)
+ * @param fdno		file descriptor (if path is NULL)
+ * @param fmode		fmode
+ * @return		gzip stream (NULL on error)
+ */
+static /*@null@*/
+rpmGZFILE gzdOpenStream(/*@null@*/ const char * path, int fdno,
+		const char * fmode)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    rpmGZFILE rpmgz = xcalloc(1, sizeof(*rpmgz));
+    char zmode[32];
+    int nthreads;
+
+    (void) strncpy(zmode, fmode, sizeof(zmode) - 1);
+    zmode[sizeof(zmode) - 1] = '\0';
+    nthreads = fdFmodeThreads(zmode);
+
+#if defined(WITH_PTHREADS)
+    if (nthreads > 1 && zmode[0] == 'w') {
+	int level = Z_DEFAULT_COMPRESSION;
+	const char * s;
+	for (s = zmode; *s != '\0'; s++) {
+	    if (*s >= '0' && *s <= '9')
+		level = (int)(*s - '0');
+	}
+	if (path != NULL)
+	    fdno = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0666);
+	if (fdno >= 0)
+	    rpmgz->pool = gzpoolNew(fdno, level, nthreads);
+	if (rpmgz->pool == NULL) {
+	    if (path != NULL && fdno >= 0)
+		(void) close(fdno);
+	    rpmgz = _free(rpmgz);
+	}
+	return rpmgz;
+    }
+#endif
+
+    rpmgz->gz = (path != NULL ? gzopen(path, zmode) : gzdopen(fdno, zmode));
+    if (rpmgz->gz == NULL)
+	rpmgz = _free(rpmgz);
+    return rpmgz;
+}
+
 static /*@null@*/
 FD_t gzdOpen(const char * path, const char * fmode)
 	/*@globals fileSystem, internalState @*/
@@ -251,12 +647,10 @@ FD_t gzdOpen(const char * path, const char * fmode)
     rpmGZFILE rpmgz;
     mode_t mode = (fmode && fmode[0] == 'w' ? O_WRONLY : O_RDONLY);
 
-    rpmgz = xcalloc(1, sizeof(*rpmgz));
-    rpmgz->gz = gzopen(path, fmode);
-    if (rpmgz->gz == NULL) {
-	rpmgz = _free(rpmgz);
+    if (fmode == NULL) return NULL;
+    rpmgz = gzdOpenStream(path, -1, fmode);
+    if (rpmgz == NULL)
 	return NULL;
-    }
     fd = fdNew("open (gzdOpen)");
     fdPop(fd); fdPush(fd, gzdio, rpmgz, -1);
     fdSetOpen(fd, path, -1, mode);
@@ -277,12 +671,9 @@ static /*@null@*/ FD_t gzdFdopen(void * cookie, const char *fmode)
     fdno = fdFileno(fd);
     fdSetFdno(fd, -1);		/* XXX skip the fdio close */
     if (fdno < 0) return NULL;
-    rpmgz = xcalloc(1, sizeof(*rpmgz));
-    rpmgz->gz = gzdopen(fdno, fmode);
-    if (rpmgz->gz == NULL) {
-	rpmgz = _free(rpmgz);
+    rpmgz = gzdOpenStream(NULL, fdno, fmode);
+    if (rpmgz == NULL)
 	return NULL;
-    }
 
     fdPush(fd, gzdio, rpmgz, fdno);		/* Push gzdio onto stack */
 
@@ -296,6 +687,7 @@ static int gzdFlush(void * cookie)
     rpmGZFILE rpmgz;
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;
+    if (rpmgz->gz == NULL) return 0;	/* XXX parallel compressor */
     return gzflush(rpmgz->gz, Z_SYNC_FLUSH);	/* XXX W2DO? */
 }
 
@@ -313,6 +705,7 @@ static ssize_t gzdRead(void * cookie, /*@out@*/ char * buf, size_t count)
 
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
+    if (rpmgz->gz == NULL) return -2;	/* XXX parallel compressor */
 
     fdstat_enter(fd, FDSTAT_READ);
     rc = gzread(rpmgz->gz, buf, (unsigned)count);
@@ -348,6 +741,18 @@ static ssize_t gzdWrite(void * cookie, const char * buf, size_t count)
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
 
     fdstat_enter(fd, FDSTAT_WRITE);
+#if defined(WITH_PTHREADS)
+    if (rpmgz->pool != NULL) {
+	rc = gzpoolWrite(rpmgz->pool, (void *)buf, count);
+DBGIO(fd, (stderr, "==>\tgzdWrite(%p,%p,%u) rc %lx %s\n", cookie, buf, (unsigned)count, (unsigned long)rc, fdbg(fd)));
+	if (rc < 0) {
+	    fd->syserrno = errno;
+	    fd->errcookie = strerror(fd->syserrno);
+	} else if (rc > 0)
+	    fdstat_exit(fd, FDSTAT_WRITE, rc);
+	return rc;
+    }
+#endif
     if (enable_rsync)
 	rc = rsyncable_gzwrite(rpmgz, (void *)buf, (unsigned)count);
     else
@@ -387,6 +792,7 @@ static int gzdSeek(void * cookie, _libio_pos_t pos, int whence)
 
     rpmgz = gzdFileno(fd);
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
+    if (rpmgz->gz == NULL) return -2;	/* XXX parallel compressor */
 
     fdstat_enter(fd, FDSTAT_SEEK);
     rc = gzseek(rpmgz->gz, (long)p, whence);
@@ -419,6 +825,13 @@ static int gzdClose( /*@only@*/ void * cookie)
     if (rpmgz == NULL) return -2;	/* XXX can't happen */
 
     fdstat_enter(fd, FDSTAT_CLOSE);
+#if defined(WITH_PTHREADS)
+    if (rpmgz->pool != NULL) {
+	rc = gzpoolClose(rpmgz->pool);
+	if (rc < 0) rc = Z_ERRNO;
+	rpmgz->pool = NULL;
+    } else
+#endif
     /*@-dependenttrans@*/
     rc = gzclose(rpmgz->gz);
     /*@=dependenttrans@*/
@@ -278,7 +278,9 @@ struct iosm_s {
     int commit;			/*!< Commit synchronously? */
     int repackaged;		/*!< Is payload repackaged? */
     int strict_erasures;	/*!< Are Rmdir/Unlink failures errors? */
-    int multithreaded;		/*!< Run stages on their own thread? */
+    int multithreaded;		/*!< No. of payload writers (<0 uses #cpus). */
+/*@relnull@*/
+    void * pipe;		/*!< Payload extraction pipeline. */
     int adding;			/*!< Is the rpmte element type TR_ADDED? */
     int debug;			/*!< Print detailed operations? */
     int nofdigests;		/*!< Disable file digests? */
@@ -205,50 +205,180 @@ compareMacroName(const void * ap, const void * bp)
 }
 
 /**
- * Enlarge macro table.
+ * Hash a macro name (DJBX33A).
+ * @param name		macro name
+ * @param namelen	no. of bytes
+ * @return		hash value
+ */
+static unsigned int
+hashMacroName(const char * name, size_t namelen)
+	/*@*/
+{
+    unsigned int h = 5381;
+
+    while (namelen-- > 0)
+	h = ((h << 5) + h) + (unsigned char) *name++;
+    return h;
+}
+
+/**
+ * Find macro name slot in hash index.
  * @param mc		macro context
+ * @param name		macro name
+ * @param namelen	no. of bytes
+ * @param hash		macro name hash
+ * @return		matching slot (or the empty slot ending the probe)
+ */
+/*@dependent@*/
+static struct MacroSlot_s *
+findSlot(MacroContext mc, const char * name, size_t namelen,
+		unsigned int hash)
+	/*@*/
+{
+    unsigned int mask = (unsigned int) mc->macroHashSize - 1;
+    unsigned int i = hash & mask;
+    struct MacroSlot_s * slot;
+
+    for (slot = mc->macroHash + i; slot->ix != 0; slot = mc->macroHash + i) {
+	if (slot->hash == hash) {
+	    MacroEntry me = mc->macroTable[slot->ix - 1];
+	    if (me != NULL && !strncmp(me->name, name, namelen)
+	     && me->name[namelen] == '\0')
+		break;
+	}
+	i = (i + 1) & mask;
+    }
+    return slot;
+}
+
+/**
+ * Rebuild macro name hash index.
+ * @param mc		macro context
+ * @param nslots	no. of hash slots (power of 2)
  */
 static void
-expandMacroTable(MacroContext mc)
+rehashMacroTable(MacroContext mc, int nslots)
 	/*@modifies mc @*/
 {
-    if (mc->macroTable == NULL) {
-	mc->macrosAllocated = MACRO_CHUNK_SIZE;
-	mc->macroTable = (MacroEntry *)
-	    xmalloc(sizeof(*mc->macroTable) * mc->macrosAllocated);
-	mc->firstFree = 0;
-    } else {
-	mc->macrosAllocated += MACRO_CHUNK_SIZE;
+    int i;
+
+    if (nslots != mc->macroHashSize) {
+	mc->macroHash = _free(mc->macroHash);
+	mc->macroHashSize = nslots;
+	mc->macroHash = xcalloc(nslots, sizeof(*mc->macroHash));
+    } else
+	memset(mc->macroHash, 0, nslots * sizeof(*mc->macroHash));
+
+    for (i = 0; i < mc->firstFree; i++) {
+	MacroEntry me = mc->macroTable[i];
+	size_t namelen = strlen(me->name);
+	unsigned int hash = hashMacroName(me->name, namelen);
+	struct MacroSlot_s * slot = findSlot(mc, me->name, namelen, hash);
+	slot->hash = hash;
+	slot->ix = i + 1;
+    }
+}
+
+/**
+ * Append a new (empty) name slot to macro table.
+ * @param mc		macro context
+ * @param name		macro name
+ * @return		address of new slot in macro table
+ */
+/*@dependent@*/
+static MacroEntry *
+newEntry(MacroContext mc, const char * name)
+	/*@modifies mc @*/
+{
+    size_t namelen = strlen(name);
+    unsigned int hash = hashMacroName(name, namelen);
+    struct MacroSlot_s * slot;
+
+    if (mc->firstFree == mc->macrosAllocated) {
+	mc->macrosAllocated = (mc->macrosAllocated > 0
+		? 2 * mc->macrosAllocated : MACRO_CHUNK_SIZE);
 	mc->macroTable = (MacroEntry *)
 	    xrealloc(mc->macroTable, sizeof(*mc->macroTable) *
 			mc->macrosAllocated);
     }
-    memset(&mc->macroTable[mc->firstFree], 0, MACRO_CHUNK_SIZE * sizeof(*(mc->macroTable)));
+
+    /* Keep the hash index at most half full. */
+    if (2 * (mc->firstFree + 1) > mc->macroHashSize)
+	rehashMacroTable(mc, (mc->macroHashSize > 0
+		? 2 * mc->macroHashSize : 4 * MACRO_CHUNK_SIZE));
+
+    mc->macroTable[mc->firstFree] = NULL;
+    slot = findSlot(mc, name, namelen, hash);
+    slot->hash = hash;
+    slot->ix = ++mc->firstFree;
+    mc->sorted = 0;
+    return &mc->macroTable[mc->firstFree - 1];
+}
+
+/**
+ * Remove a name slot from macro table.
+ * The last table entry is moved into the vacated slot, and the hash index
+ * is repaired with backward shift deletion.
+ * @param mc		macro context
+ * @param ix		macro table index (name must still be valid)
+ */
+static void
+delEntry(MacroContext mc, int ix)
+	/*@modifies mc @*/
+{
+    unsigned int mask = (unsigned int) mc->macroHashSize - 1;
+    int last = mc->firstFree - 1;
+    MacroEntry me = mc->macroTable[ix];
+    size_t namelen = strlen(me->name);
+    struct MacroSlot_s * slot = findSlot(mc, me->name, namelen,
+				hashMacroName(me->name, namelen));
+    unsigned int i = (unsigned int) (slot - mc->macroHash);
+    unsigned int j = i;
+
+    /* Close the gap in the probe sequence. */
+    for (;;) {
+	unsigned int k;
+	j = (j + 1) & mask;
+	if (mc->macroHash[j].ix == 0)
+	    break;
+	k = mc->macroHash[j].hash & mask;
+	if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+	    continue;
+	mc->macroHash[i] = mc->macroHash[j];
+	i = j;
+    }
+    mc->macroHash[i].ix = 0;
+
+    /* Move the last entry into the vacated table slot. */
+    if (ix != last) {
+	MacroEntry lme = mc->macroTable[last];
+	namelen = strlen(lme->name);
+	slot = findSlot(mc, lme->name, namelen,
+				hashMacroName(lme->name, namelen));
+	slot->ix = ix + 1;
+	mc->macroTable[ix] = lme;
+	mc->sorted = 0;
+    }
+    mc->macroTable[last] = NULL;
+    mc->firstFree = last;
 }
 
 /**
  * Sort entries in macro table.
+ * The table is only kept in name order on demand (i.e. when dumping).
  * @param mc		macro context
  */
 static void
 sortMacroTable(MacroContext mc)
 	/*@modifies mc @*/
 {
-    int i;
-
-    if (mc == NULL || mc->macroTable == NULL)
+    if (mc == NULL || mc->macroTable == NULL || mc->sorted)
 	return;
 
     qsort(mc->macroTable, mc->firstFree, sizeof(mc->macroTable[0]),
 		compareMacroName);
-
-    /* Empty pointers are now at end of table. Reset first free index. */
-    for (i = 0; i < mc->firstFree; i++) {
-	if (mc->macroTable[i] != NULL)
-	    continue;
-	mc->firstFree = i;
-	break;
-    }
+    rehashMacroTable(mc, mc->macroHashSize);
+    mc->sorted = 1;
 }
 
 #if !defined(DEBUG_MACROS)
@@ -289,6 +419,7 @@ rpmDumpMacroTable(MacroContext mc, FILE * fp)
     if (mc == NULL) mc = rpmGlobalMacroContext;
     if (fp == NULL) fp = stderr;
     
+    sortMacroTable(mc);
     fprintf(fp, "========================\n");
     if (mc->macroTable != NULL) {
 	int i;
@@ -331,6 +462,7 @@ rpmGetMacroEntries(MacroContext mc, void * _mire, int used,
     if (avp == NULL)
 	return mc->firstFree;
 
+    sortMacroTable(mc);
     av = xcalloc( (mc->firstFree+1), sizeof(mc->macroTable[0]));
     if (mc->macroTable != NULL)
     for (i = 0; i < mc->firstFree; i++) {
@@ -365,28 +497,19 @@ static MacroEntry *
 findEntry(MacroContext mc, const char * name, size_t namelen)
 	/*@*/
 {
-    MacroEntry key, *ret;
+    struct MacroSlot_s * slot;
 
 /*@-globs@*/
     if (mc == NULL) mc = rpmGlobalMacroContext;
 /*@=globs@*/
-    if (mc->macroTable == NULL || mc->firstFree == 0)
+    if (mc->macroHash == NULL || mc->firstFree == 0)
 	return NULL;
 
-    if (namelen > 0) {
-	char * t = strncpy(alloca(namelen + 1), name, namelen);
-	t[namelen] = '\0';
-	name = t;
-    }
-    
-    key = memset(alloca(sizeof(*key)), 0, sizeof(*key));
-    /*@-temptrans -assignexpose@*/
-    key->name = (char *)name;
-    /*@=temptrans =assignexpose@*/
-    ret = (MacroEntry *) bsearch(&key, mc->macroTable, mc->firstFree,
-			sizeof(*(mc->macroTable)), compareMacroName);
-    /* XXX TODO: find 1st empty slot and return that */
-    return ret;
+    if (namelen == 0)
+	namelen = strlen(name);
+
+    slot = findSlot(mc, name, namelen, hashMacroName(name, namelen));
+    return (slot->ix > 0 ? &mc->macroTable[slot->ix - 1] : NULL);
 }
 
 /* =============================================================== */
@@ -971,6 +1094,26 @@ popMacro(MacroEntry * mep)
 	}
 }
 
+/**
+ * Pop macro definition, removing the name from the table when emptied.
+ * @param mc		macro context
+ * @param mep		address of macro entry slot
+ */
+static void
+removeMacro(MacroContext mc, MacroEntry * mep)
+	/*@modifies mc, *mep @*/
+{
+    MacroEntry me = *mep;
+
+    if (me == NULL)
+	return;
+    if (me->prev == NULL) {
+	delEntry(mc, (int)(mep - mc->macroTable));
+	popMacro(&me);
+    } else
+	popMacro(mep);
+}
+
 /**
  * Free parsed arguments for parameterized macro.
  * @param mb		macro expansion state
@@ -980,14 +1123,13 @@ freeArgs(MacroBuf mb)
 	/*@modifies mb @*/
 {
     MacroContext mc = mb->mc;
-    int ndeleted = 0;
     int i;
 
     if (mc == NULL || mc->macroTable == NULL)
 	return;
 
-    /* Delete dynamic macro definitions */
-    for (i = 0; i < mc->firstFree; i++) {
+    /* Delete dynamic macro definitions (removal moves the last entry). */
+    for (i = mc->firstFree - 1; i >= 0; i--) {
 	MacroEntry *mep, me;
 	int skiptest = 0;
 	mep = &mc->macroTable[i];
@@ -1007,14 +1149,8 @@ freeArgs(MacroBuf mb)
 			me->name, me->body, me->level);
 #endif
 	}
-	popMacro(mep);
-	if (!(mep && *mep))
-	    ndeleted++;
+	removeMacro(mc, mep);
     }
-
-    /* If any deleted macros, sort macro table */
-    if (ndeleted)
-	sortMacroTable(mc);
 }
 
 /**
@@ -2644,6 +2780,588 @@ expandMacros(void * spec, MacroContext mc, char * sbuf, size_t slen)
     return rc;
 }
 
+#if !defined(DEBUG_MACROS)
+/* =============================================================== */
+/*
+ * Precompiled macro cache.
+ *
+ * The cache is a versioned, native byte order snapshot of the macro
+ * definitions read from the macro files, together with the stat(2) and
+ * SHA1 identity of every file that was read. The file is mmap'ed and the
+ * definitions are replayed through addMacro() without any line parsing.
+ * The cache is rebuilt whenever the file list (after glob expansion) or
+ * any file content changes.
+ */
+
+/*@observer@*/ /*@checked@*/ /*@null@*/
+const char * rpmMacrocache = NULL;
+
+#define	MCACHE_MAGIC	"RPMMC\0\0\0"
+#define	MCACHE_VERSION	1
+#define	MCACHE_ORDER	0x01020304
+#define	MCACHE_NULL	0xffffffff
+
+#define	MCACHEF_TOPLEVEL	(1 << 0)	/*!< file from macrofiles list */
+#define	MCACHEF_MISSING		(1 << 1)	/*!< file did not exist */
+
+/**
+ * Macro cache file header.
+ */
+struct mcacheHeader_s {
+    unsigned char magic[8];	/*!< MCACHE_MAGIC */
+    rpmuint32_t version;	/*!< MCACHE_VERSION */
+    rpmuint32_t order;		/*!< MCACHE_ORDER (byte order check) */
+    rpmuint32_t nbytes;		/*!< total cache size */
+    rpmuint32_t key;		/*!< macrofiles string offset */
+    rpmuint32_t nfiles;		/*!< no. of file records */
+    rpmuint32_t ndefs;		/*!< no. of definition records */
+    rpmuint32_t strings;	/*!< string table offset */
+    rpmuint32_t reserved;
+};
+
+/**
+ * Macro cache file record.
+ */
+struct mcacheFile_s {
+    rpmuint32_t fn;		/*!< file name string offset */
+    rpmuint32_t flags;		/*!< MCACHEF_* flags */
+    rpmuint64_t mtime;		/*!< file st_mtime */
+    rpmuint64_t size;		/*!< file st_size */
+    unsigned char digest[20];	/*!< file SHA1 digest */
+    rpmuint32_t reserved;
+};
+
+/**
+ * Macro cache definition record.
+ */
+struct mcacheDef_s {
+    rpmuint32_t n;		/*!< macro name string offset */
+    rpmuint32_t o;		/*!< macro opts string offset (or MCACHE_NULL) */
+    rpmuint32_t b;		/*!< macro body string offset */
+    rpmint32_t level;		/*!< macro level */
+};
+
+/**
+ * Macro cache recorder (active while (re-)loading macro files).
+ */
+typedef struct mcacheRecord_s {
+    const char ** files;	/*!< files read, in load order. */
+    int * flags;		/*!< file MCACHEF_* flags. */
+    int nfiles;
+    const char ** defs;		/*!< (name, opts, body) triples. */
+    int * levels;		/*!< definition levels. */
+    int ndefs;
+} * mcacheRecord;
+
+/*@only@*/ /*@null@*/
+static mcacheRecord _mcrecord = NULL;
+
+/**
+ * Record a macro file read.
+ * @param mcr		macro cache recorder
+ * @param fn		macro file name
+ * @param flags		MCACHEF_* flags
+ */
+static void mcacheAddFile(mcacheRecord mcr, const char * fn, int flags)
+	/*@modifies mcr @*/
+{
+    /* Top level files are recorded before rpmLoadMacroFile() sees them. */
+    if (mcr->nfiles > 0 && !strcmp(mcr->files[mcr->nfiles - 1], fn)) {
+	mcr->flags[mcr->nfiles - 1] |= flags;
+	return;
+    }
+    mcr->files = xrealloc(mcr->files, (mcr->nfiles + 1) * sizeof(*mcr->files));
+    mcr->flags = xrealloc(mcr->flags, (mcr->nfiles + 1) * sizeof(*mcr->flags));
+    mcr->files[mcr->nfiles] = xstrdup(fn);
+    mcr->flags[mcr->nfiles] = flags;
+    mcr->nfiles++;
+}
+
+/**
+ * Record a macro definition.
+ * @param mcr		macro cache recorder
+ * @param n		macro name
+ * @param o		macro parameters (NULL if none)
+ * @param b		macro body (NULL becomes "")
+ * @param level		macro recursion level
+ */
+static void mcacheAddDef(mcacheRecord mcr, const char * n,
+		/*@null@*/ const char * o, /*@null@*/ const char * b, int level)
+	/*@modifies mcr @*/
+{
+    const char ** d;
+
+    mcr->defs = xrealloc(mcr->defs, 3 * (mcr->ndefs + 1) * sizeof(*mcr->defs));
+    mcr->levels = xrealloc(mcr->levels, (mcr->ndefs + 1) * sizeof(*mcr->levels));
+    d = mcr->defs + 3 * mcr->ndefs;
+    d[0] = xstrdup(n);
+    d[1] = (o ? xstrdup(o) : NULL);
+    d[2] = xstrdup(b ? b : "");
+    mcr->levels[mcr->ndefs] = level;
+    mcr->ndefs++;
+}
+
+/**
+ * Destroy a macro cache recorder.
+ * @param mcr		macro cache recorder
+ * @return		NULL always
+ */
+/*@null@*/
+static mcacheRecord mcacheFree(/*@only@*/ /*@null@*/ mcacheRecord mcr)
+	/*@modifies mcr @*/
+{
+    int i;
+
+    if (mcr == NULL)
+	return NULL;
+    for (i = 0; i < mcr->nfiles; i++)
+	mcr->files[i] = _free(mcr->files[i]);
+    mcr->files = _free(mcr->files);
+    mcr->flags = _free(mcr->flags);
+    for (i = 0; i < 3 * mcr->ndefs; i++)
+	mcr->defs[i] = _free(mcr->defs[i]);
+    mcr->defs = _free(mcr->defs);
+    mcr->levels = _free(mcr->levels);
+    mcr = _free(mcr);
+    return NULL;
+}
+
+/**
+ * Return the cache file name for a macrofiles key.
+ * Each distinct macrofiles path gets its own cache file.
+ * @param cfn		macro cache base name
+ * @param macrofiles	colon separated list of macro files
+ * @return		cache file name (malloc'ed)
+ */
+/*@only@*/
+static char * mcachePath(const char * cfn, const char * macrofiles)
+	/*@*/
+{
+    char * t = xmalloc(strlen(cfn) + sizeof(".12345678"));
+    (void) sprintf(t, "%s.%08x", cfn,
+		hashMacroName(macrofiles, strlen(macrofiles)));
+    return t;
+}
+
+/**
+ * Compute the identity (stat + SHA1 digest) of a macro file.
+ * @param fn		macro file name
+ * @retval mcf		file record
+ * @param withDigest	also compute the file digest?
+ * @return		0 on success, 1 if missing, -1 on error
+ */
+static int mcacheStat(const char * fn, struct mcacheFile_s * mcf,
+		int withDigest)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies *mcf, fileSystem, internalState @*/
+{
+    struct stat sb;
+    unsigned char buf[BUFSIZ];
+    DIGEST_CTX ctx;
+    void * digest = NULL;
+    size_t digestlen = 0;
+    size_t nb;
+    FD_t fd;
+
+    memset(mcf->digest, 0, sizeof(mcf->digest));
+    if (Stat(fn, &sb) < 0) {
+	mcf->mtime = mcf->size = 0;
+	mcf->flags |= MCACHEF_MISSING;
+	return 1;
+    }
+    mcf->mtime = (rpmuint64_t) sb.st_mtime;
+    mcf->size = (rpmuint64_t) sb.st_size;
+    if (!withDigest)
+	return 0;
+
+    fd = Fopen(fn, "r.ufdio");
+    if (fd == NULL || Ferror(fd)) {
+	if (fd) (void) Fclose(fd);
+	return -1;
+    }
+    ctx = rpmDigestInit(PGPHASHALGO_SHA1, RPMDIGEST_NONE);
+    while ((nb = Fread(buf, 1, sizeof(buf), fd)) > 0)
+	(void) rpmDigestUpdate(ctx, buf, nb);
+    (void) rpmDigestFinal(ctx, &digest, &digestlen, 0);
+    (void) Fclose(fd);
+    if (digest != NULL && digestlen == sizeof(mcf->digest))
+	memcpy(mcf->digest, digest, digestlen);
+    digest = _free(digest);
+    return 0;
+}
+
+/**
+ * Append a string to a string table.
+ * @retval *sbp		string table
+ * @retval *snbp	string table size
+ * @param s		string (NULL returns MCACHE_NULL)
+ * @return		string offset
+ */
+static rpmuint32_t mcacheAddString(char ** sbp, size_t * snbp,
+		/*@null@*/ const char * s)
+	/*@modifies *sbp, *snbp @*/
+{
+    size_t off = *snbp;
+    size_t ns;
+
+    if (s == NULL)
+	return MCACHE_NULL;
+    ns = strlen(s) + 1;
+    *sbp = xrealloc(*sbp, off + ns);
+    memcpy(*sbp + off, s, ns);
+    *snbp += ns;
+    return (rpmuint32_t) off;
+}
+
+/**
+ * Write a macro cache from a recorder.
+ * @param mcr		macro cache recorder
+ * @param cfn		macro cache file name
+ * @param macrofiles	colon separated list of macro files (cache key)
+ * @return		0 on success
+ */
+static int mcacheWrite(mcacheRecord mcr, const char * cfn,
+		const char * macrofiles)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    struct mcacheHeader_s hdr;
+    struct mcacheFile_s * files = NULL;
+    struct mcacheDef_s * defs = NULL;
+    char * strings = NULL;
+    size_t nstrings = 0;
+    char * tfn = NULL;
+    size_t nb;
+    int fdno = -1;
+    int rc = -1;
+    int i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, MCACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = MCACHE_VERSION;
+    hdr.order = MCACHE_ORDER;
+    hdr.key = mcacheAddString(&strings, &nstrings, macrofiles);
+
+    hdr.nfiles = mcr->nfiles;
+    files = xcalloc(mcr->nfiles + 1, sizeof(*files));
+    for (i = 0; i < mcr->nfiles; i++) {
+	struct mcacheFile_s * mcf = files + i;
+	mcf->fn = mcacheAddString(&strings, &nstrings, mcr->files[i]);
+	mcf->flags = (mcr->flags[i] & MCACHEF_TOPLEVEL);
+	if (mcacheStat(mcr->files[i], mcf, 1) < 0)
+	    goto exit;
+    }
+
+    hdr.ndefs = mcr->ndefs;
+    defs = xcalloc(mcr->ndefs + 1, sizeof(*defs));
+    for (i = 0; i < mcr->ndefs; i++) {
+	const char ** d = mcr->defs + 3 * i;
+	defs[i].n = mcacheAddString(&strings, &nstrings, d[0]);
+	defs[i].o = mcacheAddString(&strings, &nstrings, d[1]);
+	defs[i].b = mcacheAddString(&strings, &nstrings, d[2]);
+	defs[i].level = mcr->levels[i];
+    }
+
+    hdr.strings = sizeof(hdr) + hdr.nfiles * sizeof(*files)
+		+ hdr.ndefs * sizeof(*defs);
+    nb = hdr.strings + nstrings;
+    if (nb >= MCACHE_NULL)
+	goto exit;
+    hdr.nbytes = (rpmuint32_t) nb;
+
+    /* Write to a temporary and rename, so readers never see a partial cache. */
+    tfn = xmalloc(strlen(cfn) + sizeof(".XXXXXX"));
+    (void) stpcpy(stpcpy(tfn, cfn), ".XXXXXX");
+    if ((fdno = mkstemp(tfn)) < 0)
+	goto exit;
+    if (write(fdno, &hdr, sizeof(hdr)) != (ssize_t) sizeof(hdr)
+     || write(fdno, files, hdr.nfiles * sizeof(*files))
+		!= (ssize_t) (hdr.nfiles * sizeof(*files))
+     || write(fdno, defs, hdr.ndefs * sizeof(*defs))
+		!= (ssize_t) (hdr.ndefs * sizeof(*defs))
+     || write(fdno, strings, nstrings) != (ssize_t) nstrings
+     || fchmod(fdno, 0644) < 0
+     || close(fdno) < 0)
+    {
+	if (fdno >= 0) (void) close(fdno);
+	(void) Unlink(tfn);
+	goto exit;
+    }
+    if (Rename(tfn, cfn) < 0) {
+	(void) Unlink(tfn);
+	goto exit;
+    }
+    rc = 0;
+
+exit:
+    if (rc)
+	rpmlog(RPMLOG_DEBUG, D_("cannot write macro cache %s: %s\n"),
+		cfn, strerror(errno));
+    tfn = _free(tfn);
+    files = _free(files);
+    defs = _free(defs);
+    strings = _free(strings);
+    return rc;
+}
+
+#define	MCACHE_FILES(_hdr) \
+    ((const struct mcacheFile_s *)((const char *)(_hdr) + sizeof(*(_hdr))))
+#define	MCACHE_DEFS(_hdr) \
+    ((const struct mcacheDef_s *)(MCACHE_FILES(_hdr) + (_hdr)->nfiles))
+#define	MCACHE_STR(_hdr, _off) \
+    ((_off) == MCACHE_NULL ? NULL \
+	: ((const char *)(_hdr) + (_hdr)->strings + (_off)))
+
+/**
+ * Check that all string offsets in a macro cache are within the string table.
+ * @param hdr		mapped cache (header already checked)
+ * @param nb		mapped size
+ * @return		0 if valid, 1 otherwise
+ */
+static int mcacheCheckStrings(const struct mcacheHeader_s * hdr, size_t nb)
+	/*@*/
+{
+    size_t nstrings = nb - hdr->strings;
+    rpmuint32_t i;
+
+    if (hdr->key >= nstrings)
+	return 1;
+    {	const struct mcacheFile_s * mcf = MCACHE_FILES(hdr);
+	for (i = 0; i < hdr->nfiles; i++, mcf++) {
+	    if (mcf->fn >= nstrings)
+		return 1;
+	}
+    }
+    {	const struct mcacheDef_s * def = MCACHE_DEFS(hdr);
+	for (i = 0; i < hdr->ndefs; i++, def++) {
+	    if (def->n >= nstrings || def->b >= nstrings
+	     || (def->o != MCACHE_NULL && def->o >= nstrings))
+		return 1;
+	}
+    }
+    return 0;
+}
+
+/**
+ * Map a macro cache, checking the header and string offsets.
+ * @param cfn		macro cache file name
+ * @retval *nbp		mapped size
+ * @return		mapped cache (NULL on failure)
+ */
+/*@null@*/
+static struct mcacheHeader_s * mcacheMap(const char * cfn, size_t * nbp)
+	/*@globals fileSystem @*/
+	/*@modifies *nbp, fileSystem @*/
+{
+    struct mcacheHeader_s * hdr = NULL;
+    struct stat sb;
+    size_t nb;
+    int fdno;
+
+    if ((fdno = open(cfn, O_RDONLY)) < 0)
+	return NULL;
+    if (fstat(fdno, &sb) < 0 || !S_ISREG(sb.st_mode)
+     || (size_t) sb.st_size < sizeof(*hdr))
+	goto exit;
+    nb = (size_t) sb.st_size;
+
+#if defined(HAVE_MMAP)
+    {	void * mapped = mmap(NULL, nb, PROT_READ, MAP_PRIVATE, fdno, 0);
+	if (mapped == (void *)-1)
+	    goto exit;
+	hdr = mapped;
+    }
+#else
+    hdr = xmalloc(nb);
+    if (read(fdno, hdr, nb) != (ssize_t) nb) {
+	hdr = _free(hdr);
+	goto exit;
+    }
+#endif
+
+    if (memcmp(hdr->magic, MCACHE_MAGIC, sizeof(hdr->magic))
+     || hdr->version != MCACHE_VERSION || hdr->order != MCACHE_ORDER
+     || hdr->nbytes != nb || hdr->strings > nb
+     || hdr->strings != sizeof(*hdr)
+		+ hdr->nfiles * sizeof(struct mcacheFile_s)
+		+ hdr->ndefs * sizeof(struct mcacheDef_s)
+     || hdr->nbytes == hdr->strings
+     || ((const char *)hdr)[nb - 1] != '\0'
+     || mcacheCheckStrings(hdr, nb))
+    {
+#if defined(HAVE_MMAP)
+	(void) munmap((void *)hdr, nb);
+#else
+	hdr = _free(hdr);
+#endif
+	hdr = NULL;
+	goto exit;
+    }
+    *nbp = nb;
+
+exit:
+    (void) close(fdno);
+    return hdr;
+}
+
+/**
+ * Unmap a macro cache.
+ * @param hdr		mapped cache
+ * @param nb		mapped size
+ * @return		NULL always
+ */
+/*@null@*/
+static void * mcacheUnmap(/*@only@*/ /*@null@*/ struct mcacheHeader_s * hdr,
+		size_t nb)
+	/*@modifies hdr @*/
+{
+    if (hdr != NULL) {
+#if defined(HAVE_MMAP)
+	(void) munmap((void *)hdr, nb);
+#else
+	hdr = _free(hdr);
+#endif
+    }
+    return NULL;
+}
+
+/**
+ * Update the mtime of a touched, but unchanged, macro file in a cache.
+ * The record is re-read first, and left alone if the cache was replaced.
+ * @param cfn		macro cache file name
+ * @param off		file record offset
+ * @param mcf		file record (as mapped)
+ * @param mtime		new file st_mtime
+ */
+static void mcacheTouch(const char * cfn, size_t off,
+		const struct mcacheFile_s * mcf, rpmuint64_t mtime)
+	/*@globals fileSystem @*/
+	/*@modifies fileSystem @*/
+{
+    struct mcacheFile_s rec;
+    int fdno;
+
+    if ((fdno = open(cfn, O_RDWR)) < 0)
+	return;
+    if (lseek(fdno, (off_t)off, SEEK_SET) == (off_t)off
+     && read(fdno, &rec, sizeof(rec)) == (ssize_t) sizeof(rec)
+     && !memcmp(&rec, mcf, sizeof(rec)))
+    {
+	rec.mtime = mtime;
+	if (lseek(fdno, (off_t)off, SEEK_SET) == (off_t)off)
+	    (void) write(fdno, &rec, sizeof(rec));
+    }
+    (void) close(fdno);
+}
+
+/**
+ * Check that a mapped macro cache is still current.
+ * @param hdr		mapped cache
+ * @param cfn		macro cache file name (to refresh mtimes, or NULL)
+ * @param macrofiles	colon separated list of macro files (cache key)
+ * @param files		top level macro files (after glob expansion)
+ * @param nfiles	no. of top level macro files
+ * @return		0 if current, 1 if stale
+ */
+static int mcacheCheck(const struct mcacheHeader_s * hdr,
+		/*@null@*/ const char * cfn,
+		const char * macrofiles, const char ** files, int nfiles)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    const struct mcacheFile_s * mcf = MCACHE_FILES(hdr);
+    rpmuint32_t i;
+    int j = 0;
+
+    if (strcmp((const char *)hdr + hdr->strings + hdr->key, macrofiles))
+	return 1;
+
+    for (i = 0; i < hdr->nfiles; i++, mcf++) {
+	struct mcacheFile_s st;
+	const char * fn;
+
+	fn = MCACHE_STR(hdr, mcf->fn);
+
+	/* The top level files must match the macrofiles glob, in order. */
+	if (mcf->flags & MCACHEF_TOPLEVEL) {
+	    if (j >= nfiles || strcmp(files[j], fn))
+		return 1;
+	    j++;
+	}
+
+	memset(&st, 0, sizeof(st));
+	switch (mcacheStat(fn, &st, 0)) {
+	case 1:
+	    if (!(mcf->flags & MCACHEF_MISSING))
+		return 1;
+	    continue;
+	    /*@notreached@*/ break;
+	case 0:
+	    if (mcf->flags & MCACHEF_MISSING)
+		return 1;
+	    break;
+	default:
+	    return 1;
+	    /*@notreached@*/ break;
+	}
+	if (st.size != mcf->size)
+	    return 1;
+	if (st.mtime == mcf->mtime)
+	    continue;
+
+	/* Touched, but possibly unchanged: compare content digests. */
+	if (mcacheStat(fn, &st, 1)
+	 || memcmp(st.digest, mcf->digest, sizeof(st.digest)))
+	    return 1;
+	if (cfn != NULL)
+	    mcacheTouch(cfn, (size_t)((const char *)mcf - (const char *)hdr),
+			mcf, st.mtime);
+    }
+    if (j != nfiles)
+	return 1;
+    return 0;
+}
+
+/**
+ * Load macro definitions from a (current) macro cache.
+ * @param mc		macro context
+ * @param cfn		macro cache file name
+ * @param macrofiles	colon separated list of macro files (cache key)
+ * @param files		top level macro files (after glob expansion)
+ * @param nfiles	no. of top level macro files
+ * @return		0 if loaded, 1 if stale or missing
+ */
+static int mcacheLoad(MacroContext mc, const char * cfn,
+		const char * macrofiles, const char ** files, int nfiles)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies mc, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    size_t nb = 0;
+    struct mcacheHeader_s * hdr = mcacheMap(cfn, &nb);
+    const struct mcacheDef_s * def;
+    rpmuint32_t i;
+    int rc = 1;
+
+    if (hdr == NULL || mcacheCheck(hdr, cfn, macrofiles, files, nfiles))
+	goto exit;
+
+    /* XXX Assume new fangled macro expansion */
+    /*@-mods@*/
+    max_macro_depth = _MAX_MACRO_DEPTH;
+    /*@=mods@*/
+
+    def = MCACHE_DEFS(hdr);
+    for (i = 0; i < hdr->ndefs; i++, def++)
+	addMacro(mc, MCACHE_STR(hdr, def->n), MCACHE_STR(hdr, def->o),
+		MCACHE_STR(hdr, def->b), def->level);
+    rc = 0;
+
+exit:
+    hdr = mcacheUnmap(hdr, nb);
+    return rc;
+}
+#endif	/* !defined(DEBUG_MACROS) */
+
 void
 addMacro(MacroContext mc,
 	const char * n, const char * o, const char * b, int level)
@@ -2658,13 +3376,15 @@ addMacro(MacroContext mc,
 
     if (mc == NULL) mc = rpmGlobalMacroContext;
 
-    /* If new name, expand macro table */
-    if ((mep = findEntry(mc, name, 0)) == NULL) {
-	if (mc->firstFree == mc->macrosAllocated)
-	    expandMacroTable(mc);
-	if (mc->macroTable != NULL)
-	    mep = mc->macroTable + mc->firstFree++;
-    }
+#if !defined(DEBUG_MACROS)
+    /* Record macro file definitions (doDefine() adds at level - 1). */
+    if (_mcrecord != NULL && level == (RMIL_MACROFILES - 1))
+	mcacheAddDef(_mcrecord, n, o, b, level);
+#endif
+
+    /* If new name, add to macro table */
+    if ((mep = findEntry(mc, name, 0)) == NULL)
+	mep = newEntry(mc, name);
 
     if (mep != NULL) {
 	/* XXX permit "..foo" to be pushed over ".foo" */
@@ -2676,10 +3396,6 @@ addMacro(MacroContext mc,
 	}
 	/* Push macro over previous definition */
 	pushMacro(mep, n, o, b, level);
-
-	/* If new name, sort macro table */
-	if ((*mep)->prev == NULL)
-	    sortMacroTable(mc);
     }
 }
 
@@ -2690,12 +3406,8 @@ delMacro(MacroContext mc, const char * n)
 
     if (mc == NULL) mc = rpmGlobalMacroContext;
     /* If name exists, pop entry */
-    if ((mep = findEntry(mc, n, 0)) != NULL) {
-	popMacro(mep);
-	/* If deleted name, sort macro table */
-	if (!(mep && *mep))
-	    sortMacroTable(mc);
-    }
+    if ((mep = findEntry(mc, n, 0)) != NULL)
+	removeMacro(mc, mep);
 }
 
 /*@-mustmod@*/ /* LCL: mc is modified through mb->mc, mb is abstract */
@@ -2771,6 +3483,11 @@ rpmLoadMacroFile(MacroContext mc, const char * fn, int nesting)
     FD_t fd;
     int xx;
 
+#if !defined(DEBUG_MACROS)
+    if (_mcrecord != NULL)
+	mcacheAddFile(_mcrecord, fn, 0);
+#endif
+
     /* XXX TODO: teach rdcl() to read through a URI, eliminate ".fpio". */
     fd = Fopen(fn, "r.fpio");
     if (fd == NULL || Ferror(fd)) {
@@ -2832,17 +3549,21 @@ exit:
     return rc;
 }
 
-void
-rpmInitMacros(MacroContext mc, const char * macrofiles)
+/**
+ * Return the macro files from a macrofiles path, after glob expansion.
+ * @param macrofiles	colon separated list of macro files
+ * @retval *filesp	macro file names
+ * @return		no. of macro files
+ */
+static int
+macroFiles(const char * macrofiles, const char *** filesp)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies *filesp, fileSystem, internalState @*/
 {
+    const char ** files = NULL;
+    int nfiles = 0;
     char *mfiles, *m, *me;
 
-    if (macrofiles == NULL)
-	return;
-#ifdef	DYING
-    if (mc == NULL) mc = rpmGlobalMacroContext;
-#endif
-
     mfiles = xstrdup(macrofiles);
     for (m = mfiles; m && *m != '\0'; m = me) {
 	const char ** av;
@@ -2874,8 +3595,7 @@ rpmInitMacros(MacroContext mc, const char * macrofiles)
 	    continue;
 #endif
 
-	/* Read macros from each file. */
-
+	files = xrealloc(files, (nfiles + ac + 1) * sizeof(*files));
 	for (i = 0; i < ac; i++) {
 	    size_t slen = strlen(av[i]);
 	    const char *fn = av[i];
@@ -2890,6 +3610,7 @@ rpmInitMacros(MacroContext mc, const char * macrofiles)
 #endif
 	    {
 		rpmlog(RPMLOG_WARNING, "existing RPM macros file \"%s\" considered INSECURE -- not loaded\n", fn);
+		av[i] = _free(av[i]);
 		/*@innercontinue@*/ continue;
 	    }
 	}
@@ -2902,7 +3623,7 @@ rpmInitMacros(MacroContext mc, const char * macrofiles)
 	       || _suffix(fn, ".rpmorig")
 	       || _suffix(fn, ".rpmsave"))
 	       )
-		   (void) rpmLoadMacroFile(mc, fn, _max_load_depth);
+		files[nfiles++] = xstrdup(fn);
 #undef _suffix
 
 	    av[i] = _free(av[i]);
@@ -2911,12 +3632,201 @@ rpmInitMacros(MacroContext mc, const char * macrofiles)
     }
     mfiles = _free(mfiles);
 
+    *filesp = files;
+    return nfiles;
+}
+
+/**
+ * Free macro file names.
+ * @param files		macro file names
+ * @param nfiles	no. of macro files
+ * @return		NULL always
+ */
+/*@null@*/
+static const char ** macroFilesFree(/*@only@*/ /*@null@*/ const char ** files,
+		int nfiles)
+	/*@modifies files @*/
+{
+    int i;
+
+    if (files != NULL)
+    for (i = 0; i < nfiles; i++)
+	files[i] = _free(files[i]);
+    return _free(files);
+}
+
+/**
+ * Initialize macro context from set of macrofile(s), using a macro cache.
+ * @param mc		macro context
+ * @param macrofiles	colon separated list of macro files
+ * @param cfn		macro cache base name (NULL disables)
+ */
+static void
+macroInit(MacroContext mc, const char * macrofiles, /*@null@*/ const char * cfn)
+	/*@globals rpmGlobalMacroContext, h_errno, fileSystem, internalState @*/
+	/*@modifies mc, rpmGlobalMacroContext, fileSystem, internalState @*/
+{
+    const char ** files = NULL;
+    int nfiles = macroFiles(macrofiles, &files);
+    char * t = NULL;
+    int i;
+
+#if !defined(DEBUG_MACROS)
+    if (cfn != NULL && *cfn != '\0') {
+	t = mcachePath(cfn, macrofiles);
+	if (!mcacheLoad(mc, t, macrofiles, files, nfiles))
+	    goto exit;
+	_mcrecord = mcacheFree(_mcrecord);
+	_mcrecord = xcalloc(1, sizeof(*_mcrecord));
+    }
+#endif
+
+    /* Read macros from each file. */
+    for (i = 0; i < nfiles; i++) {
+#if !defined(DEBUG_MACROS)
+	if (_mcrecord != NULL)
+	    mcacheAddFile(_mcrecord, files[i], MCACHEF_TOPLEVEL);
+#endif
+	(void) rpmLoadMacroFile(mc, files[i], _max_load_depth);
+    }
+
+#if !defined(DEBUG_MACROS)
+    if (_mcrecord != NULL) {
+	(void) mcacheWrite(_mcrecord, t, macrofiles);
+	_mcrecord = mcacheFree(_mcrecord);
+    }
+#endif
+
+#if !defined(DEBUG_MACROS)
+exit:
+#endif
+    t = _free(t);
+    files = macroFilesFree(files, nfiles);
+}
+
+void
+rpmInitMacros(MacroContext mc, const char * macrofiles)
+{
+
+    if (macrofiles == NULL)
+	return;
+#ifdef	DYING
+    if (mc == NULL) mc = rpmGlobalMacroContext;
+#endif
+
+#if !defined(DEBUG_MACROS)
+    macroInit(mc, macrofiles, rpmMacrocache);
+#else
+    macroInit(mc, macrofiles, NULL);
+#endif
+
     /* Reload cmdline macros */
     /*@-mods@*/
     rpmLoadMacros(rpmCLIMacroContext, RMIL_CMDLINE);
     /*@=mods@*/
 }
 
+#if !defined(DEBUG_MACROS)
+int
+rpmMacroCacheBuild(const char * cfn, const char * macrofiles)
+{
+    struct MacroContext_s mc_s;
+    char * t = NULL;
+    int rc;
+
+    if (cfn == NULL || macrofiles == NULL)
+	return -1;
+    memset(&mc_s, 0, sizeof(mc_s));
+    t = mcachePath(cfn, macrofiles);
+    (void) Unlink(t);
+    macroInit(&mc_s, macrofiles, cfn);
+    rpmFreeMacros(&mc_s);
+    rc = (Access(t, R_OK) == 0 ? 0 : -1);
+    t = _free(t);
+    return rc;
+}
+
+int
+rpmMacroCacheVerify(const char * cfn, const char * macrofiles)
+{
+    const char ** files = NULL;
+    int nfiles = 0;
+    size_t nb = 0;
+    struct mcacheHeader_s * hdr;
+    char * t;
+    int rc = -1;
+
+    if (cfn == NULL || macrofiles == NULL)
+	return rc;
+    t = mcachePath(cfn, macrofiles);
+    if ((hdr = mcacheMap(t, &nb)) != NULL) {
+	nfiles = macroFiles(macrofiles, &files);
+	rc = mcacheCheck(hdr, NULL, macrofiles, files, nfiles);
+	files = macroFilesFree(files, nfiles);
+	hdr = mcacheUnmap(hdr, nb);
+    }
+    t = _free(t);
+    return rc;
+}
+
+int
+rpmMacroCacheDump(const char * cfn, const char * macrofiles, FILE * fp)
+{
+    size_t nb = 0;
+    struct mcacheHeader_s * hdr;
+    char * t;
+    rpmuint32_t i;
+
+    if (cfn == NULL || macrofiles == NULL)
+	return -1;
+    if (fp == NULL) fp = stderr;
+    t = mcachePath(cfn, macrofiles);
+    hdr = mcacheMap(t, &nb);
+    if (hdr == NULL) {
+	t = _free(t);
+	return -1;
+    }
+
+    fprintf(fp, "%s: version %u, %u bytes, %u files, %u macros\n",
+		t, (unsigned) hdr->version, (unsigned) hdr->nbytes,
+		(unsigned) hdr->nfiles, (unsigned) hdr->ndefs);
+    fprintf(fp, "key: %s\n", MCACHE_STR(hdr, hdr->key));
+    {	const struct mcacheFile_s * mcf = MCACHE_FILES(hdr);
+	for (i = 0; i < hdr->nfiles; i++, mcf++) {
+	    static const char hex[] = "0123456789abcdef";
+	    char digest[2 * sizeof(mcf->digest) + 1];
+	    size_t j;
+	    for (j = 0; j < sizeof(mcf->digest); j++) {
+		digest[2*j] = hex[(mcf->digest[j] >> 4) & 0xf];
+		digest[2*j+1] = hex[mcf->digest[j] & 0xf];
+	    }
+	    digest[2*j] = '\0';
+	    fprintf(fp, "%c %s %llu %llu %s\n",
+		((mcf->flags & MCACHEF_MISSING) ? '-'
+			: (mcf->flags & MCACHEF_TOPLEVEL) ? 'F' : 'L'),
+		digest, (unsigned long long) mcf->mtime,
+		(unsigned long long) mcf->size, MCACHE_STR(hdr, mcf->fn));
+	}
+    }
+    {	const struct mcacheDef_s * def = MCACHE_DEFS(hdr);
+	for (i = 0; i < hdr->ndefs; i++, def++) {
+	    const char * o = MCACHE_STR(hdr, def->o);
+	    const char * b = MCACHE_STR(hdr, def->b);
+	    fprintf(fp, "%3d: %s", (int) def->level, MCACHE_STR(hdr, def->n));
+	    if (o && *o)
+		fprintf(fp, "(%s)", o);
+	    if (b && *b)
+		fprintf(fp, "\t%s", b);
+	    fprintf(fp, "\n");
+	}
+    }
+
+    hdr = mcacheUnmap(hdr, nb);
+    t = _free(t);
+    return 0;
+}
+#endif	/* !defined(DEBUG_MACROS) */
+
 /*@-globstate@*/
 void
 rpmFreeMacros(MacroContext mc)
@@ -2941,6 +3851,7 @@ rpmFreeMacros(MacroContext mc)
 	}
 	mc->macroTable = _free(mc->macroTable);
     }
+    mc->macroHash = _free(mc->macroHash);
     memset(mc, 0, sizeof(*mc));
 }
 /*@=globstate@*/
@@ -14,17 +14,34 @@ int _ht_debug = 0;
 
 typedef /*@owned@*/ const void * voidptr;
 
-typedef	struct hashBucket_s * hashBucket;
+typedef	struct hashSlot_s * hashSlot;
+typedef	struct hashArena_s * hashArena;
 
 /**
+ * Hash table slot (empty slots have no data).
  */
-struct hashBucket_s {
+struct hashSlot_s {
+    rpmuint32_t hash;			/*!< cached hash value of key */
+    rpmuint32_t dataCount;		/*!< no. of data values */
     voidptr key;			/*!< hash key */
-/*@owned@*/ voidptr * data;		/*!< pointer to hashed data */
-    int dataCount;			/*!< length of data (0 if unknown) */
-/*@dependent@*/hashBucket next;		/*!< pointer to next item in bucket */
+/*@dependent@*/ /*@null@*/
+    voidptr * data;			/*!< data values (in arena) */
 };
 
+/**
+ * Block of memory for keys and data values, never moved once allocated.
+ */
+struct hashArena_s {
+/*@only@*/ /*@null@*/
+    hashArena next;			/*!< previous (full) block */
+    size_t nb;				/*!< no. of bytes in block */
+    size_t used;			/*!< no. of bytes used */
+};
+
+#define	HT_ARENA_SIZE	(64 * 1024)	/*!< default arena block size */
+#define	HT_ALIGN(_n)	(((_n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+#define	HT_MIGRATE	8		/*!< old slots moved per insert */
+
 /**
  */
 struct hashTable_s {
@@ -32,7 +49,15 @@ struct hashTable_s {
     int numBuckets;			/*!< number of hash buckets */
     size_t keySize;			/*!< size of key (0 if unknown) */
     int freeData;	/*!< should data be freed when table is destroyed? */
-    hashBucket * buckets;		/*!< hash bucket array */
+    hashSlot slots;			/*!< slot array (power of 2) */
+    rpmuint32_t mask;			/*!< no. of slots - 1 */
+    rpmuint32_t nkeys;			/*!< no. of keys in table */
+/*@only@*/ /*@null@*/
+    hashSlot oslots;			/*!< slot array being migrated */
+    rpmuint32_t omask;			/*!< no. of old slots - 1 */
+    rpmuint32_t migrated;		/*!< no. of old slots migrated */
+/*@only@*/ /*@null@*/
+    hashArena arena;			/*!< key and data value storage */
 /*@relnull@*/
     hashFunctionType fn;		/*!< generate hash value for key */
 /*@relnull@*/
@@ -43,28 +68,156 @@ struct hashTable_s {
 #endif
 };
 
+/**
+ * Allocate memory from the hash table arena.
+ * @param ht            pointer to hash table
+ * @param nb            no. of bytes
+ * @return		pointer to memory
+ */
+static void * htAlloc(hashTable ht, size_t nb)
+	/*@modifies ht @*/
+{
+    hashArena a = ht->arena;
+    void * p;
+
+    nb = HT_ALIGN(nb);
+    if (a == NULL || a->nb - a->used < nb) {
+	size_t blk = HT_ALIGN(sizeof(*a));
+	size_t anb = (nb > HT_ARENA_SIZE - blk ? nb : HT_ARENA_SIZE - blk);
+	hashArena na = xmalloc(blk + anb);
+
+	na->nb = anb;
+	na->used = 0;
+	/* Keep a partly used block current for a large allocation. */
+	if (a != NULL && anb > HT_ARENA_SIZE - blk) {
+	    na->next = a->next;
+	    a->next = na;
+	} else {
+	    na->next = a;
+	    ht->arena = na;
+	}
+	a = na;
+    }
+    p = ((char *)a) + HT_ALIGN(sizeof(*a)) + a->used;
+    a->used += nb;
+    return p;
+}
+
+/**
+ * Return the (mixed) hash value of a key.
+ * Slots are indexed by the low bits of the hash, but hash functions like
+ * fpHashFunction() leave most of the entropy in the high bits. The
+ * MurmurHash3 fmix32 finalizer spreads every input bit over the low bits.
+ * @param ht            pointer to hash table
+ * @param key           pointer to key value
+ * @return		hash value
+ */
+static rpmuint32_t htHash(hashTable ht, const void * key)
+	/*@*/
+{
+    rpmuint32_t h = ht->fn(0, key, 0);
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+/**
+ * Find slot of key in a slot array.
+ * @param ht            pointer to hash table
+ * @param slots         slot array
+ * @param mask          no. of slots - 1
+ * @param hash          hash value of key
+ * @param key           pointer to key value
+ * @return pointer to slot of key (or an empty slot)
+ */
+static /*@shared@*/
+hashSlot findSlot(hashTable ht, hashSlot slots, rpmuint32_t mask,
+		rpmuint32_t hash, const void * key)
+	/*@*/
+{
+    rpmuint32_t i = hash & mask;
+    hashSlot s;
+
+    /*@-modunconnomods@*/
+    while ((s = slots + i)->data != NULL) {
+	if (s->hash == hash && !ht->eq(s->key, key))
+	    break;
+	i = (i + 1) & mask;
+    }
+    /*@=modunconnomods@*/
+
+    return s;
+}
+
 /**
  * Find entry in hash table.
  * @param ht            pointer to hash table
+ * @param hash          hash value of key
  * @param key           pointer to key value
- * @return pointer to hash bucket of key (or NULL)
+ * @return pointer to slot of key (or NULL)
  */
 static /*@shared@*/ /*@null@*/
-hashBucket findEntry(hashTable ht, const void * key)
+hashSlot findEntry(hashTable ht, rpmuint32_t hash, const void * key)
 	/*@*/
 {
-    rpmuint32_t hash = 0;
-    hashBucket b;
+    hashSlot s = findSlot(ht, ht->slots, ht->mask, hash, key);
 
-    /*@-modunconnomods@*/
-    hash = ht->fn(hash, key, 0) % ht->numBuckets;
-    b = ht->buckets[hash];
+    /* Old slots below the migration point are all in the new array. */
+    if (s->data == NULL && ht->oslots != NULL)
+	s = findSlot(ht, ht->oslots, ht->omask, hash, key);
 
-    while (b && b->key && ht->eq(b->key, key))
-	b = b->next;
-    /*@=modunconnomods@*/
+    return (s->data != NULL ? s : NULL);
+}
+
+/**
+ * Move old slots into the new slot array.
+ * @param ht            pointer to hash table
+ * @param n             no. of old slots to move
+ */
+static void htMigrate(hashTable ht, rpmuint32_t n)
+	/*@modifies ht @*/
+{
+    rpmuint32_t nold = ht->omask + 1;
+
+    while (n-- > 0 && ht->migrated < nold) {
+	hashSlot o = ht->oslots + ht->migrated++;
+	rpmuint32_t i;
+
+	if (o->data == NULL)
+	    continue;
+	for (i = o->hash & ht->mask; ht->slots[i].data != NULL;
+	     i = (i + 1) & ht->mask)
+	    {};
+	ht->slots[i] = *o;		/* structure assignment */
+    }
 
-    return b;
+    if (ht->migrated == nold) {
+	ht->oslots = _free(ht->oslots);
+	ht->omask = 0;
+	ht->migrated = 0;
+    }
+}
+
+/**
+ * Double the no. of slots, old slots are moved incrementally.
+ * @param ht            pointer to hash table
+ */
+static void htGrow(hashTable ht)
+	/*@modifies ht @*/
+{
+    /* Finish a pending migration first. */
+    if (ht->oslots != NULL)
+	htMigrate(ht, ht->omask + 1);
+
+    ht->oslots = ht->slots;
+    ht->omask = ht->mask;
+    ht->migrated = 0;
+    ht->mask = 2 * ht->mask + 1;
+    ht->slots = xcalloc(ht->mask + 1, sizeof(*ht->slots));
 }
 
 int hashEqualityString(const void * key1, const void * key2)
@@ -143,77 +296,77 @@ rpmuint32_t hashFunctionString(rpmuint32_t h, const void * data, size_t size)
 
 void htAddEntry(hashTable ht, const void * key, const void * data)
 {
-    rpmuint32_t hash = 0;
-    hashBucket b;
-
-    hash = ht->fn(hash, key, 0) % ht->numBuckets;
-    b = ht->buckets[hash];
-
-    while (b && b->key && ht->eq(b->key, key))
-	b = b->next;
-
-    if (b == NULL) {
-	b = xmalloc(sizeof(*b));
+    rpmuint32_t hash = htHash(ht, key);
+    hashSlot s;
+
+    if (ht->oslots != NULL)
+	htMigrate(ht, HT_MIGRATE);
+
+    if ((s = findEntry(ht, hash, key)) == NULL) {
+	/* Keep the load factor below 3/4. */
+	if (4 * (ht->nkeys + 1) > 3 * (ht->mask + 1))
+	    htGrow(ht);
+	s = findSlot(ht, ht->slots, ht->mask, hash, key);
+	s->hash = hash;
 	if (ht->keySize) {
-	    char *k = xmalloc(ht->keySize);
+	    char *k = htAlloc(ht, ht->keySize);
 	    memcpy(k, key, ht->keySize);
-	    b->key = k;
+	    s->key = k;
 	} else {
-	    b->key = key;
+	    s->key = key;
 	}
-	b->dataCount = 0;
-	b->next = ht->buckets[hash];
-	b->data = NULL;
-	ht->buckets[hash] = b;
+	s->dataCount = 0;
+	s->data = htAlloc(ht, sizeof(*s->data));
+	ht->nkeys++;
+    } else if ((s->dataCount & (s->dataCount - 1)) == 0) {
+	/* Data values are reallocated in the arena when a power of 2 fills. */
+	voidptr * ndata = htAlloc(ht, 2 * s->dataCount * sizeof(*s->data));
+	memcpy(ndata, s->data, s->dataCount * sizeof(*s->data));
+	s->data = ndata;
     }
 
-    b->data = xrealloc(b->data, sizeof(*b->data) * (b->dataCount + 1));
-    b->data[b->dataCount++] = data;
+    s->data[s->dataCount++] = data;
 }
 
 int htHasEntry(hashTable ht, const void * key)
 {
-    hashBucket b;
+    hashSlot s;
 
-    if (!(b = findEntry(ht, key))) return 0; else return 1;
+    if (!(s = findEntry(ht, htHash(ht, key), key))) return 0; else return 1;
 }
 
 int htGetEntry(hashTable ht, const void * key, const void * data,
 	       int * dataCount, const void * tableKey)
 {
-    hashBucket b;
+    hashSlot s;
 
-    if ((b = findEntry(ht, key)) == NULL)
+    if ((s = findEntry(ht, htHash(ht, key), key)) == NULL)
 	return 1;
 
     if (data)
-	*(const void ***)data = (const void **) b->data;
+	*(const void ***)data = (const void **) s->data;
     if (dataCount)
-	*dataCount = b->dataCount;
+	*dataCount = s->dataCount;
     if (tableKey)
-	*(const void **)tableKey = b->key;
+	*(const void **)tableKey = s->key;
 
     return 0;
 }
 
 const void ** htGetKeys(hashTable ht)
 {
-    const void ** keys = xcalloc(ht->numBuckets+1, sizeof(const void*));
+    const void ** keys = xcalloc(ht->nkeys+1, sizeof(const void*));
     const void ** keypointer = keys;
-    hashBucket b, n;
-    int i;
+    rpmuint32_t i;
 
-    for (i = 0; i < ht->numBuckets; i++) {
-	b = ht->buckets[i];
-	if (b == NULL)
-	    continue;
-	if (b->data)
-	    *(keys++) = b->key;
-	do {
-	    n = b->next;
-	    if(n != NULL)
-    		*(keys++) = n->key;
-	} while ((b = n) != NULL);
+    for (i = 0; i <= ht->mask; i++) {
+	if (ht->slots[i].data != NULL)
+	    *(keys++) = ht->slots[i].key;
+    }
+    if (ht->oslots != NULL)
+    for (i = ht->migrated; i <= ht->omask; i++) {
+	if (ht->oslots[i].data != NULL)
+	    *(keys++) = ht->oslots[i].key;
     }
 
     return keypointer;
@@ -224,28 +377,26 @@ static void htFini(void * _ht)
 	/*@modifies _ht @*/
 {
     hashTable ht = _ht;
-    hashBucket b, n;
-    int i;
+    hashArena a;
+    rpmuint32_t i;
 
-    for (i = 0; i < ht->numBuckets; i++) {
-	b = ht->buckets[i];
-	if (b == NULL)
-	    continue;
-	ht->buckets[i] = NULL;
-	if (ht->keySize > 0)
-	    b->key = _free(b->key);
-	do {
-	    n = b->next;
-	    if (b->data) {
-		if (ht->freeData)
-		    *b->data = _free(*b->data);
-		b->data = _free(b->data);
-	    }
-	    b = _free(b);
-	} while ((b = n) != NULL);
+    if (ht->oslots != NULL)
+	htMigrate(ht, ht->omask + 1);
+
+    if (ht->freeData)
+    for (i = 0; i <= ht->mask; i++) {
+	hashSlot s = ht->slots + i;
+	if (s->data != NULL)
+	    *s->data = _free(*s->data);
     }
+    ht->slots = _free(ht->slots);
+    ht->mask = 0;
+    ht->nkeys = 0;
 
-    ht->buckets = _free(ht->buckets);
+    while ((a = ht->arena) != NULL) {
+	ht->arena = a->next;
+	a = _free(a);
+    }
 }
 /*@=mustmod@*/
 
@@ -270,9 +421,20 @@ hashTable htCreate(int numBuckets, size_t keySize, int freeData,
 		hashFunctionType fn, hashEqualityType eq)
 {
     hashTable ht = htGetPool(_htPool);
+    rpmuint32_t nslots = 16;
+
+    /* Size the slot array for numBuckets keys at a load factor <= 1/2. */
+    while (nslots < 2 * (rpmuint32_t)numBuckets && nslots < 0x40000000)
+	nslots <<= 1;
 
     ht->numBuckets = numBuckets;
-    ht->buckets = xcalloc(numBuckets, sizeof(*ht->buckets));
+    ht->slots = xcalloc(nslots, sizeof(*ht->slots));
+    ht->mask = nslots - 1;
+    ht->nkeys = 0;
+    ht->oslots = NULL;
+    ht->omask = 0;
+    ht->migrated = 0;
+    ht->arena = NULL;
     ht->keySize = keySize;
     ht->freeData = freeData;
     /*@-assignexpose@*/
@@ -135,7 +135,8 @@ hashTable htFree( /*@only@*/ hashTable ht)
  * Create hash table.
  * If keySize > 0, the key is duplicated within the table (which costs
  * memory, but may be useful anyway.
- * @param numBuckets    number of hash buckets
+ * The table grows as needed, numBuckets is only the initial size.
+ * @param numBuckets    expected number of keys
  * @param keySize       size of key (0 if unknown)
  * @param freeData      Should data be freed when table is destroyed?
  * @param fn            function to generate hash key (NULL for default)
@@ -854,6 +854,52 @@ rpmioItem rpmioPutPool(rpmioItem item)
 	/*@globals fileSystem @*/
         /*@modifies item, fileSystem @*/;
 
+/**
+ * Create a memory arena (bump allocation from chunks, freed all at once).
+ * @note Arenas are not thread safe.
+ * @param name		arena name
+ * @param size		chunk size (0 uses default)
+ * @return		memory arena
+ */
+rpmioArena rpmioNewArena(/*@observer@*/ const char * name, size_t size)
+	/*@*/;
+
+/**
+ * Allocate (pointer aligned, uninitialized) memory from an arena.
+ * @param arena		memory arena (NULL uses xmalloc)
+ * @param size		no. of bytes
+ * @return		memory (released by rpmioResetArena/rpmioFreeArena)
+ */
+/*@only@*/
+void * rpmioArenaAlloc(/*@null@*/ rpmioArena arena, size_t size)
+	/*@modifies arena @*/;
+
+/**
+ * Duplicate a string into an arena.
+ * @param arena		memory arena (NULL uses xstrdup)
+ * @param s		string
+ * @return		copy of string
+ */
+/*@only@*/
+char * rpmioArenaStrdup(/*@null@*/ rpmioArena arena, const char * s)
+	/*@modifies arena @*/;
+
+/**
+ * Release all memory allocated from an arena, keeping one chunk for reuse.
+ * @param arena		memory arena
+ */
+void rpmioResetArena(/*@null@*/ rpmioArena arena)
+	/*@modifies arena @*/;
+
+/**
+ * Destroy a memory arena.
+ * @param arena		memory arena
+ * @return		NULL always
+ */
+/*@null@*/
+rpmioArena rpmioFreeArena(/*@only@*/ /*@null@*/ rpmioArena arena)
+	/*@modifies arena @*/;
+
 #ifdef __cplusplus
 }
 #endif
@@ -557,19 +557,9 @@ void fdUpdateDigests(FD_t fd, const unsigned char * buf, ssize_t buflen)
 	/*@globals internalState @*/
 	/*@modifies fd, internalState @*/
 {
-    int i;
-
   if (fd->ndigests > 0 && buf != NULL && buflen > 0) {
     fdstat_enter(fd, FDSTAT_DIGEST);
-#if defined(_OPENMP)
-#pragma omp parallel for if (fd->ndigests > 1)
-#endif
-    for (i = fd->ndigests - 1; i >= 0; i--) {
-	DIGEST_CTX ctx = fd->digests[i];
-	if (ctx == NULL)
-	    continue;
-	(void) rpmDigestUpdate(ctx, buf, buflen);
-    }
+    (void) rpmDigestUpdateMulti(fd->digests, fd->ndigests, buf, buflen);
     fdstat_exit(fd, FDSTAT_DIGEST, buflen);
   }
 }
@@ -660,6 +650,32 @@ int fdFileno(/*@null@*/ void * cookie)
 }
 /*@=shadow@*/
 
+/** \ingroup rpmio
+ * Remove a "T[0-9]*" compression thread count from an fmode.
+ * A bare "T" or "T0" asks for one thread per online cpu.
+ * @param fmode		compressor fmode (e.g. "w9T8"), modified in place
+ * @return		no. of compression threads (1 if not specified)
+ */
+/*@unused@*/ static inline
+int fdFmodeThreads(char * fmode)
+	/*@modifies fmode @*/
+{
+    char * t = strchr(fmode, 'T');
+    char * te;
+    int nthreads = 1;
+
+    if (t == NULL)
+	return nthreads;
+    for (te = t + 1, nthreads = 0; *te >= '0' && *te <= '9'; te++)
+	nthreads = 10 * nthreads + (int)(*te - '0');
+    (void) memmove(t, te, strlen(te) + 1);
+#if defined(_SC_NPROCESSORS_ONLN)
+    if (nthreads <= 0)
+	nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return (nthreads > 0 ? nthreads : 1);
+}
+
 #ifdef __cplusplus
 }
 #endif
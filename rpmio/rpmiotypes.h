@@ -47,6 +47,10 @@ struct rpmioItem_s {
  */
 typedef struct rpmioPool_s * rpmioPool;
 
+/**
+ */
+typedef struct rpmioArena_s * rpmioArena;
+
 /** \ingroup rpmio
  */
 typedef /*@abstract@*/ /*@refcounted@*/ struct rpmiob_s * rpmiob;
@@ -404,6 +408,19 @@ DIGEST_CTX rpmDigestInit(pgpHashAlgo hashalgo, rpmDigestFlags flags)
 int rpmDigestUpdate(/*@null@*/ DIGEST_CTX ctx, const void * data, size_t len)
 	/*@modifies ctx @*/;
 
+/** \ingroup rpmpgp
+ * Update several contexts with the same plain text buffer.
+ * The buffer is fed in cache sized slices to every context in turn.
+ * @param ctxs		digest contexts (NULL entries are skipped)
+ * @param nctxs		no. of digest contexts
+ * @param data		next data buffer
+ * @param len		no. bytes of data
+ * @return		0 on success
+ */
+int rpmDigestUpdateMulti(DIGEST_CTX * ctxs, size_t nctxs,
+		const void * data, size_t len)
+	/*@modifies *ctxs @*/;
+
 /** \ingroup rpmpgp
  * Return digest and destroy context.
  *
@@ -15,6 +15,17 @@ static int nrecs = 0;
 /*@unchecked@*/
 static /*@only@*/ /*@null@*/ rpmlogRec recs = NULL;
 
+#if defined(WITH_PTHREADS)
+/* The saved messages are appended to by any thread that logs. */
+/*@unchecked@*/
+static pthread_mutex_t rpmlogLock = PTHREAD_MUTEX_INITIALIZER;
+#define	DO_LOCK()	(void) pthread_mutex_lock(&rpmlogLock)
+#define	DO_UNLOCK()	(void) pthread_mutex_unlock(&rpmlogLock)
+#else
+#define	DO_LOCK()
+#define	DO_UNLOCK()
+#endif
+
 /**
  * Wrapper to free(3), hides const compilation noise, permit NULL, return NULL.
  * @param p		memory to free
@@ -29,21 +40,31 @@ _free(/*@only@*/ /*@null@*/ /*@out@*/ const void * p) /*@modifies p@*/
 
 int rpmlogGetNrecs(void)
 {
-    return nrecs;
+    int n;
+    DO_LOCK();
+    n = nrecs;
+    DO_UNLOCK();
+    return n;
 }
 
 int rpmlogCode(void)
 {
+    int code = -1;
+    DO_LOCK();
     if (recs != NULL && nrecs > 0)
-	return recs[nrecs-1].code;
-    return -1;
+	code = recs[nrecs-1].code;
+    DO_UNLOCK();
+    return code;
 }
 
 const char * rpmlogMessage(void)
 {
+    const char * msg = _("(no error)");
+    DO_LOCK();
     if (recs != NULL && nrecs > 0)
-	return recs[nrecs-1].message;
-    return _("(no error)");
+	msg = recs[nrecs-1].message;
+    DO_UNLOCK();
+    return msg;
 }
 
 const char * rpmlogRecMessage(rpmlogRec rec)
@@ -66,12 +87,14 @@ void rpmlogPrint(FILE *f)
     if (f == NULL)
 	f = stderr;
 
+    DO_LOCK();
     if (recs)
     for (i = 0; i < nrecs; i++) {
 	rpmlogRec rec = recs + i;
 	if (rec->message && *rec->message)
 	    fprintf(f, "    %s", rec->message);
     }
+    DO_UNLOCK();
 }
 /*@=modfilesys@*/
 
@@ -81,6 +104,7 @@ void rpmlogClose (void)
 {
     int i;
 
+    DO_LOCK();
     if (recs)
     for (i = 0; i < nrecs; i++) {
 	rpmlogRec rec = recs + i;
@@ -88,6 +112,7 @@ void rpmlogClose (void)
     }
     recs = _free(recs);
     nrecs = 0;
+    DO_UNLOCK();
 }
 
 void rpmlogOpen (/*@unused@*/ const char *ident,
@@ -257,6 +282,7 @@ void vrpmlog (unsigned code, const char *fmt, va_list ap)
 
     /* Save copy of all messages at warning (or below == "more important"). */
     if (pri <= RPMLOG_WARNING) {
+	DO_LOCK();
 	if (recs == NULL)
 	    recs = xmalloc((nrecs+2) * sizeof(*recs));
 	else
@@ -268,6 +294,7 @@ void vrpmlog (unsigned code, const char *fmt, va_list ap)
 	recs[nrecs].code = 0;
 	recs[nrecs].pri = 0;
 	recs[nrecs].message = NULL;
+	DO_UNLOCK();
     }
 
     if (_rpmlogCallback) {
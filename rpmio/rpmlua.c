@@ -710,6 +710,148 @@ int rpmluaCheckScript(rpmlua _lua, const char *script, const char *name)
     return ret;
 }
 
+/**
+ * Compiled chunk cache.
+ * The same scriptlet body (triggers in particular) is often run many times
+ * in a transaction. The lua_dump'ed bytecode of each chunk is kept here,
+ * keyed by a digest of chunk name and body, and is reloaded instead of
+ * re-parsing the source. The cache outlives any one lua_State.
+ * Only rpmluaRunChunk() (i.e. package scriptlets) goes through the cache,
+ * %{lua:...} macro bodies are run uncached by rpmluaRunScript().
+ */
+#define	RPMLUA_CHUNKS_MAX	256
+
+typedef struct rpmluaChunk_s {
+/*@only@*/ /*@relnull@*/
+    const char * digest;
+/*@only@*/ /*@relnull@*/
+    char * b;
+    size_t nb;
+} * rpmluaChunk;
+
+/*@unchecked@*/
+static struct rpmluaChunk_s _rpmluaChunks[RPMLUA_CHUNKS_MAX];
+
+/*@unchecked@*/
+static int _nrpmluaChunks;
+
+/*@unchecked@*/
+static int _rpmluaChunksNext;
+
+static int rpmluaChunkWriter(/*@unused@*/ lua_State *L,
+		const void * p, size_t sz, void * ud)
+	/*@modifies ud @*/
+{
+    rpmluaChunk chunk = ud;
+
+    chunk->b = xrealloc(chunk->b, chunk->nb + sz);
+    memcpy(chunk->b + chunk->nb, p, sz);
+    chunk->nb += sz;
+    return 0;
+}
+
+/**
+ * Push a compiled chunk, from the bytecode cache if possible.
+ * @param L		lua state
+ * @param script	chunk source
+ * @param name		chunk name
+ * @param _cop		compile time accumulator (or NULL)
+ * @return		0 on success (function pushed), error message pushed otherwise
+ */
+static int rpmluaLoadChunk(lua_State *L, const char * script,
+		const char * name, /*@null@*/ void * _cop)
+	/*@globals _rpmluaChunks, _nrpmluaChunks, _rpmluaChunksNext @*/
+	/*@modifies L, _cop, _rpmluaChunks, _nrpmluaChunks,
+		_rpmluaChunksNext @*/
+{
+    size_t ns = strlen(script);
+    rpmluaChunk chunk = NULL;
+    const char * digest = NULL;
+    DIGEST_CTX ctx;
+    int rc;
+    int i;
+
+    (void) rpmswEnter(_cop, 0);
+
+    ctx = rpmDigestInit(PGPHASHALGO_SHA1, RPMDIGEST_NONE);
+    (void) rpmDigestUpdate(ctx, name, strlen(name) + 1);
+    (void) rpmDigestUpdate(ctx, script, ns);
+    (void) rpmDigestFinal(ctx, &digest, NULL, 1);
+
+    if (digest != NULL)
+    for (i = 0; i < _nrpmluaChunks; i++) {
+	if (_rpmluaChunks[i].digest == NULL
+	 || strcmp(_rpmluaChunks[i].digest, digest))
+	    continue;
+	chunk = _rpmluaChunks + i;
+	break;
+    }
+
+    if (chunk != NULL) {
+	rc = luaL_loadbuffer(L, chunk->b, chunk->nb, name);
+    } else {
+	rc = luaL_loadbuffer(L, script, ns, name);
+	if (rc == 0 && digest != NULL) {
+	    /* When full, evict a single entry (round robin). */
+	    if (_nrpmluaChunks < RPMLUA_CHUNKS_MAX)
+		chunk = _rpmluaChunks + _nrpmluaChunks;
+	    else {
+		chunk = _rpmluaChunks + _rpmluaChunksNext;
+		_rpmluaChunksNext = (_rpmluaChunksNext + 1) % RPMLUA_CHUNKS_MAX;
+		chunk->digest = _free(chunk->digest);
+		chunk->b = _free(chunk->b);
+		chunk->nb = 0;
+	    }
+#if LUA_VERSION_NUM > 502
+	    if (lua_dump(L, rpmluaChunkWriter, chunk, 0) == 0 && chunk->nb > 0)
+#else
+	    if (lua_dump(L, rpmluaChunkWriter, chunk) == 0 && chunk->nb > 0)
+#endif
+	    {
+		chunk->digest = digest;
+		digest = NULL;
+		if (_nrpmluaChunks < RPMLUA_CHUNKS_MAX)
+		    _nrpmluaChunks++;
+	    } else {
+		chunk->b = _free(chunk->b);
+		chunk->nb = 0;
+	    }
+	}
+    }
+    digest = _free(digest);
+
+    (void) rpmswExit(_cop, ns);
+    return rc;
+}
+
+int rpmluaRunChunk(rpmlua _lua, const char *script, const char *name,
+		void * _cop, void * _eop)
+{
+    INITSTATE(_lua, lua);
+    lua_State *L = lua->L;
+    int ret = 0;
+    if (name == NULL)
+	name = "<lua>";
+    if (rpmluaLoadChunk(L, script, name, _cop) != 0) {
+	rpmlog(RPMLOG_ERR, _("invalid syntax in Lua script: %s\n"),
+		 lua_tostring(L, -1));
+	lua_pop(L, 1);
+	ret = -1;
+    } else {
+	int xx;
+	(void) rpmswEnter(_eop, 0);
+	xx = lua_pcall(L, 0, 0, 0);
+	(void) rpmswExit(_eop, 0);
+	if (xx != 0) {
+	    rpmlog(RPMLOG_ERR, _("Lua script failed: %s\n"),
+		 lua_tostring(L, -1));
+	    lua_pop(L, 1);
+	    ret = -1;
+	}
+    }
+    return ret;
+}
+
 int rpmluaRunScript(rpmlua _lua, const char *script, const char *name)
 {
     INITSTATE(_lua, lua);
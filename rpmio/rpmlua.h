@@ -85,6 +85,21 @@ int rpmluaRunScript(/*@null@*/ rpmlua _lua, const char *script,
 		    /*@null@*/ const char *name)
 	/*@globals fileSystem, internalState @*/
 	/*@modifies _lua, fileSystem, internalState @*/;
+/**
+ * Run a Lua chunk, reusing cached bytecode for an already seen body.
+ * Intended for package scriptlets; use rpmluaRunScript() for one-off chunks.
+ * @param _lua		lua interpreter (NULL uses global interpreter)
+ * @param script	chunk source
+ * @param name		chunk name (NULL uses "<lua>")
+ * @param _cop		compile time accumulator (rpmop, or NULL)
+ * @param _eop		execute time accumulator (rpmop, or NULL)
+ * @return		0 on success
+ */
+int rpmluaRunChunk(/*@null@*/ rpmlua _lua, const char *script,
+		    /*@null@*/ const char *name,
+		    /*@null@*/ void * _cop, /*@null@*/ void * _eop)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _lua, _cop, _eop, fileSystem, internalState @*/;
 /*@-exportlocal@*/
 int rpmluaRunScriptFile(/*@null@*/ rpmlua _lua, const char *filename)
 	/*@globals fileSystem, internalState @*/
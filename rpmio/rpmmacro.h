@@ -19,12 +19,22 @@ struct MacroEntry_s {
     unsigned short flags;	/*!< Flags. */
 };
 
+/*! The structure used to index a macro name (open addressing). */
+struct MacroSlot_s {
+    unsigned int hash;		/*!< Macro name hash. */
+    int	ix;			/*!< Macro table index + 1 (0 is empty). */
+};
+
 /*! The structure used to store the set of macros in a context. */
 struct MacroContext_s {
 /*@owned@*//*@null@*/
     MacroEntry *macroTable;	/*!< Macro entry table for context. */
     int	macrosAllocated;	/*!< No. of allocated macros. */
     int	firstFree;		/*!< No. of macros. */
+/*@owned@*//*@null@*/
+    struct MacroSlot_s *macroHash;	/*!< Macro name hash index. */
+    int	macroHashSize;		/*!< No. of hash slots (power of 2). */
+    int	sorted;			/*!< Is macro table sorted by name? */
 };
 #endif
 
@@ -42,6 +52,14 @@ extern MacroContext rpmCLIMacroContext;
  */
 /*@observer@*/ /*@checked@*/
 extern const char * rpmMacrofiles;
+
+/** \ingroup rpmrc
+ * Precompiled macro cache base name (NULL disables).
+ * The macrofiles path is hashed into a suffix, so that each distinct
+ * set of macro files has its own cache file.
+ */
+/*@observer@*/ /*@checked@*/ /*@null@*/
+extern const char * rpmMacrocache;
 /*@=redecl@*/
 
 /**
@@ -185,6 +203,8 @@ int rpmLoadMacroFile(/*@null@*/ MacroContext mc, const char * fn, int nesting)
 
 /**
  * Initialize macro context from set of macrofile(s).
+ * When rpmMacrocache is set, definitions are replayed from a current
+ * precompiled macro cache, or the cache is rebuilt after reading the files.
  * @param mc		macro context
  * @param macrofiles	colon separated list of macro files (NULL does nothing)
  */
@@ -193,6 +213,41 @@ void rpmInitMacros(/*@null@*/ MacroContext mc, const char * macrofiles)
 		h_errno, fileSystem, internalState @*/
 	/*@modifies mc, rpmGlobalMacroContext, fileSystem, internalState @*/;
 
+/**
+ * (Re-)build a precompiled macro cache from set of macrofile(s).
+ * @param cfn		macro cache base name
+ * @param macrofiles	colon separated list of macro files
+ * @return		0 on success
+ */
+int rpmMacroCacheBuild(/*@null@*/ const char * cfn,
+		/*@null@*/ const char * macrofiles)
+	/*@globals rpmGlobalMacroContext, rpmCLIMacroContext,
+		h_errno, fileSystem, internalState @*/
+	/*@modifies rpmGlobalMacroContext, fileSystem, internalState @*/;
+
+/**
+ * Verify that a precompiled macro cache is current.
+ * @param cfn		macro cache base name
+ * @param macrofiles	colon separated list of macro files
+ * @return		0 if current, 1 if stale, -1 if missing or invalid
+ */
+int rpmMacroCacheVerify(/*@null@*/ const char * cfn,
+		/*@null@*/ const char * macrofiles)
+	/*@globals h_errno, fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/;
+
+/**
+ * Print a precompiled macro cache to file stream.
+ * @param cfn		macro cache base name
+ * @param macrofiles	colon separated list of macro files
+ * @param fp		file stream (NULL uses stderr).
+ * @return		0 on success
+ */
+int rpmMacroCacheDump(/*@null@*/ const char * cfn,
+		/*@null@*/ const char * macrofiles, /*@null@*/ FILE * fp)
+	/*@globals fileSystem @*/
+	/*@modifies *fp, fileSystem @*/;
+
 /**
  * Destroy macro context.
  * @param mc		macro context (NULL uses global context).
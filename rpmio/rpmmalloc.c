@@ -20,6 +20,27 @@
 #define	EXIT_FAILURE	1
 #endif
 
+#if defined(WITH_PTHREADS)
+#include <pthread.h>
+
+#define	_POOL_MAGSIZE	32	/*!< no. of items in a thread cache */
+#define	_POOL_MAGBATCH	16	/*!< no. of items per refill/flush */
+
+/**
+ * Per-thread cache ("magazine") of unused pool items.
+ */
+typedef struct rpmioMag_s * rpmioMag;
+struct rpmioMag_s {
+/*@null@*/
+    rpmioMag next;		/*!< next magazine of this pool */
+/*@dependent@*/
+    rpmioPool pool;		/*!< pool this magazine caches */
+    int reused;			/*!< no. of items reused (not yet in pool) */
+    int nitems;			/*!< no. of cached items */
+    rpmioItem items[_POOL_MAGSIZE];
+};
+#endif	/* WITH_PTHREADS */
+
 /*@-modfilesys@*/
 /*@only@*/ void *vmefail(size_t size)
 {
@@ -60,8 +81,115 @@ struct rpmioPool_s {
     const char *name;
 /*@null@*/
     void * zlog;
+#if defined(WITH_PTHREADS)
+    pthread_key_t key;		/*!< per-thread magazine */
+    int havekey;		/*!< use per-thread magazines? */
+/*@null@*/
+    rpmioMag mags;		/*!< all magazines (protected by have) */
+#endif
 };
 
+#if defined(WITH_PTHREADS)
+/**
+ * Move the oldest magazine items to the pool list (lock must be possessed).
+ * @param pool		memory pool
+ * @param m		magazine
+ * @param n		no. of items to move
+ * @return		no. of items moved
+ */
+static int rpmioMagFlush(rpmioPool pool, rpmioMag m, int n)
+	/*@modifies pool, m @*/
+{
+    int i;
+
+    if (n > m->nitems)
+	n = m->nitems;
+    for (i = 0; i < n; i++) {
+	rpmioItem item = m->items[i];
+	item->pool = NULL;		/* XXX pool == next */
+	*pool->tail = item;
+	pool->tail = (void *)&item->pool;/* XXX pool == next */
+    }
+    m->nitems -= n;
+    if (m->nitems > 0)
+	memmove(m->items, m->items + n, m->nitems * sizeof(*m->items));
+    pool->reused += m->reused;
+    m->reused = 0;
+    return n;
+}
+
+/**
+ * Move items from the pool list to an empty magazine.
+ * @param pool		memory pool
+ * @param m		magazine
+ */
+static void rpmioMagRefill(rpmioPool pool, rpmioMag m)
+	/*@modifies pool, m @*/
+{
+    yarnPossess(pool->have);
+    while (m->nitems < _POOL_MAGBATCH && pool->head != NULL) {
+	rpmioItem item = pool->head;
+	pool->head = item->pool;	/* XXX pool == next */
+	if (pool->head == NULL)
+	    pool->tail = &pool->head;
+	m->items[m->nitems++] = item;
+    }
+    pool->reused += m->reused;
+    m->reused = 0;
+    yarnTwist(pool->have, BY, -m->nitems);
+}
+
+/**
+ * Return a thread's magazine items to the pool (thread exit).
+ * @param _m		magazine
+ */
+static void rpmioMagFini(void * _m)
+	/*@modifies _m @*/
+{
+    rpmioMag m = _m;
+    rpmioPool pool = m->pool;
+    rpmioMag * mp;
+    int n;
+
+    yarnPossess(pool->have);
+    n = rpmioMagFlush(pool, m, m->nitems);
+    for (mp = &pool->mags; *mp != NULL; mp = &(*mp)->next) {
+	if (*mp != m)
+	    continue;
+	*mp = m->next;
+	/*@loopbreak@*/ break;
+    }
+    yarnTwist(pool->have, BY, n);
+    m = _free(m);
+}
+
+/**
+ * Return the calling thread's magazine, creating it if necessary.
+ * @param pool		memory pool
+ * @return		magazine (NULL if pool is limited)
+ */
+/*@null@*/
+static rpmioMag rpmioPoolMag(rpmioPool pool)
+	/*@modifies pool @*/
+{
+    rpmioMag m;
+
+    /* Limited pools must see every item to wait for a free one. */
+    if (!pool->havekey || pool->limit >= 0)
+	return NULL;
+    if ((m = pthread_getspecific(pool->key)) == NULL) {
+	m = xcalloc(1, sizeof(*m));
+	m->pool = pool;
+	yarnPossess(pool->have);
+	m->next = pool->mags;
+	pool->mags = m;
+	yarnRelease(pool->have);
+	(void) pthread_setspecific(pool->key, m);
+    }
+    return m;
+}
+#endif	/* WITH_PTHREADS */
+
 /*@unchecked@*/ /*@only@*/ /*@null@*/
 static rpmioPool _rpmioPool;
 
@@ -78,6 +206,18 @@ rpmioPool rpmioFreePool(rpmioPool pool)
 	int count = 0;
 	yarnPossess(pool->have);
 VALGRIND_HG_CLEAN_MEMORY(pool, sizeof(*pool));
+#if defined(WITH_PTHREADS)
+	if (pool->havekey) {
+	    rpmioMag m;
+	    (void) pthread_key_delete(pool->key);
+	    pool->havekey = 0;
+	    while ((m = pool->mags) != NULL) {
+		pool->mags = m->next;
+		(void) rpmioMagFlush(pool, m, m->nitems);
+		m = _free(m);
+	    }
+	}
+#endif
 	while ((item = pool->head) != NULL) {
 VALGRIND_HG_CLEAN_MEMORY(item, pool->size);
 	    pool->head = item->pool;	/* XXX pool == next */
@@ -130,6 +270,10 @@ rpmioPool rpmioNewPool(const char * name, size_t size, int limit, int flags,
     pool->made = 0;
     pool->name = name;
     pool->zlog = NULL;
+#if defined(WITH_PTHREADS)
+    pool->havekey = (pthread_key_create(&pool->key, rpmioMagFini) == 0);
+    pool->mags = NULL;
+#endif
     rpmlog(RPMLOG_DEBUG, D_("pool %s:\tcreated size %u limit %d flags %d\n"), pool->name, (unsigned)pool->size, pool->limit, pool->flags);
     return pool;
 }
@@ -218,6 +362,25 @@ rpmioItem rpmioGetPool(rpmioPool pool, size_t size)
     rpmioItem item;
 
     if (pool != NULL) {
+#if defined(WITH_PTHREADS)
+	rpmioMag m = rpmioPoolMag(pool);
+
+	/* take an item from this thread's cache without locking */
+	if (m != NULL) {
+	    if (m->nitems == 0)
+		rpmioMagRefill(pool, m);
+	    if (m->nitems > 0) {
+		item = m->items[--m->nitems];
+		m->reused++;
+		item->pool = pool;	/* remember the pool this belongs to */
+		VALGRIND_MEMPOOL_ALLOC(pool,
+		    item + 1,
+		    size - sizeof(struct rpmioItem_s));
+		return item;
+	    }
+	}
+#endif
+
 	/* if can't create any more, wait for a space to show up */
 	yarnPossess(pool->have);
 	if (pool->limit == 0)
@@ -262,6 +425,24 @@ rpmioItem rpmioPutPool(rpmioItem item)
     rpmioPool pool;
 
     if ((pool = item->pool) != NULL) {
+#if defined(WITH_PTHREADS)
+	rpmioMag m = rpmioPoolMag(pool);
+
+	/* put the item in this thread's cache, flushing a batch if full */
+	if (m != NULL) {
+	    if (m->nitems == _POOL_MAGSIZE) {
+		int n;
+		yarnPossess(pool->have);
+		n = rpmioMagFlush(pool, m, _POOL_MAGBATCH);
+		yarnTwist(pool->have, BY, n);
+	    }
+	    item->pool = NULL;
+	    m->items[m->nitems++] = item;
+	    if (item->use != NULL)
+		yarnTwist(item->use, TO, 0);
+	    return NULL;
+	}
+#endif
 	yarnPossess(pool->have);
 	item->pool = NULL;		/* XXX pool == next */
 	*pool->tail = item;
@@ -281,6 +462,115 @@ rpmioItem rpmioPutPool(rpmioItem item)
 }
 /*@=internalglobs@*/
 
+/**
+ */
+struct rpmioArena_s {
+/*@null@*/
+    struct rpmioChunk_s * head;	/*!< chunk being allocated from */
+    size_t size;		/*!< default chunk size */
+    size_t allocated;		/*!< no. of bytes allocated since reset */
+/*@observer@*/
+    const char *name;
+};
+
+/**
+ */
+struct rpmioChunk_s {
+/*@null@*/
+    struct rpmioChunk_s * next;	/*!< previous chunk */
+    size_t size;		/*!< no. of bytes in chunk */
+    size_t used;		/*!< no. of bytes used */
+};
+
+#define	_ARENA_SIZE	(256 * 1024)
+#define	_ARENA_ALIGN(_n) \
+	(((_n) + sizeof(double) - 1) & ~(sizeof(double) - 1))
+#define	_CHUNK_DATA(_c)	\
+	(((char *)(_c)) + _ARENA_ALIGN(sizeof(struct rpmioChunk_s)))
+
+rpmioArena rpmioNewArena(const char * name, size_t size)
+{
+    rpmioArena arena = xcalloc(1, sizeof(*arena));
+    arena->head = NULL;
+    arena->size = (size > 0 ? size : _ARENA_SIZE);
+    arena->allocated = 0;
+    arena->name = name;
+    return arena;
+}
+
+void * rpmioArenaAlloc(rpmioArena arena, size_t size)
+{
+    struct rpmioChunk_s * c;
+    void * p;
+
+    if (arena == NULL)
+	return xmalloc(size);
+
+    size = _ARENA_ALIGN(size > 0 ? size : 1);
+    if ((c = arena->head) == NULL || c->size - c->used < size) {
+	size_t nb = (size > arena->size ? size : arena->size);
+	struct rpmioChunk_s * nc =
+		xmalloc(_ARENA_ALIGN(sizeof(*nc)) + nb);
+	nc->size = nb;
+	nc->used = 0;
+	/* Oversized chunks go behind the head, which may still have room. */
+	if (c != NULL && nb > arena->size) {
+	    nc->next = c->next;
+	    c->next = nc;
+	} else {
+	    nc->next = c;
+	    arena->head = nc;
+	}
+	c = nc;
+    }
+    p = _CHUNK_DATA(c) + c->used;
+    c->used += size;
+    arena->allocated += size;
+    return p;
+}
+
+char * rpmioArenaStrdup(rpmioArena arena, const char * s)
+{
+    size_t nb = strlen(s) + 1;
+    return memcpy(rpmioArenaAlloc(arena, nb), s, nb);
+}
+
+void rpmioResetArena(rpmioArena arena)
+{
+    struct rpmioChunk_s * c;
+
+    if (arena == NULL)
+	return;
+    if (arena->allocated > 0)
+	rpmlog(RPMLOG_DEBUG, D_("arena %s:\treset %u bytes.\n"),
+		arena->name, (unsigned)arena->allocated);
+
+    /* Keep the (most recent default sized) head chunk for reuse. */
+    if ((c = arena->head) != NULL) {
+	struct rpmioChunk_s * n;
+	while ((n = c->next) != NULL) {
+	    c->next = n->next;
+	    n = _free(n);
+	}
+	if (c->size > arena->size) {
+	    arena->head = NULL;
+	    c = _free(c);
+	} else
+	    c->used = 0;
+    }
+    arena->allocated = 0;
+}
+
+rpmioArena rpmioFreeArena(rpmioArena arena)
+{
+    if (arena != NULL) {
+	rpmioResetArena(arena);
+	arena->head = _free(arena->head);
+	arena = _free(arena);
+    }
+    return NULL;
+}
+
 #if !(HAVE_MCHECK_H && defined(__GNUC__)) && !defined(__LCLINT__)
 
 /*@out@*/ /*@only@*/ void * xmalloc (size_t size)
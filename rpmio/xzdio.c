@@ -7,6 +7,7 @@
 #include "rpmio_internal.h"
 #include <rpmmacro.h>
 #include <rpmcb.h>
+#include <yarn.h>
 
 #if defined(WITH_XZ)
 
@@ -46,6 +47,8 @@
 
 #define kBufferSize (1 << 15)
 
+typedef struct xzpool_s * XZPOOL;
+
 typedef struct xzfile {
 /*@only@*/
     rpmuint8_t buf[kBufferSize];	/*!< IO buffer */
@@ -54,8 +57,331 @@ typedef struct xzfile {
     FILE * fp;
     int encoding;
     int eof;
+/*@null@*/
+    XZPOOL pool;		/*!< parallel decompressor (or NULL) */
 } XZFILE;
 
+#if defined(WITH_PTHREADS)
+/* =============================================================== */
+/**
+ * Parallel xz decompression of multi-block streams.
+ *
+ * A seekable, single stream .xz file (or payload) whose index lists more
+ * than one block is decoded block by block on a pool of yarn threads,
+ * each worker pread(2)'ing and decoding whole blocks. xzread() returns
+ * the decoded blocks in stream order, waiting as needed. Workers run at
+ * most XZ_NJOBS blocks per thread ahead of the reader, and never hold more
+ * than XZ_MEMLIMIT decoded bytes in flight (the serial decoder's memlimit).
+ * Anything else (a pipe, a single block, concatenated streams, blocks
+ * larger than XZ_MEMLIMIT) falls back to the serial lzma_auto_decoder().
+ *
+ * All pool state is protected by a single yarn lock, whose value is
+ * bumped on every change.
+ */
+#define	XZ_NJOBS	2		/* max. decoded blocks per thread */
+#define	XZ_NTHREADS	4		/* default no. of decoder threads */
+#define	XZ_MEMLIMIT	(100 << 20)	/* max. decoded bytes in flight */
+
+typedef struct xzjob_s * XZJOB;
+
+/**
+ * A block being decoded.
+ */
+struct xzjob_s {
+    off_t offset;		/*!< Block file offset. */
+    size_t nin;			/*!< Block total (compressed) size. */
+/*@only@*/ /*@null@*/
+    uint8_t * out;		/*!< Decoded data. */
+    size_t nout;		/*!< Block uncompressed size. */
+    int rc;			/*!< 0 on success. */
+    int done;			/*!< Is the block decoded? */
+};
+
+/**
+ * Parallel xz decompressor.
+ */
+struct xzpool_s {
+    yarnLock lock;		/*!< Pool state (bumped on change). */
+    int fdno;
+    lzma_check check;		/*!< Stream integrity check. */
+    int nthreads;
+    yarnThread * threads;	/*!< Decoder threads. */
+    XZJOB jobs;			/*!< One job per block. */
+    unsigned njobs;
+    unsigned next;		/*!< Next block to decode. */
+    unsigned ix;		/*!< Block being read. */
+    size_t off;			/*!< Read offset in block being read. */
+    size_t inflight;		/*!< Decoded bytes allocated or reserved. */
+    int stop;			/*!< Are the threads to exit? */
+};
+
+/**
+ * Decode a block.
+ * @param pool		parallel xz decompressor
+ * @param job		block
+ * @return		0 on success
+ */
+static int xzpoolDecode(XZPOOL pool, XZJOB job)
+	/*@globals fileSystem @*/
+	/*@modifies job, fileSystem @*/
+{
+    lzma_filter filters[LZMA_FILTERS_MAX + 1];
+    lzma_block block;
+    uint8_t * in = malloc(job->nin);
+    size_t in_pos;
+    size_t out_pos = 0;
+    lzma_ret ret;
+    int rc = -1;
+    int i;
+
+    filters[0].id = LZMA_VLI_UNKNOWN;
+    job->out = malloc(job->nout ? job->nout : 1);
+    if (in == NULL || job->out == NULL)
+	goto exit;
+    if (pread(pool->fdno, in, job->nin, job->offset) != (ssize_t)job->nin)
+	goto exit;
+
+    memset(&block, 0, sizeof(block));
+    block.version = 0;
+    block.check = pool->check;
+    block.filters = filters;
+    block.header_size = lzma_block_header_size_decode(in[0]);
+    if (block.header_size > job->nin
+     || lzma_block_header_decode(&block, NULL, in) != LZMA_OK)
+	goto exit;
+
+    in_pos = block.header_size;
+    ret = lzma_block_buffer_decode(&block, NULL, in, &in_pos, job->nin,
+			job->out, &out_pos, job->nout);
+    if (ret == LZMA_OK && out_pos == job->nout)
+	rc = 0;
+
+exit:
+    for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+	free(filters[i].options);
+    free(in);
+    return rc;
+}
+
+/**
+ * Decoder thread: decode blocks in order until done or stopped.
+ * @param _pool		parallel xz decompressor
+ */
+static void xzpoolWorker(void * _pool)
+	/*@globals fileSystem @*/
+	/*@modifies _pool, fileSystem @*/
+{
+    XZPOOL pool = _pool;
+    unsigned window = XZ_NJOBS * pool->nthreads;
+
+    for (;;) {
+	XZJOB job;
+
+	yarnPossess(pool->lock);
+	while (!pool->stop && pool->next < pool->njobs
+	    && (pool->next >= pool->ix + window
+	     || (pool->inflight > 0 && pool->inflight
+			+ pool->jobs[pool->next].nout > XZ_MEMLIMIT)))
+	    yarnWaitFor(pool->lock, NOT_TO_BE, yarnPeekLock(pool->lock));
+	if (pool->stop || pool->next >= pool->njobs) {
+	    yarnRelease(pool->lock);
+	    break;
+	}
+	job = pool->jobs + pool->next++;
+	pool->inflight += job->nout;
+	yarnRelease(pool->lock);
+
+	job->rc = xzpoolDecode(pool, job);
+
+	yarnPossess(pool->lock);
+	job->done = 1;
+	yarnTwist(pool->lock, BY, 1);
+    }
+}
+
+/**
+ * Read and decode the index of a seekable, single stream .xz file.
+ * @param fdno		file descriptor (positioned at the stream header)
+ * @retval *flagsp	stream flags
+ * @retval *startp	stream header offset
+ * @return		stream index (NULL if not usable)
+ */
+/*@null@*/
+static lzma_index * xzpoolIndex(int fdno, /*@out@*/ lzma_stream_flags * flagsp,
+		/*@out@*/ off_t * startp)
+	/*@globals fileSystem @*/
+	/*@modifies *flagsp, *startp, fileSystem @*/
+{
+    uint8_t buf[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags footer;
+    lzma_index * idx = NULL;
+    uint64_t memlimit = UINT64_MAX;
+    struct stat sb;
+    off_t start = lseek(fdno, 0, SEEK_CUR);
+    off_t end;
+    uint8_t * ib = NULL;
+    size_t nib;
+    size_t pos = 0;
+
+    if (start < 0 || fstat(fdno, &sb) != 0 || !S_ISREG(sb.st_mode))
+	return NULL;
+    end = sb.st_size;
+    if (end - start < 2 * LZMA_STREAM_HEADER_SIZE)
+	return NULL;
+
+    if (pread(fdno, buf, sizeof(buf), start) != (ssize_t)sizeof(buf)
+     || lzma_stream_header_decode(flagsp, buf) != LZMA_OK)
+	return NULL;
+    if (pread(fdno, buf, sizeof(buf), end - LZMA_STREAM_HEADER_SIZE)
+		!= (ssize_t)sizeof(buf)
+     || lzma_stream_footer_decode(&footer, buf) != LZMA_OK
+     || lzma_stream_flags_compare(flagsp, &footer) != LZMA_OK)
+	return NULL;
+
+    nib = (size_t) footer.backward_size;
+    if ((off_t)nib > end - start - 2 * LZMA_STREAM_HEADER_SIZE
+     || (ib = malloc(nib)) == NULL)
+	return NULL;
+    if (pread(fdno, ib, nib, end - LZMA_STREAM_HEADER_SIZE - nib)
+		== (ssize_t)nib
+     && lzma_index_buffer_decode(&idx, &memlimit, NULL, ib, &pos, nib)
+		== LZMA_OK)
+    {
+	/* XXX concatenated streams or stream padding: use lzma_auto_decoder. */
+	if (lzma_index_stream_size(idx) != (lzma_vli)(end - start)) {
+	    lzma_index_end(idx, NULL);
+	    idx = NULL;
+	}
+    }
+    free(ib);
+    *startp = start;
+    return idx;
+}
+
+/**
+ * Create a parallel xz decompressor (if the stream has multiple blocks).
+ * @param fdno		file descriptor (positioned at the stream header)
+ * @param nthreads	no. of decoder threads
+ * @return		parallel xz decompressor (NULL if not usable)
+ */
+/*@null@*/
+static XZPOOL xzpoolNew(int fdno, int nthreads)
+	/*@globals fileSystem @*/
+	/*@modifies fileSystem @*/
+{
+    lzma_stream_flags flags;
+    lzma_index_iter iter;
+    lzma_index * idx;
+    off_t start = 0;
+    XZPOOL pool;
+    unsigned i;
+
+    if (nthreads <= 1 || (idx = xzpoolIndex(fdno, &flags, &start)) == NULL)
+	return NULL;
+    if (lzma_index_block_count(idx) <= 1) {
+	lzma_index_end(idx, NULL);
+	return NULL;
+    }
+
+    pool = xcalloc(1, sizeof(*pool));
+    pool->fdno = fdno;
+    pool->check = flags.check;
+    pool->njobs = (unsigned) lzma_index_block_count(idx);
+    pool->jobs = xcalloc(pool->njobs, sizeof(*pool->jobs));
+    lzma_index_iter_init(&iter, idx);
+    for (i = 0; i < pool->njobs; i++) {
+	XZJOB job = pool->jobs + i;
+	if (lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)
+	 || iter.block.uncompressed_size > XZ_MEMLIMIT)
+	    break;
+	job->offset = start + (off_t) iter.block.compressed_file_offset;
+	job->nin = (size_t) iter.block.total_size;
+	job->nout = (size_t) iter.block.uncompressed_size;
+    }
+    lzma_index_end(idx, NULL);
+    if (i < pool->njobs) {
+	pool->jobs = _free(pool->jobs);
+	pool = _free(pool);
+	return NULL;
+    }
+
+    pool->lock = yarnNewLock(0);
+    pool->nthreads = nthreads;
+    pool->threads = xcalloc(nthreads, sizeof(*pool->threads));
+    for (i = 0; i < (unsigned) nthreads; i++)
+	pool->threads[i] = yarnLaunch(xzpoolWorker, pool);
+    return pool;
+}
+
+/**
+ * Read decoded data, in stream order.
+ * @param pool		parallel xz decompressor
+ * @param buf		output buffer
+ * @param len		output buffer size
+ * @return		no. of bytes read (0 on EOF, -1 on error)
+ */
+static ssize_t xzpoolRead(XZPOOL pool, uint8_t * buf, size_t len)
+	/*@modifies pool, *buf @*/
+{
+    size_t nread = 0;
+
+    while (nread < len && pool->ix < pool->njobs) {
+	XZJOB job = pool->jobs + pool->ix;
+	size_t nb;
+
+	yarnPossess(pool->lock);
+	while (!job->done)
+	    yarnWaitFor(pool->lock, NOT_TO_BE, yarnPeekLock(pool->lock));
+	yarnRelease(pool->lock);
+	if (job->rc)
+	    return -1;
+
+	nb = job->nout - pool->off;
+	if (nb > len - nread)
+	    nb = len - nread;
+	memcpy(buf + nread, job->out + pool->off, nb);
+	nread += nb;
+	pool->off += nb;
+
+	if (pool->off == job->nout) {
+	    free(job->out);
+	    job->out = NULL;
+	    pool->off = 0;
+	    yarnPossess(pool->lock);
+	    pool->inflight -= job->nout;
+	    pool->ix++;
+	    yarnTwist(pool->lock, BY, 1);
+	}
+    }
+    return (ssize_t) nread;
+}
+
+/**
+ * Destroy a parallel xz decompressor.
+ * @param pool		parallel xz decompressor
+ * @return		NULL always
+ */
+/*@null@*/
+static XZPOOL xzpoolFree(/*@only@*/ XZPOOL pool)
+	/*@modifies pool @*/
+{
+    unsigned i;
+
+    yarnPossess(pool->lock);
+    pool->stop = 1;
+    yarnTwist(pool->lock, BY, 1);
+    for (i = 0; i < (unsigned) pool->nthreads; i++)
+	pool->threads[i] = yarnJoin(pool->threads[i]);
+    pool->threads = _free(pool->threads);
+    for (i = 0; i < pool->njobs; i++)
+	free(pool->jobs[i].out);
+    pool->jobs = _free(pool->jobs);
+    pool->lock = yarnFreeLock(pool->lock);
+    pool = _free(pool);
+    return NULL;
+}
+#endif	/* WITH_PTHREADS */
+
 /*@-globstate@*/
 /*@null@*/
 static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int xz)
@@ -64,12 +390,19 @@ static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int
 {
     int level = LZMA_PRESET_DEFAULT;
     int encoding = 0;
+    char fmode[32];
+    int threaded;
+    int nthreads;
     FILE *fp;
     XZFILE *xzfile;
     lzma_stream tmp;
     lzma_ret ret;
 
-    for (; *mode != '\0'; mode++) {
+    (void) strncpy(fmode, mode, sizeof(fmode) - 1);
+    fmode[sizeof(fmode) - 1] = '\0';
+    threaded = (strchr(fmode, 'T') != NULL);
+    nthreads = fdFmodeThreads(fmode);
+    for (mode = fmode; *mode != '\0'; mode++) {
 	if (*mode == 'w')
 	    encoding = 1;
 	else if (*mode == 'r')
@@ -95,6 +428,17 @@ static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int
     xzfile->strm = tmp;
     if (encoding) {
 	if (xz) {
+#if defined(LZMA_VERSION) && LZMA_VERSION >= UINT32_C(50020002)
+	    /* Multi-threaded encoding writes a multi-block stream. */
+	    if (nthreads > 1) {
+		lzma_mt mt;
+		memset(&mt, 0, sizeof(mt));
+		mt.threads = (uint32_t) nthreads;
+		mt.preset = (uint32_t) level;
+		mt.check = LZMA_CHECK_CRC32;
+		ret = lzma_stream_encoder_mt(&xzfile->strm, &mt);
+	    } else
+#endif
 	    ret = lzma_easy_encoder(&xzfile->strm, level, LZMA_CHECK_CRC32);
 	} else {
 	    lzma_options_lzma options;
@@ -106,6 +450,19 @@ static XZFILE *xzopen_internal(const char *path, const char *mode, int fdno, int
 	 * more than enough to be sufficient for level 9 which requires 65 MiB.
 	 */
 	ret = lzma_auto_decoder(&xzfile->strm, 100<<20, 0);
+#if defined(WITH_PTHREADS)
+	/* Multi-block streams are decoded in parallel (unless "T1"). */
+	if (ret == LZMA_OK && xz) {
+#if defined(_SC_NPROCESSORS_ONLN)
+	    if (!threaded) {
+		nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+		if (nthreads > XZ_NTHREADS)
+		    nthreads = XZ_NTHREADS;
+	    }
+#endif
+	    xzfile->pool = xzpoolNew(fileno(fp), nthreads);
+	}
+#endif
     }
     if (ret != LZMA_OK) {
 	(void) fclose(fp);
@@ -170,6 +527,10 @@ static int xzclose(/*@only@*/ XZFILE *xzfile)
 
     if (!xzfile)
 	return -1;
+#if defined(WITH_PTHREADS)
+    if (xzfile->pool)
+	xzfile->pool = xzpoolFree(xzfile->pool);
+#endif
     if (xzfile->encoding) {
 	for (;;) {
 	    xzfile->strm.avail_out = kBufferSize;
@@ -203,6 +564,10 @@ static ssize_t xzread(XZFILE *xzfile, void *buf, size_t len)
       return -1;
     if (xzfile->eof)
       return 0;
+#if defined(WITH_PTHREADS)
+    if (xzfile->pool)
+	return xzpoolRead(xzfile->pool, buf, len);
+#endif
 /*@-temptrans@*/
     xzfile->strm.next_out = buf;
 /*@=temptrans@*/
@@ -6,6 +6,9 @@ extern const char * __progname;
 #include <rpmiotypes.h>
 #include <rpmio_internal.h>	/* XXX fdGetFILE */
 #include <poptIO.h>
+#if defined(WITH_PTHREADS)
+#include <yarn.h>
+#endif
 #include "debug.h"
 
 static int _rpmdc_debug = 0;
@@ -32,7 +35,8 @@ enum dcFlags_e {
     RPMDC_FLAGS_STATUS		= _DFB(15),	/*!<    --status ... */
     RPMDC_FLAGS_0INSTALL	= _DFB(16),	/*!< -0,--0install ... */
     RPMDC_FLAGS_HMAC		= _DFB(17),	/*!<    --hmac ... */
-	/* 18-31 unused */
+    RPMDC_FLAGS_BENCH		= _DFB(18),	/*!<    --bench ... */
+	/* 19-31 unused */
 };
 
 /**
@@ -77,6 +81,10 @@ struct rpmdc_s {
     struct rpmop_s totalops;
     struct rpmop_s readops;
     struct rpmop_s digestops;
+
+    int jobs;			/*!< no. of digest threads (--jobs). */
+/*@null@*/
+    void * pipe;		/*!< parallel digest pipeline. */
 };
 
 /**
@@ -646,6 +654,9 @@ fprintf(stderr, "\t%s(%p) fn %s\n", __FUNCTION__, dc, dc->fn);
 	rc = 2;
 	goto exit;
     }
+#if defined(POSIX_FADV_WILLNEED)
+    (void) Fadvise(dc->fd, 0, 0, POSIX_FADV_WILLNEED);
+#endif
 
     switch (dc->algo) {
     default:
@@ -697,6 +708,245 @@ fprintf(stderr, "*** %s(%p) fn %s\n", __FUNCTION__, dc, dc->fn);
     return rc;
 }
 
+#if defined(WITH_PTHREADS)
+/*==============================================================*/
+/*
+ * Parallel digest pipeline (enabled with --jobs N):
+ *
+ *	producer:  the Fts(3) walk (or manifest loop) queues regular files.
+ *	workers:   N threads open and digest distinct files concurrently.
+ *	collector: the main thread prints the results in queue order.
+ *
+ * All pipeline state is protected by a single yarn lock, whose value is
+ * bumped on every change so that waiters can sleep until something moves.
+ */
+#define	RPMDC_PIPE_NJOBS	4	/* max. queued files per thread */
+
+typedef struct rpmdcJob_s * rpmdcJob;
+typedef struct rpmdcPipe_s * rpmdcPipe;
+
+/**
+ * File waiting to be digested and printed.
+ */
+struct rpmdcJob_s {
+/*@null@*/
+    rpmdcJob next;		/*!< Next job in queue order. */
+/*@null@*/
+    rpmdcJob qnext;		/*!< Next job for the workers. */
+/*@only@*/
+    const char * fn;
+    struct stat sb;
+    int ix;
+/*@null@*/
+    FD_t fd;			/*!< Digested file handle (NULL if skipped). */
+    int rc;			/*!< Worker return code. */
+    int done;			/*!< Has the worker finished? */
+};
+
+/**
+ * Parallel digest pipeline.
+ */
+struct rpmdcPipe_s {
+    yarnLock lock;		/*!< Pipeline state (bumped on change). */
+/*@dependent@*/
+    rpmdc dc;
+    int nthreads;
+    yarnThread * threads;	/*!< Worker threads. */
+/*@null@*/
+    rpmdcJob jobs;		/*!< Unprinted jobs in queue order. */
+    rpmdcJob * jtail;
+    unsigned njobs;
+/*@null@*/
+    rpmdcJob todo;		/*!< Jobs waiting for a worker. */
+    rpmdcJob * qtail;
+    int stop;			/*!< Are the threads to exit? */
+};
+
+/**
+ * Worker thread: open and digest queued files until stopped.
+ * @param _pipe		parallel digest pipeline
+ */
+static void rpmdcPipeWorker(void * _pipe)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies _pipe, fileSystem, internalState @*/
+{
+    rpmdcPipe pipe = _pipe;
+    struct rpmdc_s _wdc;
+    rpmdc wdc = &_wdc;
+
+    /* Only the (constant) digest options are shared with the collector. */
+    memset(wdc, 0, sizeof(*wdc));
+    wdc->flags = pipe->dc->flags;
+    wdc->algo = pipe->dc->algo;
+
+    for (;;) {
+	rpmdcJob job;
+
+	yarnPossess(pipe->lock);
+	while (!pipe->stop && pipe->todo == NULL)
+	    yarnWaitFor(pipe->lock, NOT_TO_BE, yarnPeekLock(pipe->lock));
+	if ((job = pipe->todo) == NULL) {
+	    yarnRelease(pipe->lock);
+	    break;
+	}
+	if ((pipe->todo = job->qnext) == NULL)
+	    pipe->qtail = &pipe->todo;
+	yarnRelease(pipe->lock);
+
+	wdc->fn = job->fn;
+	memcpy(&wdc->sb, &job->sb, sizeof(wdc->sb));
+	wdc->fd = NULL;
+	if ((job->rc = rpmdcInitFile(wdc)) == 0)
+	    job->rc = rpmdcCalcFile(wdc);
+	job->fd = wdc->fd;
+	wdc->fd = NULL;
+
+	yarnPossess(pipe->lock);
+	job->done = 1;
+	yarnTwist(pipe->lock, BY, 1);
+    }
+}
+
+/**
+ * Print digested files in queue order until at most maxjobs are queued.
+ * @param dc		rpmdigest container
+ * @param maxjobs	max. no. of jobs left queued
+ * @return		0 on success
+ */
+static int rpmdcPipeCollect(rpmdc dc, unsigned maxjobs)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies dc, fileSystem, internalState @*/
+{
+    rpmdcPipe pipe = dc->pipe;
+    int rc = 0;
+    int xx;
+
+    yarnPossess(pipe->lock);
+    while (pipe->njobs > maxjobs) {
+	rpmdcJob job = pipe->jobs;
+
+	while (!job->done)
+	    yarnWaitFor(pipe->lock, NOT_TO_BE, yarnPeekLock(pipe->lock));
+	if ((pipe->jobs = job->next) == NULL)
+	    pipe->jtail = &pipe->jobs;
+	pipe->njobs--;
+	yarnRelease(pipe->lock);
+
+	dc->fn = job->fn;
+	memcpy(&dc->sb, &job->sb, sizeof(dc->sb));
+	dc->ix = job->ix;
+	dc->fd = job->fd;
+	if (job->rc)
+	    rc = job->rc;
+	if ((xx = rpmdcFiniFile(dc)) != 0)
+	    rc = xx;
+	dc->fn = NULL;
+	job->fn = _free(job->fn);
+	job = _free(job);
+
+	yarnPossess(pipe->lock);
+    }
+    yarnRelease(pipe->lock);
+    return rc;
+}
+
+/**
+ * Queue the current file for digesting, printing the oldest results.
+ * @param dc		rpmdigest container
+ * @return		0 on success
+ */
+static int rpmdcPipeQueue(rpmdc dc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies dc, fileSystem, internalState @*/
+{
+    rpmdcPipe pipe = dc->pipe;
+    rpmdcJob job;
+
+    /* Only regular files are digested (and printed). */
+    if (!S_ISREG(dc->sb.st_mode))
+	return 0;
+
+    job = xcalloc(1, sizeof(*job));
+    job->fn = xstrdup(dc->fn);
+    memcpy(&job->sb, &dc->sb, sizeof(job->sb));
+    job->ix = dc->ix;
+
+    yarnPossess(pipe->lock);
+    *pipe->jtail = job;
+    pipe->jtail = &job->next;
+    pipe->njobs++;
+    *pipe->qtail = job;
+    pipe->qtail = &job->qnext;
+    yarnTwist(pipe->lock, BY, 1);
+
+    return rpmdcPipeCollect(dc, RPMDC_PIPE_NJOBS * pipe->nthreads);
+}
+
+/**
+ * Create a parallel digest pipeline, launching the worker threads.
+ * @param dc		rpmdigest container
+ * @return		new pipeline
+ */
+static rpmdcPipe rpmdcPipeNew(rpmdc dc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    rpmdcPipe pipe = xcalloc(1, sizeof(*pipe));
+    int i;
+
+    pipe->lock = yarnNewLock(0);
+    pipe->dc = dc;
+    pipe->nthreads = dc->jobs;
+    pipe->jtail = &pipe->jobs;
+    pipe->qtail = &pipe->todo;
+    pipe->threads = xcalloc(pipe->nthreads, sizeof(*pipe->threads));
+    for (i = 0; i < pipe->nthreads; i++)
+	pipe->threads[i] = yarnLaunch(rpmdcPipeWorker, pipe);
+    return pipe;
+}
+
+/**
+ * Print all queued files, then stop the workers and destroy the pipeline.
+ * @param dc		rpmdigest container
+ * @return		0 on success
+ */
+static int rpmdcPipeFree(rpmdc dc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies dc, fileSystem, internalState @*/
+{
+    rpmdcPipe pipe = dc->pipe;
+    int rc = rpmdcPipeCollect(dc, 0);
+    int i;
+
+    yarnPossess(pipe->lock);
+    pipe->stop = 1;
+    yarnTwist(pipe->lock, BY, 1);
+    for (i = 0; i < pipe->nthreads; i++)
+	pipe->threads[i] = yarnJoin(pipe->threads[i]);
+    pipe->threads = _free(pipe->threads);
+    pipe->lock = yarnFreeLock(pipe->lock);
+    pipe = _free(pipe);
+    dc->pipe = NULL;
+    return rc;
+}
+#endif	/* WITH_PTHREADS */
+
+/**
+ * Digest the current file, queueing it if --jobs was given.
+ * @param dc		rpmdigest container
+ * @return		0 on success
+ */
+static int rpmdcVisit(rpmdc dc)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies dc, fileSystem, internalState @*/
+{
+#if defined(WITH_PTHREADS)
+    if (dc->pipe != NULL)
+	return rpmdcPipeQueue(dc);
+#endif
+    return rpmdcVisitF(dc);
+}
+
 static int
 rpmdcSortLexical(const FTSENT ** a, const FTSENT ** b)
 	/*@*/
@@ -742,6 +992,12 @@ rpmdcCWalk(rpmdc dc)
 	}
 #endif
 
+#if defined(WITH_PTHREADS)
+	/* Directory lines are written directly: print queued files first. */
+	if (dc->pipe != NULL && F_ISSET(dc, 0INSTALL) && dc->p->fts_info == FTS_D)
+	    (void) rpmdcPipeCollect(dc, 0);
+#endif
+
 	dc->fn = dc->p->fts_path;	/* XXX eliminate dc->fn */
 	memcpy(&dc->sb, dc->p->fts_statp, sizeof(dc->sb));
 
@@ -785,7 +1041,7 @@ rpmdcCWalk(rpmdc dc)
 	    /*@switchbreak@*/ break;
 	default:
 	    if (!F_ISSET(dc, DIRSONLY))
-		rpmdcVisitF(dc);
+		rpmdcVisit(dc);
 	    /*@switchbreak@*/ break;
 	}
     }
@@ -795,6 +1051,115 @@ rpmdcCWalk(rpmdc dc)
     return rval;
 }
 
+/*==============================================================*/
+#define	BENCH_NBYTES	(64 * 1024 * 1024)	/* no. of bytes digested */
+
+/**
+ * Digest BENCH_NBYTES with MD5+SHA1+SHA256 through one fdUpdateDigests path.
+ * @param name		path name
+ * @param mode		0 per-digest, 1 per-digest (OpenMP), 2 multi-digest
+ * @param b		data buffer
+ * @param nb		no. of bytes per update
+ * @retval *digests	ASCII digests (concatenated)
+ * @return		0 on success
+ */
+static int rpmdcBenchRun(const char * name, int mode,
+		const unsigned char * b, size_t nb, const char ** digests)
+	/*@modifies *digests @*/
+{
+    static pgpHashAlgo algos[] =
+	{ PGPHASHALGO_MD5, PGPHASHALGO_SHA1, PGPHASHALGO_SHA256 };
+    int nctxs = (int)(sizeof(algos)/sizeof(algos[0]));
+    DIGEST_CTX ctxs[sizeof(algos)/sizeof(algos[0])];
+    struct rpmop_s op;
+    char label[64];
+    size_t n;
+    int i;
+
+    memset(&op, 0, sizeof(op));
+    for (i = 0; i < nctxs; i++)
+	ctxs[i] = rpmDigestInit(algos[i], RPMDIGEST_NONE);
+
+    (void) rpmswEnter(&op, 0);
+    for (n = 0; n < BENCH_NBYTES; n += nb) {
+	switch (mode) {
+	case 0:
+	    for (i = nctxs - 1; i >= 0; i--)
+		(void) rpmDigestUpdate(ctxs[i], b, nb);
+	    /*@switchbreak@*/ break;
+	case 1:
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+	    for (i = nctxs - 1; i >= 0; i--)
+		(void) rpmDigestUpdate(ctxs[i], b, nb);
+	    /*@switchbreak@*/ break;
+	default:
+	    (void) rpmDigestUpdateMulti(ctxs, nctxs, b, nb);
+	    /*@switchbreak@*/ break;
+	}
+    }
+    (void) rpmswExit(&op, BENCH_NBYTES);
+
+    *digests = NULL;
+    for (i = 0; i < nctxs; i++) {
+	const char * digest = NULL;
+	const char * t;
+	(void) rpmDigestFinal(ctxs[i], &digest, NULL, 1);
+	t = rpmExpand((*digests ? *digests : ""), digest, NULL);
+	*digests = _free(*digests);
+	*digests = t;
+	digest = _free(digest);
+    }
+
+    (void) snprintf(label, sizeof(label), "%6uK %s:", (unsigned)(nb/1024), name);
+    rpmswPrint(label, &op, stdout);
+    return 0;
+}
+
+/**
+ * Compare per-digest and multi-digest updates of an in-memory buffer.
+ * @return		0 if all digests agree
+ */
+static int rpmdcBench(void)
+	/*@globals fileSystem, internalState @*/
+	/*@modifies fileSystem, internalState @*/
+{
+    static size_t sizes[] = { 8 * 1024, 32 * 1024, 64 * 1024 };
+    size_t maxnb = sizes[sizeof(sizes)/sizeof(sizes[0]) - 1];
+    unsigned char * b = xmalloc(maxnb);
+    int rc = 0;
+    size_t i, j;
+
+    for (i = 0; i < maxnb; i++)
+	b[i] = (unsigned char)((i * 2654435761U) >> 24);
+
+    fprintf(stdout, "md5+sha1+sha256 of %u MB:\n",
+		(unsigned)(BENCH_NBYTES/(1024*1024)));
+    for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++) {
+	const char * serial = NULL;
+	const char * omp = NULL;
+	const char * multi = NULL;
+
+	(void) rpmdcBenchRun("serial", 0, b, sizes[j], &serial);
+#if defined(_OPENMP)
+	(void) rpmdcBenchRun("openmp", 1, b, sizes[j], &omp);
+#endif
+	(void) rpmdcBenchRun(" multi", 2, b, sizes[j], &multi);
+
+	if (strcmp(serial, multi) || (omp != NULL && strcmp(serial, omp))) {
+	    fprintf(stderr, "%s: digests differ\n", __progname);
+	    rc = 1;
+	}
+	serial = _free(serial);
+	omp = _free(omp);
+	multi = _free(multi);
+    }
+
+    b = _free(b);
+    return rc;
+}
+
 static int rpmdcLoadManifests(rpmdc dc)
 	/*@globals h_errno, fileSystem, internalState @*/
 	/*@modifies dc, h_errno, fileSystem, internalState @*/
@@ -864,6 +1229,11 @@ static struct poptOption _optionsTable[] = {
   { "binary", 'b', POPT_BIT_SET,	&_dc.flags, RPMDC_FLAGS_BINARY,
 	N_("Read in binary mode"), NULL },
 
+  { "jobs", '\0', POPT_ARG_INT,	&_dc.jobs, 0,
+	N_("Digest files using N threads"), N_("N") },
+  { "bench", '\0', POPT_BIT_SET,	&_dc.flags, RPMDC_FLAGS_BENCH,
+	N_("Compare per-digest and multi-digest update speed"), NULL },
+
 #if !defined(POPT_ARG_ARGV)
   { "check", 'c', POPT_ARG_STRING,	NULL, 'c',
 	N_("Read digests from MANIFEST file and verify (may be used more than once)"),
@@ -960,6 +1330,11 @@ main(int argc, char *argv[])
 	    fdInitHmac(dc->ofd, hmackey, 0);
     }
 
+    if (F_ISSET(dc, BENCH)) {
+	rc = rpmdcBench();
+	goto exit;
+    }
+
     av = poptGetArgs(optCon);
     ac = argvCount(av);
     if ((ac == 0 && dc->manifests == NULL)
@@ -981,13 +1356,18 @@ main(int argc, char *argv[])
     if (rc)
 	goto exit;
 
+#if defined(WITH_PTHREADS)
+    if (dc->jobs > 1)
+	dc->pipe = rpmdcPipeNew(dc);
+#endif
+
     if (dc->manifests != NULL) {
 	dc->ix = 0;
 	av = dc->paths;
 	if (av != NULL)
 	while ((dc->fn = *av++) != NULL) {
 	    if ((xx = Lstat(dc->fn, &dc->sb)) != 0
-	     || (xx = rpmdcVisitF(dc)) != 0)
+	     || (xx = rpmdcVisit(dc)) != 0)
 		rc = xx;
 	    dc->ix++;
 	}
@@ -995,6 +1375,10 @@ main(int argc, char *argv[])
 	if ((xx = rpmdcCWalk(dc)) != 0)
 	    rc = xx;
     }
+#if defined(WITH_PTHREADS)
+    if (dc->pipe != NULL && (xx = rpmdcPipeFree(dc)) != 0)
+	rc = xx;
+#endif
 
 exit:
     if (dc->nfailed)
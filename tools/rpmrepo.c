@@ -98,6 +98,8 @@ argvPrint("repo->directories", repo->directories, NULL);
 
     if (REPO_ISSET(SPLIT) && REPO_ISSET(CHECKTS))
 	rpmrepoError(1, _("--split and --checkts options are mutually exclusive"));
+    if (repo->workers < 0)
+	rpmrepoError(1, _("--workers must not be negative"));
 
 #ifdef	NOTYET
     /* Add manifest(s) contents to rpm list. */